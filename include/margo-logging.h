@@ -8,6 +8,9 @@
 #ifndef __MARGO_LOGGING_H
 #define __MARGO_LOGGING_H
 
+#include <stdint.h>
+#include <margo-log-config.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -108,6 +111,31 @@ int margo_set_global_logger(const struct margo_logger* logger);
  */
 int margo_set_global_log_level(margo_log_level level);
 
+/**
+ * @brief Counters of the asynchronous logger enabled by the
+ * "async_logging" field of the margo configuration.
+ */
+struct margo_async_log_stats {
+    uint64_t logged;       /*!< messages accepted into the buffers    */
+    uint64_t written;      /*!< messages written to the file          */
+    uint64_t dropped;      /*!< messages dropped, the buffer was full */
+    uint64_t waited;       /*!< callers that waited for buffer space  */
+    uint64_t rate_limited; /*!< messages suppressed by the rate limit */
+    uint64_t truncated;    /*!< messages truncated to fit a record    */
+};
+
+/**
+ * @brief Get the counters of the asynchronous logger of a margo instance.
+ *
+ * @param mid Margo instance
+ * @param stats Counters
+ *
+ * @return 0 in case of success, -1 if the instance does not use
+ * asynchronous logging
+ */
+int margo_get_async_log_stats(margo_instance_id             mid,
+                              struct margo_async_log_stats* stats);
+
 /**
  * @brief Logging functions. These functions will use the logger
  * registered with the margo instance, or the global logger if
@@ -144,6 +172,67 @@ void margo_error(margo_instance_id mid, const char* fmt, ...);
  */
 void margo_critical(margo_instance_id mid, const char* fmt, ...);
 
+/**
+ * @brief Lowest log level that the global logger or the logger of any
+ * instance may accept (MARGO_LOG_EXTERNAL until the global log level is
+ * known). Levels raised after having been lowered are not accounted for,
+ * so this is a lower bound. Used by the logging macros, do not modify.
+ */
+extern int __margo_log_min_level;
+
+#define __MARGO_LOG_IF_ENABLED(__level__, __fn__, __mid__, ...)           \
+    do {                                                                  \
+        if ((int)(__level__)                                              \
+            >= __atomic_load_n(&__margo_log_min_level, __ATOMIC_RELAXED)) \
+            __fn__(__mid__, __VA_ARGS__);                                 \
+    } while (0)
+
+/**
+ * @brief Logging macros. Contrary to the logging functions, they check
+ * the level of the message against __margo_log_min_level before calling
+ * the function, so a disabled message costs a load and a branch and its
+ * arguments are not evaluated. Messages below MARGO_MIN_LOG_LEVEL are
+ * compiled out.
+ */
+#if MARGO_MIN_LOG_LEVEL <= 1
+    #define MARGO_TRACE(__mid__, ...)                                \
+        __MARGO_LOG_IF_ENABLED(MARGO_LOG_TRACE, margo_trace, __mid__, \
+                               __VA_ARGS__)
+#else
+    #define MARGO_TRACE(__mid__, ...) ((void)(__mid__))
+#endif
+#if MARGO_MIN_LOG_LEVEL <= 2
+    #define MARGO_DEBUG(__mid__, ...)                                \
+        __MARGO_LOG_IF_ENABLED(MARGO_LOG_DEBUG, margo_debug, __mid__, \
+                               __VA_ARGS__)
+#else
+    #define MARGO_DEBUG(__mid__, ...) ((void)(__mid__))
+#endif
+#if MARGO_MIN_LOG_LEVEL <= 3
+    #define MARGO_INFO(__mid__, ...)                              \
+        __MARGO_LOG_IF_ENABLED(MARGO_LOG_INFO, margo_info, __mid__, \
+                               __VA_ARGS__)
+#else
+    #define MARGO_INFO(__mid__, ...) ((void)(__mid__))
+#endif
+#if MARGO_MIN_LOG_LEVEL <= 4
+    #define MARGO_WARNING(__mid__, ...)                                    \
+        __MARGO_LOG_IF_ENABLED(MARGO_LOG_WARNING, margo_warning, __mid__, \
+                               __VA_ARGS__)
+#else
+    #define MARGO_WARNING(__mid__, ...) ((void)(__mid__))
+#endif
+#if MARGO_MIN_LOG_LEVEL <= 5
+    #define MARGO_ERROR(__mid__, ...)                                \
+        __MARGO_LOG_IF_ENABLED(MARGO_LOG_ERROR, margo_error, __mid__, \
+                               __VA_ARGS__)
+#else
+    #define MARGO_ERROR(__mid__, ...) ((void)(__mid__))
+#endif
+#define MARGO_CRITICAL(__mid__, ...)                                     \
+    __MARGO_LOG_IF_ENABLED(MARGO_LOG_CRITICAL, margo_critical, __mid__, \
+                           __VA_ARGS__)
+
 #ifdef __cplusplus
 }
 #endif
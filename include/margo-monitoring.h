@@ -114,6 +114,17 @@ struct json_object; /* forward declaration to avoid including json-c */
  */
 extern struct margo_monitor* margo_default_monitor;
 
+/**
+ * The margo_trace_monitor constant can be used in place of
+ * margo_default_monitor to record every monitoring event into
+ * per-xstream binary ring buffers. The trace is kept in memory, or in
+ * a <filename_prefix>.<hostname>.<pid>.trace file if a "filename_prefix"
+ * is given in the monitoring configuration. margo_monitor_dump produces
+ * a Chrome/Perfetto trace event JSON document, and the margo-trace-convert
+ * program converts trace files into the same format.
+ */
+extern struct margo_monitor* margo_trace_monitor;
+
 /**
  * The margo_monitor_data_t union is used in all the
  * margo_monitor_*_args structures so that developers
@@ -127,6 +138,29 @@ typedef union {
     void*   p;
 } margo_monitor_data_t;
 
+/**
+ * The margo_trace_context_t structure carries the distributed trace
+ * context of an RPC (in the style of W3C Trace Context). It is sent in
+ * the header that margo prepends to the RPC's input when the ULT that
+ * forwards the RPC has a trace context (see margo_start_trace_context),
+ * and becomes the trace context of the ULT running the RPC's handler,
+ * so that the RPCs forwarded by a handler inherit it automatically.
+ *
+ * Each forwarded RPC is a span: its span_id is generated by the origin,
+ * and its parent_span_id is the span_id of the forwarding ULT's context.
+ * Monitors can retrieve the context of an RPC with margo_get_trace_context.
+ */
+typedef struct margo_trace_context {
+    uint64_t trace_id[2];    /* 128-bit trace id, 0 if not traced */
+    uint64_t span_id;        /* id of the span */
+    uint64_t parent_span_id; /* id of the parent span, 0 for a root span */
+    uint32_t flags;          /* MARGO_TRACE_CONTEXT_* flags */
+    uint32_t padding;
+} margo_trace_context_t;
+
+/* The spans of the trace should be recorded by monitors */
+#define MARGO_TRACE_CONTEXT_SAMPLED 0x1
+
 typedef enum margo_monitor_event_t
 {
     MARGO_MONITOR_FN_START,
@@ -379,6 +413,7 @@ struct margo_monitor_wait_args {
     margo_monitor_data_t uctx;
     /* input */
     margo_request request;
+    bool          skipped; /* request excluded from monitoring */
     /* output */
     hg_return_t ret;
 };
@@ -499,6 +534,11 @@ struct margo_monitor_remove_xstream_args {
  * also reset the monitor's internal state (e.g. all past RPC activities
  * will be removed).
  *
+ * The default monitor calls dump_fn once with the whole JSON document,
+ * or, if "dump_chunk_size" is set in its configuration, successively
+ * with chunks of at most that many bytes whose concatenation forms
+ * the document.
+ *
  * @param mid Margo instance ID
  * @param dump_fn Dump function pointer
  * @param uargs User arguments for the dump function pointer
@@ -552,6 +592,81 @@ hg_return_t margo_set_monitoring_data(hg_handle_t          handle,
 hg_return_t margo_get_monitoring_data(hg_handle_t           handle,
                                       margo_monitor_data_t* data);
 
+/**
+ * @brief Exclude the handle from monitoring.
+ *
+ * This function is meant to be called by a monitor from its on_create
+ * or on_rpc_handler(MARGO_MONITOR_FN_START) callback to implement
+ * sampling. Past this call, Margo neither takes timestamps nor invokes
+ * the monitor's callbacks for the operations on this handle and on
+ * the margo_request associated with it (on_forward, on_respond,
+ * on_set/get/free_input/output, on_forward_cb, on_respond_cb,
+ * on_rpc_handler(MARGO_MONITOR_FN_END) and on_rpc_ult), with the
+ * exception of on_destroy, which is always invoked so that the monitor
+ * can release any data it attached to the handle, and of on_wait, which
+ * is invoked with its skipped argument set to true so that the monitor
+ * can still tell when the calling ULT blocks.
+ *
+ * The handle is monitored again once destroyed and reused.
+ *
+ * @param handle Handle to exclude from monitoring.
+ *
+ * @return HG_SUCCESS or HG_INVALID_ARG if handle is NULL.
+ */
+hg_return_t margo_monitoring_skip_handle(hg_handle_t handle);
+
+/**
+ * @brief Start a new trace in the calling ULT, with a random trace id
+ * and a root span. The RPCs subsequently forwarded by the ULT, and the
+ * RPCs forwarded by their handlers, carry this trace context.
+ *
+ * @param mid Margo instance.
+ * @param sampled Whether monitors should record the spans of the trace.
+ *
+ * @return HG_SUCCESS or HG_INVALID_ARG if mid is NULL.
+ */
+hg_return_t margo_start_trace_context(margo_instance_id mid, bool sampled);
+
+/**
+ * @brief Set the trace context of the calling ULT, e.g. to propagate
+ * the context of an RPC handler to the ULTs it spawns. Passing NULL
+ * removes the trace context of the ULT.
+ *
+ * @param mid Margo instance.
+ * @param ctx Trace context.
+ *
+ * @return HG_SUCCESS or other Mercury error code.
+ */
+hg_return_t margo_set_current_trace_context(margo_instance_id            mid,
+                                            const margo_trace_context_t* ctx);
+
+/**
+ * @brief Get the trace context of the calling ULT.
+ *
+ * @param mid Margo instance.
+ * @param ctx Trace context (zeroed if the ULT has none).
+ *
+ * @return HG_SUCCESS, or HG_NOENTRY if the ULT has no trace context.
+ */
+hg_return_t margo_get_current_trace_context(margo_instance_id      mid,
+                                            margo_trace_context_t* ctx);
+
+/**
+ * @brief Get the trace context of an RPC, i.e. the span created when
+ * the handle was forwarded (origin side) or the span received with
+ * the RPC (target side). It is available to monitors from
+ * on_forward(MARGO_MONITOR_FN_START) and on_rpc_handler(MARGO_MONITOR_FN_START)
+ * respectively, until the handle is destroyed.
+ *
+ * @param handle Handle.
+ * @param ctx Trace context (zeroed if the RPC has none).
+ *
+ * @return HG_SUCCESS, HG_INVALID_ARG if handle is NULL,
+ * or HG_NOENTRY if the RPC has no trace context.
+ */
+hg_return_t margo_get_trace_context(hg_handle_t            handle,
+                                    margo_trace_context_t* ctx);
+
 /**
  * @brief Attach custom monitoring data to the margo_request.
  *
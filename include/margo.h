@@ -100,6 +100,17 @@ typedef enum
  */
 #define MARGO_MAX_PROVIDER_ID ((1 << (8 * __MARGO_PROVIDER_ID_SIZE)) - 1)
 
+/**
+ * Execution modes for RPC handlers (see margo_rpc_set_execution_mode).
+ * MARGO_RPC_MODE_ULT (default): the handler runs in its own ULT.
+ * MARGO_RPC_MODE_INLINE: the handler runs directly in the Mercury
+ * callback, in the context of the progress loop.
+ * MARGO_RPC_MODE_TASKLET: the handler runs as an ABT_task in its pool.
+ */
+#define MARGO_RPC_MODE_ULT     0
+#define MARGO_RPC_MODE_INLINE  1
+#define MARGO_RPC_MODE_TASKLET 2
+
 /**
  * The margo_init_info structure should be passed to margo_init_ext
  * to finely configure Margo. The structure can be memset to 0 to have
@@ -256,9 +267,22 @@ margo_instance_id margo_init(const char* addr_str,
  *  - rpc_thread_count: integer (default 0)
  *
  * @note Note that supported kinds of pools are fifo_wait (default) fifo (for
- * use with basic scheduler; will busy spin when idle) and prio_wait (custom
+ * use with basic scheduler; will busy spin when idle), prio_wait (custom
  * pool implementation for Margo that favors existing ULTs over newly created
- * ULTs when possible)
+ * ULTs when possible), earliest_first (custom pool that favors the oldest
+ * ULTs), and fair_wait (custom pool that executes the RPC handlers of
+ * distinct clients in a deficit round robin manner, so that one client
+ * cannot monopolize the pool; a "weights" array of
+ * {"address": <origin address>, "weight": <number>} objects may give some
+ * clients more turns than others, the default weight being 1)
+ *
+ * @note A pool may also specify "rpc_workers" (integer, default 0) to have
+ * that many persistent ULTs execute the handlers of the RPCs associated
+ * with it instead of creating a ULT per request, and "max_rpc_workers"
+ * (default: same as "rpc_workers") to let this set of ULTs grow when all
+ * of them are busy. Requests beyond that are executed in their own ULT.
+ * "thread_stacksize" (in bytes) sets the stack size of the handler ULTs
+ * of the pool's RPCs (see also margo_rpc_set_stack_size).
  */
 margo_instance_id margo_init_ext(const char*                   address,
                                  int                           mode,
@@ -856,6 +880,79 @@ hg_return_t margo_provider_get_identity(margo_instance_id mid,
  */
 const char* margo_rpc_get_name(margo_instance_id mid, hg_id_t id);
 
+/**
+ * @brief Set the execution mode of handlers for the provided RPC id.
+ * By default (MARGO_RPC_MODE_ULT) a new ULT is created in the RPC's pool
+ * for every incoming request. Handlers that promise never to block
+ * (no margo_forward, margo_wait, margo_thread_sleep, bulk transfers,
+ * mutexes, etc.) can be executed without a ULT, either directly in the
+ * Mercury callback (MARGO_RPC_MODE_INLINE) or as an Argobots tasklet
+ * in the RPC's pool (MARGO_RPC_MODE_TASKLET), saving a stack allocation
+ * and a context switch per request.
+ *
+ * @note In these two modes, margo_respond does not wait for the response
+ * to be sent (it behaves like margo_crespond with no callback, so errors
+ * occurring while sending the response are not reported to the handler),
+ * and RPC admission limits (rpc_limits) reject requests instead of
+ * suspending them.
+ *
+ * @param [in] mid Margo instance.
+ * @param [in] id RPC id.
+ * @param [in] mode Execution mode.
+ *
+ * @return HG_SUCCESS or corresponding HG error code.
+ */
+hg_return_t
+margo_rpc_set_execution_mode(margo_instance_id mid, hg_id_t id, int mode);
+
+/**
+ * @brief Get the execution mode of handlers for the provided RPC id.
+ *
+ * @param [in] mid Margo instance.
+ * @param [in] id RPC id.
+ * @param [out] mode Execution mode.
+ *
+ * @return HG_SUCCESS or corresponding HG error code.
+ */
+hg_return_t
+margo_rpc_get_execution_mode(margo_instance_id mid, hg_id_t id, int* mode);
+
+/**
+ * @brief Set the stack size of the ULTs executing handlers of the provided
+ * RPC id. This overrides the "thread_stacksize" of the RPC's pool and the
+ * global "abt_thread_stacksize". Lightweight handlers can use small stacks
+ * (e.g. 16 to 64 KiB) to reduce the memory footprint of many concurrent
+ * requests. Passing 0 reverts to the pool's setting.
+ *
+ * @note RPCs with a specific stack size are not executed by the pool's
+ * persistent "rpc_workers", since those have the pool's stack size.
+ *
+ * @note This function should be called right after registering the
+ * RPC, before the RPC can be received. The stack size is read without
+ * synchronization when dispatching requests.
+ *
+ * @param [in] mid Margo instance.
+ * @param [in] id RPC id.
+ * @param [in] stack_size Stack size in bytes.
+ *
+ * @return HG_SUCCESS or corresponding HG error code.
+ */
+hg_return_t
+margo_rpc_set_stack_size(margo_instance_id mid, hg_id_t id, size_t stack_size);
+
+/**
+ * @brief Get the stack size of the ULTs executing handlers of the
+ * provided RPC id. 0 means the global Argobots default is used.
+ *
+ * @param [in] mid Margo instance.
+ * @param [in] id RPC id.
+ * @param [out] stack_size Stack size in bytes.
+ *
+ * @return HG_SUCCESS or corresponding HG error code.
+ */
+hg_return_t
+margo_rpc_get_stack_size(margo_instance_id mid, hg_id_t id, size_t* stack_size);
+
 /**
  * @brief Get the pool in which RPCs of the provided id will execute their ULT.
  *
@@ -1413,6 +1510,12 @@ margo_instance_id margo_request_get_instance(margo_request req);
  * sent over the wire and immediately return (the receiver of the response
  * doesn't have to run any particular code that could cause a timeout).
  *
+ * @note In handlers registered with MARGO_REGISTER_INLINE or with the
+ * MARGO_RPC_MODE_TASKLET execution mode, which must not block, this
+ * function behaves like margo_crespond with no callback: it returns as
+ * soon as the response is posted, and errors occurring while sending
+ * the response are not reported to the caller.
+ *
  * @param [in] handle Handle of the RPC for which a response is being sent.
  * @param [in] out_struct Output argument struct for the response.
  *
@@ -2125,6 +2228,22 @@ void __margo_internal_pre_wrapper_hooks(
 void __margo_internal_post_wrapper_hooks(
     margo_instance_id mid, struct margo_monitor_rpc_ult_args* monitoring_args);
 
+/**
+ * @private
+ * Internal function used by DEFINE_MARGO_RPC_HANDLER, not supposed to be
+ * called by users! Blocks until the RPC is admitted by the "rpc_limits"
+ * configured for it, if any. Returns 0 if the RPC was rejected, in which
+ * case an HG_BUSY error has been sent back to the caller.
+ */
+int __margo_internal_rpc_admit(margo_instance_id mid, hg_handle_t handle);
+
+/**
+ * @private
+ * Internal function used by DEFINE_MARGO_RPC_HANDLER, not supposed to be
+ * called by users!
+ */
+void __margo_internal_rpc_release(margo_instance_id mid, hg_handle_t handle);
+
 /**
  * @private
  * Internal function used by DEFINE_MARGO_RPC_HANDLER, not supposed to be
@@ -2151,6 +2270,24 @@ void __margo_internal_post_handler_hooks(
  */
 void __margo_respond_with_error(hg_handle_t handle, hg_return_t ret);
 
+/**
+ * @private
+ * Internal function used by DEFINE_MARGO_RPC_HANDLER, not supposed to be
+ * called by users! Schedules the wrapper of an RPC handler according to
+ * the RPC's execution mode. Returns an Argobots error code.
+ */
+int __margo_internal_dispatch_handler(margo_instance_id mid,
+                                      hg_handle_t       handle,
+                                      ABT_pool          pool,
+                                      void (*wrapper)(void*));
+
+/**
+ * @private
+ * Internal function used by MARGO_REGISTER_INLINE, not supposed to be
+ * called by users!
+ */
+hg_id_t __margo_internal_register_inline(margo_instance_id mid, hg_id_t id);
+
 /**
  * @private
  * Internal function used by DEFINE_MARGO_RPC_HANDLER, not supposed to be
@@ -2196,6 +2333,51 @@ hg_return_t __margo_internal_set_handle_data(hg_handle_t handle);
         BOOST_PP_CAT(hg_proc_, __out_t), _handler_for_##__handler,   \
         __provider_id, __pool);
 
+/**
+ * @brief Macro that registers a function as an RPC whose handler runs
+ * inline, i.e. directly in the Mercury callback rather than in its own
+ * ULT (see margo_rpc_set_execution_mode). The handler must never block.
+ * In such a handler margo_respond does not block either: it behaves like
+ * margo_crespond and does not report errors occurring while sending the
+ * response.
+ *
+ * @param __mid Margo instance.
+ * @param __func_name String name of the RPC.
+ * @param __in_t type of input.
+ * @param __out_t type of the output.
+ * @param __handler Name of the function to register.
+ *
+ * @return The RPC id (hg_id_t).
+ */
+#define MARGO_REGISTER_INLINE(__mid, __func_name, __in_t, __out_t, __handler) \
+    __margo_internal_register_inline(                                         \
+        __mid, margo_provider_register_name(                                  \
+                   __mid, __func_name, BOOST_PP_CAT(hg_proc_, __in_t),        \
+                   BOOST_PP_CAT(hg_proc_, __out_t), _handler_for_##__handler, \
+                   MARGO_DEFAULT_PROVIDER_ID, ABT_POOL_NULL));
+
+/**
+ * @brief Same as MARGO_REGISTER_INLINE for an RPC with a specific
+ * provider ID and Argobots pool.
+ *
+ * @param __mid Margo instance.
+ * @param __func_name String name of the RPC.
+ * @param __in_t type of input.
+ * @param __out_t type of the output.
+ * @param __handler Name of the function to register.
+ * @param __provider_id ID of the provider registering the RPC.
+ * @param __pool Argobots pool the handler will execute in.
+ *
+ * @return The RPC id (hg_id_t).
+ */
+#define MARGO_REGISTER_PROVIDER_INLINE(__mid, __func_name, __in_t, __out_t, \
+                                       __handler, __provider_id, __pool)    \
+    __margo_internal_register_inline(                                       \
+        __mid, margo_provider_register_name(                                \
+                   __mid, __func_name, BOOST_PP_CAT(hg_proc_, __in_t),      \
+                   BOOST_PP_CAT(hg_proc_, __out_t),                         \
+                   _handler_for_##__handler, __provider_id, __pool));
+
 hg_return_t _handler_for_NULL(hg_handle_t);
 
 #define __MARGO_INTERNAL_RPC_WRAPPER_BODY(__name)                             \
@@ -2213,10 +2395,13 @@ hg_return_t _handler_for_NULL(hg_handle_t);
     }                                                                         \
     struct margo_monitor_rpc_ult_args __monitoring_args = {{0}, handle};      \
     __margo_internal_pre_wrapper_hooks(__mid, handle, &__monitoring_args);    \
-    margo_trace(__mid, "Starting RPC %s (handle = %p)", __rpc_name,           \
-                (void*)handle);                                               \
-    __name(handle);                                                           \
-    margo_trace(__mid, "RPC completed (handle = %p)", (void*)handle);         \
+    if (__margo_internal_rpc_admit(__mid, handle)) {                          \
+        MARGO_TRACE(__mid, "Starting RPC %s (handle = %p)", __rpc_name,       \
+                    (void*)handle);                                           \
+        __name(handle);                                                       \
+        MARGO_TRACE(__mid, "RPC completed (handle = %p)", (void*)handle);     \
+        __margo_internal_rpc_release(__mid, handle);                          \
+    }                                                                         \
     __margo_internal_post_wrapper_hooks(__mid, &__monitoring_args);
 
 #define __MARGO_INTERNAL_RPC_WRAPPER(__name)       \
@@ -2264,10 +2449,10 @@ hg_return_t _handler_for_NULL(hg_handle_t);
     __margo_internal_pre_handler_hooks(__mid, handle, &__monitoring_args);     \
     __rpc_name = margo_handle_get_name(handle);                                \
     __rpc_name = __rpc_name ? __rpc_name : #__name;                            \
-    margo_trace(__mid, "Spawning ULT " #__name " for RPC %s (handle = %p)",    \
+    MARGO_TRACE(__mid, "Spawning ULT " #__name " for RPC %s (handle = %p)",    \
                 __rpc_name, (void*)handle);                                    \
-    __ret = ABT_thread_create(__pool, (void (*)(void*))_wrapper_for_##__name,  \
-                              handle, ABT_THREAD_ATTR_NULL, NULL);             \
+    __ret = __margo_internal_dispatch_handler(                                 \
+        __mid, handle, __pool, (void (*)(void*))_wrapper_for_##__name);        \
     if (__ret != 0) {                                                          \
         margo_error(__mid,                                                     \
                     "Could not create ULT" #__name " for RPC %s (ret = %d)",   \
@@ -37,7 +37,8 @@ bool __margo_abt_pool_validate_json(const json_object_t* jpool,
     json_object_t* jkind = json_object_object_get(jpool, "kind");
     if (jkind) {
         CONFIG_IS_IN_ENUM_STRING(jkind, "pool kind", "fifo", "fifo_wait",
-                                 "prio_wait", "earliest_first", "external");
+                                 "prio_wait", "earliest_first", "fair_wait",
+                                 "external");
         if (strcmp(json_object_get_string(jkind), "external") == 0) {
             margo_error(mid,
                         "Pool is marked as external and "
@@ -47,6 +48,59 @@ bool __margo_abt_pool_validate_json(const json_object_t* jpool,
     }
     // TODO: support dlopen-ed pool definitions
 
+    /* default: 0 */
+    ASSERT_CONFIG_HAS_OPTIONAL(jpool, "rpc_workers", int, "pool");
+    CONFIG_INTEGER_MUST_BE_POSITIVE(jpool, "rpc_workers", "pool.rpc_workers");
+
+    /* default: same as rpc_workers */
+    ASSERT_CONFIG_HAS_OPTIONAL(jpool, "max_rpc_workers", int, "pool");
+    CONFIG_INTEGER_MUST_BE_POSITIVE(jpool, "max_rpc_workers",
+                                    "pool.max_rpc_workers");
+    json_object_t* jmax_workers
+        = json_object_object_get(jpool, "max_rpc_workers");
+    if (jmax_workers
+        && json_object_get_int64(jmax_workers)
+               < json_object_object_get_int_or(jpool, "rpc_workers", 0)) {
+        margo_error(mid,
+                    "\"max_rpc_workers\" must be greater or equal to "
+                    "\"rpc_workers\" in pool configuration");
+        return false;
+    }
+
+    /* default: none, only for fair_wait pools */
+    ASSERT_CONFIG_HAS_OPTIONAL(jpool, "weights", array, "pool");
+    json_object_t* jweights = json_object_object_get(jpool, "weights");
+    if (jweights
+        && (!jkind
+            || strcmp(json_object_get_string(jkind), "fair_wait") != 0)) {
+        margo_error(mid, "\"weights\" can only be used in fair_wait pools");
+        return false;
+    }
+    unsigned       i;
+    json_object_t* jweight;
+    json_array_foreach(jweights, i, jweight)
+    {
+        json_object_t* jaddress = NULL;
+        json_object_t* jvalue   = NULL;
+        CONFIG_MUST_HAVE(jweight, string, "address", "pool.weights[].address",
+                         jaddress);
+        (void)jaddress;
+        jvalue = json_object_object_get(jweight, "weight");
+        if (!jvalue
+            || !(json_object_is_type(jvalue, json_type_double)
+                 || json_object_is_type(jvalue, json_type_int))
+            || json_object_get_double(jvalue) <= 0.0) {
+            margo_error(mid,
+                        "\"pool.weights[].weight\" must be a positive number");
+            return false;
+        }
+    }
+
+    /* default: 0 (use abt_thread_stacksize) */
+    ASSERT_CONFIG_HAS_OPTIONAL(jpool, "thread_stacksize", int, "pool");
+    CONFIG_INTEGER_MUST_BE_POSITIVE(jpool, "thread_stacksize",
+                                    "pool.thread_stacksize");
+
     /* default: generated */
     ASSERT_CONFIG_HAS_OPTIONAL(jpool, "name", string, "pool");
     json_object_t* jname = json_object_object_get(jpool, "name");
@@ -123,6 +177,30 @@ bool __margo_abt_pool_init_from_json(const json_object_t* jpool,
         if (ret != ABT_SUCCESS) {
             margo_error(mid, "ABT_pool_create failed with error code %d", ret);
         }
+    } else if (strcmp(pool->kind, "fair_wait") == 0) {
+        if (!pool->access) pool->access = strdup("mpmc");
+        ABT_pool_def fair_pool_def;
+        margo_create_fair_pool_def(&fair_pool_def);
+        ret = ABT_pool_create(&fair_pool_def, ABT_POOL_CONFIG_NULL,
+                              &pool->pool);
+        if (ret != ABT_SUCCESS) {
+            margo_error(mid, "ABT_pool_create failed with error code %d", ret);
+        }
+        json_object_t* jweights = json_object_object_get(jpool, "weights");
+        if (ret == ABT_SUCCESS && jweights) {
+            pool->weights = json_object_get(jweights);
+            unsigned       i;
+            json_object_t* jweight;
+            json_array_foreach(jweights, i, jweight)
+            {
+                const char* address = json_object_object_get_string_or(
+                    jweight, "address", "");
+                double weight = json_object_get_double(
+                    json_object_object_get(jweight, "weight"));
+                margo_fair_pool_set_weight(
+                    pool->pool, margo_fair_pool_hash(address), weight);
+            }
+        }
     } else if (strcmp(pool->kind, "earliest_first") == 0) {
         if (!pool->access) pool->access = strdup("mpmc");
         ABT_pool_def efirst_pool_def;
@@ -148,6 +226,36 @@ bool __margo_abt_pool_init_from_json(const json_object_t* jpool,
 
     pool->margo_free_flag = true;
 
+    pool->thread_stacksize
+        = json_object_object_get_uint64_or(jpool, "thread_stacksize", 0);
+    if (pool->thread_stacksize) {
+        ret = ABT_thread_attr_create(&pool->thread_attr);
+        if (ret == ABT_SUCCESS)
+            ret = ABT_thread_attr_set_stacksize(pool->thread_attr,
+                                                pool->thread_stacksize);
+        if (ret != ABT_SUCCESS) {
+            // LCOV_EXCL_START
+            margo_error(mid,
+                        "Could not create thread attribute for pool %s"
+                        " (ret = %d)",
+                        pool->name, ret);
+            __margo_abt_pool_destroy(pool, abt);
+            return false;
+            // LCOV_EXCL_END
+        }
+    }
+
+    /* the workers are spawned by __margo_abt_start_rpc_workers,
+     * or when the first RPC is dispatched to the pool */
+    pool->num_rpc_workers
+        = json_object_object_get_int_or(jpool, "rpc_workers", 0);
+    pool->max_rpc_workers = json_object_object_get_int_or(
+        jpool, "max_rpc_workers", pool->num_rpc_workers);
+    if (pool->num_rpc_workers || pool->max_rpc_workers)
+        pool->rpc_workers = __margo_rpc_workers_create(
+            pool->pool, pool->thread_attr, pool->num_rpc_workers,
+            pool->max_rpc_workers);
+
     return true;
 }
 
@@ -174,11 +282,30 @@ json_object_t* __margo_abt_pool_to_json(const margo_abt_pool_t* p)
     if (p->access)
         json_object_object_add_ex(jpool, "access",
                                   json_object_new_string(p->access), flags);
+    if (p->weights)
+        json_object_object_add_ex(jpool, "weights",
+                                  json_object_get(p->weights), flags);
+    if (p->thread_stacksize)
+        json_object_object_add_ex(jpool, "thread_stacksize",
+                                  json_object_new_int64(p->thread_stacksize),
+                                  flags);
+    if (p->rpc_workers) {
+        json_object_object_add_ex(jpool, "rpc_workers",
+                                  json_object_new_int64(p->num_rpc_workers),
+                                  flags);
+        json_object_object_add_ex(jpool, "max_rpc_workers",
+                                  json_object_new_int64(p->max_rpc_workers),
+                                  flags);
+    }
     return jpool;
 }
 
 void __margo_abt_pool_destroy(margo_abt_pool_t* p, const margo_abt_t* abt)
 {
+    __margo_rpc_workers_free(p->rpc_workers);
+    json_object_put(p->weights);
+    if (p->thread_attr != ABT_THREAD_ATTR_NULL)
+        ABT_thread_attr_free(&p->thread_attr);
     free(p->kind);
     free(p->access);
     free((char*)p->name);
@@ -801,6 +928,9 @@ void __margo_abt_xstream_destroy(margo_abt_xstream_t* x, const margo_abt_t* abt)
             margo_abt_pool_t* pool_entry
                 = &((margo_abt_pool_t*)abt->pools)[pool_idx];
             pool_entry->num_xstreams -= 1;
+            /* the workers must terminate while an xstream can run them */
+            if (pool_entry->num_xstreams == 0)
+                __margo_rpc_workers_stop(pool_entry->rpc_workers);
         }
     }
 step2:
@@ -1208,6 +1338,14 @@ void __margo_abt_destroy(margo_abt_t* a)
     }
 }
 
+void __margo_abt_start_rpc_workers(const margo_abt_t* a)
+{
+    for (unsigned i = 0; i < a->pools_len; ++i) {
+        if (a->pools[i].num_xstreams == 0) continue;
+        __margo_rpc_workers_start(a->pools[i].rpc_workers);
+    }
+}
+
 void __margo_abt_lock(const margo_abt_t* abt)
 {
     ABT_mutex_lock(ABT_MUTEX_MEMORY_GET_HANDLE(&abt->mtx));
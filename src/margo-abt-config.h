@@ -17,9 +17,11 @@
 #include "margo-globals.h"
 #include "margo-prio-pool.h"
 #include "margo-efirst-pool.h"
+#include "margo-fair-pool.h"
 #include "margo-logging.h"
 #include "margo-macros.h"
 #include "margo-abt-macros.h"
+#include "margo-rpc-workers.h"
 
 /* default values for key ABT parameters if not specified */
 #define MARGO_DEFAULT_ABT_MEM_MAX_NUM_STACKS 8
@@ -62,6 +64,12 @@ typedef struct margo_abt_pool {
     bool margo_free_flag; /* flag if Margo is responsible for freeing */
     bool used_by_primary; /* flag indicating the this pool is used by the
                              primary ES */
+    uint32_t             num_rpc_workers; /* persistent RPC handler ULTs */
+    uint32_t             max_rpc_workers; /* upper bound when growing */
+    margo_rpc_workers_t* rpc_workers;     /* NULL if no workers */
+    size_t          thread_stacksize; /* stack size of RPC handler ULTs */
+    ABT_thread_attr thread_attr; /* ABT_THREAD_ATTR_NULL if no stacksize */
+    json_object_t*  weights;     /* per-origin weights of fair_wait pools */
 } margo_abt_pool_t;
 
 bool __margo_abt_pool_validate_json(const json_object_t* config,
@@ -168,6 +176,10 @@ json_object_t* __margo_abt_to_json(const margo_abt_t* abt, int options);
 
 void __margo_abt_destroy(margo_abt_t* abt);
 
+/* Spawns the persistent RPC handler ULTs of the pools that are
+ * executed by at least one xstream */
+void __margo_abt_start_rpc_workers(const margo_abt_t* abt);
+
 int  __margo_abt_find_pool_by_name(const margo_abt_t* abt, const char* name);
 int  __margo_abt_find_pool_by_handle(const margo_abt_t* abt, ABT_pool pool);
 int  __margo_abt_find_xstream_by_name(const margo_abt_t* abt, const char* name);
@@ -8,6 +8,7 @@
 #include "margo-logging.h"
 #include "margo-instance.h"
 #include "margo-globals.h"
+#include "margo-abt-profiling.h"
 
 static FILE* margo_output_file_open(margo_instance_id mid,
                                     const char*       file,
@@ -255,3 +256,69 @@ int margo_state_dump(margo_instance_id mid,
 
     return 0;
 }
+
+/* Number of times the counters of an execution stream are read again if
+ * one of its profiler callbacks was running while they were copied */
+#define ABT_PROF_SAMPLE_ATTEMPTS 16
+
+static bool abt_prof_sample_xstream(ABTXI_prof_global*       p_global,
+                                    ABTXI_prof_xstream_info* p_info,
+                                    margo_abt_prof_sample_t* sample)
+{
+    for (unsigned i = 0; i < ABT_PROF_SAMPLE_ATTEMPTS; i++) {
+        int tag = ABTXI_prof_atomic_acquire_load_int(&p_info->tag);
+        if (tag & 1) continue;
+        const ABTXI_prof_xstream_data* d = &p_info->d;
+        sample->num_runs        = d->num_events[ABTXI_PROF_EVENT_THREAD_RUN];
+        sample->num_finishes    = d->num_events[ABTXI_PROF_EVENT_THREAD_FINISH];
+        sample->num_yields      = d->num_events[ABTXI_PROF_EVENT_THREAD_YIELD];
+        sample->num_suspensions
+            = d->num_events[ABTXI_PROF_EVENT_THREAD_SUSPEND];
+#if !ABTXI_PROF_USE_TIME_LOCAL
+        /* depth 1 corresponds to the ULTs run by the main scheduler */
+        ABTXI_PROF_T busy     = d->times_elapsed[1];
+        ABTXI_PROF_T last_run = d->times_last_run[1];
+        if (last_run != ABTXI_PROF_T_ZERO
+            && last_run != ABTXI_PROF_TIME_LAST_RUN_INVALID) {
+            /* a ULT is still running on this execution stream */
+            ABTXI_PROF_T now = ABTXI_prof_get_time();
+            if (now > last_run) busy += now - last_run;
+        }
+        sample->busy_time = (double)busy * p_global->to_sec;
+#else
+        /* local timers cannot be compared across execution streams, the
+         * busy time excludes the ULT currently running */
+        sample->busy_time
+            = (double)d->times_elapsed_local[1] * p_global->to_sec;
+#endif
+        if (ABTXI_prof_atomic_acquire_load_int(&p_info->tag) == tag)
+            return true;
+    }
+    return false;
+}
+
+size_t __margo_abt_prof_sample(margo_abt_prof_sample_t* samples, size_t max)
+{
+    if (!g_margo_abt_prof_init || !g_margo_abt_prof_started) return 0;
+    ABTXI_prof_global* p_global = (ABTXI_prof_global*)g_margo_abt_prof_context;
+    size_t             count    = 0;
+
+    ABTXI_prof_spin_lock(&p_global->xstreams_lock);
+    if (p_global->state != ABTXI_PROF_GLOBAL_STATE_RUNNING) {
+        ABTXI_prof_spin_unlock(&p_global->xstreams_lock);
+        return 0;
+    }
+    double start_time = (double)p_global->start_prof_time * p_global->to_sec;
+    int    len = ABTXI_prof_atomic_acquire_load_int(&p_global->len_p_xstreams);
+    for (int rank = 0; rank < len && count < max; rank++) {
+        ABTXI_prof_xstream_info* p_info = p_global->p_xstreams[rank];
+        if (!p_info) continue;
+        margo_abt_prof_sample_t* sample = &samples[count];
+        if (!abt_prof_sample_xstream(p_global, p_info, sample)) continue;
+        sample->rank       = rank;
+        sample->start_time = start_time;
+        count++;
+    }
+    ABTXI_prof_spin_unlock(&p_global->xstreams_lock);
+    return count;
+}
@@ -0,0 +1,32 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_ABT_PROFILING_H
+#define __MARGO_ABT_PROFILING_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* Counters of an execution stream, read from the Argobots profiler
+ * (basic or detailed mode) while it is running. The counters accumulate
+ * from start_time, which changes when the profiler is restarted (e.g.
+ * by margo_dump_abt_profiling), so deltas between two samples are only
+ * meaningful if their start_time is the same. */
+typedef struct margo_abt_prof_sample {
+    int      rank;            /* rank of the execution stream */
+    uint64_t num_runs;        /* ULTs scheduled (context switches) */
+    uint64_t num_finishes;    /* ULTs that completed */
+    uint64_t num_yields;      /* ULTs that yielded */
+    uint64_t num_suspensions; /* ULTs that blocked */
+    double   busy_time; /* seconds spent running ULTs, including the
+                           ULT running when the sample was taken */
+    double   start_time; /* profiler's start time (arbitrary origin) */
+} margo_abt_prof_sample_t;
+
+/* Fills up to max samples, one per execution stream known to the
+ * profiler, without stopping it. Returns the number of samples, which
+ * is 0 if the profiler is not running. */
+size_t __margo_abt_prof_sample(margo_abt_prof_sample_t* samples, size_t max);
+
+#endif
@@ -0,0 +1,458 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <abt.h>
+#include "margo-async-logger.h"
+#include "margo-macros.h"
+
+#define ASYNC_LOG_MAX_RINGS 64
+#define ASYNC_LOG_NUM_SITES 256 /* must be a power of 2 */
+#define ASYNC_LOG_SITE_PROBES 8
+#define ASYNC_LOG_RECORD_SIZE 256
+
+/* Slot of a ring. Rings are bounded MPMC queues (Vyukov): a record whose
+ * seq equals the position of a producer is free, a record whose seq is
+ * position + 1 holds a message the drain thread has not written yet. */
+typedef struct async_log_record {
+    _Atomic size_t seq;
+    double         timestamp;
+    int32_t        level;
+    uint32_t       length;
+    char message[ASYNC_LOG_RECORD_SIZE - 2 * sizeof(size_t) - sizeof(double)];
+} async_log_record_t;
+
+typedef struct async_log_ring {
+    _Atomic size_t head; /* next position for producers */
+    char           _pad[64 - sizeof(size_t)];
+    size_t         tail; /* next position to drain */
+    async_log_record_t* records;
+} async_log_ring_t;
+
+/* Per call site rate limiting state, keyed by the format string */
+typedef struct async_log_site {
+    const char* _Atomic fmt;
+    _Atomic int64_t     second; /* second of the current window */
+    _Atomic uint32_t    count;  /* messages in the current window */
+    _Atomic uint64_t    suppressed;
+} async_log_site_t;
+
+struct margo_async_logger {
+    /* configuration */
+    char*    filename;
+    size_t   buffer_size;
+    uint32_t rate_limit;
+    bool     backpressure;
+    unsigned flush_interval_ms;
+    /* state */
+    FILE*             file;
+    unsigned          num_rings;
+    async_log_ring_t* rings;
+    async_log_site_t  sites[ASYNC_LOG_NUM_SITES];
+    pthread_t         thread;
+    _Atomic bool      stop;
+    /* counters */
+    _Atomic uint64_t logged;
+    _Atomic uint64_t written;
+    _Atomic uint64_t dropped;
+    _Atomic uint64_t waited;
+    _Atomic uint64_t rate_limited;
+    _Atomic uint64_t truncated;
+};
+
+static const char* const level_names[] = {"external", "trace",   "debug",
+                                          "info",     "warning", "error",
+                                          "critical"};
+
+static inline double wall_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+bool __margo_async_logger_validate_json(const struct json_object* config)
+{
+    if (!config) return true;
+
+#define HANDLE_CONFIG_ERROR return false
+
+    /* Fields:
+       - [optional] filename: string (default "stderr")
+       - [optional] buffer_size: integer >= 1 (default 1024)
+       - [optional] rate_limit: integer >= 0 (default 0 = unlimited)
+       - [optional] backpressure: bool (default false)
+       - [optional] flush_interval_ms: integer >= 0 (default 10)
+    */
+    if (!json_object_is_type(config, json_type_object)) {
+        margo_error(0,
+                    "\"async_logging\" field in configuration "
+                    "should be an object");
+        HANDLE_CONFIG_ERROR;
+    }
+    ASSERT_CONFIG_HAS_OPTIONAL(config, "filename", string, "async_logging");
+    ASSERT_CONFIG_HAS_OPTIONAL(config, "buffer_size", int, "async_logging");
+    ASSERT_CONFIG_HAS_OPTIONAL(config, "rate_limit", int, "async_logging");
+    ASSERT_CONFIG_HAS_OPTIONAL(config, "backpressure", boolean,
+                               "async_logging");
+    ASSERT_CONFIG_HAS_OPTIONAL(config, "flush_interval_ms", int,
+                               "async_logging");
+
+    struct json_object* ignore = NULL;
+    if (CONFIG_HAS(config, "buffer_size", ignore)
+        && json_object_get_int64(ignore) < 1) {
+        margo_error(0, "\"buffer_size\" in async_logging must be >= 1");
+        HANDLE_CONFIG_ERROR;
+    }
+    if (CONFIG_HAS(config, "rate_limit", ignore)) {
+        CONFIG_INTEGER_MUST_BE_POSITIVE(config, "rate_limit",
+                                        "async_logging.rate_limit");
+    }
+    if (CONFIG_HAS(config, "flush_interval_ms", ignore)) {
+        CONFIG_INTEGER_MUST_BE_POSITIVE(config, "flush_interval_ms",
+                                        "async_logging.flush_interval_ms");
+    }
+
+    return true;
+#undef HANDLE_CONFIG_ERROR
+}
+
+/* Reserves a record in the ring, formats the message into it, and
+ * publishes it. Returns false if the ring is full. */
+static bool ring_push(margo_async_logger_t* logger,
+                      async_log_ring_t*     ring,
+                      margo_log_level       level,
+                      double                timestamp,
+                      const char*           fmt,
+                      va_list               args)
+{
+    size_t              mask = logger->buffer_size - 1;
+    async_log_record_t* record;
+    size_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    for (;;) {
+        record     = &ring->records[pos & mask];
+        size_t seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+    record->timestamp = timestamp;
+    record->level     = level;
+    int n = vsnprintf(record->message, sizeof(record->message), fmt, args);
+    if (n < 0) n = 0;
+    if ((size_t)n >= sizeof(record->message)) {
+        n = sizeof(record->message) - 1;
+        __atomic_fetch_add(&logger->truncated, 1, __ATOMIC_RELAXED);
+    }
+    record->length = (uint32_t)n;
+    __atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void async_log(margo_async_logger_t* logger,
+                      async_log_ring_t*     ring,
+                      margo_log_level       level,
+                      double                timestamp,
+                      const char*           fmt,
+                      va_list               args)
+{
+    bool waited = false;
+    while (!ring_push(logger, ring, level, timestamp, fmt, args)) {
+        if (!logger->backpressure) {
+            __atomic_fetch_add(&logger->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (!waited) {
+            __atomic_fetch_add(&logger->waited, 1, __ATOMIC_RELAXED);
+            waited = true;
+        }
+        /* let other ULTs run on this ES, or yield the pthread if the
+         * caller is not a ULT */
+        if (ABT_thread_yield() != ABT_SUCCESS) sched_yield();
+    }
+    __atomic_fetch_add(&logger->logged, 1, __ATOMIC_RELAXED);
+}
+
+static void async_log_fmt(margo_async_logger_t* logger,
+                          async_log_ring_t*     ring,
+                          margo_log_level       level,
+                          double                timestamp,
+                          const char*           fmt,
+                          ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    async_log(logger, ring, level, timestamp, fmt, args);
+    va_end(args);
+}
+
+static async_log_site_t* find_site(margo_async_logger_t* logger,
+                                   const char*           fmt)
+{
+    uint64_t hash = ((uintptr_t)fmt >> 3) * 0x9E3779B97F4A7C15ULL;
+    for (unsigned i = 0; i < ASYNC_LOG_SITE_PROBES; i++) {
+        async_log_site_t* site
+            = &logger->sites[(hash + i) & (ASYNC_LOG_NUM_SITES - 1)];
+        const char* site_fmt = __atomic_load_n(&site->fmt, __ATOMIC_ACQUIRE);
+        if (site_fmt == fmt) return site;
+        if (site_fmt == NULL) {
+            if (__atomic_compare_exchange_n(&site->fmt, &site_fmt, fmt, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+                || site_fmt == fmt)
+                return site;
+        }
+    }
+    /* too many call sites, this one is not rate limited */
+    return NULL;
+}
+
+/* Returns false if the message should be suppressed */
+static bool rate_limit_admit(margo_async_logger_t* logger,
+                             async_log_ring_t*     ring,
+                             margo_log_level       level,
+                             double                timestamp,
+                             const char*           fmt)
+{
+    async_log_site_t* site = find_site(logger, fmt);
+    if (!site) return true;
+    int64_t second = (int64_t)timestamp;
+    int64_t window = __atomic_load_n(&site->second, __ATOMIC_RELAXED);
+    if (window != second
+        && __atomic_compare_exchange_n(&site->second, &window, second, false,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        /* new window, report what the previous ones suppressed */
+        __atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+        uint64_t suppressed
+            = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+        if (suppressed)
+            async_log_fmt(logger, ring, level, timestamp,
+                          "(%" PRIu64 " messages like \"%s\" were suppressed "
+                          "by the rate limit)",
+                          suppressed, fmt);
+    }
+    if (__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED)
+        >= logger->rate_limit) {
+        __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&logger->rate_limited, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+void __margo_async_logger_vlog(margo_async_logger_t* logger,
+                               margo_log_level       level,
+                               const char*           fmt,
+                               va_list               args)
+{
+    int rank = 0;
+    if (ABT_self_get_xstream_rank(&rank) != ABT_SUCCESS || rank < 0) rank = 0;
+    async_log_ring_t* ring = &logger->rings[rank & (logger->num_rings - 1)];
+    double timestamp = wall_time();
+    if (logger->rate_limit
+        && !rate_limit_admit(logger, ring, level, timestamp, fmt))
+        return;
+    async_log(logger, ring, level, timestamp, fmt, args);
+}
+
+/* Writes the pending records of all the rings in timestamp order.
+ * Returns the number of records written. */
+static size_t drain(margo_async_logger_t* logger)
+{
+    size_t mask    = logger->buffer_size - 1;
+    size_t written = 0;
+    for (;;) {
+        async_log_ring_t*   oldest_ring = NULL;
+        async_log_record_t* oldest      = NULL;
+        for (unsigned i = 0; i < logger->num_rings; i++) {
+            async_log_ring_t*   ring   = &logger->rings[i];
+            async_log_record_t* record = &ring->records[ring->tail & mask];
+            if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE)
+                != ring->tail + 1)
+                continue;
+            if (!oldest || record->timestamp < oldest->timestamp) {
+                oldest_ring = ring;
+                oldest      = record;
+            }
+        }
+        if (!oldest) break;
+        const char* level_name = "";
+        if (oldest->level >= 0 && oldest->level <= MARGO_LOG_CRITICAL)
+            level_name = level_names[oldest->level];
+        fprintf(logger->file, "%.6f [%s] %.*s\n", oldest->timestamp,
+                level_name, (int)oldest->length, oldest->message);
+        /* hand the record back to the producers */
+        __atomic_store_n(&oldest->seq, oldest_ring->tail + mask + 1,
+                         __ATOMIC_RELEASE);
+        oldest_ring->tail += 1;
+        written += 1;
+    }
+    if (written)
+        __atomic_fetch_add(&logger->written, written, __ATOMIC_RELAXED);
+    return written;
+}
+
+static void* drain_thread_fn(void* arg)
+{
+    margo_async_logger_t* logger = (margo_async_logger_t*)arg;
+    struct timespec       interval;
+    interval.tv_sec  = logger->flush_interval_ms / 1000;
+    interval.tv_nsec = (long)(logger->flush_interval_ms % 1000) * 1000000L;
+    while (!__atomic_load_n(&logger->stop, __ATOMIC_ACQUIRE)) {
+        if (drain(logger)) continue;
+        fflush(logger->file);
+        if (logger->flush_interval_ms)
+            nanosleep(&interval, NULL);
+        else
+            sched_yield();
+    }
+    drain(logger);
+    struct margo_async_log_stats stats;
+    __margo_async_logger_get_stats(logger, &stats);
+    if (stats.dropped || stats.rate_limited || stats.truncated)
+        fprintf(logger->file,
+                "%.6f [warning] async logger: %" PRIu64
+                " messages dropped, %" PRIu64 " rate limited, %" PRIu64
+                " truncated\n",
+                wall_time(), stats.dropped, stats.rate_limited,
+                stats.truncated);
+    fflush(logger->file);
+    return NULL;
+}
+
+margo_async_logger_t*
+__margo_async_logger_create(const struct json_object* config,
+                            unsigned                  num_xstreams)
+{
+    if (!config) return NULL;
+
+    margo_async_logger_t* logger = calloc(1, sizeof(*logger));
+    if (!logger) return NULL;
+
+    const char* filename
+        = json_object_object_get_string_or(config, "filename", "stderr");
+    logger->filename = strdup(filename);
+    size_t buffer_size
+        = json_object_object_get_uint64_or(config, "buffer_size", 1024);
+    logger->buffer_size = 1;
+    while (logger->buffer_size < buffer_size) logger->buffer_size *= 2;
+    logger->rate_limit
+        = json_object_object_get_uint64_or(config, "rate_limit", 0);
+    logger->backpressure
+        = json_object_object_get_bool_or(config, "backpressure", false);
+    logger->flush_interval_ms
+        = json_object_object_get_uint64_or(config, "flush_interval_ms", 10);
+
+    if (strcmp(filename, "stderr") == 0) {
+        logger->file = stderr;
+    } else {
+        logger->file = fopen(filename, "a");
+        // LCOV_EXCL_START
+        if (!logger->file) {
+            margo_error(0, "in %s: could not open %s", __func__, filename);
+            goto error;
+        }
+        // LCOV_EXCL_STOP
+    }
+
+    logger->num_rings = 1;
+    while (logger->num_rings < num_xstreams
+           && logger->num_rings < ASYNC_LOG_MAX_RINGS)
+        logger->num_rings *= 2;
+    logger->rings = calloc(logger->num_rings, sizeof(*logger->rings));
+    // LCOV_EXCL_START
+    if (!logger->rings) goto error;
+    // LCOV_EXCL_STOP
+    for (unsigned i = 0; i < logger->num_rings; i++) {
+        async_log_ring_t* ring = &logger->rings[i];
+        ring->records = calloc(logger->buffer_size, sizeof(*ring->records));
+        // LCOV_EXCL_START
+        if (!ring->records) goto error;
+        // LCOV_EXCL_STOP
+        for (size_t j = 0; j < logger->buffer_size; j++)
+            ring->records[j].seq = j;
+    }
+
+    // LCOV_EXCL_START
+    if (pthread_create(&logger->thread, NULL, drain_thread_fn, logger) != 0) {
+        margo_error(0, "in %s: could not create drain thread", __func__);
+        goto error;
+    }
+    // LCOV_EXCL_STOP
+    return logger;
+
+    // LCOV_EXCL_START
+error:
+    if (logger->rings) {
+        for (unsigned i = 0; i < logger->num_rings; i++)
+            free(logger->rings[i].records);
+        free(logger->rings);
+    }
+    if (logger->file && logger->file != stderr) fclose(logger->file);
+    free(logger->filename);
+    free(logger);
+    return NULL;
+    // LCOV_EXCL_STOP
+}
+
+struct json_object*
+__margo_async_logger_to_json(const margo_async_logger_t* logger)
+{
+    int flags = JSON_C_OBJECT_ADD_KEY_IS_NEW | JSON_C_OBJECT_ADD_CONSTANT_KEY;
+    struct json_object* config = json_object_new_object();
+    json_object_object_add_ex(config, "filename",
+                              json_object_new_string(logger->filename), flags);
+    json_object_object_add_ex(config, "buffer_size",
+                              json_object_new_uint64(logger->buffer_size),
+                              flags);
+    json_object_object_add_ex(config, "rate_limit",
+                              json_object_new_uint64(logger->rate_limit),
+                              flags);
+    json_object_object_add_ex(config, "backpressure",
+                              json_object_new_boolean(logger->backpressure),
+                              flags);
+    json_object_object_add_ex(
+        config, "flush_interval_ms",
+        json_object_new_uint64(logger->flush_interval_ms), flags);
+    return config;
+}
+
+void __margo_async_logger_destroy(margo_async_logger_t* logger)
+{
+    if (!logger) return;
+    __atomic_store_n(&logger->stop, true, __ATOMIC_RELEASE);
+    pthread_join(logger->thread, NULL);
+    for (unsigned i = 0; i < logger->num_rings; i++)
+        free(logger->rings[i].records);
+    free(logger->rings);
+    if (logger->file != stderr) fclose(logger->file);
+    free(logger->filename);
+    free(logger);
+}
+
+void __margo_async_logger_get_stats(const margo_async_logger_t*   logger,
+                                    struct margo_async_log_stats* stats)
+{
+    stats->logged  = __atomic_load_n(&logger->logged, __ATOMIC_RELAXED);
+    stats->written = __atomic_load_n(&logger->written, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&logger->dropped, __ATOMIC_RELAXED);
+    stats->waited  = __atomic_load_n(&logger->waited, __ATOMIC_RELAXED);
+    stats->rate_limited
+        = __atomic_load_n(&logger->rate_limited, __ATOMIC_RELAXED);
+    stats->truncated = __atomic_load_n(&logger->truncated, __ATOMIC_RELAXED);
+}
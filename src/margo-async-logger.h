@@ -0,0 +1,72 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_ASYNC_LOGGER_H
+#define __MARGO_ASYNC_LOGGER_H
+#include <stdarg.h>
+#include <stdbool.h>
+#include <json-c/json.h>
+#include <margo-logging.h>
+
+/* Asynchronous logger
+ * ===================
+ *
+ * When the margo configuration has an "async_logging" object, the log
+ * messages of the instance (those passing its log level) are no longer
+ * handed to its logger from the calling ULT. They are formatted once,
+ * with a single vsnprintf, into fixed-size records of a lock-free ring
+ * buffer. There is one ring per execution stream (selected by the rank
+ * of the calling ES, callers outside of Argobots use the first one), and
+ * a background pthread drains the rings into a file, merging them by
+ * timestamp, so that logging never waits on I/O.
+ *
+ * The "async_logging" object may specify:
+ * - filename: file the messages are appended to, or "stderr" (default);
+ * - buffer_size: number of records per ring, rounded up to a power of 2
+ *   (default 1024);
+ * - rate_limit: maximum number of messages per second from a given call
+ *   site, identified by its format string (0, the default, means
+ *   unlimited). The number of messages suppressed is logged when the
+ *   call site is used again in a later second;
+ * - backpressure: if true, callers finding their ring full yield until
+ *   the drain thread makes room, instead of dropping the message
+ *   (default false);
+ * - flush_interval_ms: how long the drain thread sleeps when the rings
+ *   are empty (default 10).
+ *
+ * Messages longer than a record are truncated. The counters can be read
+ * with margo_get_async_log_stats().
+ *
+ * The asynchronous logger replaces the instance's default logger only:
+ * if a custom logger is provided (in margo_init_info or through
+ * margo_set_logger), its functions keep being called synchronously from
+ * the logging ULT, since they may not be safe to call from the drain
+ * thread, and a warning is issued.
+ */
+typedef struct margo_async_logger margo_async_logger_t;
+
+bool __margo_async_logger_validate_json(const struct json_object* config);
+
+/* Creates the logger and starts its drain thread. Returns NULL if config
+ * is NULL or on failure (errors are reported through margo_error). */
+margo_async_logger_t*
+__margo_async_logger_create(const struct json_object* config,
+                            unsigned                  num_xstreams);
+
+struct json_object*
+__margo_async_logger_to_json(const margo_async_logger_t* logger);
+
+/* Stops the drain thread after it has written all the pending records */
+void __margo_async_logger_destroy(margo_async_logger_t* logger);
+
+void __margo_async_logger_vlog(margo_async_logger_t* logger,
+                               margo_log_level       level,
+                               const char*           fmt,
+                               va_list               args);
+
+void __margo_async_logger_get_stats(const margo_async_logger_t* logger,
+                                    struct margo_async_log_stats* stats);
+
+#endif
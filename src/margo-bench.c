@@ -0,0 +1,794 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <json-c/json.h>
+#include <margo.h>
+#include <mercury_proc_string.h>
+
+#include "margo-macros.h"
+
+/* Runs RPC benchmarks between a client (this process) and a server (a
+ * child process), each initialized with its own margo JSON configuration,
+ * and writes the results as a JSON document.
+ *
+ * The benchmarks are described by a JSON configuration of the form
+ * {"benchmarks": [ ... ]}, each benchmark being an object with a "type":
+ * - "latency": sequential RPCs with no payload, with "iterations"
+ *   (default 10000) and "warmup" (default 100) RPCs. If "timeout_ms" is
+ *   positive, margo_forward_timed is used instead of margo_forward;
+ * - "throughput": RPCs with no payload sent by "concurrency" (default 16)
+ *   ULTs during "duration_sec" seconds (default 5). The ULTs run in the
+ *   client pool named "pool" (default: the handler pool), so the number
+ *   of xstreams is set by the client's configuration;
+ * - "bulk": bulk transfers of each of the "sizes" (default 4KiB to
+ *   16MiB), "iterations" (default 100) and "warmup" (default 10) times
+ *   each. The "operation" is "pull" (default, the server pulls from the
+ *   client) or "push" (the server pushes to the client).
+ * Without a benchmark configuration, each benchmark runs once with its
+ * defaults, and the latency benchmark runs again with a timeout.
+ */
+
+#define DEFAULT_LATENCY_ITERATIONS 10000
+#define DEFAULT_LATENCY_WARMUP     100
+#define DEFAULT_CONCURRENCY        16
+#define DEFAULT_DURATION_SEC       5.0
+#define DEFAULT_BULK_ITERATIONS    100
+#define DEFAULT_BULK_WARMUP        10
+
+static const size_t default_bulk_sizes[]
+    = {4096, 65536, 1048576, 16777216};
+
+static const char* default_benchmarks
+    = "{\"benchmarks\":["
+      "{\"type\":\"latency\"},"
+      "{\"type\":\"latency\",\"timeout_ms\":1000},"
+      "{\"type\":\"throughput\"},"
+      "{\"type\":\"bulk\",\"operation\":\"pull\"},"
+      "{\"type\":\"bulk\",\"operation\":\"push\"}"
+      "]}";
+
+MERCURY_GEN_PROC(bench_bulk_in_t,
+                 ((hg_bulk_t)(bulk))((uint64_t)(size))((uint8_t)(push)))
+MERCURY_GEN_PROC(bench_config_out_t, ((hg_string_t)(config)))
+
+struct options {
+    const char* protocol;
+    const char* server_config_file;
+    const char* client_config_file;
+    const char* bench_config_file;
+    const char* output_file;
+    bool        monitoring;
+};
+
+/* RPCs of the benchmark, registered on both sides */
+typedef struct bench_rpcs {
+    hg_id_t noop_id;
+    hg_id_t bulk_id;
+    hg_id_t config_id;
+    hg_id_t shutdown_id;
+} bench_rpcs_t;
+
+/* Buffer the server transfers data from or to */
+typedef struct bench_server {
+    void*     buffer;
+    hg_size_t size;
+    hg_bulk_t bulk;
+} bench_server_t;
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: margo-bench [-p <protocol>] [-s <server config>] "
+            "[-c <client config>]\n"
+            "                   [-b <benchmark config>] [-o <output file>] "
+            "[-m]\n");
+    fprintf(stderr,
+            "   Runs RPC latency, throughput and bulk bandwidth benchmarks\n"
+            "   between this process and a server child process, and writes\n"
+            "   the results as JSON to <output file> (default stdout).\n"
+            "   -p: protocol used by both sides (default na+sm)\n"
+            "   -s, -c: margo JSON configuration of the server and client\n"
+            "   -b: JSON description of the benchmarks to run\n"
+            "   -m: enable the default monitor on both sides\n");
+}
+
+/* Reads a whole file into a null-terminated string */
+static char* read_file(const char* filename)
+{
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: could not open %s: %s\n", filename,
+                strerror(errno));
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* content = size >= 0 ? calloc((size_t)size + 1, 1) : NULL;
+    if (content && fread(content, 1, (size_t)size, file) != (size_t)size) {
+        free(content);
+        content = NULL;
+    }
+    fclose(file);
+    if (!content) fprintf(stderr, "Error: could not read %s\n", filename);
+    return content;
+}
+
+static double json_object_object_get_double_or(const struct json_object* obj,
+                                               const char*               key,
+                                               double                    x)
+{
+    struct json_object* value = json_object_object_get(obj, key);
+    if (value
+        && (json_object_is_type(value, json_type_double)
+            || json_object_is_type(value, json_type_int)))
+        return json_object_get_double(value);
+    return x;
+}
+
+/* ========================================================================
+ * Server side
+ * ======================================================================== */
+
+static void noop_ult(hg_handle_t handle)
+{
+    margo_respond(handle, NULL);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(noop_ult)
+
+static void bulk_ult(hg_handle_t handle)
+{
+    margo_instance_id     mid  = margo_hg_handle_get_instance(handle);
+    const struct hg_info* info = margo_get_info(handle);
+    const bench_server_t* server
+        = (const bench_server_t*)margo_registered_data(mid, info->id);
+    bench_bulk_in_t in;
+
+    hg_return_t hret = margo_get_input(handle, &in);
+    if (hret != HG_SUCCESS) {
+        fprintf(stderr, "Error: margo_get_input failed (%s)\n",
+                HG_Error_to_string(hret));
+        margo_destroy(handle);
+        return;
+    }
+    size_t       size = in.size < server->size ? in.size : server->size;
+    hg_bulk_op_t op   = in.push ? HG_BULK_PUSH : HG_BULK_PULL;
+    hret = margo_bulk_transfer(mid, op, info->addr, in.bulk, 0, server->bulk, 0,
+                               size);
+    if (hret != HG_SUCCESS)
+        fprintf(stderr, "Error: margo_bulk_transfer failed (%s)\n",
+                HG_Error_to_string(hret));
+    margo_free_input(handle, &in);
+    margo_respond(handle, NULL);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(bulk_ult)
+
+static void config_ult(hg_handle_t handle)
+{
+    margo_instance_id  mid = margo_hg_handle_get_instance(handle);
+    bench_config_out_t out = {.config = margo_get_config(mid)};
+    margo_respond(handle, &out);
+    free(out.config);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(config_ult)
+
+static void shutdown_ult(hg_handle_t handle)
+{
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+    margo_respond(handle, NULL);
+    margo_destroy(handle);
+    margo_finalize(mid);
+}
+DEFINE_MARGO_RPC_HANDLER(shutdown_ult)
+
+static void register_rpcs(margo_instance_id mid, bench_rpcs_t* rpcs)
+{
+    rpcs->noop_id = MARGO_REGISTER(mid, "margo_bench_noop", void, void,
+                                   noop_ult);
+    rpcs->bulk_id = MARGO_REGISTER(mid, "margo_bench_bulk", bench_bulk_in_t,
+                                   void, bulk_ult);
+    rpcs->config_id = MARGO_REGISTER(mid, "margo_bench_config", void,
+                                     bench_config_out_t, config_ult);
+    rpcs->shutdown_id = MARGO_REGISTER(mid, "margo_bench_shutdown", void,
+                                       void, shutdown_ult);
+}
+
+static void server_finalize_cb(void* uargs)
+{
+    bench_server_t* server = (bench_server_t*)uargs;
+    margo_bulk_free(server->bulk);
+    free(server->buffer);
+}
+
+/* Runs the server until the client sends the shutdown RPC. The address
+ * of the server is written into fd, which is then closed (without
+ * writing anything if the server could not be initialized). */
+static int run_server(const struct options* opts,
+                      const char*           config,
+                      int                   fd,
+                      size_t                bulk_size)
+{
+    struct margo_init_info info = {.json_config = config};
+    if (opts->monitoring) info.monitor = margo_default_monitor;
+    margo_instance_id mid
+        = margo_init_ext(opts->protocol, MARGO_SERVER_MODE, &info);
+    if (mid == MARGO_INSTANCE_NULL) {
+        fprintf(stderr, "Error: could not initialize the server\n");
+        close(fd);
+        return -1;
+    }
+
+    bench_rpcs_t rpcs;
+    register_rpcs(mid, &rpcs);
+
+    bench_server_t server = {.size = bulk_size ? bulk_size : 1};
+    server.buffer         = calloc(1, server.size);
+    hg_return_t hret      = margo_bulk_create(mid, 1, &server.buffer,
+                                              &server.size, HG_BULK_READWRITE,
+                                              &server.bulk);
+    if (!server.buffer || hret != HG_SUCCESS) {
+        fprintf(stderr, "Error: could not create the server's bulk handle\n");
+        close(fd);
+        margo_finalize(mid);
+        return -1;
+    }
+    margo_register_data(mid, rpcs.bulk_id, &server, NULL);
+    margo_push_finalize_callback(mid, server_finalize_cb, &server);
+
+    char      addr_str[256];
+    hg_size_t addr_str_size = sizeof(addr_str);
+    hg_addr_t self_addr     = HG_ADDR_NULL;
+    margo_addr_self(mid, &self_addr);
+    margo_addr_to_string(mid, addr_str, &addr_str_size, self_addr);
+    margo_addr_free(mid, self_addr);
+    ssize_t written = write(fd, addr_str, strlen(addr_str));
+    close(fd);
+    if (written != (ssize_t)strlen(addr_str)) {
+        margo_finalize(mid);
+        return -1;
+    }
+
+    margo_wait_for_finalize(mid);
+    return 0;
+}
+
+/* ========================================================================
+ * Client side
+ * ======================================================================== */
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Adds the statistics of the given durations (in seconds, sorted in
+ * place) to result, in microseconds */
+static void add_duration_stats(struct json_object* result,
+                               double*             durations,
+                               size_t              count)
+{
+    static const double      percentiles[] = {50.0, 90.0, 99.0, 99.9};
+    static const char* const names[] = {"p50_usec", "p90_usec", "p99_usec",
+                                        "p999_usec"};
+    if (!count) return;
+    qsort(durations, count, sizeof(double), compare_doubles);
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++) sum += durations[i];
+    json_object_object_add(result, "min_usec",
+                           json_object_new_double(durations[0] * 1e6));
+    json_object_object_add(result, "max_usec",
+                           json_object_new_double(durations[count - 1] * 1e6));
+    json_object_object_add(result, "avg_usec",
+                           json_object_new_double(sum / count * 1e6));
+    for (size_t i = 0; i < 4; i++) {
+        size_t rank = (size_t)(percentiles[i] / 100.0 * (double)count);
+        if (rank >= count) rank = count - 1;
+        json_object_object_add(result, names[i],
+                               json_object_new_double(durations[rank] * 1e6));
+    }
+}
+
+static struct json_object* run_latency(margo_instance_id         mid,
+                                       hg_addr_t                 addr,
+                                       const bench_rpcs_t*       rpcs,
+                                       const struct json_object* params)
+{
+    int64_t iterations = json_object_object_get_int64_or(
+        params, "iterations", DEFAULT_LATENCY_ITERATIONS);
+    int64_t warmup = json_object_object_get_int64_or(params, "warmup",
+                                                     DEFAULT_LATENCY_WARMUP);
+    double  timeout_ms
+        = json_object_object_get_double_or(params, "timeout_ms", 0.0);
+    if (iterations < 0) iterations = 0;
+    if (warmup < 0) warmup = 0;
+
+    double*     durations = calloc((size_t)iterations + 1, sizeof(double));
+    size_t      count     = 0;
+    uint64_t    timeouts = 0, errors = 0;
+    hg_handle_t handle = HG_HANDLE_NULL;
+    for (int64_t i = 0; i < warmup + iterations; i++) {
+        if (handle == HG_HANDLE_NULL
+            && margo_create(mid, addr, rpcs->noop_id, &handle) != HG_SUCCESS) {
+            errors += 1;
+            break;
+        }
+        double      t0   = ABT_get_wtime();
+        hg_return_t hret = timeout_ms > 0.0
+                             ? margo_forward_timed(handle, NULL, timeout_ms)
+                             : margo_forward(handle, NULL);
+        double      t1   = ABT_get_wtime();
+        if (hret != HG_SUCCESS) {
+            if (hret == HG_TIMEOUT)
+                timeouts += 1;
+            else
+                errors += 1;
+            /* the handle may not be reused after a failed forward */
+            margo_destroy(handle);
+            handle = HG_HANDLE_NULL;
+            continue;
+        }
+        if (i >= warmup) durations[count++] = t1 - t0;
+    }
+    if (handle != HG_HANDLE_NULL) margo_destroy(handle);
+
+    struct json_object* result = json_object_new_object();
+    json_object_object_add(result, "type", json_object_new_string("latency"));
+    json_object_object_add(result, "iterations",
+                           json_object_new_int64(iterations));
+    json_object_object_add(result, "timeout_ms",
+                           json_object_new_double(timeout_ms));
+    json_object_object_add(result, "timeouts",
+                           json_object_new_uint64(timeouts));
+    json_object_object_add(result, "errors", json_object_new_uint64(errors));
+    add_duration_stats(result, durations, count);
+    free(durations);
+    return result;
+}
+
+typedef struct throughput_args {
+    margo_instance_id mid;
+    hg_addr_t         addr;
+    hg_id_t           id;
+    double            deadline;
+    uint64_t          count;
+    uint64_t          errors;
+} throughput_args_t;
+
+static void throughput_ult(void* uargs)
+{
+    throughput_args_t* args   = (throughput_args_t*)uargs;
+    hg_handle_t        handle = HG_HANDLE_NULL;
+    if (margo_create(args->mid, args->addr, args->id, &handle) != HG_SUCCESS) {
+        args->errors += 1;
+        return;
+    }
+    while (ABT_get_wtime() < args->deadline) {
+        if (margo_forward(handle, NULL) == HG_SUCCESS)
+            args->count += 1;
+        else
+            args->errors += 1;
+    }
+    margo_destroy(handle);
+}
+
+static struct json_object* run_throughput(margo_instance_id         mid,
+                                          hg_addr_t                 addr,
+                                          const bench_rpcs_t*       rpcs,
+                                          const struct json_object* params)
+{
+    int64_t concurrency = json_object_object_get_int64_or(
+        params, "concurrency", DEFAULT_CONCURRENCY);
+    double duration = json_object_object_get_double_or(
+        params, "duration_sec", DEFAULT_DURATION_SEC);
+    const char* pool_name
+        = json_object_object_get_string_or(params, "pool", NULL);
+    if (concurrency < 1) concurrency = 1;
+
+    struct json_object* result = json_object_new_object();
+    json_object_object_add(result, "type",
+                           json_object_new_string("throughput"));
+    json_object_object_add(result, "concurrency",
+                           json_object_new_int64(concurrency));
+
+    ABT_pool pool = ABT_POOL_NULL;
+    if (pool_name) {
+        struct margo_pool_info pool_info;
+        if (margo_find_pool_by_name(mid, pool_name, &pool_info) == HG_SUCCESS)
+            pool = pool_info.pool;
+    } else {
+        margo_get_handler_pool(mid, &pool);
+    }
+    if (pool == ABT_POOL_NULL) {
+        fprintf(stderr, "Error: could not find pool %s\n",
+                pool_name ? pool_name : "<handler pool>");
+        json_object_object_add(result, "errors", json_object_new_uint64(1));
+        return result;
+    }
+
+    throughput_args_t* args    = calloc(concurrency, sizeof(*args));
+    ABT_thread*        threads = calloc(concurrency, sizeof(*threads));
+    double             start   = ABT_get_wtime();
+    for (int64_t i = 0; i < concurrency; i++) {
+        args[i].mid      = mid;
+        args[i].addr     = addr;
+        args[i].id       = rpcs->noop_id;
+        args[i].deadline = start + duration;
+        ABT_thread_create(pool, throughput_ult, &args[i], ABT_THREAD_ATTR_NULL,
+                          &threads[i]);
+    }
+    uint64_t count = 0, errors = 0;
+    for (int64_t i = 0; i < concurrency; i++) {
+        ABT_thread_join(threads[i]);
+        ABT_thread_free(&threads[i]);
+        count += args[i].count;
+        errors += args[i].errors;
+    }
+    double elapsed = ABT_get_wtime() - start;
+    free(threads);
+    free(args);
+
+    if (pool_name)
+        json_object_object_add(result, "pool",
+                               json_object_new_string(pool_name));
+    json_object_object_add(result, "duration_sec",
+                           json_object_new_double(elapsed));
+    json_object_object_add(result, "rpcs", json_object_new_uint64(count));
+    json_object_object_add(result, "errors", json_object_new_uint64(errors));
+    json_object_object_add(result, "rpcs_per_sec",
+                           json_object_new_double(count / elapsed));
+    return result;
+}
+
+/* Largest size of the bulk benchmarks, which the server allocates */
+static size_t max_bulk_size(const struct json_object* benchmarks)
+{
+    size_t              max = 0;
+    size_t              i, j;
+    struct json_object* bench;
+    struct json_object* size;
+    json_array_foreach(benchmarks, i, bench)
+    {
+        if (strcmp(json_object_object_get_string_or(bench, "type", ""), "bulk")
+            != 0)
+            continue;
+        struct json_object* sizes = json_object_object_get(bench, "sizes");
+        if (!sizes) {
+            for (j = 0; j < 4; j++)
+                if (default_bulk_sizes[j] > max) max = default_bulk_sizes[j];
+            continue;
+        }
+        json_array_foreach(sizes, j, size)
+        {
+            if ((size_t)json_object_get_int64(size) > max)
+                max = (size_t)json_object_get_int64(size);
+        }
+    }
+    return max;
+}
+
+static struct json_object* run_bulk_size(margo_instance_id   mid,
+                                         hg_addr_t           addr,
+                                         const bench_rpcs_t* rpcs,
+                                         hg_bulk_t           bulk,
+                                         bool                push,
+                                         size_t              size,
+                                         int64_t             iterations,
+                                         int64_t             warmup)
+{
+    double*         durations = calloc((size_t)iterations + 1, sizeof(double));
+    size_t          count     = 0;
+    uint64_t        errors    = 0;
+    bench_bulk_in_t in = {.bulk = bulk, .size = size, .push = push};
+    for (int64_t i = 0; i < warmup + iterations; i++) {
+        hg_handle_t handle = HG_HANDLE_NULL;
+        if (margo_create(mid, addr, rpcs->bulk_id, &handle) != HG_SUCCESS) {
+            errors += 1;
+            break;
+        }
+        double      t0   = ABT_get_wtime();
+        hg_return_t hret = margo_forward(handle, &in);
+        double      t1   = ABT_get_wtime();
+        margo_destroy(handle);
+        if (hret != HG_SUCCESS)
+            errors += 1;
+        else if (i >= warmup)
+            durations[count++] = t1 - t0;
+    }
+
+    struct json_object* result = json_object_new_object();
+    json_object_object_add(result, "size", json_object_new_uint64(size));
+    json_object_object_add(result, "iterations",
+                           json_object_new_int64(iterations));
+    json_object_object_add(result, "errors", json_object_new_uint64(errors));
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++) sum += durations[i];
+    if (sum > 0.0)
+        json_object_object_add(
+            result, "bandwidth_mib_per_sec",
+            json_object_new_double((double)size * count / sum / 1048576.0));
+    add_duration_stats(result, durations, count);
+    free(durations);
+    return result;
+}
+
+static struct json_object* run_bulk(margo_instance_id         mid,
+                                    hg_addr_t                 addr,
+                                    const bench_rpcs_t*       rpcs,
+                                    const struct json_object* params)
+{
+    int64_t iterations = json_object_object_get_int64_or(
+        params, "iterations", DEFAULT_BULK_ITERATIONS);
+    int64_t warmup = json_object_object_get_int64_or(params, "warmup",
+                                                     DEFAULT_BULK_WARMUP);
+    const char* operation
+        = json_object_object_get_string_or(params, "operation", "pull");
+    bool push = strcmp(operation, "push") == 0;
+    if (iterations < 0) iterations = 0;
+    if (warmup < 0) warmup = 0;
+
+    size_t              num_sizes = 4;
+    size_t*             sizes     = NULL;
+    struct json_object* sizes_json = json_object_object_get(params, "sizes");
+    if (sizes_json && json_object_is_type(sizes_json, json_type_array)) {
+        num_sizes = json_object_array_length(sizes_json);
+        sizes     = calloc(num_sizes + 1, sizeof(size_t));
+        for (size_t i = 0; i < num_sizes; i++)
+            sizes[i] = (size_t)json_object_get_int64(
+                json_object_array_get_idx(sizes_json, i));
+    } else {
+        sizes = calloc(num_sizes, sizeof(size_t));
+        memcpy(sizes, default_bulk_sizes, sizeof(default_bulk_sizes));
+    }
+    hg_size_t buffer_size = 1;
+    for (size_t i = 0; i < num_sizes; i++)
+        if (sizes[i] > buffer_size) buffer_size = sizes[i];
+
+    struct json_object* result = json_object_new_object();
+    json_object_object_add(result, "type", json_object_new_string("bulk"));
+    json_object_object_add(result, "operation",
+                           json_object_new_string(push ? "push" : "pull"));
+    struct json_object* results = json_object_new_array();
+    json_object_object_add(result, "results", results);
+
+    /* the buffer is registered once, outside of the measurements */
+    void*     buffer = malloc(buffer_size);
+    hg_bulk_t bulk   = HG_BULK_NULL;
+    if (!buffer
+        || margo_bulk_create(mid, 1, &buffer, &buffer_size,
+                             push ? HG_BULK_WRITE_ONLY : HG_BULK_READ_ONLY,
+                             &bulk)
+               != HG_SUCCESS) {
+        fprintf(stderr, "Error: could not create the client's bulk handle\n");
+        json_object_object_add(result, "errors", json_object_new_uint64(1));
+        free(buffer);
+        free(sizes);
+        return result;
+    }
+    memset(buffer, 1, buffer_size);
+    for (size_t i = 0; i < num_sizes; i++)
+        json_object_array_add(results,
+                              run_bulk_size(mid, addr, rpcs, bulk, push,
+                                            sizes[i], iterations, warmup));
+    margo_bulk_free(bulk);
+    free(buffer);
+    free(sizes);
+    return result;
+}
+
+/* Runs the benchmarks against the server at addr_str and returns the
+ * results, or NULL if the client could not be initialized */
+static struct json_object* run_client(const struct options*     opts,
+                                      const char*               config,
+                                      const char*               addr_str,
+                                      const struct json_object* benchmarks)
+{
+    struct margo_init_info info = {.json_config = config};
+    if (opts->monitoring) info.monitor = margo_default_monitor;
+    margo_instance_id mid
+        = margo_init_ext(opts->protocol, MARGO_CLIENT_MODE, &info);
+    if (mid == MARGO_INSTANCE_NULL) {
+        fprintf(stderr, "Error: could not initialize the client\n");
+        return NULL;
+    }
+    bench_rpcs_t rpcs;
+    register_rpcs(mid, &rpcs);
+
+    hg_addr_t addr = HG_ADDR_NULL;
+    if (margo_addr_lookup(mid, addr_str, &addr) != HG_SUCCESS) {
+        fprintf(stderr, "Error: could not look up %s\n", addr_str);
+        margo_finalize(mid);
+        return NULL;
+    }
+
+    struct json_object* output = json_object_new_object();
+    char                version[32];
+    snprintf(version, sizeof(version), "%d.%d.%d", MARGO_VERSION_MAJOR,
+             MARGO_VERSION_MINOR, MARGO_VERSION_PATCH);
+    json_object_object_add(output, "margo_version",
+                           json_object_new_string(version));
+    json_object_object_add(output, "protocol",
+                           json_object_new_string(opts->protocol));
+    json_object_object_add(output, "monitoring",
+                           json_object_new_boolean(opts->monitoring));
+    json_object_object_add(output, "server_address",
+                           json_object_new_string(addr_str));
+
+    /* configurations actually used by both sides */
+    char* client_config = margo_get_config(mid);
+    json_object_object_add(output, "client_config",
+                           json_tokener_parse(client_config));
+    free(client_config);
+    hg_handle_t handle = HG_HANDLE_NULL;
+    margo_create(mid, addr, rpcs.config_id, &handle);
+    if (margo_forward(handle, NULL) == HG_SUCCESS) {
+        bench_config_out_t out;
+        if (margo_get_output(handle, &out) == HG_SUCCESS) {
+            json_object_object_add(output, "server_config",
+                                   json_tokener_parse(out.config));
+            margo_free_output(handle, &out);
+        }
+    }
+    margo_destroy(handle);
+
+    struct json_object* results = json_object_new_array();
+    json_object_object_add(output, "results", results);
+    size_t              i;
+    struct json_object* bench;
+    json_array_foreach(benchmarks, i, bench)
+    {
+        const char* type = json_object_object_get_string_or(bench, "type", "");
+        struct json_object* result = NULL;
+        if (strcmp(type, "latency") == 0)
+            result = run_latency(mid, addr, &rpcs, bench);
+        else if (strcmp(type, "throughput") == 0)
+            result = run_throughput(mid, addr, &rpcs, bench);
+        else if (strcmp(type, "bulk") == 0)
+            result = run_bulk(mid, addr, &rpcs, bench);
+        else
+            fprintf(stderr, "Warning: ignoring benchmark of type \"%s\"\n",
+                    type);
+        if (result) json_object_array_add(results, result);
+    }
+
+    margo_create(mid, addr, rpcs.shutdown_id, &handle);
+    margo_forward(handle, NULL);
+    margo_destroy(handle);
+    margo_addr_free(mid, addr);
+    margo_finalize(mid);
+    return output;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts = {.protocol = "na+sm"};
+    int            opt;
+    while ((opt = getopt(argc, argv, "p:s:c:b:o:mh")) != -1) {
+        switch (opt) {
+        case 'p':
+            opts.protocol = optarg;
+            break;
+        case 's':
+            opts.server_config_file = optarg;
+            break;
+        case 'c':
+            opts.client_config_file = optarg;
+            break;
+        case 'b':
+            opts.bench_config_file = optarg;
+            break;
+        case 'o':
+            opts.output_file = optarg;
+            break;
+        case 'm':
+            opts.monitoring = true;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc) {
+        usage();
+        return -1;
+    }
+
+    char* server_config = NULL;
+    char* client_config = NULL;
+    char* bench_config  = NULL;
+    if ((opts.server_config_file
+         && !(server_config = read_file(opts.server_config_file)))
+        || (opts.client_config_file
+            && !(client_config = read_file(opts.client_config_file)))
+        || (opts.bench_config_file
+            && !(bench_config = read_file(opts.bench_config_file))))
+        return -1;
+    struct json_object* bench_json
+        = json_tokener_parse(bench_config ? bench_config : default_benchmarks);
+    struct json_object* benchmarks
+        = json_object_object_get(bench_json, "benchmarks");
+    if (!benchmarks || !json_object_is_type(benchmarks, json_type_array)) {
+        fprintf(stderr,
+                "Error: the benchmark configuration must be an object with "
+                "a \"benchmarks\" array\n");
+        return -1;
+    }
+
+    /* the server runs in a child process and sends its address through
+     * a pipe, which is closed without data if it failed to start */
+    int fds[2];
+    if (pipe(fds) != 0) {
+        fprintf(stderr, "Error: pipe failed: %s\n", strerror(errno));
+        return -1;
+    }
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Error: fork failed: %s\n", strerror(errno));
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        int ret = run_server(&opts, server_config, fds[1],
+                             max_bulk_size(benchmarks));
+        json_object_put(bench_json);
+        free(server_config);
+        free(client_config);
+        free(bench_config);
+        return ret;
+    }
+    close(fds[1]);
+    char    addr_str[256] = {0};
+    size_t  addr_len      = 0;
+    ssize_t n;
+    while (addr_len < sizeof(addr_str) - 1
+           && (n = read(fds[0], addr_str + addr_len,
+                        sizeof(addr_str) - 1 - addr_len))
+                  > 0)
+        addr_len += (size_t)n;
+    close(fds[0]);
+
+    struct json_object* output = NULL;
+    if (addr_len)
+        output = run_client(&opts, client_config, addr_str, benchmarks);
+    if (!output) kill(pid, SIGTERM);
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    int ret = -1;
+    if (output) {
+        FILE* out = opts.output_file ? fopen(opts.output_file, "w") : stdout;
+        if (out) {
+            fprintf(out, "%s\n",
+                    json_object_to_json_string_ext(
+                        output, JSON_C_TO_STRING_PRETTY
+                                    | JSON_C_TO_STRING_NOSLASHESCAPE));
+            if (out != stdout) fclose(out);
+            ret = 0;
+        } else {
+            fprintf(stderr, "Error: could not open %s: %s\n",
+                    opts.output_file, strerror(errno));
+        }
+        json_object_put(output);
+    }
+    json_object_put(bench_json);
+    free(server_config);
+    free(client_config);
+    free(bench_config);
+    return ret;
+}
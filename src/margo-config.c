@@ -80,6 +80,22 @@ char* margo_get_config_opt(margo_instance_id mid, int options)
     json_object_object_add_ex(
         root, "enable_abt_profiling",
         json_object_new_boolean(mid->abt_profiling_enabled), flags);
+    // rpc limits
+    if (mid->num_rpc_limits)
+        json_object_object_add_ex(
+            root, "rpc_limits",
+            __margo_rpc_limits_to_json(mid->rpc_limits, mid->num_rpc_limits),
+            flags);
+    // asynchronous logger
+    if (mid->async_logger)
+        json_object_object_add_ex(
+            root, "async_logging",
+            __margo_async_logger_to_json(mid->async_logger), flags);
+    // RPC capture
+    if (mid->rpc_capture)
+        json_object_object_add_ex(
+            root, "rpc_capture", __margo_rpc_capture_to_json(mid->rpc_capture),
+            flags);
 
     // progress_pool and rpc_pool
     if (options & MARGO_CONFIG_USE_NAMES) {
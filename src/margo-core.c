@@ -58,8 +58,10 @@ static hg_id_t margo_register_internal(margo_instance_id mid,
                                        ABT_pool          pool);
 
 static hg_return_t check_error_in_output(hg_handle_t out);
-static hg_return_t check_parent_id_in_input(hg_handle_t handle,
-                                            hg_id_t*    parent_id);
+static void        origin_classes_clear(margo_instance_id mid);
+static hg_return_t check_parent_id_in_input(hg_handle_t            handle,
+                                            hg_id_t*               parent_id,
+                                            margo_trace_context_t* trace_ctx);
 
 margo_instance_id margo_init(const char* addr_str,
                              int         mode,
@@ -150,6 +152,9 @@ static void margo_cleanup(margo_instance_id mid)
         margo_dump_abt_profiling(mid, "margo-profile", 1, NULL);
     }
 
+    /* the cached origin addresses must be released before Mercury is */
+    origin_classes_clear(mid);
+
     /* finalize Mercury before anything else because this
      * could trigger some margo_cb for forward operations that
      * have not completed yet (cancelling them) */
@@ -172,6 +177,7 @@ static void margo_cleanup(margo_instance_id mid)
     ABT_cond_free(&mid->finalize_cond);
     ABT_mutex_free(&mid->pending_operations_mtx);
     ABT_key_free(&(mid->current_rpc_id_key));
+    ABT_key_free(&(mid->current_trace_context_key));
 
     /* monitoring (destroyed before Argobots since it contains mutexes) */
     __MARGO_MONITOR(mid, FN_END, finalize, monitoring_args);
@@ -180,11 +186,17 @@ static void margo_cleanup(margo_instance_id mid)
         mid->monitor->finalize(mid->monitor->uargs);
     free(mid->monitor);
 
+    __margo_rpc_capture_destroy(mid->rpc_capture);
+    __margo_rpc_limits_destroy(mid->rpc_limits, mid->num_rpc_limits);
+
     free(mid->plumber_bucket_policy);
     free(mid->plumber_nic_policy);
 
     MARGO_TRACE(mid, "Destroying Argobots environment");
     __margo_abt_destroy(&(mid->abt));
+
+    /* last, so that the messages above are written */
+    __margo_async_logger_destroy(mid->async_logger);
     free(mid);
 
     MARGO_TRACE(0, "Completed margo_cleanup");
@@ -832,6 +844,7 @@ hg_return_t margo_destroy(hg_handle_t handle)
         if (handle_data->user_free_callback) {
             handle_data->user_free_callback(handle_data->user_data);
         }
+        if (handle_data->capture) __margo_rpc_capture_end(handle_data->capture);
         memset(handle_data, 0, sizeof(*handle_data));
     }
 
@@ -864,10 +877,12 @@ static hg_return_t margo_cb(const struct hg_cb_info* info)
         = {.info = info, .request = req, .ret = HG_SUCCESS};
     switch (info->type) {
     case HG_CB_FORWARD:
-        __MARGO_MONITOR(mid, FN_START, forward_cb, monitoring_args);
+        __MARGO_MONITOR_UNLESS_SKIPPED(req->monitoring_skip, mid, FN_START,
+                                       forward_cb, monitoring_args);
         break;
     case HG_CB_RESPOND:
-        __MARGO_MONITOR(mid, FN_START, respond_cb, monitoring_args);
+        __MARGO_MONITOR_UNLESS_SKIPPED(req->monitoring_skip, mid, FN_START,
+                                       respond_cb, monitoring_args);
         break;
     case HG_CB_BULK:
         __MARGO_MONITOR(mid, FN_START, bulk_transfer_cb, monitoring_args);
@@ -878,6 +893,9 @@ static hg_return_t margo_cb(const struct hg_cb_info* info)
 
     if (hret == HG_CANCELED && req->timer) { hret = HG_TIMEOUT; }
 
+    /* an eventual request may be freed by its waiter once set */
+    bool monitoring_skip = req->monitoring_skip;
+
     /* remove timer if there is one and it is still in place */
     if (req->timer) {
         margo_timer_cancel(req->timer);
@@ -895,10 +913,12 @@ static hg_return_t margo_cb(const struct hg_cb_info* info)
     monitoring_args.ret = hret;
     switch (info->type) {
     case HG_CB_FORWARD:
-        __MARGO_MONITOR(mid, FN_END, forward_cb, monitoring_args);
+        __MARGO_MONITOR_UNLESS_SKIPPED(monitoring_skip, mid, FN_END,
+                                       forward_cb, monitoring_args);
         break;
     case HG_CB_RESPOND:
-        __MARGO_MONITOR(mid, FN_END, respond_cb, monitoring_args);
+        __MARGO_MONITOR_UNLESS_SKIPPED(monitoring_skip, mid, FN_END,
+                                       respond_cb, monitoring_args);
         break;
     case HG_CB_BULK:
         __MARGO_MONITOR(mid, FN_END, bulk_transfer_cb, monitoring_args);
@@ -911,6 +931,7 @@ static hg_return_t margo_cb(const struct hg_cb_info* info)
     // handed to the user, hence it has to be freed here.
     if (req->kind == MARGO_REQ_CALLBACK) free(req);
 
+    if (info->type == HG_CB_FORWARD) mid->num_pending_forwards--;
     PROGRESS_NEEDED_DECR(mid);
 
     return HG_SUCCESS;
@@ -925,7 +946,7 @@ static hg_return_t margo_wait_internal(margo_request req)
 
     /* monitoring */
     struct margo_monitor_wait_args monitoring_args
-        = {.request = req, .ret = HG_SUCCESS};
+        = {.request = req, .skipped = req->monitoring_skip, .ret = HG_SUCCESS};
     __MARGO_MONITOR(req->mid, FN_START, wait, monitoring_args);
 
     MARGO_EVENTUAL_WAIT(req->eventual.ev);
@@ -987,6 +1008,8 @@ static hg_return_t margo_provider_iforward_internal(
     in_cb     = handle_data->in_proc_cb;
     out_cb    = handle_data->out_proc_cb;
     client_id = hgi->id;
+
+    req->monitoring_skip = handle_data->monitoring_skip;
     server_id = mux_id(client_id, provider_id);
 
     if (!mid) {
@@ -997,6 +1020,9 @@ static hg_return_t margo_provider_iforward_internal(
         return HG_OTHER_ERROR;
     }
 
+    /* the RPC is a new span of the trace of the calling ULT, if any */
+    __margo_trace_context_new_span(mid, &handle_data->trace_context);
+
     /* monitoring */
     struct margo_monitor_forward_args monitoring_args
         = {.provider_id = provider_id,
@@ -1005,7 +1031,8 @@ static hg_return_t margo_provider_iforward_internal(
            .timeout_ms  = timeout_ms,
            .request     = req,
            .ret         = HG_SUCCESS};
-    __MARGO_MONITOR(mid, FN_START, forward, monitoring_args);
+    __MARGO_MONITOR_UNLESS_SKIPPED(req->monitoring_skip, mid, FN_START,
+                                   forward, monitoring_args);
 
     hg_bool_t is_registered;
     hret = HG_Registered(mid->hg.hg_class, server_id, &is_registered);
@@ -1104,20 +1131,27 @@ static hg_return_t margo_provider_iforward_internal(
     // get parent RPC id
     hg_id_t parent_rpc_id;
     margo_get_current_rpc_id(mid, &parent_rpc_id);
+    parent_rpc_id &= ~MARGO_HEADER_HAS_TRACE_CONTEXT;
 
     // create the margo_forward_proc_args for the serializer
     struct margo_forward_proc_args forward_args
-        = {.handle    = handle,
-           .request   = req,
-           .user_args = (void*)in_struct,
-           .user_cb   = in_cb,
-           .header    = {.parent_rpc_id = parent_rpc_id}};
-
+        = {.handle        = handle,
+           .request       = req,
+           .user_args     = (void*)in_struct,
+           .user_cb       = in_cb,
+           .header        = {.parent_rpc_id = parent_rpc_id},
+           .trace_context = handle_data->trace_context};
+    if (handle_data->trace_context.trace_id[0]
+        || handle_data->trace_context.trace_id[1])
+        forward_args.header.parent_rpc_id |= MARGO_HEADER_HAS_TRACE_CONTEXT;
+
+    mid->num_pending_forwards++;
     hret = HG_Forward(handle, margo_cb, (void*)req, (void*)&forward_args);
 
     if (hret != HG_SUCCESS) {
         margo_error(mid, "in %s: HG_Forward failed: %s", __func__,
                     HG_Error_to_string(hret));
+        mid->num_pending_forwards--;
     }
     /* remove timer if HG_Forward failed */
     if (hret != HG_SUCCESS && req->timer) {
@@ -1137,7 +1171,8 @@ finish:
 
     /* monitoring */
     monitoring_args.ret = hret;
-    __MARGO_MONITOR(mid, FN_END, forward, monitoring_args);
+    __MARGO_MONITOR_UNLESS_SKIPPED(req->monitoring_skip, mid, FN_END,
+                                   forward, monitoring_args);
 
     return hret;
 }
@@ -1278,10 +1313,11 @@ margo_irespond_internal(hg_handle_t   handle,
 
     mid         = handle_data->mid;
 
-    req->type   = MARGO_RESPONSE_REQUEST;
-    req->handle = handle;
-    req->timer  = NULL;
-    req->mid    = mid;
+    req->type            = MARGO_RESPONSE_REQUEST;
+    req->handle          = handle;
+    req->timer           = NULL;
+    req->mid             = mid;
+    req->monitoring_skip = handle_data->monitoring_skip;
 
     /* monitoring */
     struct margo_monitor_respond_args monitoring_args = {.handle = handle,
@@ -1290,7 +1326,8 @@ margo_irespond_internal(hg_handle_t   handle,
                                                          .error      = false,
                                                          .request    = req,
                                                          .ret = HG_SUCCESS};
-    __MARGO_MONITOR(mid, FN_START, respond, monitoring_args);
+    __MARGO_MONITOR_UNLESS_SKIPPED(req->monitoring_skip, mid, FN_START,
+                                   respond, monitoring_args);
 
     out_cb = handle_data->out_proc_cb;
     if (req->kind == MARGO_REQ_EVENTUAL) {
@@ -1325,7 +1362,8 @@ finish:
 
     /* monitoring */
     monitoring_args.ret = hret;
-    __MARGO_MONITOR(mid, FN_END, respond, monitoring_args);
+    __MARGO_MONITOR_UNLESS_SKIPPED(req->monitoring_skip, mid, FN_END,
+                                   respond, monitoring_args);
 
     return hret;
 }
@@ -1355,6 +1393,12 @@ hg_return_t margo_respond(hg_handle_t handle, void* out_struct)
         return (HG_OTHER_ERROR);
     }
 
+    /* handlers that do not run in their own ULT must not block */
+    struct margo_handle_data* handle_data
+        = (struct margo_handle_data*)HG_Get_data(handle);
+    if (handle_data && handle_data->execution_mode != MARGO_RPC_MODE_ULT)
+        return margo_crespond(handle, out_struct, NULL, NULL);
+
     hg_return_t                 hret;
     struct margo_request_struct reqs = {0};
     hret = margo_irespond_internal(handle, out_struct, &reqs);
@@ -1410,7 +1454,8 @@ hg_return_t margo_get_input(hg_handle_t handle, void* in_struct)
     /* monitoring */
     struct margo_monitor_get_input_args monitoring_args
         = {.handle = handle, .data = in_struct, .ret = HG_SUCCESS};
-    __MARGO_MONITOR(mid, FN_START, get_input, monitoring_args);
+    __MARGO_MONITOR_UNLESS_SKIPPED(handle_data->monitoring_skip, mid, FN_START,
+                                   get_input, monitoring_args);
 
     // create the margo_forward_proc_args for the serializer
     struct margo_forward_proc_args forward_args
@@ -1424,7 +1469,8 @@ hg_return_t margo_get_input(hg_handle_t handle, void* in_struct)
 
     /* monitoring */
     monitoring_args.ret = hret;
-    __MARGO_MONITOR(mid, FN_END, get_input, monitoring_args);
+    __MARGO_MONITOR_UNLESS_SKIPPED(handle_data->monitoring_skip, mid, FN_END,
+                                   get_input, monitoring_args);
 
     return hret;
 }
@@ -1443,7 +1489,8 @@ hg_return_t margo_free_input(hg_handle_t handle, void* in_struct)
     /* monitoring */
     struct margo_monitor_free_input_args monitoring_args
         = {.handle = handle, .data = in_struct, .ret = HG_SUCCESS};
-    __MARGO_MONITOR(mid, FN_START, free_input, monitoring_args);
+    __MARGO_MONITOR_UNLESS_SKIPPED(handle_data->monitoring_skip, mid, FN_START,
+                                   free_input, monitoring_args);
 
     // create the margo_forward_proc_args for the serializer
     struct margo_forward_proc_args forward_args
@@ -1457,7 +1504,8 @@ hg_return_t margo_free_input(hg_handle_t handle, void* in_struct)
 
     /* monitoring */
     monitoring_args.ret = hret;
-    __MARGO_MONITOR(mid, FN_END, free_input, monitoring_args);
+    __MARGO_MONITOR_UNLESS_SKIPPED(handle_data->monitoring_skip, mid, FN_END,
+                                   free_input, monitoring_args);
 
     return hret;
 }
@@ -1476,7 +1524,8 @@ hg_return_t margo_get_output(hg_handle_t handle, void* out_struct)
     /* monitoring */
     struct margo_monitor_get_output_args monitoring_args
         = {.handle = handle, .data = out_struct, .ret = HG_SUCCESS};
-    __MARGO_MONITOR(mid, FN_START, get_output, monitoring_args);
+    __MARGO_MONITOR_UNLESS_SKIPPED(handle_data->monitoring_skip, mid, FN_START,
+                                   get_output, monitoring_args);
 
     // create the margo_respond_proc_args for the serializer
     struct margo_respond_proc_args respond_args
@@ -1495,7 +1544,8 @@ finish:
 
     /* monitoring */
     monitoring_args.ret = hret;
-    __MARGO_MONITOR(mid, FN_END, get_output, monitoring_args);
+    __MARGO_MONITOR_UNLESS_SKIPPED(handle_data->monitoring_skip, mid, FN_END,
+                                   get_output, monitoring_args);
 
     return hret;
 }
@@ -1514,7 +1564,8 @@ hg_return_t margo_free_output(hg_handle_t handle, void* out_struct)
     /* monitoring */
     struct margo_monitor_free_output_args monitoring_args
         = {.handle = handle, .ret = HG_SUCCESS};
-    __MARGO_MONITOR(mid, FN_START, free_output, monitoring_args);
+    __MARGO_MONITOR_UNLESS_SKIPPED(handle_data->monitoring_skip, mid, FN_START,
+                                   free_output, monitoring_args);
 
     // create the margo_respond_proc_args for the serializer
     struct margo_respond_proc_args respond_args
@@ -1528,7 +1579,8 @@ hg_return_t margo_free_output(hg_handle_t handle, void* out_struct)
 
     /* monitoring */
     monitoring_args.ret = hret;
-    __MARGO_MONITOR(mid, FN_END, free_output, monitoring_args);
+    __MARGO_MONITOR_UNLESS_SKIPPED(handle_data->monitoring_skip, mid, FN_END,
+                                   free_output, monitoring_args);
 
     return hret;
 }
@@ -1672,10 +1724,11 @@ static hg_return_t margo_bulk_itransfer_internal(
     hg_return_t hret = HG_TIMEOUT;
     int         ret;
 
-    req->type   = MARGO_BULK_REQUEST;
-    req->timer  = NULL;
-    req->handle = HG_HANDLE_NULL;
-    req->mid    = mid;
+    req->type            = MARGO_BULK_REQUEST;
+    req->timer           = NULL;
+    req->handle          = HG_HANDLE_NULL;
+    req->mid             = mid;
+    req->monitoring_skip = false;
 
     /* monitoring */
     struct margo_monitor_bulk_transfer_args monitoring_args
@@ -1990,6 +2043,8 @@ static void margo_rpc_data_free(void* ptr)
     if (data->user_data && data->user_free_callback) {
         data->user_free_callback(data->user_data);
     }
+    if (data->thread_attr != ABT_THREAD_ATTR_NULL)
+        ABT_thread_attr_free(&data->thread_attr);
     free(data->rpc_name);
     free(data);
 }
@@ -2255,6 +2310,17 @@ static hg_id_t margo_register_internal(margo_instance_id mid,
         margo_data->out_proc_cb        = out_proc_cb;
         margo_data->user_data          = NULL;
         margo_data->user_free_callback = NULL;
+        margo_data->execution_mode     = MARGO_RPC_MODE_ULT;
+        margo_data->rpc_workers        = NULL;
+        margo_data->pool_thread_attr   = ABT_THREAD_ATTR_NULL;
+        margo_data->classify_by_origin = false;
+        margo_data->stack_size         = 0;
+        margo_data->thread_attr        = ABT_THREAD_ATTR_NULL;
+        hg_id_t  base_id;
+        uint16_t provider_id;
+        demux_id(id, &base_id, &provider_id);
+        margo_data->limit = __margo_rpc_limits_find(
+            mid->rpc_limits, mid->num_rpc_limits, name, provider_id);
         hret = HG_Register_data(mid->hg.hg_class, id, margo_data,
                                 margo_rpc_data_free);
         if (hret != HG_SUCCESS) {
@@ -2272,6 +2338,11 @@ static hg_id_t margo_register_internal(margo_instance_id mid,
     struct margo_pool_info pool_info;
     if (margo_find_pool_by_handle(mid, pool, &pool_info) == HG_SUCCESS) {
         mid->abt.pools[pool_info.index].refcount++;
+        margo_data->rpc_workers = mid->abt.pools[pool_info.index].rpc_workers;
+        margo_data->pool_thread_attr
+            = mid->abt.pools[pool_info.index].thread_attr;
+        margo_data->classify_by_origin
+            = strcmp(mid->abt.pools[pool_info.index].kind, "fair_wait") == 0;
     }
 
 finish:
@@ -2336,9 +2407,22 @@ void __margo_internal_pre_handler_hooks(
     hg_handle_t                            handle,
     struct margo_monitor_rpc_handler_args* monitoring_args)
 {
-    hg_id_t parent_id = 0;
-    check_parent_id_in_input(handle, &parent_id);
+    hg_id_t                   parent_id = 0;
+    struct margo_handle_data* handle_data
+        = (struct margo_handle_data*)HG_Get_data(handle);
+    margo_trace_context_t trace_ctx = {0};
+    check_parent_id_in_input(handle, &parent_id, &trace_ctx);
     monitoring_args->parent_rpc_id = parent_id;
+    /* the handler's ULT continues the span of the RPC */
+    if (handle_data) handle_data->trace_context = trace_ctx;
+
+    /* RPC capture (independent of the monitor's sampling, which decides
+     * later, in its rpc_handler callback) */
+    if (mid->rpc_capture && handle_data) {
+        const struct hg_info* info = HG_Get_info(handle);
+        handle_data->capture       = __margo_rpc_capture_begin(
+            mid->rpc_capture, handle_data->rpc_name, info->id);
+    }
 
     /* monitoring */
     __MARGO_MONITOR(mid, FN_START, rpc_handler, (*monitoring_args));
@@ -2348,8 +2432,139 @@ void __margo_internal_post_handler_hooks(
     margo_instance_id                      mid,
     struct margo_monitor_rpc_handler_args* monitoring_args)
 {
+    /* if the handler must run inline, its wrapper was stashed in the
+     * handle's data by __margo_internal_dispatch_handler */
+    void (*inline_wrapper)(void*) = NULL;
+    struct margo_handle_data* handle_data
+        = (struct margo_handle_data*)HG_Get_data(monitoring_args->handle);
+    if (monitoring_args->ret == HG_SUCCESS && handle_data) {
+        inline_wrapper              = handle_data->inline_wrapper;
+        handle_data->inline_wrapper = NULL;
+    }
+
     /* monitoring */
-    __MARGO_MONITOR(mid, FN_END, rpc_handler, (*monitoring_args));
+    __MARGO_MONITOR_UNLESS_SKIPPED(handle_data && handle_data->monitoring_skip,
+                                   mid, FN_END, rpc_handler,
+                                   (*monitoring_args));
+
+    if (!inline_wrapper) return;
+
+    /* the wrapper overwrites the current RPC id of the calling ULT
+     * (the progress loop), so we restore it afterwards */
+    void* current_rpc_id = NULL;
+    ABT_key_get(mid->current_rpc_id_key, &current_rpc_id);
+    inline_wrapper(monitoring_args->handle);
+    ABT_key_set(mid->current_rpc_id_key, current_rpc_id);
+}
+
+/* Returns the fair_wait class of an RPC origin, i.e. the hash of its
+ * address string. The classes are cached by hg_addr_t in a direct-mapped
+ * cache, so that the address is only converted into a string the first
+ * time it is seen (or after its entry was replaced). As in the default
+ * monitor's address cache, each entry holds a duplicate of its address,
+ * so up to MARGO_ORIGIN_CLASS_CACHE_SIZE addresses of past origins stay
+ * allocated until their entry is replaced or the instance is finalized,
+ * and margo_addr_cmp checks that a hg_addr_t that was reused anyway still
+ * designates the same peer. */
+static uint64_t origin_class(margo_instance_id mid, hg_addr_t addr)
+{
+    struct margo_origin_class* entry
+        = &mid->origin_classes[((uintptr_t)addr >> 4)
+                               % MARGO_ORIGIN_CLASS_CACHE_SIZE];
+    ABT_mutex mtx = ABT_MUTEX_MEMORY_GET_HANDLE(&mid->origin_classes_mtx);
+    ABT_mutex_spinlock(mtx);
+    if (entry->addr == addr
+        && (entry->ref == addr || margo_addr_cmp(mid, entry->ref, addr))) {
+        uint64_t class_id = entry->class_id;
+        ABT_mutex_unlock(mtx);
+        return class_id;
+    }
+    ABT_mutex_unlock(mtx);
+
+    char      addr_str[256];
+    hg_size_t addr_str_size = sizeof(addr_str);
+    if (margo_addr_to_string(mid, addr_str, &addr_str_size, addr)
+        != HG_SUCCESS)
+        return 0;
+    uint64_t  class_id = margo_fair_pool_hash(addr_str);
+    hg_addr_t ref      = HG_ADDR_NULL;
+    if (margo_addr_dup(mid, addr, &ref) != HG_SUCCESS) return class_id;
+
+    ABT_mutex_spinlock(mtx);
+    hg_addr_t old_ref = entry->ref;
+    entry->addr       = addr;
+    entry->ref        = ref;
+    entry->class_id   = class_id;
+    ABT_mutex_unlock(mtx);
+    if (old_ref != HG_ADDR_NULL) margo_addr_free(mid, old_ref);
+    return class_id;
+}
+
+static void origin_classes_clear(margo_instance_id mid)
+{
+    for (unsigned i = 0; i < MARGO_ORIGIN_CLASS_CACHE_SIZE; i++) {
+        struct margo_origin_class* entry = &mid->origin_classes[i];
+        if (entry->ref != HG_ADDR_NULL) margo_addr_free(mid, entry->ref);
+        entry->addr = HG_ADDR_NULL;
+        entry->ref  = HG_ADDR_NULL;
+    }
+}
+
+/* Creates the handler ULT in a fair_wait pool, classifying it using
+ * the address of the RPC's origin */
+static int dispatch_handler_by_origin(margo_instance_id mid,
+                                      hg_handle_t       handle,
+                                      ABT_pool          pool,
+                                      void (*wrapper)(void*),
+                                      ABT_thread_attr attr)
+{
+    const struct hg_info* info     = margo_get_info(handle);
+    uint64_t              class_id = info ? origin_class(mid, info->addr) : 0;
+    margo_fair_pool_set_next_class(class_id);
+    int ret = ABT_thread_create(pool, wrapper, handle, attr, NULL);
+    margo_fair_pool_set_next_class(0);
+    return ret;
+}
+
+int __margo_internal_dispatch_handler(margo_instance_id mid,
+                                      hg_handle_t       handle,
+                                      ABT_pool          pool,
+                                      void (*wrapper)(void*))
+{
+    struct margo_handle_data* handle_data
+        = (struct margo_handle_data*)HG_Get_data(handle);
+    int mode = handle_data ? handle_data->execution_mode : MARGO_RPC_MODE_ULT;
+    switch (mode) {
+    case MARGO_RPC_MODE_INLINE:
+        /* run by __margo_internal_post_handler_hooks */
+        handle_data->inline_wrapper = wrapper;
+        return ABT_SUCCESS;
+    case MARGO_RPC_MODE_TASKLET:
+        return ABT_task_create(pool, wrapper, handle, NULL);
+    default:
+        if (handle_data && handle_data->rpc_workers) {
+            handle_data->run_by_worker = true;
+            if (__margo_rpc_workers_dispatch(handle_data->rpc_workers, wrapper,
+                                             handle))
+                return ABT_SUCCESS;
+            handle_data->run_by_worker = false;
+        }
+        if (handle_data && handle_data->classify_by_origin)
+            return dispatch_handler_by_origin(mid, handle, pool, wrapper,
+                                              handle_data->thread_attr);
+        return ABT_thread_create(
+            pool, wrapper, handle,
+            handle_data ? handle_data->thread_attr : ABT_THREAD_ATTR_NULL, NULL);
+    }
+}
+
+hg_id_t __margo_internal_register_inline(margo_instance_id mid, hg_id_t id)
+{
+    if (id == 0) return 0;
+    if (margo_rpc_set_execution_mode(mid, id, MARGO_RPC_MODE_INLINE)
+        != HG_SUCCESS)
+        return 0;
+    return id;
 }
 
 void __margo_internal_pre_wrapper_hooks(
@@ -2362,21 +2577,93 @@ void __margo_internal_pre_wrapper_hooks(
     margo_set_current_rpc_id(mid, info->id);
 
     /* monitoring */
-    __MARGO_MONITOR(mid, FN_START, rpc_ult, (*monitoring_args));
+    struct margo_handle_data* handle_data
+        = (struct margo_handle_data*)HG_Get_data(handle);
+    margo_set_current_trace_context(
+        mid, handle_data ? &handle_data->trace_context : NULL);
+    __MARGO_MONITOR_UNLESS_SKIPPED(handle_data && handle_data->monitoring_skip,
+                                   mid, FN_START, rpc_ult, (*monitoring_args));
 
     margo_ref_incr(handle);
 }
 
+static void margo_finalize_ult(void* args)
+{
+    margo_finalize((margo_instance_id)args);
+}
+
 void __margo_internal_post_wrapper_hooks(
     margo_instance_id mid, struct margo_monitor_rpc_ult_args* monitoring_args)
 {
+    struct margo_handle_data* handle_data
+        = (struct margo_handle_data*)HG_Get_data(monitoring_args->handle);
+    int mode = handle_data ? handle_data->execution_mode : MARGO_RPC_MODE_ULT;
+    bool run_by_worker = handle_data && handle_data->run_by_worker;
+
     /* monitoring */
-    __MARGO_MONITOR(mid, FN_END, rpc_ult, (*monitoring_args));
+    __MARGO_MONITOR_UNLESS_SKIPPED(handle_data && handle_data->monitoring_skip,
+                                   mid, FN_END, rpc_ult, (*monitoring_args));
+
+    /* inline handlers and RPC workers run in ULTs that outlive the RPC */
+    margo_set_current_trace_context(mid, NULL);
 
     margo_destroy(monitoring_args->handle);
 
     __margo_internal_decr_pending(mid);
-    if (__margo_internal_finalize_requested(mid)) { margo_finalize(mid); }
+    if (!__margo_internal_finalize_requested(mid)) return;
+    if (mode == MARGO_RPC_MODE_ULT && !run_by_worker) {
+        margo_finalize(mid);
+    } else {
+        /* margo_finalize blocks (and joins the progress loop), so it
+         * cannot be called from the progress loop or from a tasklet,
+         * and it stops the persistent workers, so it cannot be called
+         * from one of them either */
+        ABT_pool pool = ABT_POOL_NULL;
+        margo_get_handler_pool(mid, &pool);
+        int ret = ABT_thread_create(pool, margo_finalize_ult, mid,
+                                    ABT_THREAD_ATTR_NULL, NULL);
+        // LCOV_EXCL_START
+        if (ret != ABT_SUCCESS) {
+            margo_error(mid,
+                        "in %s: could not create ULT to finalize the margo "
+                        "instance (ABT_thread_create returned %d)",
+                        __func__, ret);
+        }
+        // LCOV_EXCL_STOP
+    }
+}
+
+int __margo_internal_rpc_admit(margo_instance_id mid, hg_handle_t handle)
+{
+    const struct hg_info* info = HG_Get_info(handle);
+    if (!info) return 1;
+    struct margo_rpc_data* rpc_data
+        = (struct margo_rpc_data*)HG_Registered_data(info->hg_class, info->id);
+    if (!rpc_data || !rpc_data->limit) return 1;
+    struct margo_handle_data* handle_data
+        = (struct margo_handle_data*)HG_Get_data(handle);
+    bool can_block
+        = !handle_data || handle_data->execution_mode == MARGO_RPC_MODE_ULT;
+    if (__margo_rpc_limit_acquire(mid, rpc_data->limit, can_block)) return 1;
+    margo_warning(mid,
+                  "Rejecting RPC %s because too many instances of it "
+                  "are waiting for admission",
+                  rpc_data->rpc_name ? rpc_data->rpc_name : "???");
+    __margo_respond_with_error(handle, HG_BUSY);
+    /* drop the reference the user handler would have released */
+    margo_destroy(handle);
+    return 0;
+}
+
+void __margo_internal_rpc_release(margo_instance_id mid, hg_handle_t handle)
+{
+    (void)mid;
+    const struct hg_info* info = HG_Get_info(handle);
+    if (!info) return;
+    struct margo_rpc_data* rpc_data
+        = (struct margo_rpc_data*)HG_Registered_data(info->hg_class, info->id);
+    if (!rpc_data || !rpc_data->limit) return;
+    __margo_rpc_limit_release(rpc_data->limit);
 }
 
 static void margo_handle_data_free(void* args)
@@ -2389,6 +2676,7 @@ static void margo_handle_data_free(void* args)
     if (!handle_data) return;
     if (handle_data->user_free_callback)
         handle_data->user_free_callback(handle_data->user_data);
+    if (handle_data->capture) __margo_rpc_capture_end(handle_data->capture);
     free(handle_data);
 }
 
@@ -2409,6 +2697,20 @@ hg_return_t __margo_internal_set_handle_data(hg_handle_t handle)
     handle_data->rpc_name    = rpc_data->rpc_name;
     handle_data->in_proc_cb  = rpc_data->in_proc_cb;
     handle_data->out_proc_cb = rpc_data->out_proc_cb;
+    handle_data->execution_mode = rpc_data->execution_mode;
+    handle_data->run_by_worker  = false;
+    handle_data->classify_by_origin = rpc_data->classify_by_origin;
+    if (rpc_data->stack_size || rpc_data->classify_by_origin) {
+        /* the workers' stacks may not have the requested size,
+         * and a fair_wait pool needs one ULT per request to classify */
+        handle_data->rpc_workers = NULL;
+        handle_data->thread_attr = rpc_data->stack_size
+                                     ? rpc_data->thread_attr
+                                     : rpc_data->pool_thread_attr;
+    } else {
+        handle_data->rpc_workers = rpc_data->rpc_workers;
+        handle_data->thread_attr = rpc_data->pool_thread_attr;
+    }
     if (!handle_data_attached)
         return HG_Set_data(handle, handle_data, margo_handle_data_free);
     else
@@ -2452,11 +2754,87 @@ hg_return_t margo_rpc_set_pool(margo_instance_id mid, hg_id_t id, ABT_pool pool)
         mid->abt.pools[new_pool_entry_idx].refcount++;
     else
         margo_warning(mid, "Associating RPC with a pool not know to Margo");
+    data->rpc_workers = new_pool_entry_idx >= 0
+                          ? mid->abt.pools[new_pool_entry_idx].rpc_workers
+                          : NULL;
+    data->pool_thread_attr = new_pool_entry_idx >= 0
+                               ? mid->abt.pools[new_pool_entry_idx].thread_attr
+                               : ABT_THREAD_ATTR_NULL;
+    data->classify_by_origin
+        = new_pool_entry_idx >= 0
+       && strcmp(mid->abt.pools[new_pool_entry_idx].kind, "fair_wait") == 0;
     __margo_abt_unlock(&mid->abt);
     data->pool = pool;
     return HG_SUCCESS;
 }
 
+hg_return_t
+margo_rpc_set_execution_mode(margo_instance_id mid, hg_id_t id, int mode)
+{
+    if (mid == MARGO_INSTANCE_NULL) return HG_INVALID_ARG;
+    if (mode != MARGO_RPC_MODE_ULT && mode != MARGO_RPC_MODE_INLINE
+        && mode != MARGO_RPC_MODE_TASKLET)
+        return HG_INVALID_ARG;
+    struct margo_rpc_data* data
+        = (struct margo_rpc_data*)HG_Registered_data(margo_get_class(mid), id);
+    if (!data) return HG_NOENTRY;
+    data->execution_mode = mode;
+    return HG_SUCCESS;
+}
+
+hg_return_t
+margo_rpc_get_execution_mode(margo_instance_id mid, hg_id_t id, int* mode)
+{
+    if (mid == MARGO_INSTANCE_NULL) return HG_INVALID_ARG;
+    struct margo_rpc_data* data
+        = (struct margo_rpc_data*)HG_Registered_data(margo_get_class(mid), id);
+    if (!data) return HG_NOENTRY;
+    if (mode) *mode = data->execution_mode;
+    return HG_SUCCESS;
+}
+
+hg_return_t
+margo_rpc_set_stack_size(margo_instance_id mid, hg_id_t id, size_t stack_size)
+{
+    if (mid == MARGO_INSTANCE_NULL) return HG_INVALID_ARG;
+    struct margo_rpc_data* data
+        = (struct margo_rpc_data*)HG_Registered_data(margo_get_class(mid), id);
+    if (!data) return HG_NOENTRY;
+    __margo_abt_lock(&mid->abt);
+    /* the lock only protects against concurrent calls: the attribute
+     * and stack_size are read without it by __margo_internal_set_handle_data,
+     * hence this function must be called before the RPC is received */
+    int ret = ABT_SUCCESS;
+    if (stack_size && data->thread_attr == ABT_THREAD_ATTR_NULL)
+        ret = ABT_thread_attr_create(&data->thread_attr);
+    if (stack_size && ret == ABT_SUCCESS)
+        ret = ABT_thread_attr_set_stacksize(data->thread_attr, stack_size);
+    if (ret == ABT_SUCCESS) data->stack_size = stack_size;
+    __margo_abt_unlock(&mid->abt);
+    if (ret != ABT_SUCCESS) {
+        // LCOV_EXCL_START
+        margo_error(mid, "in %s: could not set stack size (ret = %d)",
+                    __func__, ret);
+        return HG_OTHER_ERROR;
+        // LCOV_EXCL_END
+    }
+    return HG_SUCCESS;
+}
+
+hg_return_t
+margo_rpc_get_stack_size(margo_instance_id mid, hg_id_t id, size_t* stack_size)
+{
+    if (mid == MARGO_INSTANCE_NULL) return HG_INVALID_ARG;
+    struct margo_rpc_data* data
+        = (struct margo_rpc_data*)HG_Registered_data(margo_get_class(mid), id);
+    if (!data) return HG_NOENTRY;
+    if (!stack_size) return HG_SUCCESS;
+    *stack_size = data->stack_size;
+    if (*stack_size == 0 && data->pool_thread_attr != ABT_THREAD_ATTR_NULL)
+        ABT_thread_attr_get_stacksize(data->pool_thread_attr, stack_size);
+    return HG_SUCCESS;
+}
+
 const char* margo_handle_get_name(hg_handle_t handle)
 {
     struct margo_handle_data* handle_data = HG_Get_data(handle);
@@ -2488,7 +2866,9 @@ hg_return_t check_error_in_output(hg_handle_t handle)
     return hret;
 }
 
-hg_return_t check_parent_id_in_input(hg_handle_t handle, hg_id_t* parent_id)
+hg_return_t check_parent_id_in_input(hg_handle_t            handle,
+                                     hg_id_t*               parent_id,
+                                     margo_trace_context_t* trace_ctx)
 {
     struct margo_forward_proc_args forward_args
         = {.user_args = NULL, .user_cb = NULL};
@@ -2498,7 +2878,10 @@ hg_return_t check_parent_id_in_input(hg_handle_t handle, hg_id_t* parent_id)
     // will return HG_CHECKSUM_ERROR because we are not reading the
     // whole input.
     if (hret != HG_SUCCESS && hret != HG_CHECKSUM_ERROR) return hret;
-    *parent_id = forward_args.header.parent_rpc_id;
+    *parent_id = forward_args.header.parent_rpc_id
+               & ~MARGO_HEADER_HAS_TRACE_CONTEXT;
+    if (forward_args.header.parent_rpc_id & MARGO_HEADER_HAS_TRACE_CONTEXT)
+        *trace_ctx = forward_args.trace_context;
     if (hret == HG_CHECKSUM_ERROR) return HG_SUCCESS;
     HG_Free_input(handle, (void*)&forward_args);
     return HG_SUCCESS;
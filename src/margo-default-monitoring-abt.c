@@ -0,0 +1,297 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <abt.h>
+#include "margo-instance.h"
+#include "margo-globals.h"
+#include "margo-default-monitoring-abt.h"
+
+/* Argobots profiler time series of an xstream or of a pool */
+enum
+{
+    ABT_BUSY_SERIES,
+    ABT_IDLE_SERIES,
+    ABT_SWITCHES_SERIES,
+    ABT_FINISHED_SERIES,
+    NUM_ABT_SERIES
+};
+
+typedef struct abt_time_series {
+    char*          name; /* hash key (name of the xstream or pool) */
+    time_series_t  series[NUM_ABT_SERIES];
+    UT_hash_handle hh;
+} abt_time_series_t;
+
+/* Maximum xstream rank for which profiler counters are sampled
+ * (exclusive); xstreams of higher ranks have no time series */
+#define ABT_TIME_SERIES_MAX_XSTREAMS 256
+
+/* ========================================================================
+ * Argobots profiler time series function definitions
+ * ======================================================================== */
+
+static abt_time_series_t* find_or_add_abt_time_series(abt_time_series_t** hash,
+                                                      const char*         name)
+{
+    abt_time_series_t* ts = NULL;
+    HASH_FIND_STR(*hash, name, ts);
+    if (!ts) {
+        ts       = (abt_time_series_t*)calloc(1, sizeof(*ts));
+        ts->name = strdup(name);
+        for (size_t i = 0; i < NUM_ABT_SERIES; i++)
+            ts->series[i].kind = TIME_SERIES_SUM;
+        HASH_ADD_KEYPTR(hh, *hash, ts->name, strlen(ts->name), ts);
+    }
+    return ts;
+}
+
+/* Activity of an xstream or of a pool between two samples */
+typedef struct abt_activity {
+    double   busy;    /* seconds */
+    double   elapsed; /* seconds, times the number of xstreams for a pool */
+    uint64_t switches;
+    uint64_t finished;
+} abt_activity_t;
+
+static void abt_time_series_append(const default_monitor_state_t* monitor,
+                                   abt_time_series_t*             ts,
+                                   double                         timestamp,
+                                   const abt_activity_t*          activity)
+{
+    double idle = activity->elapsed - activity->busy;
+    __margo_monitor_time_series_append(monitor, &ts->series[ABT_BUSY_SERIES],
+                                       timestamp,
+                                       (uint64_t)(activity->busy * 1e6));
+    __margo_monitor_time_series_append(monitor, &ts->series[ABT_IDLE_SERIES],
+                                       timestamp,
+                                       idle > 0.0 ? (uint64_t)(idle * 1e6) : 0);
+    __margo_monitor_time_series_append(monitor,
+                                       &ts->series[ABT_SWITCHES_SERIES],
+                                       timestamp, activity->switches);
+    __margo_monitor_time_series_append(monitor,
+                                       &ts->series[ABT_FINISHED_SERIES],
+                                       timestamp, activity->finished);
+}
+
+/* Activity of an xstream since its last sample, which is replaced */
+static void abt_activity_since(margo_abt_prof_sample_t*       last,
+                               const margo_abt_prof_sample_t* sample,
+                               double                         elapsed,
+                               abt_activity_t*                activity)
+{
+    /* the counters start over when the profiler is restarted (e.g. by
+     * margo_dump_abt_profiling) */
+    if (last->start_time != sample->start_time
+        || last->num_runs > sample->num_runs
+        || last->num_finishes > sample->num_finishes
+        || last->busy_time > sample->busy_time)
+        memset(last, 0, sizeof(*last));
+    activity->busy     = sample->busy_time - last->busy_time;
+    activity->elapsed  = elapsed;
+    activity->switches = sample->num_runs - last->num_runs;
+    activity->finished = sample->num_finishes - last->num_finishes;
+    if (activity->busy > elapsed) activity->busy = elapsed;
+    *last = *sample;
+}
+
+void __margo_monitor_abt_time_series_update(default_monitor_state_t* monitor,
+                                            double                   timestamp)
+{
+    if (!monitor->enable_abt_time_series) return;
+    margo_instance_id mid     = monitor->mid;
+    double            elapsed = timestamp - monitor->abt_time_series_last_ts;
+    if (elapsed <= 0.0) return;
+    monitor->abt_time_series_last_ts = timestamp;
+
+    size_t num_samples = __margo_abt_prof_sample(monitor->abt_prof_samples,
+                                                 ABT_TIME_SERIES_MAX_XSTREAMS);
+    size_t num_pools   = margo_get_num_pools(mid);
+    abt_activity_t* pool_activities
+        = num_pools ? (abt_activity_t*)calloc(num_pools, sizeof(abt_activity_t))
+                    : NULL;
+    if (!pool_activities) num_pools = 0;
+
+    ABT_mutex_spinlock(
+        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->abt_time_series_mtx));
+    size_t num_xstreams = margo_get_num_xstreams(mid);
+    for (size_t i = 0; i < num_xstreams; i++) {
+        struct margo_xstream_info xstream_info;
+        if (margo_find_xstream_by_index(mid, i, &xstream_info) != HG_SUCCESS)
+            continue;
+        int rank;
+        if (ABT_xstream_get_rank(xstream_info.xstream, &rank) != ABT_SUCCESS)
+            continue;
+        // abt_prof_last_samples is indexed by rank, higher ranks are
+        // not tracked
+        if (rank < 0 || rank >= ABT_TIME_SERIES_MAX_XSTREAMS) continue;
+        const margo_abt_prof_sample_t* sample = NULL;
+        for (size_t j = 0; j < num_samples && !sample; j++)
+            if (monitor->abt_prof_samples[j].rank == rank)
+                sample = &monitor->abt_prof_samples[j];
+        if (!sample) continue;
+
+        abt_activity_t activity;
+        abt_activity_since(&monitor->abt_prof_last_samples[rank], sample,
+                           elapsed, &activity);
+        abt_time_series_append(
+            monitor,
+            find_or_add_abt_time_series(&monitor->abt_xstream_time_series,
+                                        xstream_info.name),
+            timestamp, &activity);
+
+        /* attribute the activity to the pools of the main scheduler */
+        ABT_sched sched;
+        int       sched_num_pools;
+        if (ABT_xstream_get_main_sched(xstream_info.xstream, &sched)
+                != ABT_SUCCESS
+            || ABT_sched_get_num_pools(sched, &sched_num_pools) != ABT_SUCCESS)
+            continue;
+        for (int j = 0; j < sched_num_pools; j++) {
+            ABT_pool               pool;
+            struct margo_pool_info pool_info;
+            if (ABT_sched_get_pools(sched, 1, j, &pool) != ABT_SUCCESS
+                || margo_find_pool_by_handle(mid, pool, &pool_info)
+                       != HG_SUCCESS
+                || pool_info.index >= num_pools)
+                continue;
+            abt_activity_t* pool_activity = &pool_activities[pool_info.index];
+            pool_activity->busy += activity.busy;
+            pool_activity->elapsed += activity.elapsed;
+            pool_activity->switches += activity.switches;
+            pool_activity->finished += activity.finished;
+        }
+    }
+    for (size_t i = 0; i < num_pools; i++) {
+        struct margo_pool_info pool_info;
+        if (margo_find_pool_by_index(mid, i, &pool_info) != HG_SUCCESS)
+            continue;
+        abt_time_series_append(
+            monitor,
+            find_or_add_abt_time_series(&monitor->abt_pool_time_series,
+                                        pool_info.name),
+            timestamp, &pool_activities[i]);
+    }
+    ABT_mutex_unlock(
+        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->abt_time_series_mtx));
+    free(pool_activities);
+}
+
+/* Writes the time series of a hash of abt_time_series_t as an object.
+ * The series are copied (and reset if requested) with the mutex held,
+ * then written. */
+static void abt_time_series_hash_write(margo_json_writer_t*           w,
+                                       const default_monitor_state_t* monitor,
+                                       abt_time_series_t* const*      hash,
+                                       bool                           reset)
+{
+    ABT_mutex_spinlock(
+        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->abt_time_series_mtx));
+    size_t         count  = HASH_COUNT(*hash);
+    char**         names  = count ? (char**)calloc(count, sizeof(char*)) : NULL;
+    time_series_t* copies = count ? (time_series_t*)calloc(
+                                count * NUM_ABT_SERIES, sizeof(*copies))
+                                  : NULL;
+    if (!names || !copies) count = 0;
+    size_t             i = 0;
+    abt_time_series_t *ts, *tmp;
+    HASH_ITER(hh, *hash, ts, tmp)
+    {
+        if (i == count) break;
+        names[i] = strdup(ts->name);
+        for (size_t j = 0; j < NUM_ABT_SERIES; j++) {
+            __margo_monitor_time_series_copy(monitor,
+                                             &copies[i * NUM_ABT_SERIES + j],
+                                             &ts->series[j]);
+            if (reset) __margo_monitor_time_series_reset(&ts->series[j]);
+        }
+        i++;
+    }
+    ABT_mutex_unlock(
+        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->abt_time_series_mtx));
+
+    static const char* const series_names[NUM_ABT_SERIES]
+        = {"busy_usec", "idle_usec", "switches", "finished"};
+    __margo_json_writer_begin_object(w);
+    for (i = 0; i < count; i++) {
+        __margo_json_writer_key(w, names[i]);
+        __margo_json_writer_begin_object(w);
+        const time_series_t* series[NUM_ABT_SERIES];
+        for (size_t j = 0; j < NUM_ABT_SERIES; j++)
+            series[j] = &copies[i * NUM_ABT_SERIES + j];
+        __margo_monitor_time_series_write(w, monitor, series, series_names,
+                                          NUM_ABT_SERIES);
+        __margo_json_writer_end_object(w);
+        for (size_t j = 0; j < NUM_ABT_SERIES; j++)
+            __margo_monitor_time_series_free(&copies[i * NUM_ABT_SERIES + j]);
+        free(names[i]);
+    }
+    __margo_json_writer_end_object(w);
+    free(copies);
+    free(names);
+}
+
+void
+__margo_monitor_abt_time_series_write(margo_json_writer_t*           w,
+                                      const default_monitor_state_t* monitor,
+                                      bool                           reset)
+{
+    __margo_json_writer_begin_object(w);
+    __margo_json_writer_key(w, "xstreams");
+    abt_time_series_hash_write(w, monitor, &monitor->abt_xstream_time_series,
+                               reset);
+    __margo_json_writer_key(w, "pools");
+    abt_time_series_hash_write(w, monitor, &monitor->abt_pool_time_series,
+                               reset);
+    __margo_json_writer_end_object(w);
+}
+
+void __margo_monitor_abt_time_series_init(default_monitor_state_t* monitor)
+{
+    margo_instance_id mid = monitor->mid;
+    if (!monitor->enable_time_series) monitor->enable_abt_time_series = false;
+    if (monitor->enable_abt_time_series && !g_margo_abt_prof_init) {
+        margo_warning(mid,
+                      "Argobots profiling time series require Argobots to "
+                      "be built with its tool interface, disabling them");
+        monitor->enable_abt_time_series = false;
+    }
+    if (!monitor->enable_abt_time_series) return;
+    monitor->abt_prof_last_samples = (margo_abt_prof_sample_t*)calloc(
+        ABT_TIME_SERIES_MAX_XSTREAMS, sizeof(margo_abt_prof_sample_t));
+    monitor->abt_prof_samples = (margo_abt_prof_sample_t*)calloc(
+        ABT_TIME_SERIES_MAX_XSTREAMS, sizeof(margo_abt_prof_sample_t));
+    monitor->abt_time_series_last_ts = ABT_get_wtime();
+    /* leave the profiler running at finalize if someone else started it */
+    monitor->abt_prof_started_by_monitor = !g_margo_abt_prof_started;
+    margo_start_abt_profiling(mid, false);
+}
+
+void __margo_monitor_abt_time_series_free(default_monitor_state_t* monitor)
+{
+    if (!monitor->enable_abt_time_series) return;
+    ABT_mutex_spinlock(
+        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->abt_time_series_mtx));
+    abt_time_series_t* hashes[]
+        = {monitor->abt_xstream_time_series, monitor->abt_pool_time_series};
+    for (size_t h = 0; h < 2; h++) {
+        abt_time_series_t *a, *atmp;
+        HASH_ITER(hh, hashes[h], a, atmp)
+        {
+            HASH_DEL(hashes[h], a);
+            for (size_t i = 0; i < NUM_ABT_SERIES; i++)
+                __margo_monitor_time_series_free(&a->series[i]);
+            free(a->name);
+            free(a);
+        }
+    }
+    monitor->abt_xstream_time_series = NULL;
+    monitor->abt_pool_time_series    = NULL;
+    free(monitor->abt_prof_last_samples);
+    free(monitor->abt_prof_samples);
+    ABT_mutex_unlock(
+        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->abt_time_series_mtx));
+}
@@ -0,0 +1,48 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_DEFAULT_MONITORING_ABT_H
+#define __MARGO_DEFAULT_MONITORING_ABT_H
+#include "margo-default-monitoring.h"
+
+/*
+ * Argobots profiler time series in Margo's default monitoring system
+ * ==================================================================
+ *
+ * If the "time_series" configuration has "abt_profiling" set to true,
+ * the monitor starts the Argobots profiler in basic mode (if it was not
+ * already started) and reads its counters, without stopping it, every
+ * time the time series are updated. The following time series are then
+ * added, for each xstream and for each pool (the activity of an xstream
+ * being attributed to every pool of its main scheduler):
+ *   - Time spent running ULTs since the last check (busy_usec);
+ *   - Time spent in the scheduler since the last check (idle_usec);
+ *   - Number of ULTs scheduled since the last check (switches);
+ *   - Number of ULTs completed since the last check (finished).
+ * These are sums, so the utilization over any tier is
+ * busy_usec / (busy_usec + idle_usec), and the average run time of a
+ * ULT is busy_usec / switches. This requires Argobots to be built with
+ * its tool interface, otherwise the option is disabled with a warning.
+ */
+
+/* Starts the Argobots profiler if monitor->enable_abt_time_series, or
+ * clears it if Argobots does not have its tool interface */
+void __margo_monitor_abt_time_series_init(default_monitor_state_t* monitor);
+
+/* Samples the profiler and appends the activity of the xstreams and of
+ * the pools since the last update to their time series */
+void __margo_monitor_abt_time_series_update(default_monitor_state_t* monitor,
+                                            double                   timestamp);
+
+/* Writes the time series as an object with "xstreams" and "pools"
+ * fields, each an object keyed by name */
+void
+__margo_monitor_abt_time_series_write(margo_json_writer_t*           w,
+                                      const default_monitor_state_t* monitor,
+                                      bool                           reset);
+
+void __margo_monitor_abt_time_series_free(default_monitor_state_t* monitor);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <abt.h>
+#include "margo-instance.h"
+#include "margo-handle-cache.h"
+#include "margo-metrics.h"
+#include "margo-default-monitoring-metrics.h"
+
+/* ========================================================================
+ * Metrics segment function definitions
+ * ======================================================================== */
+
+/* Maps the metrics segment in a file named after the configured prefix.
+ * Errors are reported and leave the segment disabled. */
+void __margo_monitor_metrics_segment_open(default_monitor_state_t* monitor)
+{
+    if (!monitor->metrics_filename_prefix
+        || !monitor->metrics_filename_prefix[0])
+        return;
+
+    char hostname[1024];
+    hostname[1023] = '\0';
+    gethostname(hostname, 1023);
+    size_t filename_size
+        = snprintf(NULL, 0, "%s.%s.%d.metrics",
+                   monitor->metrics_filename_prefix, hostname, (int)getpid());
+    monitor->metrics_filename = calloc(1, filename_size + 1);
+    sprintf(monitor->metrics_filename, "%s.%s.%d.metrics",
+            monitor->metrics_filename_prefix, hostname, (int)getpid());
+
+    size_t size = sizeof(margo_metrics_segment_t);
+    int    fd   = open(monitor->metrics_filename, O_RDWR | O_CREAT | O_TRUNC,
+                       0644);
+    if (fd < 0) {
+        // LCOV_EXCL_START
+        margo_error(monitor->mid, "in %s: could not open %s: %s", __func__,
+                    monitor->metrics_filename, strerror(errno));
+        return;
+        // LCOV_EXCL_END
+    }
+    void* region = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0)
+        region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        // LCOV_EXCL_START
+        margo_error(monitor->mid, "in %s: could not map %s: %s", __func__,
+                    monitor->metrics_filename, strerror(errno));
+        unlink(monitor->metrics_filename);
+        return;
+        // LCOV_EXCL_END
+    }
+    monitor->metrics_snapshot = calloc(1, size);
+    if (!monitor->metrics_snapshot) {
+        // LCOV_EXCL_START
+        munmap(region, size);
+        unlink(monitor->metrics_filename);
+        return;
+        // LCOV_EXCL_END
+    }
+    monitor->metrics_snapshot->pid = (int64_t)getpid();
+    snprintf(monitor->metrics_snapshot->address,
+             sizeof(monitor->metrics_snapshot->address), "%s",
+             monitor->self_addr_str);
+    monitor->metrics = (margo_metrics_segment_t*)region;
+    __margo_monitor_metrics_segment_update(monitor, ABT_get_wtime());
+    __margo_metrics_init(monitor->metrics);
+}
+
+void __margo_monitor_metrics_segment_close(default_monitor_state_t* monitor)
+{
+    if (monitor->metrics) {
+        munmap(monitor->metrics, sizeof(*monitor->metrics));
+        unlink(monitor->metrics_filename);
+        monitor->metrics = NULL;
+    }
+    free(monitor->metrics_snapshot);
+    free(monitor->metrics_filename);
+    free(monitor->metrics_filename_prefix);
+    monitor->metrics_snapshot        = NULL;
+    monitor->metrics_filename        = NULL;
+    monitor->metrics_filename_prefix = NULL;
+}
+
+/* Adds the counts of a histogram into power-of-two buckets */
+static void metrics_hist_add(uint64_t* buckets, const histogram_t* hist)
+{
+    if (!hist->blocks) return;
+    for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+        uint64_t count = histogram_bucket_count(hist, i);
+        if (!count) continue;
+        buckets[__margo_metrics_hist_bucket(histogram_bucket_value(i))]
+            += count;
+    }
+}
+
+static margo_metrics_rpc_t*
+metrics_find_or_add_rpc(margo_metrics_segment_t* snapshot, hg_id_t id)
+{
+    for (uint32_t i = 0; i < snapshot->num_rpcs; i++)
+        if (snapshot->rpcs[i].id == id) return &snapshot->rpcs[i];
+    if (snapshot->num_rpcs == MARGO_METRICS_MAX_RPCS) return NULL;
+    margo_metrics_rpc_t* rpc = &snapshot->rpcs[snapshot->num_rpcs++];
+    rpc->id                  = id;
+    return rpc;
+}
+
+/* Sums the RPC statistics of all the shards, by RPC id */
+static void metrics_collect_rpcs(default_monitor_state_t* monitor,
+                                 margo_metrics_segment_t* snapshot)
+{
+    memset(snapshot->rpcs, 0, snapshot->num_rpcs * sizeof(*snapshot->rpcs));
+    snapshot->num_rpcs = 0;
+    for (int i = 0; i < MONITOR_NUM_SHARDS; i++) {
+        monitor_shard_t* shard = monitor->shards[i];
+        ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&shard->mutex));
+        origin_rpc_statistics_t *origin, *origin_tmp;
+        HASH_ITER(hh, shard->origin_rpc_stats, origin, origin_tmp)
+        {
+            margo_metrics_rpc_t* rpc
+                = metrics_find_or_add_rpc(snapshot, origin->callpath.rpc_id);
+            if (!rpc) continue;
+            rpc->origin_count += origin->forward_cb[DURATION].num;
+            metrics_hist_add(rpc->origin_hist,
+                             &origin->hist[ORIGIN_FORWARD_HIST]);
+        }
+        target_rpc_statistics_t *target, *target_tmp;
+        HASH_ITER(hh, shard->target_rpc_stats, target, target_tmp)
+        {
+            margo_metrics_rpc_t* rpc
+                = metrics_find_or_add_rpc(snapshot, target->callpath.rpc_id);
+            if (!rpc) continue;
+            rpc->target_count += target->ult[DURATION].num;
+            metrics_hist_add(rpc->target_hist,
+                             &target->hist[TARGET_HANDLER_HIST]);
+        }
+        ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&shard->mutex));
+    }
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_info_mtx));
+    for (uint32_t i = 0; i < snapshot->num_rpcs; i++) {
+        rpc_info_t* rpc_info
+            = rpc_info_find(monitor->rpc_info, snapshot->rpcs[i].id);
+        snprintf(snapshot->rpcs[i].name, sizeof(snapshot->rpcs[i].name), "%s",
+                 rpc_info ? rpc_info->name : "");
+    }
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_info_mtx));
+}
+
+/* Builds a snapshot of the instance and publishes it into the segment.
+ * Skipped if another ULT is already doing it. */
+void __margo_monitor_metrics_segment_update(default_monitor_state_t* monitor,
+                                            double                   timestamp)
+{
+    if (ABT_mutex_trylock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->metrics_mtx))
+        != ABT_SUCCESS)
+        return;
+    monitor->metrics_last_ts = timestamp;
+
+    margo_instance_id        mid      = monitor->mid;
+    margo_metrics_segment_t* snapshot = monitor->metrics_snapshot;
+    struct timespec          now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    snapshot->update_time       = now.tv_sec + now.tv_nsec * 1e-9;
+    snapshot->sample_rpcs_every = monitor->sample_rpcs_every;
+    snapshot->num_updates += 1;
+
+    snapshot->progress_calls        = mid->num_progress_calls;
+    snapshot->trigger_calls         = mid->num_trigger_calls;
+    snapshot->origin_rpcs_in_flight = mid->num_pending_forwards;
+    ABT_mutex_lock(mid->pending_operations_mtx);
+    snapshot->target_rpcs_in_flight = mid->pending_operations;
+    ABT_mutex_unlock(mid->pending_operations_mtx);
+    snapshot->handle_cache_size = mid->handle_cache_size;
+    snapshot->handle_cache_used = __margo_handle_cache_num_used(mid);
+
+    size_t num_pools    = margo_get_num_pools(mid);
+    snapshot->num_pools = 0;
+    for (size_t i = 0;
+         i < num_pools && snapshot->num_pools < MARGO_METRICS_MAX_POOLS; i++) {
+        struct margo_pool_info pool_info;
+        if (margo_find_pool_by_index(mid, i, &pool_info) != HG_SUCCESS)
+            continue;
+        margo_metrics_pool_t* pool = &snapshot->pools[snapshot->num_pools++];
+        size_t                size = 0, total_size = 0;
+        ABT_pool_get_size(pool_info.pool, &size);
+        ABT_pool_get_total_size(pool_info.pool, &total_size);
+        snprintf(pool->name, sizeof(pool->name), "%s",
+                 pool_info.name ? pool_info.name : "");
+        pool->size       = size;
+        pool->total_size = total_size;
+    }
+
+    if (monitor->enable_statistics) metrics_collect_rpcs(monitor, snapshot);
+
+    __margo_metrics_publish(monitor->metrics, snapshot);
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->metrics_mtx));
+}
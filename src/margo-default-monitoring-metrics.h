@@ -0,0 +1,36 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_DEFAULT_MONITORING_METRICS_H
+#define __MARGO_DEFAULT_MONITORING_METRICS_H
+#include "margo-default-monitoring.h"
+
+/*
+ * Shared-memory metrics in Margo's default monitoring system
+ * ==========================================================
+ *
+ * If the "metrics" configuration has a "filename_prefix", the monitor
+ * publishes a snapshot of the instance (pool sizes, progress counters,
+ * RPCs in flight, handle cache usage) and of its RPC statistics into
+ * the segment described in margo-metrics.h, every "interval_sec"
+ * seconds. The snapshot is built by the progress loop in a private
+ * copy of the segment, then published under the segment's seqlock.
+ * The per-RPC counters and histograms are those of the statistics, so
+ * they are reset when the statistics are dumped with reset.
+ */
+
+/* Maps the metrics segment in a file named after the configured prefix,
+ * if any. Errors are reported and leave the segment disabled. */
+void __margo_monitor_metrics_segment_open(default_monitor_state_t* monitor);
+
+/* Unmaps and removes the metrics segment */
+void __margo_monitor_metrics_segment_close(default_monitor_state_t* monitor);
+
+/* Builds a snapshot of the instance and publishes it into the segment.
+ * Skipped if another ULT is already doing it. */
+void __margo_monitor_metrics_segment_update(default_monitor_state_t* monitor,
+                                            double                   timestamp);
+
+#endif
@@ -0,0 +1,418 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <abt.h>
+#include "margo-instance.h"
+#include "margo-id.h"
+#include "margo-handle-cache.h"
+#include "margo-default-monitoring-openmetrics.h"
+
+/* ========================================================================
+ * OpenMetrics export function definitions
+ * ======================================================================== */
+
+/* Upper bounds (in seconds) of the buckets of the exported histograms */
+static const double om_buckets[] = {
+    1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2,
+    2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0};
+#define OM_NUM_BUCKETS (sizeof(om_buckets) / sizeof(om_buckets[0]))
+
+typedef enum om_series_kind
+{
+    OM_ORIGIN,
+    OM_TARGET,
+    OM_BULK
+} om_series_kind_t;
+
+/* Histogram with the buckets above (not cumulative), plus the count and
+ * sum of all the samples, including those above the last bucket */
+typedef struct om_hist {
+    uint64_t count;
+    double   sum;
+    uint64_t buckets[OM_NUM_BUCKETS];
+} om_hist_t;
+
+/* Exported series: the statistics of all the callpaths with the same
+ * RPC id and peer (and bulk operation) are added, regardless of their
+ * parent RPC */
+typedef struct om_key {
+    uint64_t kind;
+    hg_id_t  rpc_id;
+    uint64_t addr_id;
+    uint64_t operation;
+} om_key_t;
+
+typedef struct om_series {
+    om_key_t       key; /* hash key */
+    UT_hash_handle hh;
+    om_hist_t hists[2]; /* origin: forward; target: handler and queue;
+                           bulk: transfer */
+    double    bytes;    /* bulk only */
+} om_series_t;
+
+static om_series_t* om_series_find_or_add(om_series_t**    hash,
+                                          om_series_kind_t kind,
+                                          hg_id_t          rpc_id,
+                                          uint64_t         addr_id,
+                                          uint64_t         operation)
+{
+    om_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.kind            = kind;
+    key.rpc_id          = rpc_id;
+    key.addr_id         = addr_id;
+    key.operation       = operation;
+    om_series_t* series = NULL;
+    HASH_FIND(hh, *hash, &key, sizeof(key), series);
+    if (series) return series;
+    series = (om_series_t*)calloc(1, sizeof(*series));
+    if (!series) return NULL;
+    series->key = key;
+    HASH_ADD(hh, *hash, key, sizeof(key), series);
+    return series;
+}
+
+/* Adds statistics and their histogram, whose buckets are mapped to the
+ * exported buckets with map (OM_NUM_BUCKETS for none) */
+static void om_hist_add(om_hist_t*          dst,
+                        const statistics_t* stats,
+                        const histogram_t*  hist,
+                        const uint8_t*      map)
+{
+    dst->count += stats->num;
+    dst->sum += stats->sum;
+    if (!hist->blocks) return;
+    for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+        if (map[i] < OM_NUM_BUCKETS)
+            dst->buckets[map[i]] += histogram_bucket_count(hist, i);
+}
+
+/* Writes value into out as an escaped label value */
+static void om_escape(const char* value, char* out, size_t size)
+{
+    size_t n = 0;
+    for (const char* p = value; *p && n + 3 < size; p++) {
+        if (*p == '\\' || *p == '"') {
+            out[n++] = '\\';
+            out[n++] = *p;
+        } else if (*p == '\n') {
+            out[n++] = '\\';
+            out[n++] = 'n';
+        } else {
+            out[n++] = *p;
+        }
+    }
+    out[n] = '\0';
+}
+
+static void om_family(margo_json_writer_t* w,
+                      const char*          name,
+                      const char*          type,
+                      const char*          unit,
+                      const char*          help)
+{
+    __margo_json_writer_printf(w, "# TYPE %s %s\n", name, type);
+    if (unit) __margo_json_writer_printf(w, "# UNIT %s %s\n", name, unit);
+    __margo_json_writer_printf(w, "# HELP %s %s\n", name, help);
+}
+
+static void om_hist_write(margo_json_writer_t* w,
+                          const char*          name,
+                          const char*          labels,
+                          const om_hist_t*     hist,
+                          bool                 with_buckets)
+{
+    uint64_t cumulative = 0;
+    for (size_t i = 0; with_buckets && i < OM_NUM_BUCKETS; i++) {
+        cumulative += hist->buckets[i];
+        __margo_json_writer_printf(w, "%s_bucket{%s,le=\"%g\"} %" PRIu64 "\n",
+                                   name, labels, om_buckets[i], cumulative);
+    }
+    __margo_json_writer_printf(w, "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n",
+                               name, labels, hist->count);
+    __margo_json_writer_printf(w, "%s_count{%s} %" PRIu64 "\n", name, labels,
+                               hist->count);
+    __margo_json_writer_printf(w, "%s_sum{%s} %.9g\n", name, labels,
+                               hist->sum);
+}
+
+/* Writes the labels of a series into labels */
+static void om_series_labels(const default_monitor_state_t* monitor,
+                             const char*                    address,
+                             const om_series_t*             series,
+                             char*                          labels,
+                             size_t                         size)
+{
+    default_monitor_state_t* state = (default_monitor_state_t*)monitor;
+    uint16_t                 provider_id;
+    hg_id_t                  base_id;
+    demux_id(series->key.rpc_id, &base_id, &provider_id);
+    char rpc[128], peer[320];
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->rpc_info_mtx));
+    rpc_info_t* rpc_info = rpc_info_find(state->rpc_info, series->key.rpc_id);
+    om_escape(rpc_info ? rpc_info->name : "<unknown>", rpc, sizeof(rpc));
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->rpc_info_mtx));
+    // addr_info entries are only freed on finalize
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->addr_info_mtx));
+    addr_info_t* addr_info = addr_info_find_by_id(monitor, series->key.addr_id);
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->addr_info_mtx));
+    om_escape(addr_info ? addr_info->name : "<unknown>", peer, sizeof(peer));
+    int n = snprintf(labels, size,
+                     "address=\"%s\",rpc=\"%s\",provider_id=\"%u\","
+                     "peer=\"%s\"",
+                     address, rpc, provider_id, peer);
+    if (series->key.kind == OM_BULK && n > 0 && (size_t)n < size)
+        snprintf(labels + n, size - n, ",operation=\"%s\"",
+                 series->key.operation == HG_BULK_PULL ? "pull" : "push");
+}
+
+/* Writes the statistics of the monitor and the state of the instance as
+ * OpenMetrics text. Counters are cumulative since the last reset of the
+ * statistics, so the export itself does not reset anything unless
+ * requested. */
+void __margo_monitor_openmetrics_write(margo_json_writer_t*           w,
+                                       const default_monitor_state_t* monitor,
+                                       bool                           reset)
+{
+    margo_instance_id mid = monitor->mid;
+    char              address[320];
+    om_escape(monitor->self_addr_str, address, sizeof(address));
+    char labels[1024];
+
+    /* map the buckets of the monitor's histograms to the exported ones */
+    uint8_t map[HISTOGRAM_NUM_BUCKETS];
+    for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+        double  value = histogram_bucket_value(i) * 1e-9;
+        uint8_t j     = 0;
+        while (j < OM_NUM_BUCKETS && value > om_buckets[j]) j++;
+        map[i] = j;
+    }
+
+    /* merge the shards, then add the callpaths into series */
+    om_series_t *   hash = NULL, *series, *tmp;
+    monitor_shard_t merged;
+    memset(&merged, 0, sizeof(merged));
+    if (monitor->enable_statistics) {
+        for (int i = 0; i < MONITOR_NUM_SHARDS; i++) {
+            monitor_shard_t* shard = monitor->shards[i];
+            ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&shard->mutex));
+            __margo_monitor_shard_merge(&merged, shard, reset);
+            ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&shard->mutex));
+        }
+    }
+    {
+        origin_rpc_statistics_t *p, *p_tmp;
+        HASH_ITER(hh, merged.origin_rpc_stats, p, p_tmp)
+        {
+            series = om_series_find_or_add(&hash, OM_ORIGIN,
+                                           p->callpath.rpc_id,
+                                           p->callpath.addr_id, 0);
+            if (!series) continue;
+            om_hist_add(&series->hists[0], &p->forward_cb[TIMESTAMP],
+                        &p->hist[ORIGIN_FORWARD_HIST], map);
+        }
+    }
+    {
+        target_rpc_statistics_t *p, *p_tmp;
+        HASH_ITER(hh, merged.target_rpc_stats, p, p_tmp)
+        {
+            series = om_series_find_or_add(&hash, OM_TARGET,
+                                           p->callpath.rpc_id,
+                                           p->callpath.addr_id, 0);
+            if (!series) continue;
+            om_hist_add(&series->hists[0], &p->ult[DURATION],
+                        &p->hist[TARGET_HANDLER_HIST], map);
+            om_hist_add(&series->hists[1], &p->ult[TIMESTAMP],
+                        &p->hist[TARGET_ULT_QUEUE_HIST], map);
+        }
+    }
+    {
+        bulk_transfer_statistics_t *p, *p_tmp;
+        HASH_ITER(hh, merged.bulk_transfer_stats, p, p_tmp)
+        {
+            series = om_series_find_or_add(
+                &hash, OM_BULK, p->bulk_key.callpath.rpc_id,
+                p->bulk_key.remote_addr_id, p->bulk_key.operation);
+            if (!series) continue;
+            om_hist_add(&series->hists[0], &p->transfer_cb[TIMESTAMP],
+                        &p->hist[BULK_TRANSFER_HIST], map);
+            series->bytes += p->transfer_size.sum;
+        }
+    }
+    __margo_monitor_shard_clear(&merged);
+
+    /* RPC and bulk transfer histograms, one family at a time */
+    static const struct {
+        om_series_kind_t kind;
+        size_t           hist;
+        const char*      name;
+        const char*      help;
+    } families[] = {
+        {OM_ORIGIN, 0, "margo_rpc_forward_seconds",
+         "Time from the forward of an RPC to its completion."},
+        {OM_TARGET, 1, "margo_rpc_queue_seconds",
+         "Time from the reception of an RPC to the start of its handler."},
+        {OM_TARGET, 0, "margo_rpc_handler_seconds",
+         "Duration of the handler of an RPC."},
+        {OM_BULK, 0, "margo_bulk_transfer_seconds",
+         "Duration of the bulk transfers issued by an RPC."}};
+    bool with_buckets = monitor->num_percentiles > 0;
+    for (size_t f = 0; f < sizeof(families) / sizeof(families[0]); f++) {
+        om_family(w, families[f].name, "histogram", "seconds",
+                  families[f].help);
+        HASH_ITER(hh, hash, series, tmp)
+        {
+            if (series->key.kind != families[f].kind) continue;
+            om_series_labels(monitor, address, series, labels, sizeof(labels));
+            om_hist_write(w, families[f].name, labels,
+                          &series->hists[families[f].hist], with_buckets);
+        }
+    }
+    om_family(w, "margo_bulk_transfer_bytes", "counter", "bytes",
+              "Bytes transferred by the bulk transfers issued by an RPC.");
+    HASH_ITER(hh, hash, series, tmp)
+    {
+        if (series->key.kind != OM_BULK) continue;
+        om_series_labels(monitor, address, series, labels, sizeof(labels));
+        __margo_json_writer_printf(w,
+                                   "margo_bulk_transfer_bytes_total{%s} %.0f\n",
+                                   labels, series->bytes);
+    }
+    HASH_ITER(hh, hash, series, tmp)
+    {
+        HASH_DEL(hash, series);
+        free(series);
+    }
+
+    /* instance-wide metrics */
+    om_family(w, "margo_progress_calls", "counter", NULL,
+              "Calls to the Mercury progress function.");
+    __margo_json_writer_printf(w,
+                               "margo_progress_calls_total{address=\"%s\"} "
+                               "%" PRIu64 "\n",
+                               address, (uint64_t)mid->num_progress_calls);
+    om_family(w, "margo_trigger_calls", "counter", NULL,
+              "Calls to the Mercury trigger function.");
+    __margo_json_writer_printf(w,
+                               "margo_trigger_calls_total{address=\"%s\"} "
+                               "%" PRIu64 "\n",
+                               address, (uint64_t)mid->num_trigger_calls);
+    ABT_mutex_lock(mid->pending_operations_mtx);
+    uint64_t target_in_flight = mid->pending_operations;
+    ABT_mutex_unlock(mid->pending_operations_mtx);
+    om_family(w, "margo_rpcs_in_flight", "gauge", NULL,
+              "RPCs forwarded and waiting for a response (origin), "
+              "or received and not yet completed (target).");
+    __margo_json_writer_printf(
+        w, "margo_rpcs_in_flight{address=\"%s\",side=\"origin\"} %" PRIu64 "\n",
+        address, (uint64_t)mid->num_pending_forwards);
+    __margo_json_writer_printf(
+        w, "margo_rpcs_in_flight{address=\"%s\",side=\"target\"} %" PRIu64 "\n",
+        address, target_in_flight);
+    om_family(w, "margo_handle_cache_used", "gauge", NULL,
+              "Cached handles in use.");
+    __margo_json_writer_printf(
+        w, "margo_handle_cache_used{address=\"%s\"} %zu\n", address,
+        __margo_handle_cache_num_used(mid));
+    om_family(w, "margo_handle_cache_size", "gauge", NULL,
+              "Capacity of the handle cache.");
+    __margo_json_writer_printf(w,
+                               "margo_handle_cache_size{address=\"%s\"} %zu\n",
+                               address, mid->handle_cache_size);
+
+    size_t num_pools = margo_get_num_pools(mid);
+    for (int total = 0; total < 2; total++) {
+        const char* name = total ? "margo_pool_total_size" : "margo_pool_size";
+        om_family(w, name, "gauge", NULL,
+                  total ? "ULTs in a pool, including blocked ULTs."
+                        : "Runnable ULTs in a pool.");
+        for (size_t i = 0; i < num_pools; i++) {
+            struct margo_pool_info pool_info;
+            if (margo_find_pool_by_index(mid, i, &pool_info) != HG_SUCCESS)
+                continue;
+            size_t size = 0;
+            if (total)
+                ABT_pool_get_total_size(pool_info.pool, &size);
+            else
+                ABT_pool_get_size(pool_info.pool, &size);
+            char pool[128];
+            om_escape(pool_info.name ? pool_info.name : "", pool,
+                      sizeof(pool));
+            __margo_json_writer_printf(
+                w, "%s{address=\"%s\",pool=\"%s\"} %zu\n", name, address,
+                pool, size);
+        }
+    }
+    __margo_json_writer_printf(w, "# EOF\n");
+}
+
+/* Writes the OpenMetrics text into <prefix>.<hostname>.<pid>.prom,
+ * through a temporary file renamed once complete, so that collectors
+ * reading the file never see a partial export. Skipped if another ULT
+ * is already doing it. */
+void __margo_monitor_openmetrics_write_file(default_monitor_state_t* monitor,
+                                            double                   timestamp)
+{
+    if (!monitor->openmetrics_filename_prefix
+        || !monitor->openmetrics_filename_prefix[0])
+        return;
+    if (ABT_mutex_trylock(
+            ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->openmetrics_mtx))
+        != ABT_SUCCESS)
+        return;
+    monitor->openmetrics_last_ts = timestamp;
+
+    char hostname[1024];
+    hostname[1023] = '\0';
+    gethostname(hostname, 1023);
+    pid_t  pid = getpid();
+    size_t filename_size
+        = snprintf(NULL, 0, "%s.%s.%d.prom.tmp",
+                   monitor->openmetrics_filename_prefix, hostname, pid);
+    char* tmp_filename = calloc(1, filename_size + 1);
+    sprintf(tmp_filename, "%s.%s.%d.prom.tmp",
+            monitor->openmetrics_filename_prefix, hostname, pid);
+    FILE* file = fopen(tmp_filename, "w");
+    if (!file) {
+        // LCOV_EXCL_START
+        margo_error(monitor->mid, "Error open file %s: %s", tmp_filename,
+                    strerror(errno));
+        goto finish;
+        // LCOV_EXCL_END
+    }
+    margo_json_writer_t writer;
+    __margo_json_writer_init(&writer, __margo_json_writer_file_sink, file,
+                             MONITOR_FILE_CHUNK_SIZE, monitor->precision,
+                             false);
+    __margo_monitor_openmetrics_write(&writer, monitor, false);
+    bool ok = __margo_json_writer_finalize(&writer);
+    ok      = (fclose(file) == 0) && ok;
+    if (ok) {
+        char* filename = strdup(tmp_filename);
+        /* remove the ".tmp" suffix */
+        filename[filename_size - 4] = '\0';
+        if (rename(tmp_filename, filename) != 0) {
+            // LCOV_EXCL_START
+            margo_error(monitor->mid, "Error renaming %s: %s", tmp_filename,
+                        strerror(errno));
+            // LCOV_EXCL_END
+        }
+        free(filename);
+    } else {
+        // LCOV_EXCL_START
+        unlink(tmp_filename);
+        // LCOV_EXCL_END
+    }
+
+finish:
+    free(tmp_filename);
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->openmetrics_mtx));
+}
@@ -0,0 +1,40 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_DEFAULT_MONITORING_OPENMETRICS_H
+#define __MARGO_DEFAULT_MONITORING_OPENMETRICS_H
+#include "margo-default-monitoring.h"
+
+/*
+ * OpenMetrics export in Margo's default monitoring system
+ * =======================================================
+ *
+ * The statistics and the state of the instance can be exported as
+ * OpenMetrics (Prometheus) text, with histograms of the RPC forward,
+ * queueing, and handler times and of the bulk transfer times, labeled
+ * by RPC name, provider id, and peer, and gauges of the pool sizes.
+ * Callpaths that differ only by their parent RPC are added together.
+ * The export is written every "interval_sec" seconds into
+ * <prefix>.<hostname>.<pid>.prom if the "openmetrics" configuration has
+ * a "filename_prefix" (e.g. in the directory of a node exporter's
+ * textfile collector), and margo_monitor_dump produces it instead of
+ * JSON if "dump" is true. Counters are cumulative, so exporting does
+ * not reset the statistics.
+ */
+
+/* Writes the statistics of the monitor and the state of the instance as
+ * OpenMetrics text. Counters are cumulative since the last reset of the
+ * statistics, so the export itself does not reset anything unless
+ * requested. */
+void __margo_monitor_openmetrics_write(margo_json_writer_t*           w,
+                                       const default_monitor_state_t* monitor,
+                                       bool                           reset);
+
+/* Writes the OpenMetrics text into <prefix>.<hostname>.<pid>.prom, if a
+ * prefix is configured. Skipped if another ULT is already doing it. */
+void __margo_monitor_openmetrics_write_file(default_monitor_state_t* monitor,
+                                            double                   timestamp);
+
+#endif
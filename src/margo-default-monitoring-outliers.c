@@ -0,0 +1,247 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <abt.h>
+#include "margo-instance.h"
+#include "margo-id.h"
+#include "margo-default-monitoring-outliers.h"
+
+/* ========================================================================
+ * Outlier detection function definitions
+ * ======================================================================== */
+
+/* Updates the moving percentile estimate of a callpath with the
+ * end-to-end duration of an RPC, and returns true if the RPC is an
+ * outlier, setting the limit it exceeded. Must be called with the mutex
+ * of the shard containing the estimate held. */
+static bool check_outlier(const default_monitor_state_t* monitor,
+                          outlier_estimate_t*            estimate,
+                          double                         duration,
+                          outlier_t*                     outlier)
+{
+    bool result = false;
+    if (monitor->outlier_threshold > 0.0
+        && duration > monitor->outlier_threshold) {
+        outlier->limit            = monitor->outlier_threshold;
+        outlier->above_percentile = false;
+        result                    = true;
+    }
+    if (monitor->outlier_percentile > 0.0) {
+        if (estimate->value <= 0.0) {
+            estimate->value = duration;
+        } else {
+            if (!result && estimate->num_samples >= monitor->outlier_min_samples
+                && duration > estimate->value) {
+                outlier->limit            = estimate->value;
+                outlier->above_percentile = true;
+                result                    = true;
+            }
+            estimate->value *= duration > estimate->value
+                                 ? monitor->outlier_up
+                                 : monitor->outlier_down;
+        }
+        estimate->num_samples += 1;
+    }
+    if (result) outlier->duration = duration;
+    return result;
+}
+
+/* Records the origin and/or target sides of an RPC from its session if
+ * they are outliers (both for an RPC sent by the process to itself) */
+void __margo_monitor_record_outliers(default_monitor_state_t* monitor,
+                                     const session_t*         session)
+{
+    outlier_t outliers[2];
+    size_t    n = 0;
+
+    monitor_shard_t*        shard  = shard_lock(monitor);
+    const origin_session_t* origin = &session->origin;
+    double                  end_ts = origin->wait_end_ts > 0.0
+                                       ? origin->wait_end_ts
+                                       : origin->forward_cb_ts;
+    if (origin->stats && origin->forward_start_ts > 0.0 && end_ts > 0.0) {
+        origin_rpc_statistics_t* stats = origin->stats;
+        stats = origin_rpc_stats_in_shard(shard, &stats);
+        if (check_outlier(monitor, &stats->outlier_estimate,
+                          end_ts - origin->forward_start_ts, &outliers[n])) {
+            outliers[n].is_origin      = true;
+            outliers[n].callpath       = stats->callpath;
+            outliers[n].session.origin = *origin;
+            n += 1;
+        }
+    }
+    const target_session_t* target = &session->target;
+    end_ts = target->respond_end_ts > 0.0 ? target->respond_end_ts
+                                          : target->ult_end_ts;
+    if (target->stats && end_ts > 0.0) {
+        target_rpc_statistics_t* stats = target->stats;
+        stats = target_rpc_stats_in_shard(shard, &stats);
+        if (check_outlier(monitor, &stats->outlier_estimate,
+                          end_ts - target->handler_start_ts, &outliers[n])) {
+            outliers[n].is_origin      = false;
+            outliers[n].callpath       = stats->callpath;
+            outliers[n].session.target = *target;
+            n += 1;
+        }
+    }
+    shard_unlock(shard);
+    if (!n) return;
+
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->outliers_mtx));
+    for (size_t i = 0; i < n; i++) {
+        monitor->outliers[monitor->outliers_head] = outliers[i];
+        monitor->outliers_head
+            = (monitor->outliers_head + 1) % monitor->max_outliers;
+        if (monitor->num_outliers < monitor->max_outliers)
+            monitor->num_outliers += 1;
+        monitor->total_outliers += 1;
+    }
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->outliers_mtx));
+}
+
+/* ========================================================================
+ * Outlier function definitions
+ * ======================================================================== */
+
+/* Writes the timestamp of a phase relative to the start of the RPC,
+ * if the phase happened */
+static inline void outlier_phase_write(margo_json_writer_t* w,
+                                       const char*          name,
+                                       double               timestamp,
+                                       double               start_ts)
+{
+    if (timestamp > 0.0)
+        __margo_json_writer_key_double(w, name, timestamp - start_ts);
+}
+
+static void outlier_write(margo_json_writer_t*           w,
+                          const default_monitor_state_t* monitor,
+                          const outlier_t*               outlier)
+{
+    default_monitor_state_t* state = (default_monitor_state_t*)monitor;
+    uint16_t                 provider_id;
+    hg_id_t                  base_id, parent_base_id;
+    uint16_t                 parent_provider_id;
+    demux_id(outlier->callpath.rpc_id, &base_id, &provider_id);
+    demux_id(outlier->callpath.parent_id, &parent_base_id,
+             &parent_provider_id);
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->rpc_info_mtx));
+    rpc_info_t* rpc_info
+        = rpc_info_find(monitor->rpc_info, outlier->callpath.rpc_id);
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->rpc_info_mtx));
+    // addr_info entries are only freed on finalize
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->addr_info_mtx));
+    addr_info_t* addr_info
+        = addr_info_find_by_id(monitor, outlier->callpath.addr_id);
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->addr_info_mtx));
+
+    __margo_json_writer_begin_object(w);
+    __margo_json_writer_key_string(w, "side",
+                                   outlier->is_origin ? "origin" : "target");
+    __margo_json_writer_key_string(w, "name", rpc_info ? rpc_info->name : "");
+    __margo_json_writer_key_uint64(w, "rpc_id", base_id);
+    __margo_json_writer_key_uint64(w, "provider_id", provider_id);
+    __margo_json_writer_key_uint64(w, "parent_rpc_id", parent_base_id);
+    __margo_json_writer_key_uint64(w, "parent_provider_id",
+                                   parent_provider_id);
+    __margo_json_writer_key_string(w, "peer",
+                                   addr_info ? addr_info->name : "<unknown>");
+    __margo_json_writer_key_double(w, "duration", outlier->duration);
+    __margo_json_writer_key_string(
+        w, "exceeded", outlier->above_percentile ? "percentile" : "threshold");
+    __margo_json_writer_key_double(w, "limit", outlier->limit);
+    if (outlier->is_origin) {
+        const origin_session_t* s     = &outlier->session.origin;
+        double                  start = s->create_ts;
+        __margo_json_writer_key_double(w, "start", start);
+        __margo_json_writer_key(w, "xstream");
+        __margo_json_writer_int64(w, s->xstream_rank);
+        // timestamps relative to the creation of the handle
+        __margo_json_writer_key(w, "phases");
+        __margo_json_writer_begin_object(w);
+        outlier_phase_write(w, "forward_start", s->forward_start_ts, start);
+        outlier_phase_write(w, "set_input_start", s->set_input_start_ts,
+                            start);
+        outlier_phase_write(w, "set_input_end", s->set_input_end_ts, start);
+        outlier_phase_write(w, "forward_end", s->forward_end_ts, start);
+        outlier_phase_write(w, "wait_start", s->wait_start_ts, start);
+        outlier_phase_write(w, "forward_cb", s->forward_cb_ts, start);
+        outlier_phase_write(w, "wait_end", s->wait_end_ts, start);
+        outlier_phase_write(w, "get_output_start", s->get_output_start_ts,
+                            start);
+        outlier_phase_write(w, "get_output_end", s->get_output_end_ts, start);
+        __margo_json_writer_end_object(w);
+    } else {
+        const target_session_t* s     = &outlier->session.target;
+        double                  start = s->handler_start_ts;
+        __margo_json_writer_key_double(w, "start", start);
+        __margo_json_writer_key(w, "xstream");
+        __margo_json_writer_int64(w, s->xstream_rank);
+        __margo_json_writer_key_uint64(w, "pool_size", s->pool_size);
+        if (monitor->enable_cpu_time)
+            __margo_json_writer_key_double(w, "cpu_time", s->cpu_time);
+        // timestamps relative to the handler (arrival of the RPC)
+        __margo_json_writer_key(w, "phases");
+        __margo_json_writer_begin_object(w);
+        outlier_phase_write(w, "ult_start", s->ult_start_ts, start);
+        outlier_phase_write(w, "get_input_start", s->get_input_start_ts,
+                            start);
+        outlier_phase_write(w, "get_input_end", s->get_input_end_ts, start);
+        outlier_phase_write(w, "respond_start", s->respond_start_ts, start);
+        outlier_phase_write(w, "respond_end", s->respond_end_ts, start);
+        outlier_phase_write(w, "wait_start", s->wait_start_ts, start);
+        outlier_phase_write(w, "wait_end", s->wait_end_ts, start);
+        outlier_phase_write(w, "ult_end", s->ult_end_ts, start);
+        __margo_json_writer_end_object(w);
+        __margo_json_writer_key(w, "bulk");
+        __margo_json_writer_begin_object(w);
+        __margo_json_writer_key_uint64(w, "count", s->bulk_count);
+        __margo_json_writer_key_uint64(w, "size", s->bulk_size);
+        __margo_json_writer_key_double(w, "time", s->bulk_time);
+        __margo_json_writer_end_object(w);
+    }
+    __margo_json_writer_end_object(w);
+}
+
+/* Writes the outliers, oldest first. The ring buffer is copied (and
+ * reset if requested) with the mutex held, then written. */
+void __margo_monitor_outliers_write(margo_json_writer_t*           w,
+                                    const default_monitor_state_t* monitor,
+                                    bool                           reset)
+{
+    default_monitor_state_t* state = (default_monitor_state_t*)monitor;
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->outliers_mtx));
+    size_t     num_outliers = state->num_outliers;
+    uint64_t   total        = state->total_outliers;
+    outlier_t* outliers
+        = num_outliers ? (outlier_t*)malloc(num_outliers * sizeof(*outliers))
+                       : NULL;
+    if (outliers) {
+        size_t first = (state->outliers_head + state->max_outliers
+                        - num_outliers)
+                     % state->max_outliers;
+        for (size_t i = 0; i < num_outliers; i++)
+            outliers[i] = state->outliers[(first + i) % state->max_outliers];
+    } else {
+        num_outliers = 0;
+    }
+    if (reset) {
+        state->num_outliers   = 0;
+        state->outliers_head  = 0;
+        state->total_outliers = 0;
+    }
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->outliers_mtx));
+
+    __margo_json_writer_begin_object(w);
+    __margo_json_writer_key_uint64(w, "total", total);
+    __margo_json_writer_key(w, "records");
+    __margo_json_writer_begin_array(w);
+    for (size_t i = 0; i < num_outliers; i++)
+        outlier_write(w, monitor, &outliers[i]);
+    __margo_json_writer_end_array(w);
+    __margo_json_writer_end_object(w);
+    free(outliers);
+}
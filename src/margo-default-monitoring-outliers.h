@@ -0,0 +1,53 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_DEFAULT_MONITORING_OUTLIERS_H
+#define __MARGO_DEFAULT_MONITORING_OUTLIERS_H
+#include "margo-default-monitoring.h"
+
+/*
+ * Outliers in Margo's default monitoring system
+ * =============================================
+ *
+ * Statistics and histograms hide individual slow requests. If the
+ * "outliers" configuration is present, each RPC whose end-to-end time
+ * at its origin (from forward to the end of the wait) or at its target
+ * (from the handler to the end of the respond) exceeds "threshold_sec",
+ * or exceeds a moving estimate of the "percentile"-th percentile of its
+ * callpath, is recorded with the timestamps of all its phases taken from
+ * its session, the depth of the handler pool when it arrived, the rank
+ * of the xstream that ran it, and its bulk transfers. The estimate is
+ * updated on every RPC (multiplicatively, so that it converges to the
+ * percentile regardless of the scale of the durations) and is only used
+ * after "min_samples" RPCs of the callpath.
+ *
+ * The "max_records" most recent outliers are kept in a ring buffer and
+ * written in the "outliers" field of the statistics.
+ */
+
+/* Outlier RPC, with a copy of the side of its session that was slow */
+typedef struct outlier {
+    bool       is_origin;
+    bool       above_percentile; /* false if above threshold_sec */
+    double     duration;
+    double     limit; /* threshold or percentile estimate exceeded */
+    callpath_t callpath;
+    union {
+        origin_session_t origin;
+        target_session_t target;
+    } session;
+} outlier_t;
+
+/* Records the origin and/or target sides of an RPC from its session if
+ * they are outliers (both for an RPC sent by the process to itself) */
+void __margo_monitor_record_outliers(default_monitor_state_t* monitor,
+                                     const session_t*         session);
+
+/* Writes the outliers, oldest first */
+void __margo_monitor_outliers_write(margo_json_writer_t*           w,
+                                    const default_monitor_state_t* monitor,
+                                    bool                           reset);
+
+#endif
@@ -0,0 +1,194 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <abt.h>
+#include "margo-instance.h"
+#include "margo-default-monitoring-watchdog.h"
+
+/* ========================================================================
+ * Watchdog function definitions
+ * ======================================================================== */
+
+/* The progress loop does not run while it waits for progress to be
+ * needed, or once it has been shut down */
+static inline bool progress_is_idle(margo_instance_id mid)
+{
+    if (mid->hg_progress_shutdown_flag) return true;
+    return mid->progress_when_needed.flag
+        && !__atomic_load_n(&mid->progress_when_needed.pending,
+                            __ATOMIC_RELAXED);
+}
+
+static void watchdog_report_stall(default_monitor_state_t* monitor,
+                                  double                   now,
+                                  double                   duration)
+{
+    margo_instance_id mid = monitor->mid;
+    int rank = __atomic_load_n(&monitor->progress_xstream, __ATOMIC_RELAXED);
+    if (mid->progress_pool_idx == monitor->watchdog_pool_idx) {
+        size_t pool_size = 0;
+        ABT_pool_get_total_size(monitor->watchdog_pool, &pool_size);
+        margo_warning(
+            mid,
+            "Progress loop stalled for %.3f seconds (progress pool "
+            "\"%s\" has %zu ULTs, progress ULT last ran on xstream %d)",
+            duration, monitor->watchdog_pool_name, pool_size, rank);
+    } else {
+        /* the progress loop was migrated to a pool that the watchdog
+         * cannot safely access */
+        margo_warning(mid,
+                      "Progress loop stalled for %.3f seconds (progress ULT "
+                      "last ran on xstream %d)",
+                      duration, rank);
+    }
+
+    /* RPC handler ULT that may be blocking the xstream */
+    if (rank >= 0 && rank < WATCHDOG_MAX_XSTREAMS) {
+        watchdog_slot_t* slot = &monitor->running_rpcs[rank];
+        hg_id_t rpc_id = __atomic_load_n(&slot->rpc_id, __ATOMIC_ACQUIRE);
+        uint64_t ult_id = __atomic_load_n(&slot->ult_id, __ATOMIC_RELAXED);
+        double   start_ts;
+        __atomic_load(&slot->start_ts, &start_ts, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (rpc_id
+            && rpc_id == __atomic_load_n(&slot->rpc_id, __ATOMIC_RELAXED)) {
+            char name[64] = "<unknown>";
+            ABT_mutex_spinlock(
+                ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_info_mtx));
+            rpc_info_t* rpc_info = rpc_info_find(monitor->rpc_info, rpc_id);
+            if (rpc_info) snprintf(name, sizeof(name), "%s", rpc_info->name);
+            ABT_mutex_unlock(
+                ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_info_mtx));
+            margo_warning(mid,
+                          "Handler ULT %" PRIu64 " of RPC \"%s\" has been "
+                          "running on xstream %d for %.3f seconds",
+                          ult_id, name, rank, now - start_ts);
+        }
+    }
+
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->watchdog_mtx));
+    monitor->num_stalls += 1;
+    monitor->stalled = true;
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->watchdog_mtx));
+}
+
+static void watchdog_report_resume(default_monitor_state_t* monitor,
+                                   double                   duration)
+{
+    margo_warning(monitor->mid, "Progress loop resumed after %.3f seconds",
+                  duration);
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->watchdog_mtx));
+    if (monitor->max_stall < duration) monitor->max_stall = duration;
+    monitor->total_stall += duration;
+    monitor->stalled = false;
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->watchdog_mtx));
+}
+
+/* Body of the watchdog thread. The progress loop is stalled if its
+ * heartbeat has not changed for more than the threshold, plus the
+ * timeout of the HG_Progress call it may be blocked in. */
+static void* watchdog_fn(void* arg)
+{
+    default_monitor_state_t* monitor = (default_monitor_state_t*)arg;
+    struct timespec          interval;
+    interval.tv_sec  = (time_t)monitor->watchdog_interval;
+    interval.tv_nsec = (long)((monitor->watchdog_interval
+                               - (double)interval.tv_sec)
+                              * 1e9);
+    uint64_t last_heartbeat = 0;
+    double   last_ts        = 0.0;
+    bool     stalled        = false;
+    while (!__atomic_load_n(&monitor->watchdog_stop, __ATOMIC_ACQUIRE)) {
+        nanosleep(&interval, NULL);
+        double   now = ABT_get_wtime();
+        uint64_t heartbeat
+            = __atomic_load_n(&monitor->heartbeat, __ATOMIC_ACQUIRE);
+        if (heartbeat != last_heartbeat) {
+            if (stalled) watchdog_report_resume(monitor, now - last_ts);
+            stalled        = false;
+            last_heartbeat = heartbeat;
+            __atomic_load(&monitor->heartbeat_ts, &last_ts, __ATOMIC_RELAXED);
+            continue;
+        }
+        /* the progress loop has not started yet */
+        if (!heartbeat) continue;
+        if (progress_is_idle(monitor->mid)) {
+            last_ts = now;
+            continue;
+        }
+        if (stalled) continue;
+        unsigned timeout_ms = __atomic_load_n(&monitor->heartbeat_timeout_ms,
+                                              __ATOMIC_RELAXED);
+        if (now - last_ts <= monitor->watchdog_threshold + timeout_ms * 1e-3)
+            continue;
+        stalled = true;
+        watchdog_report_stall(monitor, now, now - last_ts);
+    }
+    return NULL;
+}
+
+void __margo_monitor_watchdog_start(default_monitor_state_t* monitor)
+{
+    margo_instance_id mid = monitor->mid;
+    if (!monitor->enable_watchdog) return;
+    __margo_abt_lock(&mid->abt);
+    const margo_abt_pool_t* pool = &mid->abt.pools[mid->progress_pool_idx];
+    monitor->watchdog_pool_idx   = mid->progress_pool_idx;
+    monitor->watchdog_pool       = pool->pool;
+    monitor->watchdog_pool_name  = strdup(pool->name ? pool->name : "");
+    __margo_abt_unlock(&mid->abt);
+    // LCOV_EXCL_START
+    if (pthread_create(&monitor->watchdog_thread, NULL, watchdog_fn, monitor)
+        != 0) {
+        margo_error(mid, "in %s: could not create watchdog thread", __func__);
+        monitor->enable_watchdog = false;
+    }
+    // LCOV_EXCL_STOP
+}
+
+void __margo_monitor_watchdog_stop(default_monitor_state_t* monitor)
+{
+    if (monitor->enable_watchdog) {
+        __atomic_store_n(&monitor->watchdog_stop, true, __ATOMIC_RELEASE);
+        pthread_join(monitor->watchdog_thread, NULL);
+    }
+    free(monitor->watchdog_pool_name);
+    monitor->watchdog_pool_name = NULL;
+}
+
+/* Writes the stalls detected by the watchdog */
+void
+__margo_monitor_watchdog_stalls_write(margo_json_writer_t*           w,
+                                      const default_monitor_state_t* monitor,
+                                      bool                           reset)
+{
+    default_monitor_state_t* state = (default_monitor_state_t*)monitor;
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->watchdog_mtx));
+    uint64_t num_stalls  = state->num_stalls;
+    double   max_stall   = state->max_stall;
+    double   total_stall = state->total_stall;
+    bool     stalled     = state->stalled;
+    if (reset) {
+        state->num_stalls  = 0;
+        state->max_stall   = 0.0;
+        state->total_stall = 0.0;
+    }
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->watchdog_mtx));
+
+    __margo_json_writer_key(w, "stalls");
+    __margo_json_writer_begin_object(w);
+    __margo_json_writer_key_uint64(w, "num", num_stalls);
+    __margo_json_writer_key_double(w, "max_sec", max_stall);
+    __margo_json_writer_key_double(w, "total_sec", total_stall);
+    __margo_json_writer_key(w, "ongoing");
+    __margo_json_writer_bool(w, stalled);
+    __margo_json_writer_end_object(w);
+}
@@ -0,0 +1,95 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_DEFAULT_MONITORING_WATCHDOG_H
+#define __MARGO_DEFAULT_MONITORING_WATCHDOG_H
+#include "margo-default-monitoring.h"
+
+/*
+ * Progress loop watchdog in Margo's default monitoring system
+ * ===========================================================
+ *
+ * A handler that blocks the xstream running the progress loop, or a
+ * Mercury progress or trigger call that takes too long, stalls every
+ * RPC of the instance. If the "watchdog" configuration is present, the
+ * progress and trigger callbacks update a heartbeat, and a pthread
+ * checks it every "check_interval_sec" seconds. The progress loop is
+ * considered stalled when the heartbeat has not changed for more than
+ * "stall_threshold_sec" seconds (plus the timeout of the HG_Progress
+ * call it may legitimately be blocked in, and excluding the time spent
+ * waiting for progress to be needed). A stall is logged as a warning,
+ * with the progress pool, the xstream the progress ULT last ran on,
+ * and the RPC handler ULT last started on that xstream if it has not
+ * completed. The end of the stall is logged with its duration, and the
+ * "stalls" field of the "progress_loop" statistics counts them.
+ */
+
+/* Signals to the watchdog that the progress loop is running, and
+ * whether it is about to block in HG_Progress for up to timeout_ms */
+static inline void watchdog_heartbeat(default_monitor_state_t* monitor,
+                                      double                   timestamp,
+                                      unsigned                 timeout_ms)
+{
+    __atomic_store_n(&monitor->heartbeat_timeout_ms, timeout_ms,
+                     __ATOMIC_RELAXED);
+    __atomic_store(&monitor->heartbeat_ts, &timestamp, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&monitor->heartbeat, 1, __ATOMIC_RELEASE);
+}
+
+/* Records (is_start) or clears the RPC handler ULT running on the
+ * calling xstream. The ULT may complete on another xstream than the
+ * one it started on, in which case the slots are searched for it. */
+static inline void watchdog_track_ult(default_monitor_state_t* monitor,
+                                      hg_handle_t              handle,
+                                      double                   timestamp,
+                                      bool                     is_start)
+{
+    ABT_unit_id ult_id = 0;
+    ABT_thread_self_id(&ult_id);
+    int rank = self_xstream_rank();
+    if (is_start) {
+        if (rank < 0 || rank >= WATCHDOG_MAX_XSTREAMS) return;
+        const struct hg_info* info = margo_get_info(handle);
+        watchdog_slot_t*      slot = &monitor->running_rpcs[rank];
+        __atomic_store_n(&slot->rpc_id, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&slot->ult_id, (uint64_t)ult_id, __ATOMIC_RELAXED);
+        __atomic_store(&slot->start_ts, &timestamp, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->rpc_id, info ? info->id : 0,
+                         __ATOMIC_RELEASE);
+        return;
+    }
+    if (rank >= 0 && rank < WATCHDOG_MAX_XSTREAMS
+        && __atomic_load_n(&monitor->running_rpcs[rank].ult_id,
+                           __ATOMIC_RELAXED)
+               == (uint64_t)ult_id) {
+        __atomic_store_n(&monitor->running_rpcs[rank].rpc_id, 0,
+                         __ATOMIC_RELEASE);
+        return;
+    }
+    for (int i = 0; i < WATCHDOG_MAX_XSTREAMS; i++) {
+        if (__atomic_load_n(&monitor->running_rpcs[i].ult_id, __ATOMIC_RELAXED)
+            != (uint64_t)ult_id)
+            continue;
+        __atomic_store_n(&monitor->running_rpcs[i].rpc_id, 0,
+                         __ATOMIC_RELEASE);
+        return;
+    }
+}
+
+/* Starts the watchdog thread if monitor->enable_watchdog, or clears it
+ * if the thread cannot be created. Must be called once the progress pool
+ * of the margo instance is known. */
+void __margo_monitor_watchdog_start(default_monitor_state_t* monitor);
+
+/* Stops the watchdog thread, if it was started */
+void __margo_monitor_watchdog_stop(default_monitor_state_t* monitor);
+
+/* Writes the "stalls" field of the progress loop statistics */
+void
+__margo_monitor_watchdog_stalls_write(margo_json_writer_t*           w,
+                                      const default_monitor_state_t* monitor,
+                                      bool                           reset);
+
+#endif
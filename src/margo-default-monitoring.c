@@ -4,22 +4,32 @@
  *
  * See COPYRIGHT in top-level directory.
  */
+#include <stddef.h>
 #include <string.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <abt.h>
 #include <json-c/json.h>
 #include "margo-macros.h"
 #include "margo-instance.h"
 #include "margo-monitoring.h"
+#include "margo-monitoring-internal.h"
 #include "margo-id.h"
-#ifdef __clang_analyzer__
-    // Prevent clang-analyzer from getting confused by the actual HASH_JEN
-    // macro. This trivial HASH_FUNCTION is not actually used when the code is
-    // compiled.
-    #define HASH_FUNCTION(keyptr, keylen, hashv) hashv = 0
-#endif
-#include "uthash.h"
+#include "margo-json-writer.h"
+#include "margo-metrics.h"
+#include "margo-handle-cache.h"
+#include "margo-globals.h"
+#include "margo-default-monitoring.h"
+#include "margo-default-monitoring-abt.h"
+#include "margo-default-monitoring-outliers.h"
+#include "margo-default-monitoring-watchdog.h"
+#include "margo-default-monitoring-metrics.h"
+#include "margo-default-monitoring-openmetrics.h"
 
 /*
  * Statistics in Margo's default monitoring system
@@ -66,6 +76,41 @@
  * Note that RPC ids above contain the encoded provider ids, so
  * demux_id can be used to further obtain the provider id and base id
  * from these RPC ids.
+ *
+ * All the above statistics are sharded per execution stream: each
+ * xstream (indexed by its rank) updates its own monitor_shard_t, whose
+ * mutex is only contended by the dump operation (and by the rare threads
+ * that share a shard, such as non-Argobots threads, which use shard 0).
+ * The shards are merged lazily when the statistics are converted into
+ * JSON. Sessions cache the statistics entry of the shard in which they
+ * started; an event occurring on another xstream looks up the entry with
+ * the same key in its own shard.
+ *
+ * To avoid converting addresses into strings on every RPC, each shard
+ * also caches the address ids of the last ADDR_CACHE_CAPACITY hg_addr_t
+ * it has seen, in LRU order. Each cached entry holds a reference to its
+ * address (margo_addr_dup), so the address of a peer that is gone, e.g.
+ * a departed client, stays allocated until it is evicted by more recent
+ * addresses or until the instance is finalized. At most
+ * ADDR_CACHE_CAPACITY addresses are held per shard in use, i.e. per
+ * xstream running monitored operations (up to MONITOR_NUM_SHARDS).
+ *
+ * The statistics also include histograms of the duration of the progress
+ * loop iterations (between consecutive progress calls) and of the number
+ * of callbacks triggered in each.
+ *
+ * Latency histograms (see histogram_t) are kept next to some statistics
+ * to report the percentiles listed in the "statistics.percentiles" array
+ * (e.g. [50, 90, 99, 99.9]). They are disabled by default (empty array),
+ * because of their memory cost: entries are kept per callpath, hence per
+ * peer, and per shard, so their memory grows with the number of peers
+ * times the number of RPCs times the number of xstreams handling them.
+ * Each origin entry has 1 histogram, each target entry 3, and each bulk
+ * entry 1, of about 1 to 2 KiB for typical latencies. For instance, 1000
+ * clients each sending 10 RPCs handled by 8 xstreams may use up to
+ * 1000 x 10 x 8 x 3 target histograms, i.e. 230 to 470 MiB. The latency
+ * quantiles of the metrics segment and the buckets of the OpenMetrics
+ * export also come from these histograms.
  */
 
 /*
@@ -94,425 +139,320 @@
  * RPC time series are managed by a UThash indexed by RPC id
  * (not callpath, contrary to statistics, but the RPC id does
  * include the provider id).
+ * RPC handlers and bulk transfers only increment counts in their
+ * xstream's shard (see statistics above); the periodic update sums
+ * and resets the counts of all the shards before adding a value, so
+ * the mutex of the RPC time series is not taken on the RPC path.
  * Pool time series are managed by an array initialized with
  * the number of pools specified in margo's configuration.
+ *
+ * The Argobots profiler time series are described in
+ * margo-default-monitoring-abt.h.
  */
 
-/* ========================================================================
- * Helper JSON-C function
- * ======================================================================== */
-
-/* This function checks if a key is present in a json object and, if not,
- * will create it and associate it with an empty object.
- * This function does not check that the provided root object is indeed
- * a JSON object.
+/*
+ * Spans in Margo's default monitoring system
+ * ==========================================
+ *
+ * For the RPCs that carry a sampled trace context (see
+ * margo_start_trace_context), the monitor records a client span (from
+ * forward to the end of the wait) at the origin and a server span (from
+ * the handler to the end of the respond) at the target. Both have the
+ * span id generated by the origin, so the spans files of the processes
+ * involved in a trace can be joined offline on trace and span ids.
+ * Traced RPCs are always monitored, regardless of sample_rpcs_every.
+ *
+ * Up to "max_spans" spans are kept in memory; spans recorded past that
+ * are counted as dropped until the spans are dumped with reset.
  */
-inline static struct json_object*
-json_object_object_get_or_create_object(struct json_object* root,
-                                        const char*         key)
-{
-    struct json_object* result = json_object_object_get(root, key);
-    if (!result) {
-        result = json_object_new_object();
-        json_object_object_add_ex(root, key, result,
-                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    }
-    return result;
-}
-
-/* ========================================================================
- * Statistics structure definitions
- * ======================================================================== */
 
-struct default_monitor_state;
-
-typedef struct statistics {
-    uint64_t num; /* number of samples  */
-    double   min; /* minimum value      */
-    double   max; /* maximum value      */
-    double   sum; /* sum of all samples */
-    double   avg; /* running average    */
-    double   var; /* running variance   */
-    /* mutex protecting accesses */
-    ABT_mutex_memory mutex;
-} statistics_t;
-
-typedef struct callpath {
-    hg_id_t  rpc_id;    /* current RPC id */
-    hg_id_t  parent_id; /* id of the RPC it came from, if any */
-    uint64_t addr_id; /* address the current RPC was sent to or received from */
-} callpath_t;
-
-/* Bulk transfer operations are further indexed by
- * the remote address and the operation, in addition
- * to their callpath.
+/*
+ * Exporters of Margo's default monitoring system
+ * ==============================================
+ *
+ * The shared-memory metrics segment, the OpenMetrics export, the
+ * outliers, and the progress loop watchdog are implemented in their own
+ * files (margo-default-monitoring-*.c), and described in their headers.
  */
-typedef struct bulk_key {
-    callpath_t callpath;
-    uint64_t
-        remote_addr_id; /* address of the peer with which transfer is done */
-    hg_bulk_op_t operation; /* PULL or PUSH */
-} bulk_key_t;
-
-#define UPDATE_STATISTICS_WITH(stats, value)                               \
-    do {                                                                   \
-        ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&((stats).mutex))); \
-        (stats).num += 1;                                                  \
-        (stats).min = ((stats).min > (value) || (stats).num == 1)          \
-                        ? (value)                                          \
-                        : (stats).min;                                     \
-        (stats).max = ((stats).max < (value)) ? (value) : (stats).max;     \
-        (stats).sum += (value);                                            \
-        double old_avg = (stats).avg;                                      \
-        (stats).avg    = (stats).sum / (stats).num;                        \
-        (stats).var                                                        \
-            = (stats).var + ((value)-old_avg) * ((value) - (stats).avg);   \
-        ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&((stats).mutex)));   \
-    } while (0)
 
-static struct json_object* statistics_to_json(const statistics_t* stats,
-                                              bool                reset);
-
-/* Statistics related to the Mercury progress loop */
-typedef struct hg_statistics {
-    statistics_t progress_with_timeout;
-    statistics_t progress_without_timeout;
-    statistics_t progress_timeout_value;
-    statistics_t trigger;
-} hg_statistics_t;
-
-static struct json_object* hg_statistics_to_json(const hg_statistics_t* stats,
-                                                 bool                   reset);
-
-/* Some statistics fields in the following structures will be
- * a pair of "duration" statistics (duration of the operation)
- * and "timestamp" statistics (timestamp of the operation
- * relative to another, earlier operation). In the latter case,
- * the reference operation used for the timestamp is marked with
- * a comment.
+/*
+ * CPU time in Margo's default monitoring system
+ * =============================================
+ *
+ * The duration of a handler ULT includes the time it spends blocked in
+ * nested RPCs, bulk transfers and responses. If the "cpu_time"
+ * configuration is present, the monitor also measures the time the ULT
+ * spends on CPU, using the CPU clock of the thread of its xstream
+ * (CLOCK_THREAD_CPUTIME_ID). The clock is read when the ULT starts and
+ * ends, and around each margo_wait it makes, and the CPU time of the
+ * segments between these points is summed (a segment that ends on
+ * another xstream than it started on is not counted). The "cpu_time"
+ * statistics of each RPC at its target can then be compared with those
+ * of its "ult" to tell CPU-bound RPCs from the others.
+ *
+ * The clock is also read around margo_thread_sleep, and around the waits
+ * on requests left out by sampling (sample_rpcs_every), which margo
+ * reports to the monitor with their skipped argument set, although none
+ * of their other events are. Other ULTs that run while the handler
+ * blocks or yields outside of margo (e.g. when locking an ABT_mutex,
+ * waiting on an ABT_eventual, or in ABT_thread_yield) still have their
+ * CPU time accounted to the handler.
  */
-enum
-{
-    DURATION  = 0,
-    TIMESTAMP = 1
-};
 
-/* Statistics related to bulk creation. */
-typedef struct bulk_create_statistics {
-    statistics_t   duration;
-    statistics_t   size;
-    callpath_t     callpath; /* hash key */
-    UT_hash_handle hh;       /* hash handle */
-} bulk_create_statistics_t;
-
-static struct json_object*
-bulk_create_statistics_to_json(const bulk_create_statistics_t* stats,
-                               bool                            reset);
-
-/* Statistics related to bulk transfers */
-typedef struct bulk_transfer_statistics {
-    statistics_t   transfer; /* reference timestamp */
-    statistics_t   transfer_size;
-    statistics_t   transfer_cb[2];
-    statistics_t   wait[2];
-    bulk_key_t     bulk_key; /* hash key */
-    UT_hash_handle hh;       /* hash handle */
-} bulk_transfer_statistics_t;
-
-static struct json_object*
-bulk_transfer_statistics_to_json(const bulk_transfer_statistics_t* stats,
-                                 bool                              reset);
-
-/* Statistics related to RPCs at their origin */
-typedef struct origin_rpc_statistics {
-    /* reference timestamp is the create operation,
-     * for which no statistics are collected */
-    statistics_t   forward[2];
-    statistics_t   forward_cb[2];
-    statistics_t   wait[2];
-    statistics_t   set_input[2];
-    statistics_t   get_output[2];
-    callpath_t     callpath; /* hash key */
-    UT_hash_handle hh;       /* hash handle */
-} origin_rpc_statistics_t;
-
-static struct json_object*
-origin_rpc_statistics_to_json(const origin_rpc_statistics_t* stats, bool reset);
-
-/* Statistics related to RPCs at their target */
-typedef struct target_rpc_statistics {
-    statistics_t   handler; /* handler timestamp isn't used */
-    statistics_t   ult[2];
-    statistics_t   respond[2];
-    statistics_t   respond_cb[2];
-    statistics_t   wait[2];
-    statistics_t   set_output[2];
-    statistics_t   get_input[2];
-    callpath_t     callpath; /* hash key */
-    UT_hash_handle hh;       /* hash handle */
-} target_rpc_statistics_t;
-
-static struct json_object*
-target_rpc_statistics_to_json(const target_rpc_statistics_t* stats, bool reset);
+/* Must be called with the mutex of the shard containing stats held */
+#define UPDATE_STATISTICS_WITH(stats, value)                             \
+    do {                                                                 \
+        (stats).num += 1;                                                \
+        (stats).min = ((stats).min > (value) || (stats).num == 1)        \
+                        ? (value)                                        \
+                        : (stats).min;                                   \
+        (stats).max = ((stats).max < (value)) ? (value) : (stats).max;   \
+        (stats).sum += (value);                                          \
+        double old_avg = (stats).avg;                                    \
+        (stats).avg    = (stats).sum / (stats).num;                      \
+        (stats).var                                                      \
+            = (stats).var + ((value)-old_avg) * ((value) - (stats).avg); \
+    } while (0)
 
-/* ========================================================================
- * Time series structure definitions
- * ======================================================================== */
+/* Number of statistics_t at the beginning of a structure, before __field__ */
+#define NUM_STATISTICS_BEFORE(__type__, __field__) \
+    (offsetof(__type__, __field__) / sizeof(statistics_t))
 
-/* uint64_t value associated with a timestamp */
-typedef struct timedval {
-    uint64_t value;
-    double   timestamp;
-} timedval_t;
-
-/* Linked list of arrays of time_uint64_t */
-typedef struct timedval_frame {
-    struct timedval_frame* next;    /* next frame */
-    size_t                 size;    /* current size of the data array */
-    timedval_t             data[1]; /* data */
-} timedval_frame_t;
-
-/* Time series */
-typedef struct time_series {
-    size_t            frame_capacity; /* allocated size of each frame */
-    timedval_frame_t* first_frame;
-    timedval_frame_t* last_frame;
-} time_series_t;
-
-static void time_series_append(time_series_t* series, double ts, uint64_t val);
-static void time_series_clear(time_series_t* series);
-
-/* RPC-related time series */
-typedef struct rpc_time_series {
-    uint64_t      rpc_count;        /* count of RPCs since last added value */
-    time_series_t rpc_count_series; /* time series of rpc_count */
-    uint64_t bulk_size; /* total size bulk-transferred since last added value */
-    time_series_t  bulk_size_series; /* time series of bulk-transferred size */
-    hg_id_t        rpc_id;           /* hash key */
-    UT_hash_handle hh;               /* hash handle */
-    /* mutex protecting accesses */
-    ABT_mutex_memory mutex;
-} rpc_time_series_t;
+static void statistics_merge(statistics_t*       dst,
+                             const statistics_t* src,
+                             size_t              count);
 
+static void histogram_merge(histogram_t*       dst,
+                            const histogram_t* src,
+                            size_t             count);
+static void histogram_reset(histogram_t* hist, size_t count);
+static void histogram_free(histogram_t* hist, size_t count);
+
+static void init_time_series_tiers(default_monitor_state_t* monitor,
+                                   struct json_object*      tiers);
 static rpc_time_series_t*
 find_or_add_time_series_for_rpc(struct default_monitor_state* monitor,
                                 hg_id_t                       rpc_id);
+static rpc_ts_count_t* rpc_ts_count_find_or_add(struct monitor_shard* shard,
+                                                hg_id_t               rpc_id);
 static void free_all_time_series(struct default_monitor_state* monitor);
-static struct json_object* rpc_time_series_to_json(rpc_time_series_t* rpc_ts,
-                                                   bool               reset);
+static void rpc_time_series_write(margo_json_writer_t*                w,
+                                  const struct default_monitor_state* monitor,
+                                  rpc_time_series_t*                  rpc_ts,
+                                  bool                                reset);
 static void update_rpc_time_series(struct default_monitor_state* monitor,
                                    double                        timestamp);
 
 static void update_pool_time_series(struct default_monitor_state* monitor,
                                     double                        timestamp);
-static struct json_object*
-pool_time_series_to_json(const struct default_monitor_state* monitor,
-                         bool                                reset);
-
-/* ========================================================================
- * RPC info
- * ======================================================================== */
+static void pool_time_series_write(margo_json_writer_t*                w,
+                                   const struct default_monitor_state* monitor,
+                                   bool                                reset);
 
-/* Structure used to track registered RPCs */
-typedef struct rpc_info {
-    hg_id_t        id;
-    UT_hash_handle hh;
-    char           name[1];
-} rpc_info_t;
-
-static rpc_info_t* rpc_info_find(rpc_info_t* hash, hg_id_t id);
-static void        rpc_info_clear(rpc_info_t* hash);
-
-/* Structure used to track addresses, hashed by name */
-typedef struct addr_info {
-    UT_hash_handle hh_by_id;
-    UT_hash_handle hh_by_name;
-    uint64_t       id;
-    char           name[1];
-} addr_info_t;
+static void rpc_info_clear(rpc_info_t* hash);
 
 static addr_info_t* addr_info_find_or_add(struct default_monitor_state* monitor,
-                                          margo_instance_id             mid,
-                                          hg_addr_t                     addr);
-static addr_info_t*
-addr_info_find_by_id(const struct default_monitor_state* monitor, uint64_t id);
+                                          const char*                   name,
+                                          size_t                        size);
 static void addr_info_clear(addr_info_t* hash_by_id, addr_info_t* hash_by_name);
 
-struct session;
-struct bulk_session;
-
-/* Root of the monitor's state */
-typedef struct default_monitor_state {
-    margo_instance_id mid;
-    bool              enable_statistics;
-    bool              enable_time_series;
-    char*             filename_prefix;
-    int               precision; /* precision used when printing doubles */
-    int stats_pretty_json;       /* use tabs and stuff in JSON printing */
-    int time_series_pretty_json; /* use tabs and stuff in JSON printing */
-    int sample_progress_every;
-    /* self address */
-    char* self_addr_str;
-    /* sampling counter */
-    uint64_t progress_sampling;
-    /* RPC information */
-    rpc_info_t*      rpc_info;
-    ABT_mutex_memory rpc_info_mtx;
-    /* Address info */
-    addr_info_t* addr_info_by_name; /* hash of addr_info_t by name field */
-    addr_info_t* addr_info_by_id;   /* hash of addr_info_t by id field */
-    uint64_t     addr_info_last_id; /* last id used for addresses */
-    ABT_mutex_memory
-        addr_info_mtx; /* mutex protecting access to the addr_info fields */
-    /* Argobots keys */
-    ABT_key callpath_key; /* may be associated with a callpath */
-    /* Statistics and their mutex */
-    hg_statistics_t             hg_stats;
-    ABT_mutex_memory            hg_stats_mtx;
-    bulk_create_statistics_t*   bulk_create_stats;
-    ABT_mutex_memory            bulk_create_stats_mtx;
-    bulk_transfer_statistics_t* bulk_transfer_stats;
-    ABT_mutex_memory            bulk_transfer_stats_mtx;
-    origin_rpc_statistics_t*    origin_rpc_stats;
-    ABT_mutex_memory            origin_rpc_stats_mtx;
-    target_rpc_statistics_t*    target_rpc_stats;
-    ABT_mutex_memory            target_rpc_stats_mtx;
-    /* Time series and their mutex */
-    rpc_time_series_t* rpc_time_series; /* hash */
-    ABT_mutex_memory   rpc_time_series_mtx;
-    time_series_t* pool_size_time_series; /* array of size mid->abt.pools_len */
-    time_series_t*
-        pool_total_size_time_series; /* array of size mid->abt.pools_len */
-    ABT_mutex_memory pool_time_series_mtx;
-    double           rpc_time_series_last_ts;
-    double           time_series_interval;
-    /* session and bulk_session pools */
-    struct session*      session_pool;
-    ABT_mutex_memory     session_pool_mtx;
-    struct bulk_session* bulk_session_pool;
-    ABT_mutex_memory     bulk_session_pool_mtx;
-    /* Time series */
-} default_monitor_state_t;
-
-static struct json_object*
-monitor_statistics_to_json(const default_monitor_state_t* monitor, bool reset);
-static struct json_object*
-monitor_time_series_to_json(const default_monitor_state_t* monitor, bool reset);
+static uint64_t addr_id_find_or_add(struct default_monitor_state* monitor,
+                                    struct monitor_shard*         shard,
+                                    margo_instance_id             mid,
+                                    hg_addr_t                     addr);
+static void     addr_cache_clear(struct default_monitor_state* monitor,
+                                 struct monitor_shard*         shard);
+
+/* Whether the session of the handler ULT is associated with the ULT
+ * (through session_key) while it runs */
+static inline bool
+tracks_handler_sessions(const default_monitor_state_t* monitor)
+{
+    return monitor->enable_outliers || monitor->enable_cpu_time;
+}
+
+/* Counts an RPC issued (is_origin) or received by the process and
+ * decides whether to monitor it. One in every sample_rpcs_every RPCs of
+ * each id is sampled, so that rare RPCs are not missed. Must be called
+ * with the shard's mutex held. The RPCs that are not sampled are then
+ * excluded from monitoring with margo_monitoring_skip_handle, so none
+ * of the other callbacks are invoked for them, except on_destroy.
+ */
+static bool sample_rpc(const default_monitor_state_t* monitor,
+                       monitor_shard_t*               shard,
+                       hg_id_t                        id,
+                       bool                           is_origin)
+{
+    if (monitor->sample_rpcs_every <= 1) return true;
+    uint16_t provider_id;
+    hg_id_t  base_id;
+    demux_id(id, &base_id, &provider_id);
+    rpc_count_t* count = NULL;
+    HASH_FIND(hh, shard->rpc_counts, &base_id, sizeof(base_id), count);
+    if (!count) {
+        count     = (rpc_count_t*)calloc(1, sizeof(*count));
+        count->id = base_id;
+        HASH_ADD(hh, shard->rpc_counts, id, sizeof(count->id), count);
+    }
+    uint64_t* total   = is_origin ? &count->origin_total : &count->target_total;
+    uint64_t* sampled = is_origin ? &count->origin_sampled
+                                  : &count->target_sampled;
+    bool      result  = (*total % monitor->sample_rpcs_every) == 0;
+    *total += 1;
+    *sampled += result;
+    return result;
+}
 
+/* Defines the following functions for a hash of statistics in a shard,
+ * in addition to those defined by DEFINE_SHARD_HASH_LOOKUP_FUNCTIONS:
+ * - <hash>_merge(dst, src, reset): merges the entries (statistics and
+ *   histograms) of src into dst;
+ * - <hash>_clear(shard): frees all the entries.
+ * Both must be called with the shard's mutex held.
+ */
+#define DEFINE_SHARD_HASH_FUNCTIONS(__hash__, __type__, __key__)               \
+    static void __hash__##_merge(monitor_shard_t* dst, monitor_shard_t* src,   \
+                                 bool reset)                                   \
+    {                                                                          \
+        __type__ *p, *tmp;                                                     \
+        size_t    count      = NUM_STATISTICS_BEFORE(__type__, hist);          \
+        size_t    hist_count = sizeof(p->hist) / sizeof(histogram_t);          \
+        HASH_ITER(hh, src->__hash__, p, tmp)                                   \
+        {                                                                      \
+            __type__* q = __hash__##_find_or_add(dst, &p->__key__);            \
+            statistics_merge((statistics_t*)q, (statistics_t*)p, count);       \
+            histogram_merge(q->hist, p->hist, hist_count);                     \
+            if (!reset) continue;                                              \
+            memset(p, 0, count * sizeof(statistics_t));                        \
+            histogram_reset(p->hist, hist_count);                              \
+        }                                                                      \
+    }                                                                          \
+    static void __hash__##_clear(monitor_shard_t* shard)                       \
+    {                                                                          \
+        __type__ *p, *tmp;                                                     \
+        HASH_ITER(hh, shard->__hash__, p, tmp)                                 \
+        {                                                                      \
+            HASH_DEL(shard->__hash__, p);                                      \
+            histogram_free(p->hist, sizeof(p->hist) / sizeof(histogram_t));    \
+            free(p);                                                           \
+        }                                                                      \
+    }
+
+DEFINE_SHARD_HASH_FUNCTIONS(origin_rpc_stats,
+                            origin_rpc_statistics_t,
+                            callpath)
+DEFINE_SHARD_HASH_FUNCTIONS(target_rpc_stats,
+                            target_rpc_statistics_t,
+                            callpath)
+DEFINE_SHARD_HASH_FUNCTIONS(bulk_create_stats,
+                            bulk_create_statistics_t,
+                            callpath)
+DEFINE_SHARD_HASH_FUNCTIONS(bulk_transfer_stats,
+                            bulk_transfer_statistics_t,
+                            bulk_key)
+
+static void monitor_statistics_write(margo_json_writer_t*           w,
+                                     const default_monitor_state_t* monitor,
+                                     bool                           reset);
+static void monitor_time_series_write(margo_json_writer_t*           w,
+                                      const default_monitor_state_t* monitor,
+                                      bool                           reset);
+static void monitor_spans_write(margo_json_writer_t*           w,
+                                const default_monitor_state_t* monitor,
+                                bool                           reset);
 static void
 write_monitor_state_to_json_file(const default_monitor_state_t* monitor,
                                  bool                           reset);
 
-/* A session is an object that will be associated with an hg_handle_t
- * when on_forward or on_rpc_handler is invoked, and will be destroyed
- * when on_destroy is called on the handle.
- *
- * Note that when a process sends an RPC to itself, the hg_handle_t
- * is the same in the sender logic (forward, forward_cb, etc.) and
- * in the receiver logic (rpc_handler, respond, etc.), so we cannot
- * factor the origin and target fields into a union.
- */
-typedef struct session {
-    struct {
-        double                   create_ts;
-        double                   forward_start_ts;
-        double                   forward_end_ts;
-        double                   wait_end_ts;
-        origin_rpc_statistics_t* stats;
-    } origin;
-    struct {
-        double                   handler_start_ts;
-        double                   ult_start_ts;
-        double                   respond_start_ts;
-        double                   respond_end_ts;
-        target_rpc_statistics_t* stats;
-    } target;
-    struct session* next; /* used to managed the session pool */
-} session_t;
-
-typedef struct bulk_session {
-    double                      transfer_start_ts;
-    double                      transfer_end_ts;
-    bulk_transfer_statistics_t* stats;
-    struct bulk_session* next; /* used to managed the bulk_session pool */
-} bulk_session_t;
+/* Starts a segment of CPU time of a handler ULT */
+static inline void cpu_time_resume(target_session_t* session)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return;
+    session->cpu_segment_start   = ts.tv_sec + ts.tv_nsec * 1e-9;
+    session->cpu_segment_rank    = self_xstream_rank();
+    session->cpu_segment_running = true;
+}
+
+/* Ends a segment of CPU time of a handler ULT. The thread CPU clocks of
+ * different xstreams cannot be compared, so the segment is dropped if
+ * the ULT has migrated. */
+static inline void cpu_time_pause(target_session_t* session)
+{
+    if (!session->cpu_segment_running) return;
+    session->cpu_segment_running = false;
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return;
+    if (session->cpu_segment_rank != self_xstream_rank()) return;
+    double t = ts.tv_sec + ts.tv_nsec * 1e-9 - session->cpu_segment_start;
+    if (t > 0.0) session->cpu_time += t;
+}
+
+/* Pauses (blocking) or resumes the CPU time of the calling ULT, if it is
+ * a handler ULT with a session */
+static inline void cpu_time_block(const default_monitor_state_t* monitor,
+                                  bool                           blocking)
+{
+    session_t* rpc_session = NULL;
+    ABT_key_get(monitor->session_key, (void**)&rpc_session);
+    if (!rpc_session) return;
+    if (blocking)
+        cpu_time_pause(&rpc_session->target);
+    else
+        cpu_time_resume(&rpc_session->target);
+}
 
+
+/* Sessions are taken from and released to the pool of the shard of
+ * the calling xstream, so these functions must not be called with the
+ * mutex of a shard held.
+ */
 static inline session_t* new_session(default_monitor_state_t* monitor)
 {
-    session_t* result = NULL;
-    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->session_pool_mtx));
-    if (monitor->session_pool) {
-        result                = monitor->session_pool;
-        monitor->session_pool = result->next;
+    session_t*       result = NULL;
+    monitor_shard_t* shard  = shard_lock(monitor);
+    if (shard->session_pool) {
+        result              = shard->session_pool;
+        shard->session_pool = result->next;
         memset(result, 0, sizeof(*result));
     } else {
         result = (session_t*)calloc(1, sizeof(*result));
     }
-    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->session_pool_mtx));
+    shard_unlock(shard);
     return result;
 }
 
 static inline void release_session(default_monitor_state_t* monitor,
                                    session_t*               session)
 {
-    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->session_pool_mtx));
-    session->next         = monitor->session_pool;
-    monitor->session_pool = session;
-    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->session_pool_mtx));
-}
-
-static inline void clear_session_pool(default_monitor_state_t* monitor)
-{
-    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->session_pool_mtx));
-    session_t* session = monitor->session_pool;
-    while (session) {
-        session_t* next = session->next;
-        free(session);
-        session = next;
-    }
-    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->session_pool_mtx));
+    monitor_shard_t* shard = shard_lock(monitor);
+    session->next          = shard->session_pool;
+    shard->session_pool    = session;
+    shard_unlock(shard);
 }
 
 static inline bulk_session_t* new_bulk_session(default_monitor_state_t* monitor)
 {
-    bulk_session_t* result = NULL;
-    ABT_mutex_spinlock(
-        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->bulk_session_pool_mtx));
-    if (monitor->bulk_session_pool) {
-        result                     = monitor->bulk_session_pool;
-        monitor->bulk_session_pool = result->next;
+    bulk_session_t*  result = NULL;
+    monitor_shard_t* shard  = shard_lock(monitor);
+    if (shard->bulk_session_pool) {
+        result                   = shard->bulk_session_pool;
+        shard->bulk_session_pool = result->next;
         memset(result, 0, sizeof(*result));
     } else {
         result = (bulk_session_t*)calloc(1, sizeof(*result));
     }
-    ABT_mutex_unlock(
-        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->bulk_session_pool_mtx));
+    shard_unlock(shard);
     return result;
 }
 
 static inline void release_bulk_session(default_monitor_state_t* monitor,
                                         bulk_session_t*          session)
 {
-    ABT_mutex_spinlock(
-        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->bulk_session_pool_mtx));
-    session->next              = monitor->bulk_session_pool;
-    monitor->bulk_session_pool = session;
-    ABT_mutex_unlock(
-        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->bulk_session_pool_mtx));
-}
-
-static inline void clear_bulk_session_pool(default_monitor_state_t* monitor)
-{
-    ABT_mutex_spinlock(
-        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->bulk_session_pool_mtx));
-    bulk_session_t* session = monitor->bulk_session_pool;
-    while (session) {
-        bulk_session_t* next = session->next;
-        free(session);
-        session = next;
-    }
-    ABT_mutex_unlock(
-        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->bulk_session_pool_mtx));
+    monitor_shard_t* shard   = shard_lock(monitor);
+    session->next            = shard->bulk_session_pool;
+    shard->bulk_session_pool = session;
+    shard_unlock(shard);
 }
 
 /* ========================================================================
@@ -527,19 +467,41 @@ static void* __margo_default_monitor_initialize(margo_instance_id   mid,
     default_monitor_state_t* monitor = calloc(1, sizeof(*monitor));
     ABT_key_create(NULL, &(monitor->callpath_key));
     monitor->mid = mid;
+    for (int i = 0; i < MONITOR_NUM_SHARDS; i++) {
+        /* allocated separately to avoid false sharing */
+        monitor->shards[i] = calloc(1, sizeof(monitor_shard_t));
+    }
 
     /* default configuration */
     const char* prefix         = getenv("MARGO_MONITORING_FILENAME_PREFIX");
     const char* disable_stats  = getenv("MARGO_MONITORING_DISABLE_STATISTICS");
     const char* disable_series = getenv("MARGO_MONITORING_DISABLE_TIME_SERIES");
+    const char* disable_spans  = getenv("MARGO_MONITORING_DISABLE_SPANS");
+    const char* metrics_prefix = getenv("MARGO_METRICS_FILENAME_PREFIX");
+    const char* om_prefix      = getenv("MARGO_OPENMETRICS_FILENAME_PREFIX");
     monitor->filename_prefix   = strdup(prefix ? prefix : "margo");
     monitor->precision         = 9;
     monitor->stats_pretty_json = 0;
     monitor->time_series_pretty_json = 0;
     monitor->sample_progress_every   = 1;
+    monitor->sample_rpcs_every       = 1;
+    monitor->num_percentiles         = 0;
     monitor->time_series_interval    = 1.0;
     monitor->enable_statistics       = !disable_stats;
     monitor->enable_time_series      = !disable_series;
+    monitor->enable_spans            = !disable_spans;
+    monitor->max_spans               = 65536;
+    monitor->metrics_filename_prefix
+        = metrics_prefix ? strdup(metrics_prefix) : NULL;
+    monitor->metrics_interval = 1.0;
+    monitor->openmetrics_filename_prefix = om_prefix ? strdup(om_prefix)
+                                                     : NULL;
+    monitor->openmetrics_interval        = 10.0;
+    monitor->outlier_percentile          = 99.0;
+    monitor->outlier_min_samples         = 100;
+    monitor->max_outliers                = 128;
+    monitor->watchdog_threshold          = 1.0;
+    monitor->progress_xstream            = -1;
 
     /* read configuration */
     struct json_object* filename_prefix
@@ -550,6 +512,13 @@ static void* __margo_default_monitor_initialize(margo_instance_id   mid,
         monitor->filename_prefix
             = strdup(json_object_get_string(filename_prefix));
     }
+    struct json_object* dump_chunk_size
+        = json_object_object_get(config, "dump_chunk_size");
+    if (dump_chunk_size && json_object_is_type(dump_chunk_size, json_type_int)
+        && json_object_get_int64(dump_chunk_size) > 0) {
+        monitor->dump_chunk_size
+            = (size_t)json_object_get_int64(dump_chunk_size);
+    }
     /* statistics configuration */
     struct json_object* statistics
         = json_object_object_get(config, "statistics");
@@ -572,12 +541,35 @@ static void* __margo_default_monitor_initialize(margo_instance_id   mid,
             if (monitor->sample_progress_every <= 0)
                 monitor->sample_progress_every = 0;
         }
+        struct json_object* rpc_sampling
+            = json_object_object_get(statistics, "sample_rpcs_every");
+        if (rpc_sampling && json_object_is_type(rpc_sampling, json_type_int)) {
+            monitor->sample_rpcs_every = json_object_get_int(rpc_sampling);
+            if (monitor->sample_rpcs_every <= 0)
+                monitor->sample_rpcs_every = 1;
+        }
         struct json_object* pretty_json
             = json_object_object_get(statistics, "pretty_json");
         if (pretty_json && json_object_is_type(pretty_json, json_type_boolean)
             && json_object_get_boolean(pretty_json)) {
             monitor->stats_pretty_json = JSON_C_TO_STRING_PRETTY;
         }
+        struct json_object* percentiles
+            = json_object_object_get(statistics, "percentiles");
+        if (percentiles && json_object_is_type(percentiles, json_type_array)) {
+            size_t n                 = json_object_array_length(percentiles);
+            monitor->num_percentiles = 0;
+            for (size_t i = 0; i < n && i < MAX_PERCENTILES; i++) {
+                struct json_object* pct
+                    = json_object_array_get_idx(percentiles, i);
+                if (!(json_object_is_type(pct, json_type_double)
+                      || json_object_is_type(pct, json_type_int)))
+                    continue;
+                double v = json_object_get_double(pct);
+                if (v <= 0.0 || v > 100.0) continue;
+                monitor->percentiles[monitor->num_percentiles++] = v;
+            }
+        }
     }
 
     /* time_series configuration */
@@ -611,6 +603,180 @@ static void* __margo_default_monitor_initialize(margo_instance_id   mid,
             && json_object_get_boolean(pretty_json)) {
             monitor->time_series_pretty_json = JSON_C_TO_STRING_PRETTY;
         }
+        struct json_object* abt_profiling
+            = json_object_object_get(time_series, "abt_profiling");
+        if (abt_profiling
+            && json_object_is_type(abt_profiling, json_type_boolean)) {
+            monitor->enable_abt_time_series
+                = json_object_get_boolean(abt_profiling);
+        }
+    }
+    init_time_series_tiers(
+        monitor, time_series ? json_object_object_get(time_series, "tiers")
+                             : NULL);
+
+    /* spans configuration */
+    struct json_object* spans = json_object_object_get(config, "spans");
+    if (spans && json_object_is_type(spans, json_type_object)) {
+        struct json_object* disable = json_object_object_get(spans, "disable");
+        if (disable && json_object_is_type(disable, json_type_boolean)) {
+            monitor->enable_spans = !json_object_get_boolean(disable);
+        }
+        struct json_object* max_spans
+            = json_object_object_get(spans, "max_spans");
+        if (max_spans && json_object_is_type(max_spans, json_type_int)
+            && json_object_get_int64(max_spans) >= 0) {
+            monitor->max_spans = (size_t)json_object_get_int64(max_spans);
+        }
+    }
+    /* spans are built from the sessions, which require statistics */
+    if (!monitor->enable_statistics) monitor->enable_spans = false;
+
+    /* outliers configuration */
+    struct json_object* outliers = json_object_object_get(config, "outliers");
+    if (outliers && json_object_is_type(outliers, json_type_object)) {
+        monitor->enable_outliers = true;
+        struct json_object* disable
+            = json_object_object_get(outliers, "disable");
+        if (disable && json_object_is_type(disable, json_type_boolean)) {
+            monitor->enable_outliers = !json_object_get_boolean(disable);
+        }
+        struct json_object* threshold
+            = json_object_object_get(outliers, "threshold_sec");
+        if (threshold
+            && (json_object_is_type(threshold, json_type_double)
+                || json_object_is_type(threshold, json_type_int))
+            && json_object_get_double(threshold) >= 0.0) {
+            monitor->outlier_threshold = json_object_get_double(threshold);
+        }
+        struct json_object* percentile
+            = json_object_object_get(outliers, "percentile");
+        if (percentile
+            && (json_object_is_type(percentile, json_type_double)
+                || json_object_is_type(percentile, json_type_int))
+            && json_object_get_double(percentile) >= 0.0
+            && json_object_get_double(percentile) < 100.0) {
+            monitor->outlier_percentile = json_object_get_double(percentile);
+        }
+        struct json_object* min_samples
+            = json_object_object_get(outliers, "min_samples");
+        if (min_samples && json_object_is_type(min_samples, json_type_int)
+            && json_object_get_int64(min_samples) >= 0) {
+            monitor->outlier_min_samples
+                = (uint64_t)json_object_get_int64(min_samples);
+        }
+        struct json_object* max_records
+            = json_object_object_get(outliers, "max_records");
+        if (max_records && json_object_is_type(max_records, json_type_int)
+            && json_object_get_int64(max_records) > 0) {
+            monitor->max_outliers = (size_t)json_object_get_int64(max_records);
+        }
+    }
+    /* outliers are detected from the sessions, which require statistics */
+    if (!monitor->enable_statistics) monitor->enable_outliers = false;
+    if (monitor->enable_outliers) {
+        /* the estimate moves up by about q*step when exceeded and down
+         * by about (1-q)*step otherwise, so it is exceeded by a fraction
+         * 1-q of the samples once stable */
+        const double step     = 0.05;
+        double       q        = monitor->outlier_percentile / 100.0;
+        monitor->outlier_up   = 1.0 + step * q;
+        monitor->outlier_down = 1.0 - step * (1.0 - q);
+        monitor->outliers
+            = (outlier_t*)calloc(monitor->max_outliers, sizeof(outlier_t));
+        if (!monitor->outliers) monitor->enable_outliers = false;
+    }
+
+    /* CPU time configuration */
+    struct json_object* cpu_time = json_object_object_get(config, "cpu_time");
+    if (cpu_time && json_object_is_type(cpu_time, json_type_object)) {
+        monitor->enable_cpu_time = true;
+        struct json_object* disable
+            = json_object_object_get(cpu_time, "disable");
+        if (disable && json_object_is_type(disable, json_type_boolean)) {
+            monitor->enable_cpu_time = !json_object_get_boolean(disable);
+        }
+    }
+    /* the CPU time is accounted in the statistics */
+    if (!monitor->enable_statistics) monitor->enable_cpu_time = false;
+    if (tracks_handler_sessions(monitor))
+        ABT_key_create(NULL, &(monitor->session_key));
+
+    /* watchdog configuration */
+    struct json_object* watchdog = json_object_object_get(config, "watchdog");
+    if (watchdog && json_object_is_type(watchdog, json_type_object)) {
+        monitor->enable_watchdog = true;
+        struct json_object* disable
+            = json_object_object_get(watchdog, "disable");
+        if (disable && json_object_is_type(disable, json_type_boolean)) {
+            monitor->enable_watchdog = !json_object_get_boolean(disable);
+        }
+        struct json_object* threshold
+            = json_object_object_get(watchdog, "stall_threshold_sec");
+        if (threshold
+            && (json_object_is_type(threshold, json_type_double)
+                || json_object_is_type(threshold, json_type_int))
+            && json_object_get_double(threshold) > 0.0) {
+            monitor->watchdog_threshold = json_object_get_double(threshold);
+        }
+        struct json_object* interval
+            = json_object_object_get(watchdog, "check_interval_sec");
+        if (interval
+            && (json_object_is_type(interval, json_type_double)
+                || json_object_is_type(interval, json_type_int))
+            && json_object_get_double(interval) > 0.0) {
+            monitor->watchdog_interval = json_object_get_double(interval);
+        }
+    }
+    /* by default, a stall is detected within 10% of the threshold */
+    if (monitor->watchdog_interval == 0.0)
+        monitor->watchdog_interval = monitor->watchdog_threshold / 10.0;
+
+    /* metrics configuration */
+    struct json_object* metrics = json_object_object_get(config, "metrics");
+    if (metrics && json_object_is_type(metrics, json_type_object)) {
+        struct json_object* metrics_prefix_json
+            = json_object_object_get(metrics, "filename_prefix");
+        if (metrics_prefix_json
+            && json_object_is_type(metrics_prefix_json, json_type_string)) {
+            free(monitor->metrics_filename_prefix);
+            monitor->metrics_filename_prefix
+                = strdup(json_object_get_string(metrics_prefix_json));
+        }
+        struct json_object* interval
+            = json_object_object_get(metrics, "interval_sec");
+        if (interval
+            && (json_object_is_type(interval, json_type_double)
+                || json_object_is_type(interval, json_type_int))
+            && json_object_get_double(interval) >= 0.0) {
+            monitor->metrics_interval = json_object_get_double(interval);
+        }
+    }
+
+    /* openmetrics configuration */
+    struct json_object* openmetrics
+        = json_object_object_get(config, "openmetrics");
+    if (openmetrics && json_object_is_type(openmetrics, json_type_object)) {
+        struct json_object* om_prefix_json
+            = json_object_object_get(openmetrics, "filename_prefix");
+        if (om_prefix_json
+            && json_object_is_type(om_prefix_json, json_type_string)) {
+            free(monitor->openmetrics_filename_prefix);
+            monitor->openmetrics_filename_prefix
+                = strdup(json_object_get_string(om_prefix_json));
+        }
+        struct json_object* interval
+            = json_object_object_get(openmetrics, "interval_sec");
+        if (interval
+            && (json_object_is_type(interval, json_type_double)
+                || json_object_is_type(interval, json_type_int))
+            && json_object_get_double(interval) >= 0.0) {
+            monitor->openmetrics_interval = json_object_get_double(interval);
+        }
+        struct json_object* dump = json_object_object_get(openmetrics, "dump");
+        if (dump && json_object_is_type(dump, json_type_boolean)) {
+            monitor->openmetrics_dump = json_object_get_boolean(dump);
+        }
     }
 
     /* allocate time array for pool size time series */
@@ -621,12 +787,14 @@ static void* __margo_default_monitor_initialize(margo_instance_id   mid,
         monitor->pool_total_size_time_series
             = (time_series_t*)calloc(num_pools, sizeof(time_series_t));
         for (size_t i = 0; i < num_pools; i++) {
-            // TODO: make this configurable?
-            monitor->pool_size_time_series[i].frame_capacity       = 256;
-            monitor->pool_total_size_time_series[i].frame_capacity = 256;
+            monitor->pool_size_time_series[i].kind       = TIME_SERIES_MAX;
+            monitor->pool_total_size_time_series[i].kind = TIME_SERIES_MAX;
         }
     }
 
+    /* start the Argobots profiler for its time series */
+    __margo_monitor_abt_time_series_init(monitor);
+
     /* preinitialize sessions */
     for (int i = 0; i < 32; i++) {
         session_t* session = (session_t*)malloc(sizeof(*session));
@@ -645,6 +813,12 @@ static void* __margo_default_monitor_initialize(margo_instance_id   mid,
     margo_addr_free(mid, self_addr);
     monitor->self_addr_str = strdup(self_addr_str[0] ? self_addr_str : "<unknown>");
 
+    /* map the metrics segment, if requested */
+    __margo_monitor_metrics_segment_open(monitor);
+
+    /* start the watchdog thread, if requested */
+    __margo_monitor_watchdog_start(monitor);
+
     return (void*)monitor;
 }
 
@@ -653,14 +827,24 @@ static void __margo_default_monitor_finalize(void* uargs)
     default_monitor_state_t* monitor = (default_monitor_state_t*)uargs;
     if (!monitor) return;
 
+    /* stop the watchdog */
+    __margo_monitor_watchdog_stop(monitor);
+
     /* do a final update of time series */
     double ts = ABT_get_wtime();
     update_rpc_time_series(monitor, ts);
     update_pool_time_series(monitor, ts);
+    __margo_monitor_abt_time_series_update(monitor, ts);
+    if (monitor->abt_prof_started_by_monitor)
+        margo_stop_abt_profiling(monitor->mid);
 
     /* write JSON file */
     write_monitor_state_to_json_file(monitor, false);
 
+    /* remove the metrics segment */
+    __margo_monitor_metrics_segment_close(monitor);
+    free(monitor->openmetrics_filename_prefix);
+
     /* free RPC info */
     rpc_info_clear(monitor->rpc_info);
 
@@ -669,49 +853,23 @@ static void __margo_default_monitor_finalize(void* uargs)
     monitor->addr_info_by_name = NULL;
     monitor->addr_info_by_id   = NULL;
 
-    /* free origin RPC statistics */
-    {
-        origin_rpc_statistics_t *p, *tmp;
-        HASH_ITER(hh, monitor->origin_rpc_stats, p, tmp)
-        {
-            HASH_DEL(monitor->origin_rpc_stats, p);
-            free(p);
-        }
-    }
-    /* free target RPC statistics */
-    {
-        target_rpc_statistics_t *p, *tmp;
-        HASH_ITER(hh, monitor->target_rpc_stats, p, tmp)
-        {
-            HASH_DEL(monitor->target_rpc_stats, p);
-            free(p);
-        }
-    }
-    /* free bulk_create statistics */
-    {
-        bulk_create_statistics_t *p, *tmp;
-        HASH_ITER(hh, monitor->bulk_create_stats, p, tmp)
-        {
-            HASH_DEL(monitor->bulk_create_stats, p);
-            free(p);
-        }
-    }
-    /* free bulk_transfer statistics */
-    {
-        bulk_transfer_statistics_t *p, *tmp;
-        HASH_ITER(hh, monitor->bulk_transfer_stats, p, tmp)
-        {
-            HASH_DEL(monitor->bulk_transfer_stats, p);
-            free(p);
-        }
+    /* free statistics and session pools */
+    for (int i = 0; i < MONITOR_NUM_SHARDS; i++) {
+        /* no-op if already done by on_finalize */
+        addr_cache_clear(monitor, monitor->shards[i]);
+        __margo_monitor_shard_clear(monitor->shards[i]);
+        free(monitor->shards[i]);
     }
     /* free RPC and bulk time series */
     free_all_time_series(monitor);
-    /* free session pools */
-    clear_session_pool(monitor);
-    clear_bulk_session_pool(monitor);
-    /* free ABT key */
+    /* free spans */
+    free(monitor->spans);
+    /* free outliers */
+    free(monitor->outliers);
+    /* free ABT keys */
     ABT_key_free(&(monitor->callpath_key));
+    if (tracks_handler_sessions(monitor))
+        ABT_key_free(&(monitor->session_key));
     /* free filename */
     free(monitor->filename_prefix);
     /* free self_addr */
@@ -733,6 +891,10 @@ static struct json_object* __margo_default_monitor_config(void* uargs)
     json_object_object_add_ex(config, "precision",
                               json_object_new_int(monitor->precision),
                               JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    json_object_object_add_ex(
+        config, "dump_chunk_size",
+        json_object_new_uint64(monitor->dump_chunk_size),
+        JSON_C_OBJECT_ADD_KEY_IS_NEW);
     struct json_object* statistics = json_object_new_object();
     json_object_object_add_ex(config, "statistics", statistics,
                               JSON_C_OBJECT_ADD_KEY_IS_NEW);
@@ -744,6 +906,17 @@ static struct json_object* __margo_default_monitor_config(void* uargs)
         statistics, "disable",
         json_object_new_boolean(!monitor->enable_statistics),
         JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    struct json_object* percentiles
+        = json_object_new_array_ext((int)monitor->num_percentiles);
+    for (size_t i = 0; i < monitor->num_percentiles; i++)
+        json_object_array_add(percentiles,
+                              json_object_new_double(monitor->percentiles[i]));
+    json_object_object_add_ex(statistics, "percentiles", percentiles,
+                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    json_object_object_add_ex(
+        statistics, "sample_rpcs_every",
+        json_object_new_int(monitor->sample_rpcs_every),
+        JSON_C_OBJECT_ADD_KEY_IS_NEW);
     struct json_object* time_series = json_object_new_object();
     json_object_object_add_ex(config, "time_series", time_series,
                               JSON_C_OBJECT_ADD_KEY_IS_NEW);
@@ -759,6 +932,102 @@ static struct json_object* __margo_default_monitor_config(void* uargs)
         time_series, "time_interval_sec",
         json_object_new_double(monitor->time_series_interval),
         JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    json_object_object_add_ex(
+        time_series, "abt_profiling",
+        json_object_new_boolean(monitor->enable_abt_time_series),
+        JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    struct json_object* tiers
+        = json_object_new_array_ext((int)monitor->num_time_series_tiers);
+    json_object_object_add_ex(time_series, "tiers", tiers,
+                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    for (size_t i = 0; i < monitor->num_time_series_tiers; i++) {
+        const time_series_tier_config_t* tier = &monitor->time_series_tiers[i];
+        struct json_object*              tier_json = json_object_new_object();
+        json_object_array_add(tiers, tier_json);
+        json_object_object_add_ex(tier_json, "resolution_sec",
+                                  json_object_new_double(tier->resolution),
+                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(
+            tier_json, "retention_sec",
+            json_object_new_double(tier->resolution * tier->capacity),
+            JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    }
+    struct json_object* spans = json_object_new_object();
+    json_object_object_add_ex(config, "spans", spans,
+                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    json_object_object_add_ex(spans, "disable",
+                              json_object_new_boolean(!monitor->enable_spans),
+                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    json_object_object_add_ex(spans, "max_spans",
+                              json_object_new_uint64(monitor->max_spans),
+                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    if (monitor->enable_outliers) {
+        struct json_object* outliers = json_object_new_object();
+        json_object_object_add_ex(config, "outliers", outliers,
+                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(
+            outliers, "threshold_sec",
+            json_object_new_double(monitor->outlier_threshold),
+            JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(
+            outliers, "percentile",
+            json_object_new_double(monitor->outlier_percentile),
+            JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(
+            outliers, "min_samples",
+            json_object_new_uint64(monitor->outlier_min_samples),
+            JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(
+            outliers, "max_records",
+            json_object_new_uint64(monitor->max_outliers),
+            JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    }
+    if (monitor->enable_cpu_time) {
+        json_object_object_add_ex(config, "cpu_time", json_object_new_object(),
+                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    }
+    if (monitor->enable_watchdog) {
+        struct json_object* watchdog = json_object_new_object();
+        json_object_object_add_ex(config, "watchdog", watchdog,
+                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(
+            watchdog, "stall_threshold_sec",
+            json_object_new_double(monitor->watchdog_threshold),
+            JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(
+            watchdog, "check_interval_sec",
+            json_object_new_double(monitor->watchdog_interval),
+            JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    }
+    struct json_object* metrics = json_object_new_object();
+    json_object_object_add_ex(config, "metrics", metrics,
+                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    json_object_object_add_ex(
+        metrics, "filename_prefix",
+        json_object_new_string(monitor->metrics_filename_prefix
+                                   ? monitor->metrics_filename_prefix
+                                   : ""),
+        JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    json_object_object_add_ex(
+        metrics, "interval_sec",
+        json_object_new_double(monitor->metrics_interval),
+        JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    struct json_object* openmetrics = json_object_new_object();
+    json_object_object_add_ex(config, "openmetrics", openmetrics,
+                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    json_object_object_add_ex(
+        openmetrics, "filename_prefix",
+        json_object_new_string(monitor->openmetrics_filename_prefix
+                                   ? monitor->openmetrics_filename_prefix
+                                   : ""),
+        JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    json_object_object_add_ex(
+        openmetrics, "interval_sec",
+        json_object_new_double(monitor->openmetrics_interval),
+        JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    json_object_object_add_ex(
+        openmetrics, "dump", json_object_new_boolean(monitor->openmetrics_dump),
+        JSON_C_OBJECT_ADD_KEY_IS_NEW);
     return config;
 }
 
@@ -794,6 +1063,33 @@ __margo_default_monitor_on_progress(void*                         uargs,
                          + monitor->time_series_interval))) {
         update_rpc_time_series(monitor, timestamp);
         update_pool_time_series(monitor, timestamp);
+        __margo_monitor_abt_time_series_update(monitor, timestamp);
+    }
+
+    /* publish metrics */
+    if ((event_type == MARGO_MONITOR_FN_END) && monitor->metrics
+        && (timestamp
+            >= (monitor->metrics_last_ts + monitor->metrics_interval))) {
+        __margo_monitor_metrics_segment_update(monitor, timestamp);
+    }
+
+    /* export OpenMetrics */
+    if ((event_type == MARGO_MONITOR_FN_END)
+        && monitor->openmetrics_filename_prefix
+        && (timestamp >= (monitor->openmetrics_last_ts
+                          + monitor->openmetrics_interval))) {
+        __margo_monitor_openmetrics_write_file(monitor, timestamp);
+    }
+
+    /* heartbeat */
+    if (monitor->enable_watchdog) {
+        if (event_type == MARGO_MONITOR_FN_START) {
+            __atomic_store_n(&monitor->progress_xstream, self_xstream_rank(),
+                             __ATOMIC_RELAXED);
+            watchdog_heartbeat(monitor, timestamp, event_args->timeout_ms);
+        } else {
+            watchdog_heartbeat(monitor, timestamp, 0);
+        }
     }
 
     if (event_type == MARGO_MONITOR_FN_START) monitor->progress_sampling += 1;
@@ -801,6 +1097,18 @@ __margo_default_monitor_on_progress(void*                         uargs,
     /* statistics */
     if (!monitor->enable_statistics) return;
 
+    /* duration of the iteration ending with this progress call, and
+     * number of callbacks triggered in it */
+    double   iteration = 0.0;
+    uint64_t batch     = 0;
+    if (event_type == MARGO_MONITOR_FN_END) {
+        if (monitor->progress_last_end_ts > 0.0)
+            iteration = timestamp - monitor->progress_last_end_ts;
+        monitor->progress_last_end_ts = timestamp;
+        batch                         = monitor->trigger_batch;
+        monitor->trigger_batch        = 0;
+    }
+
     if (event_type == MARGO_MONITOR_FN_START) {
         if (!monitor->sample_progress_every
             || (monitor->progress_sampling % monitor->sample_progress_every))
@@ -816,14 +1124,23 @@ __margo_default_monitor_on_progress(void*                         uargs,
     monitor->progress_sampling %= monitor->sample_progress_every;
 
     // MARGO_MONITOR_FN_END
-    double t = timestamp - event_args->uctx.f;
+    double           t     = timestamp - event_args->uctx.f;
+    monitor_shard_t* shard = shard_lock(monitor);
     if (event_args->timeout_ms) {
-        UPDATE_STATISTICS_WITH(monitor->hg_stats.progress_with_timeout, t);
-        UPDATE_STATISTICS_WITH(monitor->hg_stats.progress_timeout_value,
+        UPDATE_STATISTICS_WITH(shard->hg_stats.progress_with_timeout, t);
+        UPDATE_STATISTICS_WITH(shard->hg_stats.progress_timeout_value,
                                event_args->timeout_ms);
     } else {
-        UPDATE_STATISTICS_WITH(monitor->hg_stats.progress_without_timeout, t);
+        UPDATE_STATISTICS_WITH(shard->hg_stats.progress_without_timeout, t);
     }
+    if (monitor->num_percentiles) {
+        if (iteration > 0.0)
+            histogram_record(&shard->progress_hist[PROGRESS_ITERATION_HIST],
+                             iteration);
+        histogram_record_value(&shard->progress_hist[TRIGGER_BATCH_HIST],
+                               batch);
+    }
+    shard_unlock(shard);
 }
 
 static void
@@ -833,6 +1150,8 @@ __margo_default_monitor_on_trigger(void*                        uargs,
                                    margo_monitor_trigger_args_t event_args)
 {
     default_monitor_state_t* monitor = (default_monitor_state_t*)uargs;
+    /* heartbeat (callbacks run by the trigger may block the loop) */
+    if (monitor->enable_watchdog) watchdog_heartbeat(monitor, timestamp, 0);
     if (!monitor->enable_statistics) return;
 
     if (event_type == MARGO_MONITOR_FN_START) {
@@ -841,8 +1160,11 @@ __margo_default_monitor_on_trigger(void*                        uargs,
     }
     // MARGO_MONITOR_FN_END
     if (event_args->actual_count == 0) return;
-    double t = timestamp - event_args->uctx.f;
-    UPDATE_STATISTICS_WITH(monitor->hg_stats.trigger, t);
+    monitor->trigger_batch += event_args->actual_count;
+    double           t     = timestamp - event_args->uctx.f;
+    monitor_shard_t* shard = shard_lock(monitor);
+    UPDATE_STATISTICS_WITH(shard->hg_stats.trigger, t);
+    shard_unlock(shard);
 }
 
 static void
@@ -859,6 +1181,21 @@ __margo_default_monitor_on_create(void*                       uargs,
         return;
     }
     // MARGO_MONITOR_FN_END
+    if (event_args->ret != HG_SUCCESS) return;
+
+    monitor_shard_t* shard   = shard_lock(monitor);
+    bool             sampled = sample_rpc(monitor, shard, event_args->id, true);
+    shard_unlock(shard);
+    // the handle will be forwarded with the trace context of the ULT
+    margo_trace_context_t trace_ctx;
+    if (!sampled && monitor->enable_spans
+        && margo_get_current_trace_context(monitor->mid, &trace_ctx)
+               == HG_SUCCESS)
+        sampled = trace_ctx.flags & MARGO_TRACE_CONTEXT_SAMPLED;
+    if (!sampled) {
+        margo_monitoring_skip_handle(event_args->handle);
+        return;
+    }
 
     session_t* session = new_session(monitor);
 
@@ -912,44 +1249,34 @@ __margo_default_monitor_on_forward(void*                        uargs,
 
         event_args->uctx.f = timestamp;
 
-        // get address info
-        ABT_mutex_spinlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->addr_info_mtx));
-        addr_info_t* addr_info
-            = addr_info_find_or_add(monitor, mid, handle_info->addr);
-        ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->addr_info_mtx));
-
-        // attach statistics to session
-        hg_id_t id = handle_info->id;
-        id         = mux_id(id, event_args->provider_id);
-        callpath_t key
-            = {.rpc_id = id, .parent_id = 0, .addr_id = addr_info->id};
+        // form callpath key
+        hg_id_t    id  = mux_id(handle_info->id, event_args->provider_id);
+        callpath_t key = {.rpc_id = id, .parent_id = 0, .addr_id = 0};
         // try to get parent RPC id from context
         margo_get_current_rpc_id(mid, &key.parent_id);
 
-        ABT_mutex_spinlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->origin_rpc_stats_mtx));
-        HASH_FIND(hh, monitor->origin_rpc_stats, &key, sizeof(key), rpc_stats);
-        if (!rpc_stats) {
-            rpc_stats = (origin_rpc_statistics_t*)calloc(1, sizeof(*rpc_stats));
-            rpc_stats->callpath = key;
-            HASH_ADD(hh, monitor->origin_rpc_stats, callpath, sizeof(key),
-                     rpc_stats);
-        }
-        ABT_mutex_unlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->origin_rpc_stats_mtx));
+        monitor_shard_t* shard = shard_lock(monitor);
+        // get address id
+        key.addr_id
+            = addr_id_find_or_add(monitor, shard, mid, handle_info->addr);
+        // attach statistics to session
+        rpc_stats             = origin_rpc_stats_find_or_add(shard, &key);
         session->origin.stats = rpc_stats;
 
         double t = timestamp - session->origin.create_ts;
         UPDATE_STATISTICS_WITH(rpc_stats->forward[TIMESTAMP], t);
+        shard_unlock(shard);
         session->origin.forward_start_ts = timestamp;
+        session->origin.xstream_rank     = self_xstream_rank();
 
     } else if (event_type == MARGO_MONITOR_FN_END) {
 
         // update statistics
-        rpc_stats = session->origin.stats;
+        monitor_shard_t* shard = shard_lock(monitor);
+        rpc_stats = origin_rpc_stats_in_shard(shard, &session->origin.stats);
         double t  = timestamp - event_args->uctx.f;
         UPDATE_STATISTICS_WITH(rpc_stats->forward[DURATION], t);
+        shard_unlock(shard);
         session->origin.forward_end_ts = timestamp;
     }
 }
@@ -965,16 +1292,21 @@ __margo_default_monitor_on_set_input(void*                          uargs,
     // retrieve the session that was create on on_create
     hg_handle_t handle = margo_request_get_handle(event_args->request);
     RETRIEVE_SESSION(handle);
-    origin_rpc_statistics_t* rpc_stats = session->origin.stats;
+    monitor_shard_t*         shard = shard_lock(monitor);
+    origin_rpc_statistics_t* rpc_stats
+        = origin_rpc_stats_in_shard(shard, &session->origin.stats);
 
     if (event_type == MARGO_MONITOR_FN_START) {
         event_args->uctx.f = timestamp;
         double t           = timestamp - session->origin.forward_start_ts;
         UPDATE_STATISTICS_WITH(rpc_stats->set_input[TIMESTAMP], t);
+        session->origin.set_input_start_ts = timestamp;
     } else {
         double t = timestamp - event_args->uctx.f;
         UPDATE_STATISTICS_WITH(rpc_stats->set_input[DURATION], t);
+        session->origin.set_input_end_ts = timestamp;
     }
+    shard_unlock(shard);
 }
 
 static void __margo_default_monitor_on_set_output(
@@ -988,7 +1320,9 @@ static void __margo_default_monitor_on_set_output(
     // retrieve the session that was create on on_create
     hg_handle_t handle = margo_request_get_handle(event_args->request);
     RETRIEVE_SESSION(handle);
-    target_rpc_statistics_t* rpc_stats = session->target.stats;
+    monitor_shard_t*         shard = shard_lock(monitor);
+    target_rpc_statistics_t* rpc_stats
+        = target_rpc_stats_in_shard(shard, &session->target.stats);
 
     if (event_type == MARGO_MONITOR_FN_START) {
         event_args->uctx.f = timestamp;
@@ -998,6 +1332,7 @@ static void __margo_default_monitor_on_set_output(
         double t = timestamp - event_args->uctx.f;
         UPDATE_STATISTICS_WITH(rpc_stats->set_output[DURATION], t);
     }
+    shard_unlock(shard);
 }
 
 static void __margo_default_monitor_on_get_output(
@@ -1010,16 +1345,21 @@ static void __margo_default_monitor_on_get_output(
     if (!monitor->enable_statistics) return;
     // retrieve the session that was create on on_create
     RETRIEVE_SESSION(event_args->handle);
-    origin_rpc_statistics_t* rpc_stats = session->origin.stats;
+    monitor_shard_t*         shard = shard_lock(monitor);
+    origin_rpc_statistics_t* rpc_stats
+        = origin_rpc_stats_in_shard(shard, &session->origin.stats);
 
     if (event_type == MARGO_MONITOR_FN_START) {
         event_args->uctx.f = timestamp;
         double t           = timestamp - session->origin.wait_end_ts;
         UPDATE_STATISTICS_WITH(rpc_stats->get_output[TIMESTAMP], t);
+        session->origin.get_output_start_ts = timestamp;
     } else {
         double t = timestamp - event_args->uctx.f;
         UPDATE_STATISTICS_WITH(rpc_stats->get_output[DURATION], t);
+        session->origin.get_output_end_ts = timestamp;
     }
+    shard_unlock(shard);
 }
 
 static void
@@ -1032,16 +1372,21 @@ __margo_default_monitor_on_get_input(void*                          uargs,
     if (!monitor->enable_statistics) return;
     // retrieve the session that was create on on_create
     RETRIEVE_SESSION(event_args->handle);
-    target_rpc_statistics_t* rpc_stats = session->target.stats;
+    monitor_shard_t*         shard = shard_lock(monitor);
+    target_rpc_statistics_t* rpc_stats
+        = target_rpc_stats_in_shard(shard, &session->target.stats);
 
     if (event_type == MARGO_MONITOR_FN_START) {
         event_args->uctx.f = timestamp;
         double t           = timestamp - session->target.ult_start_ts;
         UPDATE_STATISTICS_WITH(rpc_stats->get_input[TIMESTAMP], t);
+        session->target.get_input_start_ts = timestamp;
     } else {
         double t = timestamp - event_args->uctx.f;
         UPDATE_STATISTICS_WITH(rpc_stats->get_input[DURATION], t);
+        session->target.get_input_end_ts = timestamp;
     }
+    shard_unlock(shard);
 }
 
 static void __margo_default_monitor_on_forward_cb(
@@ -1055,16 +1400,22 @@ static void __margo_default_monitor_on_forward_cb(
     // retrieve the session that was create on on_create
     hg_handle_t handle = margo_request_get_handle(event_args->request);
     RETRIEVE_SESSION(handle);
-    origin_rpc_statistics_t* rpc_stats = session->origin.stats;
+    monitor_shard_t*         shard = shard_lock(monitor);
+    origin_rpc_statistics_t* rpc_stats
+        = origin_rpc_stats_in_shard(shard, &session->origin.stats);
 
     if (event_type == MARGO_MONITOR_FN_START) {
         event_args->uctx.f = timestamp;
         double t           = timestamp - session->origin.forward_start_ts;
         UPDATE_STATISTICS_WITH(rpc_stats->forward_cb[TIMESTAMP], t);
+        if (monitor->num_percentiles)
+            histogram_record(&rpc_stats->hist[ORIGIN_FORWARD_HIST], t);
+        session->origin.forward_cb_ts = timestamp;
     } else {
         double t = timestamp - event_args->uctx.f;
         UPDATE_STATISTICS_WITH(rpc_stats->forward_cb[DURATION], t);
     }
+    shard_unlock(shard);
 }
 
 static void
@@ -1078,7 +1429,9 @@ __margo_default_monitor_on_respond(void*                        uargs,
     // retrieve the session that was create on on_create
     hg_handle_t handle = margo_request_get_handle(event_args->request);
     RETRIEVE_SESSION(handle);
-    target_rpc_statistics_t* rpc_stats = session->target.stats;
+    monitor_shard_t*         shard = shard_lock(monitor);
+    target_rpc_statistics_t* rpc_stats
+        = target_rpc_stats_in_shard(shard, &session->target.stats);
 
     if (event_type == MARGO_MONITOR_FN_START) {
         event_args->uctx.f = timestamp;
@@ -1090,6 +1443,7 @@ __margo_default_monitor_on_respond(void*                        uargs,
         UPDATE_STATISTICS_WITH(rpc_stats->respond[DURATION], t);
         session->target.respond_end_ts = timestamp;
     }
+    shard_unlock(shard);
 }
 
 static void __margo_default_monitor_on_respond_cb(
@@ -1103,16 +1457,21 @@ static void __margo_default_monitor_on_respond_cb(
     // retrieve the session that was create on on_create
     hg_handle_t handle = margo_request_get_handle(event_args->request);
     RETRIEVE_SESSION(handle);
-    target_rpc_statistics_t* rpc_stats = session->target.stats;
+    monitor_shard_t*         shard = shard_lock(monitor);
+    target_rpc_statistics_t* rpc_stats
+        = target_rpc_stats_in_shard(shard, &session->target.stats);
 
     if (event_type == MARGO_MONITOR_FN_START) {
         event_args->uctx.f = timestamp;
         double t           = timestamp - session->target.respond_start_ts;
         UPDATE_STATISTICS_WITH(rpc_stats->respond_cb[TIMESTAMP], t);
+        if (monitor->num_percentiles)
+            histogram_record(&rpc_stats->hist[TARGET_RESPOND_HIST], t);
     } else {
         double t = timestamp - event_args->uctx.f;
         UPDATE_STATISTICS_WITH(rpc_stats->respond_cb[DURATION], t);
     }
+    shard_unlock(shard);
 }
 
 static void
@@ -1123,6 +1482,11 @@ __margo_default_monitor_on_wait(void*                     uargs,
 {
     default_monitor_state_t* monitor = (default_monitor_state_t*)uargs;
     if (!monitor->enable_statistics) return;
+    // a handler ULT is off CPU while it waits, including on requests left
+    // out by sampling
+    if (monitor->enable_cpu_time)
+        cpu_time_block(monitor, event_type == MARGO_MONITOR_FN_START);
+    if (event_args->skipped) return;
     // retrieve the session that was create on on_create
     statistics_t*   duration_stats  = NULL;
     statistics_t*   timestamp_stats = NULL;
@@ -1131,25 +1495,38 @@ __margo_default_monitor_on_wait(void*                     uargs,
 
     margo_request_type request_type
         = margo_request_get_type(event_args->request);
+    monitor_shard_t* shard = shard_lock(monitor);
     if (request_type == MARGO_FORWARD_REQUEST) {
         hg_handle_t handle = margo_request_get_handle(event_args->request);
         RETRIEVE_SESSION(handle);
+        origin_rpc_statistics_t* rpc_stats
+            = origin_rpc_stats_in_shard(shard, &session->origin.stats);
         ref_ts          = session->origin.forward_end_ts;
-        duration_stats  = &(session->origin.stats->wait[DURATION]);
-        timestamp_stats = &(session->origin.stats->wait[TIMESTAMP]);
-        if (event_type == MARGO_MONITOR_FN_END)
+        duration_stats  = &(rpc_stats->wait[DURATION]);
+        timestamp_stats = &(rpc_stats->wait[TIMESTAMP]);
+        if (event_type == MARGO_MONITOR_FN_START)
+            session->origin.wait_start_ts = timestamp;
+        else
             session->origin.wait_end_ts = timestamp;
     } else if (request_type == MARGO_RESPONSE_REQUEST) {
         hg_handle_t handle = margo_request_get_handle(event_args->request);
         RETRIEVE_SESSION(handle);
+        target_rpc_statistics_t* rpc_stats
+            = target_rpc_stats_in_shard(shard, &session->target.stats);
         ref_ts          = session->target.respond_end_ts;
-        duration_stats  = &(session->target.stats->wait[DURATION]);
-        timestamp_stats = &(session->target.stats->wait[TIMESTAMP]);
+        duration_stats  = &(rpc_stats->wait[DURATION]);
+        timestamp_stats = &(rpc_stats->wait[TIMESTAMP]);
+        if (event_type == MARGO_MONITOR_FN_START)
+            session->target.wait_start_ts = timestamp;
+        else
+            session->target.wait_end_ts = timestamp;
     } else if (request_type == MARGO_BULK_REQUEST) {
         RETRIEVE_BULK_SESSION(event_args->request);
+        bulk_transfer_statistics_t* bulk_stats
+            = bulk_transfer_stats_in_shard(shard, &session->stats);
         ref_ts          = session->transfer_end_ts;
-        duration_stats  = &(session->stats->wait[DURATION]);
-        timestamp_stats = &(session->stats->wait[TIMESTAMP]);
+        duration_stats  = &(bulk_stats->wait[DURATION]);
+        timestamp_stats = &(bulk_stats->wait[TIMESTAMP]);
         bulk_session    = session;
     }
 
@@ -1161,8 +1538,16 @@ __margo_default_monitor_on_wait(void*                     uargs,
         double t = timestamp - event_args->uctx.f;
         if (duration_stats) UPDATE_STATISTICS_WITH(*duration_stats, t);
     }
+    shard_unlock(shard);
 
     if ((event_type == MARGO_MONITOR_FN_END) && bulk_session) {
+        /* account the transfer in the session of the handler ULT */
+        session_t* rpc_session = NULL;
+        if (monitor->enable_outliers)
+            ABT_key_get(monitor->session_key, (void**)&rpc_session);
+        if (rpc_session)
+            rpc_session->target.bulk_time
+                += timestamp - bulk_session->transfer_start_ts;
         release_bulk_session(monitor, bulk_session);
     }
 }
@@ -1183,39 +1568,40 @@ static void __margo_default_monitor_on_rpc_handler(
     target_rpc_statistics_t* rpc_stats = NULL;
 
     if (event_type == MARGO_MONITOR_FN_START) {
-        // get address info
-        ABT_mutex_spinlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->addr_info_mtx));
-        addr_info_t* addr_info
-            = addr_info_find_or_add(monitor, mid, handle_info->addr);
-        ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->addr_info_mtx));
-
-        // form callpath key
-        hg_id_t    id  = margo_get_info(event_args->handle)->id;
-        callpath_t key = {.rpc_id    = id,
-                          .parent_id = event_args->parent_rpc_id,
-                          .addr_id   = addr_info->id};
+        hg_id_t id = margo_get_info(event_args->handle)->id;
 
         /* statistics */
+        bool sampled = true;
         if (monitor->enable_statistics) {
+            monitor_shard_t* shard = shard_lock(monitor);
+            sampled                = sample_rpc(monitor, shard, id, false);
+            shard_unlock(shard);
+            margo_trace_context_t trace_ctx;
+            if (!sampled && monitor->enable_spans
+                && margo_get_trace_context(event_args->handle, &trace_ctx)
+                       == HG_SUCCESS)
+                sampled = trace_ctx.flags & MARGO_TRACE_CONTEXT_SAMPLED;
+            if (!sampled) margo_monitoring_skip_handle(event_args->handle);
+        }
+        if (monitor->enable_statistics && sampled) {
             if (!session) { session = new_session(monitor); }
             session->target.handler_start_ts  = timestamp;
+            if (monitor->enable_outliers) {
+                size_t pool_size = 0;
+                ABT_pool_get_total_size(event_args->pool, &pool_size);
+                session->target.pool_size = pool_size;
+            }
             margo_monitor_data_t monitor_data = {.p = (void*)session};
             margo_set_monitoring_data(event_args->handle, monitor_data);
 
-            ABT_mutex_spinlock(
-                ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->target_rpc_stats_mtx));
-            HASH_FIND(hh, monitor->target_rpc_stats, &key, sizeof(key),
-                      rpc_stats);
-            if (!rpc_stats) {
-                rpc_stats
-                    = (target_rpc_statistics_t*)calloc(1, sizeof(*rpc_stats));
-                rpc_stats->callpath = key;
-                HASH_ADD(hh, monitor->target_rpc_stats, callpath, sizeof(key),
-                         rpc_stats);
-            }
-            ABT_mutex_unlock(
-                ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->target_rpc_stats_mtx));
+            monitor_shard_t* shard = shard_lock(monitor);
+            // form callpath key
+            callpath_t key = {.rpc_id    = id,
+                              .parent_id = event_args->parent_rpc_id,
+                              .addr_id   = addr_id_find_or_add(
+                                  monitor, shard, mid, handle_info->addr)};
+            rpc_stats = target_rpc_stats_find_or_add(shard, &key);
+            shard_unlock(shard);
             session->target.stats = rpc_stats;
             event_args->uctx.f    = timestamp;
 
@@ -1228,24 +1614,23 @@ static void __margo_default_monitor_on_rpc_handler(
 
         /* time series */
         if (monitor->enable_time_series) {
-            // find the time series associated with
-            // this callpath and increment its count
-            ABT_mutex_spinlock(
-                ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_time_series_mtx));
-            rpc_time_series_t* rpc_ts
-                = find_or_add_time_series_for_rpc(monitor, id);
-            rpc_ts->rpc_count += 1;
-            ABT_mutex_unlock(
-                ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_time_series_mtx));
+            // increment the count of this RPC in the shard, it is added
+            // to the time series by update_rpc_time_series
+            monitor_shard_t* shard = shard_lock(monitor);
+            rpc_ts_count_find_or_add(shard, id)->rpc_count += 1;
+            shard_unlock(shard);
         }
 
     } else {
 
         if (monitor->enable_statistics) {
             // update statistics
-            rpc_stats = session->target.stats;
-            double t  = timestamp - event_args->uctx.f;
+            monitor_shard_t* shard = shard_lock(monitor);
+            rpc_stats
+                = target_rpc_stats_in_shard(shard, &session->target.stats);
+            double t = timestamp - event_args->uctx.f;
             UPDATE_STATISTICS_WITH(rpc_stats->handler, t);
+            shard_unlock(shard);
         }
     }
 }
@@ -1257,26 +1642,102 @@ __margo_default_monitor_on_rpc_ult(void*                        uargs,
                                    margo_monitor_rpc_ult_args_t event_args)
 {
     default_monitor_state_t* monitor = (default_monitor_state_t*)uargs;
+    if (monitor->enable_watchdog)
+        watchdog_track_ult(monitor, event_args->handle, timestamp,
+                           event_type == MARGO_MONITOR_FN_START);
     if (!monitor->enable_statistics) return;
     // retrieve the session that was create on on_create
     RETRIEVE_SESSION(event_args->handle);
-    target_rpc_statistics_t* rpc_stats = session->target.stats;
+    monitor_shard_t*         shard = shard_lock(monitor);
+    target_rpc_statistics_t* rpc_stats
+        = target_rpc_stats_in_shard(shard, &session->target.stats);
 
     if (event_type == MARGO_MONITOR_FN_START) {
 
         event_args->uctx.f = timestamp;
         double t           = timestamp - session->target.handler_start_ts;
         UPDATE_STATISTICS_WITH(rpc_stats->ult[TIMESTAMP], t);
+        if (monitor->num_percentiles)
+            histogram_record(&rpc_stats->hist[TARGET_ULT_QUEUE_HIST], t);
         // set callpath key
-        callpath_t* current_callpath = &(session->target.stats->callpath);
+        callpath_t* current_callpath = &(rpc_stats->callpath);
         ABT_key_set(monitor->callpath_key, current_callpath);
         // set the reference time start_ts to the current timestamp
         session->target.ult_start_ts = timestamp;
+        session->target.xstream_rank = self_xstream_rank();
+        if (monitor->enable_cpu_time) cpu_time_resume(&session->target);
 
     } else {
         double t = timestamp - event_args->uctx.f;
         UPDATE_STATISTICS_WITH(rpc_stats->ult[DURATION], t);
+        if (monitor->num_percentiles)
+            histogram_record(&rpc_stats->hist[TARGET_HANDLER_HIST], t);
+        session->target.ult_end_ts = timestamp;
+        if (monitor->enable_cpu_time) {
+            cpu_time_pause(&session->target);
+            UPDATE_STATISTICS_WITH(rpc_stats->cpu_time,
+                                   session->target.cpu_time);
+        }
+    }
+    shard_unlock(shard);
+    // bulk transfers and waits of the ULT are accounted in its session
+    if (tracks_handler_sessions(monitor))
+        ABT_key_set(monitor->session_key,
+                    event_type == MARGO_MONITOR_FN_START ? session : NULL);
+}
+
+/* Records the client and/or server spans of a traced RPC from its
+ * session (both for an RPC sent by the process to itself) */
+static void record_spans(default_monitor_state_t* monitor,
+                         hg_handle_t              handle,
+                         const session_t*         session)
+{
+    margo_trace_context_t ctx;
+    if (margo_get_trace_context(handle, &ctx) != HG_SUCCESS) return;
+    if (!(ctx.flags & MARGO_TRACE_CONTEXT_SAMPLED)) return;
+
+    span_t spans[2];
+    size_t n = 0;
+    if (session->origin.stats && session->origin.forward_start_ts > 0.0) {
+        double end_ts = session->origin.wait_end_ts > 0.0
+                          ? session->origin.wait_end_ts
+                          : session->origin.forward_end_ts;
+        spans[n++]    = (span_t){.context   = ctx,
+                                 .callpath  = session->origin.stats->callpath,
+                                 .start_ts  = session->origin.forward_start_ts,
+                                 .end_ts    = end_ts,
+                                 .is_origin = true};
+    }
+    if (session->target.stats && session->target.respond_end_ts > 0.0) {
+        spans[n++] = (span_t){.context   = ctx,
+                              .callpath  = session->target.stats->callpath,
+                              .start_ts  = session->target.handler_start_ts,
+                              .end_ts    = session->target.respond_end_ts,
+                              .is_origin = false};
+    }
+    if (!n) return;
+
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->spans_mtx));
+    for (size_t i = 0; i < n; i++) {
+        if (monitor->num_spans == monitor->spans_capacity
+            && monitor->spans_capacity < monitor->max_spans) {
+            size_t capacity = monitor->spans_capacity
+                                ? 2 * monitor->spans_capacity
+                                : 256;
+            if (capacity > monitor->max_spans) capacity = monitor->max_spans;
+            span_t* new_spans
+                = (span_t*)realloc(monitor->spans, capacity * sizeof(span_t));
+            if (new_spans) {
+                monitor->spans          = new_spans;
+                monitor->spans_capacity = capacity;
+            }
+        }
+        if (monitor->num_spans < monitor->spans_capacity)
+            monitor->spans[monitor->num_spans++] = spans[i];
+        else
+            monitor->dropped_spans += 1;
     }
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->spans_mtx));
 }
 
 static void
@@ -1295,6 +1756,12 @@ __margo_default_monitor_on_destroy(void*                        uargs,
     // MARGO_MONITOR_FN_START
     margo_monitor_data_t monitor_data;
     margo_get_monitoring_data(event_args->handle, &monitor_data);
+    // no session is attached to the handles of RPCs that were not sampled
+    if (!monitor_data.p) return;
+    if (monitor->enable_spans)
+        record_spans(monitor, event_args->handle, (session_t*)monitor_data.p);
+    if (monitor->enable_outliers)
+        __margo_monitor_record_outliers(monitor, (session_t*)monitor_data.p);
     release_session(monitor, (session_t*)monitor_data.p);
 }
 
@@ -1312,7 +1779,10 @@ static void __margo_default_monitor_on_bulk_create(
     default_monitor_state_t* monitor = (default_monitor_state_t*)uargs;
     if (!monitor->enable_statistics) return;
 
-    bulk_create_statistics_t* bulk_stats = NULL;
+    if (event_type == MARGO_MONITOR_FN_START) {
+        event_args->uctx.f = timestamp;
+        return;
+    }
 
     // no bulk_statistics_t attached to current ULT
     callpath_t default_key = {0};
@@ -1323,30 +1793,19 @@ static void __margo_default_monitor_on_bulk_create(
     ABT_key_get(monitor->callpath_key, (void**)&pkey);
     if (!pkey) pkey = (callpath_t*)&default_key;
 
-    ABT_mutex_spinlock(
-        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->bulk_create_stats_mtx));
-    HASH_FIND(hh, monitor->bulk_create_stats, pkey, sizeof(*pkey), bulk_stats);
-    if (!bulk_stats) {
-        bulk_stats = (bulk_create_statistics_t*)calloc(1, sizeof(*bulk_stats));
-        bulk_stats->callpath = *pkey;
-        HASH_ADD(hh, monitor->bulk_create_stats, callpath, sizeof(*pkey),
-                 bulk_stats);
-    }
-    ABT_mutex_unlock(
-        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->bulk_create_stats_mtx));
-
-    if (event_type == MARGO_MONITOR_FN_START) {
-        event_args->uctx.f = timestamp;
-    } else {
-        double t = timestamp - event_args->uctx.f;
-        // compute total size
-        size_t size = 0;
-        for (unsigned i = 0; i < event_args->count; i++) {
-            size += event_args->sizes[i];
-        }
-        UPDATE_STATISTICS_WITH(bulk_stats->duration, t);
-        UPDATE_STATISTICS_WITH(bulk_stats->size, (double)size);
-    }
+    double t = timestamp - event_args->uctx.f;
+    // compute total size
+    size_t size = 0;
+    for (unsigned i = 0; i < event_args->count; i++) {
+        size += event_args->sizes[i];
+    }
+    monitor_shard_t*          shard = shard_lock(monitor);
+    bulk_create_statistics_t* bulk_stats
+        = bulk_create_stats_find_or_add(shard, pkey);
+    UPDATE_STATISTICS_WITH(bulk_stats->duration, t);
+    UPDATE_STATISTICS_WITH(bulk_stats->size, (double)size);
+    if (monitor->num_percentiles) histogram_record(&bulk_stats->hist[0], t);
+    shard_unlock(shard);
 }
 
 static void __margo_default_monitor_on_bulk_transfer(
@@ -1363,17 +1822,9 @@ static void __margo_default_monitor_on_bulk_transfer(
 
     if (event_type == MARGO_MONITOR_FN_START) {
 
-        // get address info
-        ABT_mutex_spinlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->addr_info_mtx));
-        addr_info_t* addr_info
-            = addr_info_find_or_add(monitor, mid, event_args->origin_addr);
-        ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->addr_info_mtx));
-
         // create the bulk_key for the bulk_transfer_statistics in the hash
         // table
-        bulk_key_t  bulk_key     = {.operation      = event_args->op,
-                               .remote_addr_id = addr_info ? addr_info->id : 0};
+        bulk_key_t  bulk_key     = {.operation = event_args->op};
         callpath_t* callpath_ptr = NULL;
         // try to get current callpath from the installed ABT_key
         ABT_key_get(monitor->callpath_key, (void**)&callpath_ptr);
@@ -1386,25 +1837,24 @@ static void __margo_default_monitor_on_bulk_transfer(
 
         /* statistics */
         if (monitor->enable_statistics) {
-            ABT_mutex_spinlock(
-                ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->bulk_transfer_stats_mtx));
-            HASH_FIND(hh, monitor->bulk_transfer_stats, &bulk_key,
-                      sizeof(bulk_key), bulk_stats);
-            if (!bulk_stats) {
-                bulk_stats = (bulk_transfer_statistics_t*)calloc(
-                    1, sizeof(*bulk_stats));
-                bulk_stats->bulk_key = bulk_key;
-                HASH_ADD(hh, monitor->bulk_transfer_stats, bulk_key,
-                         sizeof(bulk_key), bulk_stats);
-            }
-            ABT_mutex_unlock(
-                ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->bulk_transfer_stats_mtx));
+            bulk_session_t*  session = new_bulk_session(monitor);
+            monitor_shard_t* shard   = shard_lock(monitor);
+            bulk_key.remote_addr_id = addr_id_find_or_add(
+                monitor, shard, mid, event_args->origin_addr);
+            bulk_stats = bulk_transfer_stats_find_or_add(shard, &bulk_key);
+            shard_unlock(shard);
 
             event_args->uctx.f = timestamp;
 
-            bulk_session_t* session           = new_bulk_session(monitor);
             session->transfer_start_ts        = event_args->uctx.f;
             session->stats                    = bulk_stats;
+            session_t* rpc_session            = NULL;
+            if (monitor->enable_outliers)
+                ABT_key_get(monitor->session_key, (void**)&rpc_session);
+            if (rpc_session) {
+                rpc_session->target.bulk_count += 1;
+                rpc_session->target.bulk_size += event_args->size;
+            }
             margo_monitor_data_t monitor_data = {.p = (void*)session};
             margo_request_set_monitoring_data(event_args->request,
                                               monitor_data);
@@ -1417,15 +1867,13 @@ static void __margo_default_monitor_on_bulk_transfer(
 
         /* time series */
         if (monitor->enable_time_series) {
-            // find the time series associated with
-            // this callpath and increment its count
-            ABT_mutex_spinlock(
-                ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_time_series_mtx));
-            rpc_time_series_t* rpc_ts = find_or_add_time_series_for_rpc(
-                monitor, bulk_key.callpath.rpc_id);
-            rpc_ts->bulk_size += event_args->size;
-            ABT_mutex_unlock(
-                ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_time_series_mtx));
+            // increment the bulk size of this RPC in the shard, it is
+            // added to the time series by update_rpc_time_series
+            monitor_shard_t* shard = shard_lock(monitor);
+            rpc_ts_count_find_or_add(shard, bulk_key.callpath.rpc_id)
+                ->bulk_size
+                += event_args->size;
+            shard_unlock(shard);
         }
 
     } else {
@@ -1434,11 +1882,13 @@ static void __margo_default_monitor_on_bulk_transfer(
             margo_monitor_data_t monitor_data;
             margo_request_get_monitoring_data(event_args->request,
                                               &monitor_data);
-            bulk_session_t* session = (bulk_session_t*)monitor_data.p;
-            bulk_stats              = session->stats;
-            double t                = timestamp - event_args->uctx.f;
+            bulk_session_t*  session = (bulk_session_t*)monitor_data.p;
+            double           t       = timestamp - event_args->uctx.f;
+            monitor_shard_t* shard   = shard_lock(monitor);
+            bulk_stats = bulk_transfer_stats_in_shard(shard, &session->stats);
             UPDATE_STATISTICS_WITH(bulk_stats->transfer, t);
             UPDATE_STATISTICS_WITH(bulk_stats->transfer_size, event_args->size);
+            shard_unlock(shard);
             session->transfer_end_ts = timestamp;
         }
     }
@@ -1454,18 +1904,23 @@ static void __margo_default_monitor_on_bulk_transfer_cb(
     if (!monitor->enable_statistics) return;
     // retrieve the session that was create on on_create
     RETRIEVE_BULK_SESSION(event_args->request);
-    bulk_transfer_statistics_t* bulk_stats = session->stats;
+    monitor_shard_t*            shard = shard_lock(monitor);
+    bulk_transfer_statistics_t* bulk_stats
+        = bulk_transfer_stats_in_shard(shard, &session->stats);
 
     if (event_type == MARGO_MONITOR_FN_START) {
 
         event_args->uctx.f = timestamp;
         double t           = timestamp - session->transfer_start_ts;
         UPDATE_STATISTICS_WITH(bulk_stats->transfer_cb[TIMESTAMP], t);
+        if (monitor->num_percentiles)
+            histogram_record(&bulk_stats->hist[BULK_TRANSFER_HIST], t);
 
     } else {
         double t = timestamp - event_args->uctx.f;
         UPDATE_STATISTICS_WITH(bulk_stats->transfer_cb[DURATION], t);
     }
+    shard_unlock(shard);
 }
 
 static void
@@ -1492,13 +1947,11 @@ __margo_default_monitor_on_add_pool(void*                         uargs,
                       * sizeof(*monitor->pool_total_size_time_series));
     memset(&monitor->pool_size_time_series[current_num_pools], 0,
            sizeof(monitor->pool_size_time_series[current_num_pools]));
-    monitor->pool_size_time_series[current_num_pools].frame_capacity
-        = monitor->pool_size_time_series[current_num_pools - 1].frame_capacity;
+    monitor->pool_size_time_series[current_num_pools].kind = TIME_SERIES_MAX;
     memset(&monitor->pool_total_size_time_series[current_num_pools], 0,
            sizeof(monitor->pool_total_size_time_series[current_num_pools]));
-    monitor->pool_total_size_time_series[current_num_pools].frame_capacity
-        = monitor->pool_total_size_time_series[current_num_pools - 1]
-              .frame_capacity;
+    monitor->pool_total_size_time_series[current_num_pools].kind
+        = TIME_SERIES_MAX;
     ABT_mutex_unlock(
         ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->pool_time_series_mtx));
 }
@@ -1524,8 +1977,9 @@ static void __margo_default_monitor_on_remove_pool(
     // since event_type == MARGO_MONITOR_FN_END
     size_t   current_num_pools = monitor->mid->abt.pools_len;
     uint32_t index             = event_args->info->index;
-    time_series_clear(&monitor->pool_size_time_series[index]);
-    time_series_clear(&monitor->pool_total_size_time_series[index]);
+    __margo_monitor_time_series_free(&monitor->pool_size_time_series[index]);
+    __margo_monitor_time_series_free(
+        &monitor->pool_total_size_time_series[index]);
     memmove(&monitor->pool_size_time_series[index],
             &monitor->pool_size_time_series[index + 1],
             (current_num_pools - index)
@@ -1562,6 +2016,16 @@ static void __margo_default_monitor_on_remove_xstream(
     (void)event_args;
 }
 
+__MONITOR_FN(sleep)
+{
+    (void)timestamp;
+    (void)event_args;
+    default_monitor_state_t* monitor = (default_monitor_state_t*)uargs;
+    // a handler ULT is off CPU while it sleeps
+    if (monitor->enable_cpu_time)
+        cpu_time_block(monitor, event_type == MARGO_MONITOR_FN_START);
+}
+
 #define __MONITOR_FN_EMPTY(__name__) \
     __MONITOR_FN(__name__)           \
     {                                \
@@ -1574,11 +2038,32 @@ static void __margo_default_monitor_on_remove_xstream(
 __MONITOR_FN_EMPTY(bulk_free)
 __MONITOR_FN_EMPTY(deregister)
 __MONITOR_FN_EMPTY(lookup)
-__MONITOR_FN_EMPTY(sleep)
+
 __MONITOR_FN_EMPTY(free_input)
 __MONITOR_FN_EMPTY(free_output)
 __MONITOR_FN_EMPTY(prefinalize)
-__MONITOR_FN_EMPTY(finalize)
+
+static void
+__margo_default_monitor_on_finalize(void*                         uargs,
+                                    double                        timestamp,
+                                    margo_monitor_event_t         event_type,
+                                    margo_monitor_finalize_args_t event_args)
+{
+    (void)event_args;
+    default_monitor_state_t* monitor = (default_monitor_state_t*)uargs;
+    if (event_type != MARGO_MONITOR_FN_START) return;
+    // the last OpenMetrics export needs the instance's handle cache
+    if (monitor->openmetrics_filename_prefix)
+        __margo_monitor_openmetrics_write_file(monitor, timestamp);
+    // the cached addresses must be released before Mercury is finalized
+    __atomic_store_n(&monitor->addr_cache_closed, true, __ATOMIC_RELEASE);
+    for (int i = 0; i < MONITOR_NUM_SHARDS; i++) {
+        monitor_shard_t* shard = monitor->shards[i];
+        ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&shard->mutex));
+        addr_cache_clear(monitor, shard);
+        ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&shard->mutex));
+    }
+}
 __MONITOR_FN_EMPTY(user)
 
 static hg_return_t __margo_default_monitor_dump(void*                 uargs,
@@ -1589,37 +2074,48 @@ static hg_return_t __margo_default_monitor_dump(void*                 uargs,
     const default_monitor_state_t* monitor
         = (const default_monitor_state_t*)uargs;
 
-    /* get printing precision */
-    char double_format[] = "%.Xf";
-    double_format[2]     = (char)(48 + monitor->precision);
-    json_c_set_serialization_double_format(double_format, JSON_C_OPTION_GLOBAL);
+    /* the JSON is handed to dump_fn as it is written, in chunks of
+     * dump_chunk_size bytes, or in a single call if dump_chunk_size is 0 */
+    margo_json_writer_t writer;
+    __margo_json_writer_init(&writer, dump_fn, dump_args,
+                             monitor->dump_chunk_size, monitor->precision,
+                             monitor->stats_pretty_json);
+
+    if (monitor->openmetrics_dump) {
+        __margo_monitor_openmetrics_write(&writer, monitor, reset);
+        goto finish;
+    }
 
-    struct json_object* dump = json_object_new_object();
+    __margo_json_writer_begin_object(&writer);
 
-    /* write statistics to json */
+    /* write statistics */
     if (monitor->enable_statistics) {
-        /* create JSON statistics */
-        struct json_object* stats = monitor_statistics_to_json(monitor, reset);
-        json_object_object_add(dump, "stats", stats);
+        __margo_json_writer_key(&writer, "stats");
+        monitor_statistics_write(&writer, monitor, reset);
     }
 
-    /* write time series to json */
+    /* write time series */
     if (monitor->enable_time_series) {
-        /* create JSON statistics */
-        struct json_object* series
-            = monitor_time_series_to_json(monitor, reset);
-        json_object_object_add(dump, "series", series);
+        __margo_json_writer_key(&writer, "series");
+        monitor_time_series_write(&writer, monitor, reset);
     }
 
-    if (dump_fn) {
-        /* convert to string and call the dump function */
-        size_t      json_len = 0;
-        const char* json_str = json_object_to_json_string_length(
-            dump, monitor->stats_pretty_json | JSON_C_TO_STRING_NOSLASHESCAPE,
-            &json_len);
-        dump_fn(dump_args, json_str, json_len);
+    /* write spans */
+    if (monitor->enable_spans) {
+        __margo_json_writer_key(&writer, "spans");
+        monitor_spans_write(&writer, monitor, reset);
+    }
+
+    __margo_json_writer_end_object(&writer);
+
+finish:
+    if (!__margo_json_writer_finalize(&writer)) {
+        // LCOV_EXCL_START
+        margo_error(monitor->mid, "in %s: could not allocate JSON buffer",
+                    __func__);
+        return HG_NOMEM;
+        // LCOV_EXCL_END
     }
-    json_object_put(dump);
     return HG_SUCCESS;
 }
 
@@ -1653,11 +2149,6 @@ write_monitor_state_to_json_file(const default_monitor_state_t* monitor,
     gethostname(hostname, 1023);
     /* get pid */
     pid_t pid = getpid();
-    /* get printing precision */
-    char double_format[] = "%.Xf";
-    double_format[2]     = (char)(48 + monitor->precision);
-    json_c_set_serialization_double_format(double_format, JSON_C_OPTION_GLOBAL);
-
     /* write statistics file */
     if (monitor->enable_statistics) {
         /* compute size needed for the full file name */
@@ -1677,16 +2168,13 @@ write_monitor_state_to_json_file(const default_monitor_state_t* monitor,
                         strerror(errnum));
             goto finish_stats_file;
         }
-        /* create JSON statistics */
-        struct json_object* json = monitor_statistics_to_json(monitor, reset);
-
         /* write statistics */
-        size_t      json_len = 0;
-        const char* json_str = json_object_to_json_string_length(
-            json, monitor->stats_pretty_json | JSON_C_TO_STRING_NOSLASHESCAPE,
-            &json_len);
-        fwrite(json_str, json_len, 1, file);
-        json_object_put(json);
+        margo_json_writer_t writer;
+        __margo_json_writer_init(&writer, __margo_json_writer_file_sink, file,
+                                 MONITOR_FILE_CHUNK_SIZE, monitor->precision,
+                                 monitor->stats_pretty_json);
+        monitor_statistics_write(&writer, monitor, reset);
+        __margo_json_writer_finalize(&writer);
         /* finish */
 finish_stats_file:
         free(stats_filename);
@@ -1712,223 +2200,255 @@ finish_stats_file:
                         strerror(errnum));
             goto finish_series_file;
         }
-        /* create JSON statistics */
-        struct json_object* json = monitor_time_series_to_json(monitor, reset);
-
-        /* write statistics */
-        size_t      json_len = 0;
-        const char* json_str = json_object_to_json_string_length(
-            json,
-            monitor->time_series_pretty_json | JSON_C_TO_STRING_NOSLASHESCAPE,
-            &json_len);
-        fwrite(json_str, json_len, 1, file);
-        json_object_put(json);
+        /* write time series */
+        margo_json_writer_t writer;
+        __margo_json_writer_init(&writer, __margo_json_writer_file_sink, file,
+                                 MONITOR_FILE_CHUNK_SIZE, monitor->precision,
+                                 monitor->time_series_pretty_json);
+        monitor_time_series_write(&writer, monitor, reset);
+        __margo_json_writer_finalize(&writer);
         /* finish */
 finish_series_file:
         free(series_filename);
         if (file) fclose(file);
     }
+
+    /* write spans file, if any RPC was traced */
+    if (monitor->enable_spans
+        && (monitor->num_spans || monitor->dropped_spans)) {
+        /* compute size needed for the full file name */
+        size_t spans_filename_size
+            = snprintf(NULL, 0, "%s.%s.%d.spans.json", monitor->filename_prefix,
+                       hostname, pid);
+        /* create full file name */
+        char* spans_filename = calloc(1, spans_filename_size + 1);
+        sprintf(spans_filename, "%s.%s.%d.spans.json", monitor->filename_prefix,
+                hostname, pid);
+        /* open the file */
+        int   errnum;
+        FILE* file = fopen(spans_filename, "w");
+        if (!file) {
+            errnum = errno;
+            margo_error(monitor->mid, "Error open file %s: %s", spans_filename,
+                        strerror(errnum));
+            goto finish_spans_file;
+        }
+        /* write spans */
+        margo_json_writer_t writer;
+        __margo_json_writer_init(&writer, __margo_json_writer_file_sink, file,
+                                 MONITOR_FILE_CHUNK_SIZE, monitor->precision,
+                                 monitor->stats_pretty_json);
+        monitor_spans_write(&writer, monitor, reset);
+        __margo_json_writer_finalize(&writer);
+        /* finish */
+finish_spans_file:
+        free(spans_filename);
+        if (file) fclose(file);
+    }
 }
 
 /* ========================================================================
- * Functions related to converting statistics into a json_object tree
+ * Functions related to writing statistics with a JSON writer
  * ======================================================================== */
 
-static struct json_object* statistics_to_json(const statistics_t* stats,
-                                              bool                reset)
+/* Writes "key": {"num": ..., "min": ..., ...} */
+static void statistics_write(margo_json_writer_t* w,
+                             const char*          key,
+                             const statistics_t*  stats)
 {
-    struct json_object* json = json_object_new_object();
-    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&stats->mutex));
-    json_object_object_add_ex(json, "num", json_object_new_int(stats->num),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(json, "min", json_object_new_double(stats->min),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(json, "max", json_object_new_double(stats->max),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(json, "avg", json_object_new_double(stats->avg),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(json, "var", json_object_new_double(stats->var),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(json, "sum", json_object_new_double(stats->sum),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    if (reset) {
-        ((statistics_t*)stats)->num = 0;
-        ((statistics_t*)stats)->min = 0;
-        ((statistics_t*)stats)->max = 0;
-        ((statistics_t*)stats)->avg = 0;
-        ((statistics_t*)stats)->var = 0;
-        ((statistics_t*)stats)->sum = 0;
-    }
-    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&stats->mutex));
-    return json;
+    __margo_json_writer_key(w, key);
+    __margo_json_writer_begin_object(w);
+    __margo_json_writer_key_uint64(w, "num", stats->num);
+    __margo_json_writer_key_double(w, "min", stats->min);
+    __margo_json_writer_key_double(w, "max", stats->max);
+    __margo_json_writer_key_double(w, "avg", stats->avg);
+    __margo_json_writer_key_double(w, "var", stats->var);
+    __margo_json_writer_key_double(w, "sum", stats->sum);
+    __margo_json_writer_end_object(w);
 }
 
-static struct json_object* statistics_pair_to_json(const statistics_t* stats,
-                                                   const char*         name1,
-                                                   const char*         name2,
-                                                   bool                reset)
+/* Writes a histogram as an object of the form
+ * {"num": N, "p50": x, "p99": y, ...} for the configured percentiles,
+ * with values multiplied by unit (1e-9 for durations, so that they are
+ * in seconds like other statistics, 1 for counts).
+ */
+static void histogram_write(margo_json_writer_t*           w,
+                            const char*                    key,
+                            const histogram_t*             hist,
+                            const default_monitor_state_t* monitor,
+                            double                         unit)
 {
-    struct json_object* json = json_object_new_object();
-    json_object_object_add_ex(json, name1, statistics_to_json(stats, reset),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(json, name2, statistics_to_json(stats + 1, reset),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    return json;
+    __margo_json_writer_key(w, key);
+    __margo_json_writer_begin_object(w);
+    __margo_json_writer_key_uint64(w, "num", hist->total);
+    for (size_t i = 0; i < monitor->num_percentiles; i++) {
+        double   pct   = monitor->percentiles[i];
+        uint64_t value = 0;
+        if (hist->total) {
+            uint64_t rank = (uint64_t)(pct / 100.0 * hist->total + 0.999999);
+            if (rank == 0) rank = 1;
+            uint64_t cumul = 0;
+            for (size_t j = 0; j < HISTOGRAM_NUM_BUCKETS; j++) {
+                cumul += histogram_bucket_count(hist, j);
+                if (cumul < rank) continue;
+                value = histogram_bucket_value(j);
+                break;
+            }
+            if (value < hist->min) value = hist->min;
+            if (value > hist->max) value = hist->max;
+        }
+        char pct_key[32];
+        snprintf(pct_key, sizeof(pct_key), "p%g", pct);
+        __margo_json_writer_key_double(w, pct_key, value * unit);
+    }
+    __margo_json_writer_end_object(w);
 }
 
-static struct json_object* hg_statistics_to_json(const hg_statistics_t* stats,
-                                                 bool                   reset)
+/* Writes a "histograms" object with the given names */
+static void histograms_write(margo_json_writer_t*           w,
+                             const histogram_t*             hist,
+                             const char* const*             names,
+                             size_t                         count,
+                             const default_monitor_state_t* monitor)
 {
-    struct json_object* json = json_object_new_object();
-    json_object_object_add_ex(
-        json, "progress_with_timeout",
-        statistics_to_json(&stats->progress_with_timeout, reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "progress_timeout_value_msec",
-        statistics_to_json(&stats->progress_timeout_value, reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "progress_without_timeout",
-        statistics_to_json(&stats->progress_without_timeout, reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(json, "trigger",
-                              statistics_to_json(&stats->trigger, reset),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    return json;
+    if (!monitor->num_percentiles) return;
+    __margo_json_writer_key(w, "histograms");
+    __margo_json_writer_begin_object(w);
+    for (size_t i = 0; i < count; i++)
+        histogram_write(w, names[i], &hist[i], monitor, 1e-9);
+    __margo_json_writer_end_object(w);
 }
 
-static struct json_object*
-bulk_create_statistics_to_json(const bulk_create_statistics_t* stats,
-                               bool                            reset)
+static void statistics_pair_write(margo_json_writer_t* w,
+                                  const char*          key,
+                                  const statistics_t*  stats,
+                                  const char*          name1,
+                                  const char*          name2)
 {
-    struct json_object* json = json_object_new_object();
-    json_object_object_add_ex(json, "duration",
-                              statistics_to_json(&stats->duration, reset),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(json, "size",
-                              statistics_to_json(&stats->size, reset),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    return json;
+    __margo_json_writer_key(w, key);
+    __margo_json_writer_begin_object(w);
+    statistics_write(w, name1, stats);
+    statistics_write(w, name2, stats + 1);
+    __margo_json_writer_end_object(w);
 }
 
-static struct json_object*
-bulk_transfer_statistics_to_json(const bulk_transfer_statistics_t* stats,
-                                 bool                              reset)
+static void progress_loop_write(margo_json_writer_t*           w,
+                                const monitor_shard_t*         shard,
+                                const default_monitor_state_t* monitor,
+                                bool                           reset)
 {
-    struct json_object* json     = json_object_new_object();
-    struct json_object* transfer = json_object_new_object();
-    json_object_object_add_ex(json, "itransfer", transfer,
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(transfer, "duration",
-                              statistics_to_json(&stats->transfer, reset),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(transfer, "size",
-                              statistics_to_json(&stats->transfer_size, reset),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "transfer_cb",
-        statistics_pair_to_json(stats->transfer_cb, "duration",
-                                "relative_timestamp_from_itransfer_start",
-                                reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "itransfer_wait",
-        statistics_pair_to_json(stats->wait, "duration",
-                                "relative_timestamp_from_itransfer_end", reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    return json;
+    const hg_statistics_t* stats = &shard->hg_stats;
+    __margo_json_writer_begin_object(w);
+    statistics_write(w, "progress_with_timeout", &stats->progress_with_timeout);
+    statistics_write(w, "progress_timeout_value_msec",
+                     &stats->progress_timeout_value);
+    statistics_write(w, "progress_without_timeout",
+                     &stats->progress_without_timeout);
+    statistics_write(w, "trigger", &stats->trigger);
+    if (monitor->num_percentiles) {
+        __margo_json_writer_key(w, "histograms");
+        __margo_json_writer_begin_object(w);
+        histogram_write(w, "iteration",
+                        &shard->progress_hist[PROGRESS_ITERATION_HIST],
+                        monitor, 1e-9);
+        histogram_write(w, "trigger_batch",
+                        &shard->progress_hist[TRIGGER_BATCH_HIST], monitor,
+                        1.0);
+        __margo_json_writer_end_object(w);
+    }
+    if (monitor->enable_watchdog)
+        __margo_monitor_watchdog_stalls_write(w, monitor, reset);
+    __margo_json_writer_end_object(w);
 }
 
-static struct json_object*
-origin_rpc_statistics_to_json(const origin_rpc_statistics_t* stats, bool reset)
+static void
+bulk_create_statistics_write(margo_json_writer_t*            w,
+                             const bulk_create_statistics_t* stats,
+                             const default_monitor_state_t*  monitor)
 {
-    struct json_object* json = json_object_new_object();
-    json_object_object_add_ex(
-        json, "iforward",
-        statistics_pair_to_json(stats->forward, "duration",
-                                "relative_timestamp_from_create", reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "forward_cb",
-        statistics_pair_to_json(stats->forward_cb, "duration",
-                                "relative_timestamp_from_iforward_start",
-                                reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "iforward_wait",
-        statistics_pair_to_json(stats->wait, "duration",
-                                "relative_timestamp_from_iforward_end", reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "set_input",
-        statistics_pair_to_json(stats->set_input, "duration",
-                                "relative_timestamp_from_iforward_start",
-                                reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "get_output",
-        statistics_pair_to_json(stats->get_output, "duration",
-                                "relative_timestamp_from_wait_end", reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    return json;
+    statistics_write(w, "duration", &stats->duration);
+    statistics_write(w, "size", &stats->size);
+    static const char* const hist_names[] = {"duration"};
+    histograms_write(w, stats->hist, hist_names, 1, monitor);
 }
 
-static struct json_object*
-target_rpc_statistics_to_json(const target_rpc_statistics_t* stats, bool reset)
+static void
+bulk_transfer_statistics_write(margo_json_writer_t*              w,
+                               const bulk_transfer_statistics_t* stats,
+                               const default_monitor_state_t*    monitor)
 {
-    struct json_object* json = json_object_new_object();
+    __margo_json_writer_key(w, "itransfer");
+    __margo_json_writer_begin_object(w);
+    statistics_write(w, "duration", &stats->transfer);
+    statistics_write(w, "size", &stats->transfer_size);
+    __margo_json_writer_end_object(w);
+    statistics_pair_write(w, "transfer_cb", stats->transfer_cb, "duration",
+                          "relative_timestamp_from_itransfer_start");
+    statistics_pair_write(w, "itransfer_wait", stats->wait, "duration",
+                          "relative_timestamp_from_itransfer_end");
+    static const char* const hist_names[NUM_BULK_TRANSFER_HISTS]
+        = {"transfer"};
+    histograms_write(w, stats->hist, hist_names, NUM_BULK_TRANSFER_HISTS,
+                     monitor);
+}
 
-    struct json_object* handler = json_object_new_object();
-    json_object_object_add_ex(json, "handler", handler,
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(handler, "duration",
-                              statistics_to_json(&stats->handler, reset),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
+static void origin_rpc_statistics_write(margo_json_writer_t*           w,
+                                        const origin_rpc_statistics_t* stats,
+                                        const default_monitor_state_t* monitor)
+{
+    statistics_pair_write(w, "iforward", stats->forward, "duration",
+                          "relative_timestamp_from_create");
+    statistics_pair_write(w, "forward_cb", stats->forward_cb, "duration",
+                          "relative_timestamp_from_iforward_start");
+    statistics_pair_write(w, "iforward_wait", stats->wait, "duration",
+                          "relative_timestamp_from_iforward_end");
+    statistics_pair_write(w, "set_input", stats->set_input, "duration",
+                          "relative_timestamp_from_iforward_start");
+    statistics_pair_write(w, "get_output", stats->get_output, "duration",
+                          "relative_timestamp_from_wait_end");
+    static const char* const hist_names[NUM_ORIGIN_HISTS] = {"forward"};
+    histograms_write(w, stats->hist, hist_names, NUM_ORIGIN_HISTS, monitor);
+}
 
-    json_object_object_add_ex(
-        json, "ult",
-        statistics_pair_to_json(stats->ult, "duration",
-                                "relative_timestamp_from_handler_start", reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "irespond",
-        statistics_pair_to_json(stats->respond, "duration",
-                                "relative_timestamp_from_ult_start", reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "respond_cb",
-        statistics_pair_to_json(stats->respond_cb, "duration",
-                                "relative_timestamp_from_irespond_start",
-                                reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "irespond_wait",
-        statistics_pair_to_json(stats->wait, "duration",
-                                "relative_timestamp_from_irespond_end", reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "set_output",
-        statistics_pair_to_json(stats->set_output, "duration",
-                                "relative_timestamp_from_irespond_start",
-                                reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(
-        json, "get_input",
-        statistics_pair_to_json(stats->get_input, "duration",
-                                "relative_timestamp_from_ult_start", reset),
-        JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    return json;
+static void target_rpc_statistics_write(margo_json_writer_t*           w,
+                                        const target_rpc_statistics_t* stats,
+                                        const default_monitor_state_t* monitor)
+{
+    __margo_json_writer_key(w, "handler");
+    __margo_json_writer_begin_object(w);
+    statistics_write(w, "duration", &stats->handler);
+    __margo_json_writer_end_object(w);
+    statistics_pair_write(w, "ult", stats->ult, "duration",
+                          "relative_timestamp_from_handler_start");
+    statistics_pair_write(w, "irespond", stats->respond, "duration",
+                          "relative_timestamp_from_ult_start");
+    statistics_pair_write(w, "respond_cb", stats->respond_cb, "duration",
+                          "relative_timestamp_from_irespond_start");
+    statistics_pair_write(w, "irespond_wait", stats->wait, "duration",
+                          "relative_timestamp_from_irespond_end");
+    statistics_pair_write(w, "set_output", stats->set_output, "duration",
+                          "relative_timestamp_from_irespond_start");
+    statistics_pair_write(w, "get_input", stats->get_input, "duration",
+                          "relative_timestamp_from_ult_start");
+    if (monitor->enable_cpu_time) {
+        __margo_json_writer_key(w, "cpu_time");
+        __margo_json_writer_begin_object(w);
+        statistics_write(w, "duration", &stats->cpu_time);
+        __margo_json_writer_end_object(w);
+    }
+    static const char* const hist_names[NUM_TARGET_HISTS]
+        = {"ult_queue", "handler", "respond"};
+    histograms_write(w, stats->hist, hist_names, NUM_TARGET_HISTS, monitor);
 }
 
-/* This function creates a string in the form "A:B:C:D" where
+/* This function writes into rpc_key a string in the form "A:B:C:D" where
  * - A is the parent RPC id
  * - B is the parent provider id
  * - C is the current RPC id
  * - D is the current provider id
- * The returned string must be freed by the caller.
  */
-static char* build_rpc_key(const callpath_t* callpath)
+static void
+build_rpc_key(const callpath_t* callpath, char* rpc_key, size_t size)
 {
     uint16_t provider_id;
     hg_id_t  base_id;
@@ -1936,21 +2456,17 @@ static char* build_rpc_key(const callpath_t* callpath)
     hg_id_t  parent_base_id;
     demux_id(callpath->rpc_id, &base_id, &provider_id);
     demux_id(callpath->parent_id, &parent_base_id, &parent_provider_id);
-    size_t len     = snprintf(NULL, 0, "%lu:%d:%lu:%d", parent_base_id,
-                          parent_provider_id, base_id, provider_id);
-    char*  rpc_key = (char*)calloc(len + 1, 1);
-    sprintf(rpc_key, "%lu:%d:%lu:%d", parent_base_id, parent_provider_id,
-            base_id, provider_id);
-    return rpc_key;
+    snprintf(rpc_key, size, "%lu:%d:%lu:%d", parent_base_id,
+             parent_provider_id, base_id, provider_id);
 }
 
-/* This function adds the id, provider_id, parent_id,
- * parent_provider_id, and name  attributes to a
- * JSON fragment containing RPC statistics.
+/* This function writes the id, provider_id, parent_id,
+ * parent_provider_id, and name attributes of the JSON
+ * object containing RPC statistics.
  */
-static void fill_json_with_rpc_info(struct json_object*            rpc_json,
-                                    const callpath_t*              callpath,
-                                    const default_monitor_state_t* monitor)
+static void write_rpc_info(margo_json_writer_t*           w,
+                           const callpath_t*              callpath,
+                           const default_monitor_state_t* monitor)
 {
     uint16_t provider_id;
     hg_id_t  base_id;
@@ -1958,228 +2474,320 @@ static void fill_json_with_rpc_info(struct json_object*            rpc_json,
     hg_id_t  parent_base_id;
     demux_id(callpath->rpc_id, &base_id, &provider_id);
     demux_id(callpath->parent_id, &parent_base_id, &parent_provider_id);
-    // add "rpc_id" entry
-    json_object_object_add_ex(rpc_json, "rpc_id",
-                              json_object_new_uint64(base_id),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    // add "provider_id" entry
-    json_object_object_add_ex(rpc_json, "provider_id",
-                              json_object_new_uint64(provider_id),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    // add "parent_id" entry
-    json_object_object_add_ex(rpc_json, "parent_rpc_id",
-                              json_object_new_uint64(parent_base_id),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    // add "parent_provider_id" entry
-    json_object_object_add_ex(rpc_json, "parent_provider_id",
-                              json_object_new_uint64(parent_provider_id),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    // add "name" entry
+    __margo_json_writer_key_uint64(w, "rpc_id", base_id);
+    __margo_json_writer_key_uint64(w, "provider_id", provider_id);
+    __margo_json_writer_key_uint64(w, "parent_rpc_id", parent_base_id);
+    __margo_json_writer_key_uint64(w, "parent_provider_id",
+                                   parent_provider_id);
     rpc_info_t* rpc_info = rpc_info_find(monitor->rpc_info, callpath->rpc_id);
     const char* rpc_name = rpc_info ? rpc_info->name : "";
-    rpc_name             = rpc_name ? rpc_name : "";
-    json_object_object_add_ex(rpc_json, "name",
-                              json_object_new_string(rpc_name),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    __margo_json_writer_key_string(w, "name", rpc_name ? rpc_name : "");
 }
 
-static struct json_object*
-monitor_statistics_to_json(const default_monitor_state_t* state, bool reset)
+/* Writes a key of the form "<prefix> <address>" */
+static void
+write_addr_key(margo_json_writer_t* w, const char* prefix, const char* addr)
 {
-    struct json_object* json = json_object_new_object();
-    // add self address
-    json_object_object_add_ex(json, "address",
-                              json_object_new_string(state->self_addr_str),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    // mercury progress loop statistic
-    json_object_object_add_ex(json, "progress_loop",
-                              hg_statistics_to_json(&state->hg_stats, reset),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    // RPC statistics
-    struct json_object* rpcs = json_object_new_object();
-    json_object_object_add_ex(json, "rpcs", rpcs, JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    // origin statistics
+    char key[256];
+    snprintf(key, sizeof(key), "%s %s", prefix, addr);
+    __margo_json_writer_key(w, key);
+}
+
+/* The merged statistics are written in the "rpcs" section as follows.
+ *   "<rpc key>": {
+ *     <rpc info>,
+ *     "origin": { "sent to <addr>": { <origin stats> }, ... },
+ *     "target": {
+ *       "received from <addr>": {
+ *         <target stats>,
+ *         "bulk": {
+ *           "create": { <bulk create stats> },
+ *           "pull from <addr>": { <bulk transfer stats> }, ...
+ *         }
+ *       }, ...
+ *     }
+ *   }
+ * Since JSON objects are written in one go, the entries of the four
+ * hashes are first sorted by RPC key, side (origin/target), address,
+ * and kind of entry.
+ */
+typedef enum rpc_entry_kind
+{
+    RPC_ENTRY_ORIGIN = 0,
+    RPC_ENTRY_TARGET,
+    RPC_ENTRY_BULK_CREATE,
+    RPC_ENTRY_BULK_TRANSFER
+} rpc_entry_kind_t;
+
+typedef struct rpc_entry {
+    rpc_entry_kind_t  kind;
+    const callpath_t* callpath;
+    const bulk_key_t* bulk_key; /* bulk transfers only */
+    const void*       stats;
+    const char*       addr;        /* name of callpath->addr_id */
+    const char*       remote_addr; /* name of bulk_key->remote_addr_id */
+} rpc_entry_t;
+
+#define COMPARE_FIELD(__a__, __b__) \
+    if ((__a__) != (__b__)) return (__a__) < (__b__) ? -1 : 1
+
+static int rpc_entry_compare(const void* a, const void* b)
+{
+    const rpc_entry_t* x = (const rpc_entry_t*)a;
+    const rpc_entry_t* y = (const rpc_entry_t*)b;
+    COMPARE_FIELD(x->callpath->parent_id, y->callpath->parent_id);
+    COMPARE_FIELD(x->callpath->rpc_id, y->callpath->rpc_id);
+    COMPARE_FIELD(x->kind != RPC_ENTRY_ORIGIN, y->kind != RPC_ENTRY_ORIGIN);
+    COMPARE_FIELD(x->callpath->addr_id, y->callpath->addr_id);
+    COMPARE_FIELD(x->kind, y->kind);
+    if (x->kind != RPC_ENTRY_BULK_TRANSFER) return 0;
+    COMPARE_FIELD(x->bulk_key->operation, y->bulk_key->operation);
+    COMPARE_FIELD(x->bulk_key->remote_addr_id, y->bulk_key->remote_addr_id);
+    return 0;
+}
+
+#undef COMPARE_FIELD
+
+/* Collects the entries of the merged hashes, with their address names */
+static rpc_entry_t* collect_rpc_entries(const default_monitor_state_t* monitor,
+                                        const monitor_shard_t*         merged,
+                                        size_t*                        count)
+{
+    size_t n = HASH_COUNT(merged->origin_rpc_stats)
+             + HASH_COUNT(merged->target_rpc_stats)
+             + HASH_COUNT(merged->bulk_create_stats)
+             + HASH_COUNT(merged->bulk_transfer_stats);
+    *count = 0;
+    if (n == 0) return NULL;
+    rpc_entry_t* entries = (rpc_entry_t*)calloc(n, sizeof(*entries));
+    if (!entries) return NULL;
+    size_t i = 0;
     {
         origin_rpc_statistics_t *p, *tmp;
-        ABT_mutex_spinlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&state->origin_rpc_stats_mtx));
-        HASH_ITER(hh, state->origin_rpc_stats, p, tmp)
+        HASH_ITER(hh, merged->origin_rpc_stats, p, tmp)
         {
-            // build RPC key
-            char* rpc_key = build_rpc_key(&(p->callpath));
-            // find JSON object corresponding to this RPC key
-            struct json_object* rpc_json
-                = json_object_object_get(rpcs, rpc_key);
-            if (!rpc_json) {
-                rpc_json = json_object_new_object();
-                json_object_object_add(rpcs, rpc_key, rpc_json);
-                // fill RPC information
-                fill_json_with_rpc_info(rpc_json, &(p->callpath), state);
-            }
-            // find or add "origin" section
-            struct json_object* origin
-                = json_object_object_get_or_create_object(rpc_json, "origin");
-            // get the destination address from the callpath
-            addr_info_t* addr_info
-                = addr_info_find_by_id(state, p->callpath.addr_id);
-            char addr_key[256];
-            sprintf(addr_key, "sent to %s",
-                    addr_info ? addr_info->name : "<unknown>");
-            // convert origin_rpc_statistics to json
-            struct json_object* stats = origin_rpc_statistics_to_json(p, reset);
-            // add statistics to "origin" object with the address as key
-            json_object_object_add_ex(origin, addr_key, stats,
-                                      JSON_C_OBJECT_ADD_KEY_IS_NEW);
-            free(rpc_key);
-        }
-        ABT_mutex_unlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&state->origin_rpc_stats_mtx));
-    }
-    // target statistics
+            entries[i++] = (rpc_entry_t){.kind     = RPC_ENTRY_ORIGIN,
+                                         .callpath = &p->callpath,
+                                         .stats    = p};
+        }
+    }
     {
         target_rpc_statistics_t *p, *tmp;
-        ABT_mutex_spinlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&state->target_rpc_stats_mtx));
-        HASH_ITER(hh, state->target_rpc_stats, p, tmp)
+        HASH_ITER(hh, merged->target_rpc_stats, p, tmp)
         {
-            // build RPC key
-            char* rpc_key = build_rpc_key(&(p->callpath));
-            // find json object corresponding to this RPC
-            struct json_object* rpc_json
-                = json_object_object_get(rpcs, rpc_key);
-            if (!rpc_json) {
-                rpc_json = json_object_new_object();
-                json_object_object_add(rpcs, rpc_key, rpc_json);
-                // fill RPC information
-                fill_json_with_rpc_info(rpc_json, &(p->callpath), state);
-            }
-            // find or add "target" section
-            struct json_object* target
-                = json_object_object_get_or_create_object(rpc_json, "target");
-            // get the source address from the callpath
-            addr_info_t* addr_info
-                = addr_info_find_by_id(state, p->callpath.addr_id);
-            char addr_key[256];
-            sprintf(addr_key, "received from %s",
-                    addr_info ? addr_info->name : "<unknown>");
-            // convert target_rpc_statistics to json
-            struct json_object* stats = target_rpc_statistics_to_json(p, reset);
-            // add statistics to "target" object with the address as key
-            json_object_object_add_ex(target, addr_key, stats,
-                                      JSON_C_OBJECT_ADD_KEY_IS_NEW);
-            free(rpc_key);
-        }
-        ABT_mutex_unlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&state->target_rpc_stats_mtx));
-    }
-    // bulk create statistics
+            entries[i++] = (rpc_entry_t){.kind     = RPC_ENTRY_TARGET,
+                                         .callpath = &p->callpath,
+                                         .stats    = p};
+        }
+    }
     {
         bulk_create_statistics_t *p, *tmp;
-        ABT_mutex_spinlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&state->bulk_create_stats_mtx));
-        HASH_ITER(hh, state->bulk_create_stats, p, tmp)
+        HASH_ITER(hh, merged->bulk_create_stats, p, tmp)
         {
-            // build RPC key
-            char* rpc_key = build_rpc_key(&(p->callpath));
-            // find json object corresponding to the RPC
-            struct json_object* rpc_json
-                = json_object_object_get(rpcs, rpc_key);
-            if (!rpc_json) {
-                rpc_json = json_object_new_object();
-                json_object_object_add(rpcs, rpc_key, rpc_json);
-                // fill RPC information
-                fill_json_with_rpc_info(rpc_json, &(p->callpath), state);
-            }
-            // find or add a "target" section for it
-            struct json_object* target
-                = json_object_object_get_or_create_object(rpc_json, "target");
-            // get the source address from the callpath
-            addr_info_t* addr_info
-                = addr_info_find_by_id(state, p->callpath.addr_id);
-            char addr_key[256];
-            sprintf(addr_key, "received from %s",
-                    addr_info ? addr_info->name : "<unknown>");
-            // find or add the "received from <address>" section
-            struct json_object* received_from
-                = json_object_object_get_or_create_object(target, addr_key);
-            // find or add the "bulk" section in "received_from"
-            struct json_object* bulk = json_object_object_get_or_create_object(
-                received_from, "bulk");
-            // convert bulk_create_statistics to json
-            struct json_object* create
-                = bulk_create_statistics_to_json(p, reset);
-            // add statistics
-            json_object_object_add_ex(bulk, "create", create,
-                                      JSON_C_OBJECT_ADD_KEY_IS_NEW);
-            free(rpc_key);
-        }
-        ABT_mutex_unlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&state->bulk_create_stats_mtx));
-    }
-    // bulk transfer statistics
+            entries[i++] = (rpc_entry_t){.kind     = RPC_ENTRY_BULK_CREATE,
+                                         .callpath = &p->callpath,
+                                         .stats    = p};
+        }
+    }
     {
         bulk_transfer_statistics_t *p, *tmp;
-        ABT_mutex_spinlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&state->bulk_transfer_stats_mtx));
-        HASH_ITER(hh, state->bulk_transfer_stats, p, tmp)
+        HASH_ITER(hh, merged->bulk_transfer_stats, p, tmp)
         {
-            // build RPC key
-            char* rpc_key = build_rpc_key(&(p->bulk_key.callpath));
-            // find json object corresponding to the RPC
-            struct json_object* rpc_json
-                = json_object_object_get(rpcs, rpc_key);
-            if (!rpc_json) {
-                rpc_json = json_object_new_object();
-                json_object_object_add(rpcs, rpc_key, rpc_json);
-                // fill RPC information
-                fill_json_with_rpc_info(rpc_json, &(p->bulk_key.callpath),
-                                        state);
-            }
-            // find or add a "target" section for it
-            struct json_object* target
-                = json_object_object_get_or_create_object(rpc_json, "target");
-            // get the source address from the callpath
-            addr_info_t* addr_info
-                = addr_info_find_by_id(state, p->bulk_key.callpath.addr_id);
-            char addr_key[256];
-            sprintf(addr_key, "received from %s",
-                    addr_info ? addr_info->name : "<unknown>");
-            // find or add the "received from <address>" section
-            struct json_object* received_from
-                = json_object_object_get_or_create_object(target, addr_key);
-            // find or add the "bulk" section
-            struct json_object* bulk = json_object_object_get_or_create_object(
-                received_from, "bulk");
-            // get the address used in the transfer and the direction of the
-            // transfer
-            addr_info_t* xfer_addr_info
-                = addr_info_find_by_id(state, p->bulk_key.remote_addr_id);
-            char xfer_addr_key[256];
-            if (p->bulk_key.operation == HG_BULK_PULL) {
-                sprintf(xfer_addr_key, "pull from %s",
-                        xfer_addr_info ? xfer_addr_info->name : "<unknown>");
-            } else {
-                sprintf(xfer_addr_key, "push to %s",
-                        xfer_addr_info ? xfer_addr_info->name : "<unknown>");
-            }
-            // convert bulk_transfer_statistics to json
-            struct json_object* stats
-                = bulk_transfer_statistics_to_json(p, reset);
-            // add statistics with the address as key
-            json_object_object_add_ex(bulk, xfer_addr_key, stats,
-                                      JSON_C_OBJECT_ADD_KEY_IS_NEW);
-            free(rpc_key);
+            entries[i++] = (rpc_entry_t){.kind     = RPC_ENTRY_BULK_TRANSFER,
+                                         .callpath = &p->bulk_key.callpath,
+                                         .bulk_key = &p->bulk_key,
+                                         .stats    = p};
+        }
+    }
+    // addr_info entries are only freed on finalize, so their names
+    // remain valid after the mutex is released
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->addr_info_mtx));
+    for (i = 0; i < n; i++) {
+        addr_info_t* info
+            = addr_info_find_by_id(monitor, entries[i].callpath->addr_id);
+        entries[i].addr = info ? info->name : "<unknown>";
+        if (entries[i].kind != RPC_ENTRY_BULK_TRANSFER) continue;
+        info = addr_info_find_by_id(monitor,
+                                    entries[i].bulk_key->remote_addr_id);
+        entries[i].remote_addr = info ? info->name : "<unknown>";
+    }
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->addr_info_mtx));
+    qsort(entries, n, sizeof(*entries), rpc_entry_compare);
+    *count = n;
+    return entries;
+}
+
+/* Writes the content of the "rpcs" section from sorted entries */
+static void write_rpc_entries(margo_json_writer_t*           w,
+                              const rpc_entry_t*             entries,
+                              size_t                         count,
+                              const default_monitor_state_t* monitor)
+{
+    for (size_t i = 0; i < count; i++) {
+        const rpc_entry_t* e    = &entries[i];
+        const rpc_entry_t* prev = i ? &entries[i - 1] : NULL;
+        bool               same_rpc
+            = prev && prev->callpath->rpc_id == e->callpath->rpc_id
+           && prev->callpath->parent_id == e->callpath->parent_id;
+        bool same_side = same_rpc
+                      && (prev->kind == RPC_ENTRY_ORIGIN)
+                             == (e->kind == RPC_ENTRY_ORIGIN);
+        bool same_addr
+            = same_side && prev->callpath->addr_id == e->callpath->addr_id;
+        bool same_bulk
+            = same_addr && prev->kind >= RPC_ENTRY_BULK_CREATE;
+        // close the objects of the previous entry
+        if (prev && !same_bulk && prev->kind >= RPC_ENTRY_BULK_CREATE)
+            __margo_json_writer_end_object(w);
+        if (prev && !same_addr) __margo_json_writer_end_object(w);
+        if (prev && !same_side) __margo_json_writer_end_object(w);
+        if (prev && !same_rpc) __margo_json_writer_end_object(w);
+        // open the objects of this entry
+        if (!same_rpc) {
+            char rpc_key[128];
+            build_rpc_key(e->callpath, rpc_key, sizeof(rpc_key));
+            __margo_json_writer_key(w, rpc_key);
+            __margo_json_writer_begin_object(w);
+            write_rpc_info(w, e->callpath, monitor);
+        }
+        if (!same_side) {
+            __margo_json_writer_key(
+                w, e->kind == RPC_ENTRY_ORIGIN ? "origin" : "target");
+            __margo_json_writer_begin_object(w);
+        }
+        if (!same_addr) {
+            write_addr_key(w,
+                           e->kind == RPC_ENTRY_ORIGIN ? "sent to"
+                                                       : "received from",
+                           e->addr);
+            __margo_json_writer_begin_object(w);
+        }
+        if (!same_bulk && e->kind >= RPC_ENTRY_BULK_CREATE) {
+            __margo_json_writer_key(w, "bulk");
+            __margo_json_writer_begin_object(w);
+        }
+        // write the statistics
+        switch (e->kind) {
+        case RPC_ENTRY_ORIGIN:
+            origin_rpc_statistics_write(w, e->stats, monitor);
+            break;
+        case RPC_ENTRY_TARGET:
+            target_rpc_statistics_write(w, e->stats, monitor);
+            break;
+        case RPC_ENTRY_BULK_CREATE:
+            __margo_json_writer_key(w, "create");
+            __margo_json_writer_begin_object(w);
+            bulk_create_statistics_write(w, e->stats, monitor);
+            __margo_json_writer_end_object(w);
+            break;
+        case RPC_ENTRY_BULK_TRANSFER:
+            write_addr_key(w,
+                           e->bulk_key->operation == HG_BULK_PULL ? "pull from"
+                                                                  : "push to",
+                           e->remote_addr);
+            __margo_json_writer_begin_object(w);
+            bulk_transfer_statistics_write(w, e->stats, monitor);
+            __margo_json_writer_end_object(w);
+            break;
         }
-        ABT_mutex_unlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&state->bulk_transfer_stats_mtx));
+    }
+    if (count == 0) return;
+    if (entries[count - 1].kind >= RPC_ENTRY_BULK_CREATE)
+        __margo_json_writer_end_object(w); /* bulk */
+    __margo_json_writer_end_object(w);     /* address */
+    __margo_json_writer_end_object(w);     /* side */
+    __margo_json_writer_end_object(w);     /* RPC */
+}
+
+/* Writes the exact RPC counts, when only a sample of the RPCs is
+ * monitored */
+static void write_rpc_counts(margo_json_writer_t*           w,
+                             const monitor_shard_t*         merged,
+                             const default_monitor_state_t* monitor)
+{
+    __margo_json_writer_key(w, "sampling");
+    __margo_json_writer_begin_object(w);
+    __margo_json_writer_key_uint64(w, "sample_rpcs_every",
+                                   monitor->sample_rpcs_every);
+    __margo_json_writer_key(w, "rpcs");
+    __margo_json_writer_begin_array(w);
+    rpc_count_t *p, *tmp;
+    HASH_ITER(hh, merged->rpc_counts, p, tmp)
+    {
+        __margo_json_writer_begin_object(w);
+        __margo_json_writer_key_uint64(w, "rpc_id", p->id);
+        rpc_info_t* rpc_info = rpc_info_find(
+            monitor->rpc_info, mux_id(p->id, MARGO_DEFAULT_PROVIDER_ID));
+        __margo_json_writer_key_string(w, "name",
+                                       rpc_info ? rpc_info->name : "");
+        __margo_json_writer_key(w, "origin");
+        __margo_json_writer_begin_object(w);
+        __margo_json_writer_key_uint64(w, "num", p->origin_total);
+        __margo_json_writer_key_uint64(w, "sampled", p->origin_sampled);
+        __margo_json_writer_end_object(w);
+        __margo_json_writer_key(w, "target");
+        __margo_json_writer_begin_object(w);
+        __margo_json_writer_key_uint64(w, "num", p->target_total);
+        __margo_json_writer_key_uint64(w, "sampled", p->target_sampled);
+        __margo_json_writer_end_object(w);
+        __margo_json_writer_end_object(w);
+    }
+    __margo_json_writer_end_array(w);
+    __margo_json_writer_end_object(w);
+}
+
+static void monitor_statistics_write(margo_json_writer_t*           w,
+                                     const default_monitor_state_t* state,
+                                     bool                           reset)
+{
+    // merge the shards, each shard being locked only while it is merged
+    monitor_shard_t merged;
+    memset(&merged, 0, sizeof(merged));
+    for (int i = 0; i < MONITOR_NUM_SHARDS; i++) {
+        monitor_shard_t* shard = state->shards[i];
+        ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&shard->mutex));
+        __margo_monitor_shard_merge(&merged, shard, reset);
+        ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&shard->mutex));
+    }
+    size_t       num_entries = 0;
+    rpc_entry_t* entries = collect_rpc_entries(state, &merged, &num_entries);
+
+    __margo_json_writer_begin_object(w);
+    // add self address
+    __margo_json_writer_key_string(w, "address", state->self_addr_str);
+    // mercury progress loop statistic
+    __margo_json_writer_key(w, "progress_loop");
+    progress_loop_write(w, &merged, state, reset);
+    // RPC admission limits
+    if (state->mid->num_rpc_limits) {
+        struct json_object* limits = __margo_rpc_limits_usage_to_json(
+            state->mid->rpc_limits, state->mid->num_rpc_limits, reset);
+        __margo_json_writer_key(w, "rpc_limits");
+        __margo_json_writer_json(w, limits);
+        json_object_put(limits);
+    }
+    // RPC statistics
+    __margo_json_writer_key(w, "rpcs");
+    __margo_json_writer_begin_object(w);
+    write_rpc_entries(w, entries, num_entries, state);
+    __margo_json_writer_end_object(w);
+    free(entries);
+    // exact RPC counts, when only a sample of the RPCs is monitored
+    if (state->sample_rpcs_every > 1) write_rpc_counts(w, &merged, state);
+    __margo_monitor_shard_clear(&merged);
+    // slowest RPCs
+    if (state->enable_outliers) {
+        __margo_json_writer_key(w, "outliers");
+        __margo_monitor_outliers_write(w, state, reset);
     }
     // add hostname and pid
     char hostname[1024];
     hostname[1023] = '\0';
     gethostname(hostname, 1023);
     pid_t pid = getpid();
-    json_object_object_add(json, "hostname", json_object_new_string(hostname));
-    json_object_object_add(json, "pid", json_object_new_int(pid));
+    __margo_json_writer_key_string(w, "hostname", hostname);
+    __margo_json_writer_key(w, "pid");
+    __margo_json_writer_int64(w, pid);
 
     // add command line
     FILE* cmdline_file = fopen("/proc/self/cmdline", "r");
@@ -2187,89 +2795,87 @@ monitor_statistics_to_json(const default_monitor_state_t* state, bool reset)
         char* cmdline = (char*)malloc(4096);
         if (cmdline) {
             size_t size = fread(cmdline, 1, 4096, cmdline_file);
-            struct json_object* cmdline_json = json_object_new_array();
+            __margo_json_writer_key(w, "cmdline");
+            __margo_json_writer_begin_array(w);
             char* p = cmdline;
             while (p < cmdline + size) {
                 size_t len = strlen(p);
-                if (len > 0) {
-                    json_object_array_add(cmdline_json, json_object_new_string(p));
-                }
+                if (len > 0) __margo_json_writer_string(w, p);
                 p += len + 1;
             }
-            json_object_object_add(json, "cmdline", cmdline_json);
+            __margo_json_writer_end_array(w);
         }
         free(cmdline);
         fclose(cmdline_file);
     }
-    return json;
+    __margo_json_writer_end_object(w);
 }
 
-static struct json_object*
-monitor_time_series_to_json(const default_monitor_state_t* monitor, bool reset)
+static void monitor_time_series_write(margo_json_writer_t*           w,
+                                      const default_monitor_state_t* monitor,
+                                      bool                           reset)
 {
-    struct json_object* json = json_object_new_object();
+    __margo_json_writer_begin_object(w);
     // add self address
-    json_object_object_add_ex(json, "address",
-                              json_object_new_string(monitor->self_addr_str),
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    __margo_json_writer_key_string(w, "address", monitor->self_addr_str);
     /* RPC time series */
-    struct json_object* rpcs = json_object_new_object();
-    json_object_object_add_ex(json, "rpcs", rpcs, JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    {
+    __margo_json_writer_key(w, "rpcs");
+    __margo_json_writer_begin_object(w);
+    // list the time series, which are only freed on finalize
+    ABT_mutex_spinlock(
+        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_time_series_mtx));
+    size_t              num_rpcs = HASH_COUNT(monitor->rpc_time_series);
+    rpc_time_series_t** rpc_ts_list
+        = num_rpcs ? (rpc_time_series_t**)malloc(num_rpcs * sizeof(void*))
+                   : NULL;
+    if (rpc_ts_list) {
         rpc_time_series_t *rpc_ts, *tmp;
-        ABT_mutex_spinlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_time_series_mtx));
+        size_t             i = 0;
         HASH_ITER(hh, monitor->rpc_time_series, rpc_ts, tmp)
         {
-            // get RPC name
-            rpc_info_t* rpc_info
-                = rpc_info_find(monitor->rpc_info, rpc_ts->rpc_id);
-            // get provider id and base id
-            hg_id_t  base_id;
-            uint16_t provider_id;
-            demux_id(rpc_ts->rpc_id, &base_id, &provider_id);
-            // create the key
-            size_t key_size;
-            char*  key;
-            if (rpc_info) {
-                key_size
-                    = snprintf(NULL, 0, "%s:%d", rpc_info->name, provider_id);
-                key = malloc(key_size + 1);
-                snprintf(key, key_size + 1, "%s:%d", rpc_info->name,
-                         provider_id);
-            } else {
-                key = malloc(10);
-                snprintf(key, 10, "<unknown>");
-            }
-            // create JSON object corresponding to this RPC's time series
-            struct json_object* json_ts
-                = rpc_time_series_to_json(rpc_ts, reset);
-            // add it to the RPC section
-            json_object_object_add_ex(rpcs, key, json_ts,
-                                      JSON_C_OBJECT_ADD_KEY_IS_NEW);
-            // free the key
-            free(key);
-        }
-        ABT_mutex_unlock(
-            ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_time_series_mtx));
-    }
-    struct json_object* pools = pool_time_series_to_json(monitor, reset);
-    json_object_object_add_ex(json, "pools", pools,
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    return json;
+            rpc_ts_list[i++] = rpc_ts;
+        }
+    } else {
+        num_rpcs = 0;
+    }
+    ABT_mutex_unlock(
+        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_time_series_mtx));
+    for (size_t i = 0; i < num_rpcs; i++) {
+        rpc_time_series_t* rpc_ts = rpc_ts_list[i];
+        // get RPC name
+        rpc_info_t* rpc_info = rpc_info_find(monitor->rpc_info, rpc_ts->rpc_id);
+        // get provider id and base id
+        hg_id_t  base_id;
+        uint16_t provider_id;
+        demux_id(rpc_ts->rpc_id, &base_id, &provider_id);
+        // create the key
+        char key[256];
+        if (rpc_info)
+            snprintf(key, sizeof(key), "%s:%d", rpc_info->name, provider_id);
+        else
+            snprintf(key, sizeof(key), "<unknown>");
+        __margo_json_writer_key(w, key);
+        __margo_json_writer_begin_object(w);
+        rpc_time_series_write(w, monitor, rpc_ts, reset);
+        __margo_json_writer_end_object(w);
+    }
+    free(rpc_ts_list);
+    __margo_json_writer_end_object(w);
+    /* Pool time series */
+    __margo_json_writer_key(w, "pools");
+    pool_time_series_write(w, monitor, reset);
+    /* Argobots profiler time series */
+    if (monitor->enable_abt_time_series) {
+        __margo_json_writer_key(w, "abt");
+        __margo_monitor_abt_time_series_write(w, monitor, reset);
+    }
+    __margo_json_writer_end_object(w);
 }
 
 /* ========================================================================
  * Functions related to the hash of rpc_info_t maintained by the monitor
  * ======================================================================== */
 
-static rpc_info_t* rpc_info_find(rpc_info_t* hash, hg_id_t id)
-{
-    rpc_info_t* info = NULL;
-    HASH_FIND(hh, hash, &id, sizeof(id), info);
-    return info;
-}
-
 static void rpc_info_clear(rpc_info_t* hash)
 {
     rpc_info_t *p, *tmp;
@@ -2284,38 +2890,104 @@ static void rpc_info_clear(rpc_info_t* hash)
  * Functions related to the hash of addr_info_t maintained by the monitor
  * ======================================================================== */
 
+/* Must be called with monitor->addr_info_mtx held */
 static addr_info_t* addr_info_find_or_add(default_monitor_state_t* monitor,
-                                          margo_instance_id        mid,
-                                          hg_addr_t                addr)
+                                          const char*              name,
+                                          size_t                   size)
 {
-    addr_info_t* info          = NULL;
-    char         addr_str[128] = {0};
-    hg_size_t    addr_str_size = 128;
-    hg_return_t  hret
-        = margo_addr_to_string(mid, addr_str, &addr_str_size, addr);
-    if (hret != HG_SUCCESS) {
-        strcpy(addr_str, "<unknown>");
-        addr_str_size = 9;
-    }
-    HASH_FIND(hh_by_name, monitor->addr_info_by_name, addr_str, addr_str_size,
-              info);
+    addr_info_t* info = NULL;
+    HASH_FIND(hh_by_name, monitor->addr_info_by_name, name, size, info);
     if (info) return info;
-    info = (addr_info_t*)calloc(1, sizeof(*info) + addr_str_size);
+    info = (addr_info_t*)calloc(1, sizeof(*info) + size);
     monitor->addr_info_last_id += 1;
     info->id = monitor->addr_info_last_id;
-    memcpy(info->name, addr_str, addr_str_size);
-    HASH_ADD(hh_by_name, monitor->addr_info_by_name, name[0], addr_str_size,
-             info);
+    memcpy(info->name, name, size);
+    HASH_ADD(hh_by_name, monitor->addr_info_by_name, name[0], size, info);
     HASH_ADD(hh_by_id, monitor->addr_info_by_id, id, sizeof(info->id), info);
     return info;
 }
 
-static addr_info_t* addr_info_find_by_id(const default_monitor_state_t* monitor,
-                                         uint64_t                       id)
+/* Must be called with the shard's mutex held. The address is converted
+ * into a string only when its hg_addr_t is not in the shard's cache (the
+ * first time it is seen, or after it was evicted), and the global
+ * addr_info hash is only locked the first time its string is seen by the
+ * shard. */
+static uint64_t addr_id_find_or_add(default_monitor_state_t* monitor,
+                                    monitor_shard_t*         shard,
+                                    margo_instance_id        mid,
+                                    hg_addr_t                addr)
 {
-    addr_info_t* info = NULL;
-    HASH_FIND(hh_by_id, monitor->addr_info_by_id, &id, sizeof(id), info);
-    return info;
+    addr_cache_entry_t* cached = NULL;
+    HASH_FIND(hh, shard->addr_cache, &addr, sizeof(addr), cached);
+    if (cached) {
+        if (cached->ref == addr || margo_addr_cmp(mid, cached->ref, addr)) {
+            // move the entry to the most recently used end
+            if (cached->hh.next) {
+                HASH_DEL(shard->addr_cache, cached);
+                HASH_ADD(hh, shard->addr_cache, addr, sizeof(addr), cached);
+            }
+            return cached->id;
+        }
+        // the hg_addr_t was reused for another peer
+        HASH_DEL(shard->addr_cache, cached);
+        margo_addr_free(mid, cached->ref);
+        free(cached);
+    }
+
+    addr_id_t*  entry         = NULL;
+    char        addr_str[128] = {0};
+    hg_size_t   addr_str_size = 128;
+    hg_return_t hret
+        = margo_addr_to_string(mid, addr_str, &addr_str_size, addr);
+    if (hret != HG_SUCCESS) {
+        strcpy(addr_str, "<unknown>");
+        addr_str_size = 9;
+    }
+    HASH_FIND(hh, shard->addr_ids, addr_str, addr_str_size, entry);
+    if (!entry) {
+        ABT_mutex_spinlock(
+            ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->addr_info_mtx));
+        addr_info_t* info
+            = addr_info_find_or_add(monitor, addr_str, addr_str_size);
+        ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->addr_info_mtx));
+        entry     = (addr_id_t*)calloc(1, sizeof(*entry) + addr_str_size);
+        entry->id = info->id;
+        memcpy(entry->name, addr_str, addr_str_size);
+        HASH_ADD(hh, shard->addr_ids, name[0], addr_str_size, entry);
+    }
+
+    // cache the id for this hg_addr_t
+    if (hret != HG_SUCCESS
+        || __atomic_load_n(&monitor->addr_cache_closed, __ATOMIC_ACQUIRE))
+        return entry->id;
+    if (HASH_COUNT(shard->addr_cache) >= ADDR_CACHE_CAPACITY) {
+        // evict the least recently used entry
+        cached = shard->addr_cache;
+        HASH_DEL(shard->addr_cache, cached);
+        margo_addr_free(mid, cached->ref);
+        free(cached);
+    }
+    hg_addr_t ref = HG_ADDR_NULL;
+    if (margo_addr_dup(mid, addr, &ref) != HG_SUCCESS) return entry->id;
+    cached       = (addr_cache_entry_t*)calloc(1, sizeof(*cached));
+    cached->addr = addr;
+    cached->ref  = ref;
+    cached->id   = entry->id;
+    HASH_ADD(hh, shard->addr_cache, addr, sizeof(addr), cached);
+    return entry->id;
+}
+
+/* Must be called with the shard's mutex held */
+static void addr_cache_clear(default_monitor_state_t* monitor,
+                             monitor_shard_t*         shard)
+{
+    addr_cache_entry_t *p, *tmp;
+    HASH_ITER(hh, shard->addr_cache, p, tmp)
+    {
+        HASH_DEL(shard->addr_cache, p);
+        margo_addr_free(monitor->mid, p->ref);
+        free(p);
+    }
 }
 
 static void addr_info_clear(addr_info_t* hash_by_id, addr_info_t* hash_by_name)
@@ -2332,35 +3004,354 @@ static void addr_info_clear(addr_info_t* hash_by_id, addr_info_t* hash_by_name)
     }
 }
 
+/* ========================================================================
+ * Functions related to the shards of statistics
+ * ======================================================================== */
+
+static void
+statistics_merge(statistics_t* dst, const statistics_t* src, size_t count)
+{
+    for (size_t i = 0; i < count; i++, dst++, src++) {
+        if (src->num == 0) continue;
+        if (dst->num == 0) {
+            *dst = *src;
+            continue;
+        }
+        /* var is the sum of squared differences from the mean,
+         * combined using Chan et al.'s parallel algorithm */
+        uint64_t num   = dst->num + src->num;
+        double   delta = src->avg - dst->avg;
+        dst->var       = dst->var + src->var
+                 + delta * delta * ((double)dst->num * src->num / num);
+        dst->min = dst->min < src->min ? dst->min : src->min;
+        dst->max = dst->max > src->max ? dst->max : src->max;
+        dst->sum += src->sum;
+        dst->num = num;
+        dst->avg = dst->sum / num;
+    }
+}
+
+static void
+histogram_merge(histogram_t* dst, const histogram_t* src, size_t count)
+{
+    for (size_t i = 0; i < count; i++, dst++, src++) {
+        if (src->total == 0) continue;
+        for (size_t b = 0; b < HISTOGRAM_NUM_BLOCKS; b++) {
+            const uint64_t* src_block = src->blocks[b];
+            if (!src_block) continue;
+            uint64_t* dst_block = histogram_block(dst, b * HISTOGRAM_SUB_COUNT);
+            if (!dst_block) continue;
+            for (size_t j = 0; j < HISTOGRAM_SUB_COUNT; j++)
+                dst_block[j] += src_block[j];
+        }
+        dst->min = (dst->min > src->min || dst->total == 0) ? src->min
+                                                            : dst->min;
+        dst->max = (dst->max < src->max) ? src->max : dst->max;
+        dst->total += src->total;
+    }
+}
+
+static void histogram_reset(histogram_t* hist, size_t count)
+{
+    for (size_t i = 0; i < count; i++, hist++) {
+        if (hist->total == 0) continue;
+        for (size_t b = 0; b < HISTOGRAM_NUM_BLOCKS; b++)
+            if (hist->blocks[b])
+                memset(hist->blocks[b], 0,
+                       HISTOGRAM_SUB_COUNT * sizeof(uint64_t));
+        hist->total = 0;
+        hist->min   = 0;
+        hist->max   = 0;
+    }
+}
+
+static void histogram_free(histogram_t* hist, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (!hist[i].blocks) continue;
+        for (size_t b = 0; b < HISTOGRAM_NUM_BLOCKS; b++)
+            free(hist[i].blocks[b]);
+        free(hist[i].blocks);
+    }
+}
+
+void __margo_monitor_shard_merge(monitor_shard_t* dst,
+                                 monitor_shard_t* src,
+                                 bool             reset)
+{
+    size_t count = sizeof(hg_statistics_t) / sizeof(statistics_t);
+    statistics_merge((statistics_t*)&dst->hg_stats,
+                     (statistics_t*)&src->hg_stats, count);
+    if (reset) memset(&src->hg_stats, 0, sizeof(src->hg_stats));
+    histogram_merge(dst->progress_hist, src->progress_hist, NUM_PROGRESS_HIST);
+    if (reset) histogram_reset(src->progress_hist, NUM_PROGRESS_HIST);
+    origin_rpc_stats_merge(dst, src, reset);
+    target_rpc_stats_merge(dst, src, reset);
+    bulk_create_stats_merge(dst, src, reset);
+    bulk_transfer_stats_merge(dst, src, reset);
+    {
+        rpc_count_t *p, *tmp;
+        HASH_ITER(hh, src->rpc_counts, p, tmp)
+        {
+            rpc_count_t* q = NULL;
+            HASH_FIND(hh, dst->rpc_counts, &p->id, sizeof(p->id), q);
+            if (!q) {
+                q     = (rpc_count_t*)calloc(1, sizeof(*q));
+                q->id = p->id;
+                HASH_ADD(hh, dst->rpc_counts, id, sizeof(q->id), q);
+            }
+            q->origin_total += p->origin_total;
+            q->origin_sampled += p->origin_sampled;
+            q->target_total += p->target_total;
+            q->target_sampled += p->target_sampled;
+            if (reset) {
+                p->origin_total   = 0;
+                p->origin_sampled = 0;
+                p->target_total   = 0;
+                p->target_sampled = 0;
+            }
+        }
+    }
+}
+
+void __margo_monitor_shard_clear(monitor_shard_t* shard)
+{
+    histogram_free(shard->progress_hist, NUM_PROGRESS_HIST);
+    memset(shard->progress_hist, 0, sizeof(shard->progress_hist));
+    origin_rpc_stats_clear(shard);
+    target_rpc_stats_clear(shard);
+    bulk_create_stats_clear(shard);
+    bulk_transfer_stats_clear(shard);
+    {
+        rpc_count_t *p, *tmp;
+        HASH_ITER(hh, shard->rpc_counts, p, tmp)
+        {
+            HASH_DEL(shard->rpc_counts, p);
+            free(p);
+        }
+    }
+    {
+        rpc_ts_count_t *p, *tmp;
+        HASH_ITER(hh, shard->rpc_ts_counts, p, tmp)
+        {
+            HASH_DEL(shard->rpc_ts_counts, p);
+            free(p);
+        }
+    }
+    {
+        addr_id_t *p, *tmp;
+        HASH_ITER(hh, shard->addr_ids, p, tmp)
+        {
+            HASH_DEL(shard->addr_ids, p);
+            free(p);
+        }
+    }
+    {
+        session_t* session = shard->session_pool;
+        while (session) {
+            session_t* next = session->next;
+            free(session);
+            session = next;
+        }
+        shard->session_pool = NULL;
+    }
+    {
+        bulk_session_t* session = shard->bulk_session_pool;
+        while (session) {
+            bulk_session_t* next = session->next;
+            free(session);
+            session = next;
+        }
+        shard->bulk_session_pool = NULL;
+    }
+}
+
 /* ========================================================================
  * Time series function definitions
  * ======================================================================== */
 
-static void time_series_append(time_series_t* series, double ts, uint64_t val)
+static void init_time_series_tiers(default_monitor_state_t* monitor,
+                                   struct json_object*      tiers)
+{
+    /* default: time_interval_sec for an hour, then 1 minute for a day */
+    double resolutions[MAX_TIME_SERIES_TIERS]
+        = {monitor->time_series_interval, 60.0};
+    double retentions[MAX_TIME_SERIES_TIERS] = {3600.0, 86400.0};
+    size_t num_tiers = monitor->time_series_interval < 60.0 ? 2 : 1;
+
+    if (tiers && json_object_is_type(tiers, json_type_array)
+        && json_object_array_length(tiers) > 0) {
+        num_tiers = 0;
+        size_t n  = json_object_array_length(tiers);
+        for (size_t i = 0; i < n && num_tiers < MAX_TIME_SERIES_TIERS; i++) {
+            struct json_object* tier = json_object_array_get_idx(tiers, i);
+            struct json_object* resolution
+                = json_object_object_get(tier, "resolution_sec");
+            struct json_object* retention
+                = json_object_object_get(tier, "retention_sec");
+            if (!resolution || !retention) continue;
+            double res = json_object_get_double(resolution);
+            double ret = json_object_get_double(retention);
+            /* each tier must be coarser than the previous one */
+            if (res <= 0.0 || ret < res) continue;
+            if (num_tiers && res <= resolutions[num_tiers - 1]) continue;
+            resolutions[num_tiers] = res;
+            retentions[num_tiers]  = ret;
+            num_tiers += 1;
+        }
+        /* the first tier's resolution is the update interval */
+        if (num_tiers) monitor->time_series_interval = resolutions[0];
+    }
+    if (num_tiers == 0) {
+        resolutions[0] = monitor->time_series_interval;
+        retentions[0]  = 3600.0;
+        num_tiers      = 1;
+    }
+
+    for (size_t i = 0; i < num_tiers; i++) {
+        time_series_tier_config_t* tier = &monitor->time_series_tiers[i];
+        tier->factor                    = 1;
+        if (i > 0) {
+            /* round to the nearest multiple of the previous resolution */
+            tier->factor = (size_t)(resolutions[i] / resolutions[i - 1] + 0.5);
+            if (tier->factor < 1) tier->factor = 1;
+        }
+        tier->resolution = i > 0 ? monitor->time_series_tiers[i - 1].resolution
+                                       * tier->factor
+                                 : resolutions[0];
+        tier->capacity   = (size_t)ceil(retentions[i] / tier->resolution);
+        if (tier->capacity < 1) tier->capacity = 1;
+    }
+    monitor->num_time_series_tiers = num_tiers;
+}
+
+static void time_series_push(const default_monitor_state_t* monitor,
+                             time_series_t*                 series,
+                             size_t                         index,
+                             double                         ts,
+                             uint64_t                       val)
+{
+    const time_series_tier_config_t* config
+        = &monitor->time_series_tiers[index];
+    time_series_tier_t* tier = &series->tiers[index];
+    if (!tier->data) {
+        tier->data = (timedval_t*)malloc(config->capacity * sizeof(timedval_t));
+        if (!tier->data) return;
+    }
+    size_t i = (tier->head + tier->size) % config->capacity;
+    if (tier->size == config->capacity)
+        tier->head = (tier->head + 1) % config->capacity; /* overwrite oldest */
+    else
+        tier->size += 1;
+    tier->data[i].timestamp = ts;
+    tier->data[i].value     = val;
+
+    /* aggregate into the next tier */
+    if (index + 1 >= monitor->num_time_series_tiers) return;
+    time_series_tier_t* next = &series->tiers[index + 1];
+    if (next->pending_count == 0)
+        next->pending = val;
+    else if (series->kind == TIME_SERIES_SUM)
+        next->pending += val;
+    else if (val > next->pending)
+        next->pending = val;
+    next->pending_count += 1;
+    if (next->pending_count < monitor->time_series_tiers[index + 1].factor)
+        return;
+    uint64_t aggregate  = next->pending;
+    next->pending       = 0;
+    next->pending_count = 0;
+    time_series_push(monitor, series, index + 1, ts, aggregate);
+}
+
+void __margo_monitor_time_series_append(const default_monitor_state_t* monitor,
+                                        time_series_t*                 series,
+                                        double                         ts,
+                                        uint64_t                       val)
+{
+    time_series_push(monitor, series, 0, ts, val);
+}
+
+void __margo_monitor_time_series_reset(time_series_t* series)
 {
-    timedval_frame_t* frame = series->last_frame;
-    if (!frame || frame->size == series->frame_capacity) {
-        frame = (timedval_frame_t*)malloc(
-            sizeof(*frame) + sizeof(timedval_t) * (series->frame_capacity - 1));
-        frame->next        = NULL;
-        frame->size        = 0;
-        series->last_frame = frame;
+    if (!series) return;
+    for (size_t i = 0; i < MAX_TIME_SERIES_TIERS; i++) {
+        series->tiers[i].head          = 0;
+        series->tiers[i].size          = 0;
+        series->tiers[i].pending       = 0;
+        series->tiers[i].pending_count = 0;
     }
-    if (!series->first_frame) series->first_frame = frame;
-    frame->data[frame->size].timestamp = ts;
-    frame->data[frame->size].value     = val;
-    frame->size += 1;
 }
 
-static void time_series_clear(time_series_t* series)
+void __margo_monitor_time_series_free(time_series_t* series)
 {
     if (!series) return;
-    while (series->first_frame) {
-        timedval_frame_t* next = series->first_frame->next;
-        free(series->first_frame);
-        series->first_frame = next;
+    for (size_t i = 0; i < MAX_TIME_SERIES_TIERS; i++) {
+        free(series->tiers[i].data);
+        series->tiers[i].data = NULL;
     }
-    series->last_frame = NULL;
+    __margo_monitor_time_series_reset(series);
+}
+
+void __margo_monitor_time_series_copy(const default_monitor_state_t* monitor,
+                                      time_series_t*                 dst,
+                                      const time_series_t*           src)
+{
+    memset(dst, 0, sizeof(*dst));
+    dst->kind = src->kind;
+    for (size_t t = 0; t < monitor->num_time_series_tiers; t++) {
+        const time_series_tier_t* from = &src->tiers[t];
+        time_series_tier_t*       to   = &dst->tiers[t];
+        size_t capacity = monitor->time_series_tiers[t].capacity;
+        if (from->size == 0) continue;
+        to->data = (timedval_t*)malloc(from->size * sizeof(timedval_t));
+        if (!to->data) continue;
+        size_t first = capacity - from->head;
+        if (first > from->size) first = from->size;
+        memcpy(to->data, from->data + from->head, first * sizeof(timedval_t));
+        memcpy(to->data + first, from->data,
+               (from->size - first) * sizeof(timedval_t));
+        to->size = from->size;
+    }
+}
+
+void __margo_monitor_time_series_write(margo_json_writer_t*           w,
+                                       const default_monitor_state_t* monitor,
+                                       const time_series_t* const*    series,
+                                       const char* const*             names,
+                                       size_t                         count)
+{
+    for (size_t t = 0; t < monitor->num_time_series_tiers; t++) {
+        size_t capacity = monitor->time_series_tiers[t].capacity;
+        double res      = monitor->time_series_tiers[t].resolution;
+
+        if (t == 1) {
+            __margo_json_writer_key(w, "tiers");
+            __margo_json_writer_begin_array(w);
+        }
+        if (t > 0) __margo_json_writer_begin_object(w);
+        __margo_json_writer_key_double(w, "resolution_sec", res);
+        const time_series_tier_t* ref = &series[0]->tiers[t];
+        __margo_json_writer_key(w, "timestamps");
+        __margo_json_writer_begin_array(w);
+        for (size_t i = 0; i < ref->size; i++) {
+            const timedval_t* v = &ref->data[(ref->head + i) % capacity];
+            __margo_json_writer_double(w, v->timestamp);
+        }
+        __margo_json_writer_end_array(w);
+        for (size_t k = 0; k < count; k++) {
+            const time_series_tier_t* tier = &series[k]->tiers[t];
+            __margo_json_writer_key(w, names[k]);
+            __margo_json_writer_begin_array(w);
+            for (size_t i = 0; i < tier->size; i++) {
+                const timedval_t* v = &tier->data[(tier->head + i) % capacity];
+                __margo_json_writer_uint64(w, v->value);
+            }
+            __margo_json_writer_end_array(w);
+        }
+        if (t > 0) __margo_json_writer_end_object(w);
+    }
+    if (monitor->num_time_series_tiers > 1) __margo_json_writer_end_array(w);
 }
 
 /* Free both RPC time series and Pool time series */
@@ -2373,8 +3364,8 @@ static void free_all_time_series(default_monitor_state_t* monitor)
     HASH_ITER(hh, monitor->rpc_time_series, p, tmp)
     {
         HASH_DEL(monitor->rpc_time_series, p);
-        time_series_clear(&(p->rpc_count_series));
-        time_series_clear(&(p->bulk_size_series));
+        __margo_monitor_time_series_free(&(p->rpc_count_series));
+        __margo_monitor_time_series_free(&(p->bulk_size_series));
         free(p);
     }
     ABT_mutex_unlock(
@@ -2384,13 +3375,16 @@ static void free_all_time_series(default_monitor_state_t* monitor)
         ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->pool_time_series_mtx));
     size_t num_pools = margo_get_num_pools(monitor->mid);
     for (size_t i = 0; i < num_pools; i++) {
-        time_series_clear(&(monitor->pool_size_time_series[i]));
-        time_series_clear(&(monitor->pool_total_size_time_series[i]));
+        __margo_monitor_time_series_free(&(monitor->pool_size_time_series[i]));
+        __margo_monitor_time_series_free(
+            &(monitor->pool_total_size_time_series[i]));
     }
     free(monitor->pool_size_time_series);
     free(monitor->pool_total_size_time_series);
     ABT_mutex_unlock(
-        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_time_series_mtx));
+        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->pool_time_series_mtx));
+
+    __margo_monitor_abt_time_series_free(monitor);
 }
 
 /* ========================================================================
@@ -2406,83 +3400,92 @@ find_or_add_time_series_for_rpc(default_monitor_state_t* monitor,
     if (!ts) {
         ts         = (rpc_time_series_t*)calloc(1, sizeof(*ts));
         ts->rpc_id = rpc_id;
-        ts->rpc_count_series.frame_capacity
-            = 256; // TODO: should this be configurable?
-        ts->bulk_size_series.frame_capacity
-            = 256; // TODO: should this be configurable?
+        ts->rpc_count_series.kind = TIME_SERIES_SUM;
+        ts->bulk_size_series.kind = TIME_SERIES_SUM;
         HASH_ADD(hh, monitor->rpc_time_series, rpc_id, sizeof(rpc_id), ts);
     }
     return ts;
 }
 
-static struct json_object* rpc_time_series_to_json(rpc_time_series_t* rpc_ts,
-                                                   bool               reset)
+/* Returns the shard's counts for the time series of an RPC. Must be
+ * called with the shard's mutex held. */
+static rpc_ts_count_t* rpc_ts_count_find_or_add(monitor_shard_t* shard,
+                                                hg_id_t          rpc_id)
 {
-    timedval_frame_t* frame      = rpc_ts->rpc_count_series.first_frame;
-    size_t            array_size = 0;
-    while (frame) {
-        array_size += frame->size;
-        frame = frame->next;
-    }
+    rpc_ts_count_t* count = NULL;
+    HASH_FIND(hh, shard->rpc_ts_counts, &rpc_id, sizeof(rpc_id), count);
+    if (!count) {
+        count     = (rpc_ts_count_t*)calloc(1, sizeof(*count));
+        count->id = rpc_id;
+        HASH_ADD(hh, shard->rpc_ts_counts, id, sizeof(count->id), count);
+    }
+    return count;
+}
 
-    struct json_object* json       = json_object_new_object();
-    struct json_object* timestamps = json_object_new_array_ext(array_size);
-    struct json_object* count      = json_object_new_array_ext(array_size);
-    struct json_object* bulk_size  = json_object_new_array_ext(array_size);
-    json_object_object_add_ex(json, "timestamps", timestamps,
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(json, "count", count,
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    json_object_object_add_ex(json, "bulk_size", bulk_size,
-                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
-    frame = rpc_ts->rpc_count_series.first_frame;
-    while (frame) {
-        for (size_t i = 0; i < frame->size; i++) {
-            json_object_array_add(
-                timestamps, json_object_new_double(frame->data[i].timestamp));
-            json_object_array_add(count,
-                                  json_object_new_uint64(frame->data[i].value));
-        }
-        frame = frame->next;
+/* Writes the time series of an RPC in the current object. The series are
+ * copied (and reset if requested) with the mutex held, then written. */
+static void rpc_time_series_write(margo_json_writer_t*           w,
+                                  const default_monitor_state_t* monitor,
+                                  rpc_time_series_t*             rpc_ts,
+                                  bool                           reset)
+{
+    time_series_t copies[2];
+    ABT_mutex_spinlock(
+        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_time_series_mtx));
+    __margo_monitor_time_series_copy(monitor, &copies[0],
+                                     &rpc_ts->rpc_count_series);
+    __margo_monitor_time_series_copy(monitor, &copies[1],
+                                     &rpc_ts->bulk_size_series);
+    if (reset) {
+        __margo_monitor_time_series_reset(&(rpc_ts->rpc_count_series));
+        __margo_monitor_time_series_reset(&(rpc_ts->bulk_size_series));
     }
+    ABT_mutex_unlock(
+        ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_time_series_mtx));
 
     // note: count and bulk_size time series are updated at
     // the same time in the progress callback, so we know
-    // the series of timestamps will be the same. No need to
-    // use the series of timestamps of bulk_size.
-
-    frame = rpc_ts->bulk_size_series.first_frame;
-    while (frame) {
-        for (size_t i = 0; i < frame->size; i++) {
-            json_object_array_add(bulk_size,
-                                  json_object_new_uint64(frame->data[i].value));
-        }
-        frame = frame->next;
-    }
-
-    if (!reset) goto finish;
-    time_series_clear(&(rpc_ts->rpc_count_series));
-    time_series_clear(&(rpc_ts->bulk_size_series));
-
-finish:
-    return json;
+    // the series of timestamps will be the same.
+    const time_series_t* const series[] = {&copies[0], &copies[1]};
+    const char* const          names[]  = {"count", "bulk_size"};
+    __margo_monitor_time_series_write(w, monitor, series, names, 2);
+    __margo_monitor_time_series_free(&copies[0]);
+    __margo_monitor_time_series_free(&copies[1]);
 }
 
+/* Adds a value to the time series of each RPC, summing and resetting
+ * the counts of all the shards. Locks rpc_time_series_mtx, then each
+ * shard in turn (the RPC path only ever locks its shard). */
 static void update_rpc_time_series(struct default_monitor_state* monitor,
                                    double                        timestamp)
 {
     if (!monitor->enable_time_series) return;
     rpc_time_series_t *rpc_ts, *tmp;
+    rpc_ts_count_t *   count, *count_tmp;
     ABT_mutex_spinlock(
         ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpc_time_series_mtx));
+    for (int i = 0; i < MONITOR_NUM_SHARDS; i++) {
+        monitor_shard_t* shard = monitor->shards[i];
+        ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&shard->mutex));
+        HASH_ITER(hh, shard->rpc_ts_counts, count, count_tmp)
+        {
+            if (!count->rpc_count && !count->bulk_size) continue;
+            rpc_ts = find_or_add_time_series_for_rpc(monitor, count->id);
+            rpc_ts->rpc_count += count->rpc_count;
+            rpc_ts->bulk_size += count->bulk_size;
+            count->rpc_count = 0;
+            count->bulk_size = 0;
+        }
+        ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&shard->mutex));
+    }
     HASH_ITER(hh, monitor->rpc_time_series, rpc_ts, tmp)
     {
-        time_series_append(&rpc_ts->rpc_count_series, timestamp,
-                           rpc_ts->rpc_count);
+        __margo_monitor_time_series_append(monitor, &rpc_ts->rpc_count_series,
+                                           timestamp, rpc_ts->rpc_count);
         rpc_ts->rpc_count = 0;
 
-        time_series_append(&rpc_ts->bulk_size_series, timestamp,
-                           rpc_ts->bulk_size);
+        __margo_monitor_time_series_append(monitor, &rpc_ts->bulk_size_series,
+                                           timestamp, rpc_ts->bulk_size);
         rpc_ts->bulk_size = 0;
     }
     ABT_mutex_unlock(
@@ -2494,77 +3497,50 @@ static void update_rpc_time_series(struct default_monitor_state* monitor,
  * Pool time series function definitions
  * ======================================================================== */
 
-static struct json_object*
-pool_time_series_to_json(const default_monitor_state_t* monitor, bool reset)
+/* Writes the time series of the pools as an object. The series are
+ * copied (and reset if requested) with the mutex held, then written. */
+static void pool_time_series_write(margo_json_writer_t*           w,
+                                   const default_monitor_state_t* monitor,
+                                   bool                           reset)
 {
+    size_t         num_pools = margo_get_num_pools(monitor->mid);
+    time_series_t* copies
+        = num_pools ? (time_series_t*)calloc(2 * num_pools, sizeof(*copies))
+                    : NULL;
+    if (!copies) num_pools = 0;
+
     ABT_mutex_spinlock(
         ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->pool_time_series_mtx));
-
-    struct json_object* json = json_object_new_object();
-
-    size_t num_pools = margo_get_num_pools(monitor->mid);
-    for (size_t i = 0; i < num_pools; i++) {
-
-        time_series_t* pool_size_ts = &monitor->pool_size_time_series[i];
-        time_series_t* pool_total_size_ts
-            = &monitor->pool_total_size_time_series[i];
-
-        timedval_frame_t* frame      = pool_size_ts->first_frame;
-        size_t            array_size = 0;
-        while (frame) {
-            array_size += frame->size;
-            frame = frame->next;
-        }
-
-        struct json_object*    pool_json = json_object_new_object();
-        struct margo_pool_info pool_info;
-        margo_find_pool_by_index(monitor->mid, i, &pool_info);
-        json_object_object_add_ex(json, pool_info.name, pool_json,
-                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
-
-        struct json_object* timestamps = json_object_new_array_ext(array_size);
-        struct json_object* size       = json_object_new_array_ext(array_size);
-        struct json_object* total_size = json_object_new_array_ext(array_size);
-        json_object_object_add_ex(pool_json, "timestamps", timestamps,
-                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
-        json_object_object_add_ex(pool_json, "size", size,
-                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
-        json_object_object_add_ex(pool_json, "total_size", total_size,
-                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
-
-        frame = pool_size_ts->first_frame;
-        while (frame) {
-            for (size_t j = 0; j < frame->size; j++) {
-                json_object_array_add(
-                    timestamps,
-                    json_object_new_double(frame->data[j].timestamp));
-                json_object_array_add(
-                    size, json_object_new_uint64(frame->data[j].value));
-            }
-            frame = frame->next;
-        }
-        frame = pool_total_size_ts->first_frame;
-        while (frame) {
-            for (size_t j = 0; j < frame->size; j++) {
-                json_object_array_add(
-                    total_size, json_object_new_uint64(frame->data[j].value));
-            }
-            frame = frame->next;
-        }
-    }
-
-    if (!reset) goto finish;
-
     for (size_t i = 0; i < num_pools; i++) {
-        time_series_clear(&(monitor->pool_size_time_series[i]));
-        time_series_clear(&(monitor->pool_total_size_time_series[i]));
+        __margo_monitor_time_series_copy(monitor, &copies[2 * i],
+                                         &monitor->pool_size_time_series[i]);
+        __margo_monitor_time_series_copy(
+            monitor, &copies[2 * i + 1],
+            &monitor->pool_total_size_time_series[i]);
+        if (!reset) continue;
+        __margo_monitor_time_series_reset(&(monitor->pool_size_time_series[i]));
+        __margo_monitor_time_series_reset(
+            &(monitor->pool_total_size_time_series[i]));
     }
-
-finish:
     ABT_mutex_unlock(
         ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->pool_time_series_mtx));
 
-    return json;
+    __margo_json_writer_begin_object(w);
+    for (size_t i = 0; i < num_pools; i++) {
+        struct margo_pool_info pool_info;
+        margo_find_pool_by_index(monitor->mid, i, &pool_info);
+        __margo_json_writer_key(w, pool_info.name);
+        __margo_json_writer_begin_object(w);
+        const time_series_t* const series[]
+            = {&copies[2 * i], &copies[2 * i + 1]};
+        const char* const names[] = {"size", "total_size"};
+        __margo_monitor_time_series_write(w, monitor, series, names, 2);
+        __margo_json_writer_end_object(w);
+        __margo_monitor_time_series_free(&copies[2 * i]);
+        __margo_monitor_time_series_free(&copies[2 * i + 1]);
+    }
+    __margo_json_writer_end_object(w);
+    free(copies);
 }
 
 static void update_pool_time_series(struct default_monitor_state* monitor,
@@ -2588,11 +3564,92 @@ static void update_pool_time_series(struct default_monitor_state* monitor,
             != ABT_SUCCESS) {
             continue;
         }
-        time_series_append(&(monitor->pool_size_time_series[i]), timestamp,
-                           pool_size);
-        time_series_append(&(monitor->pool_total_size_time_series[i]),
-                           timestamp, pool_total_size);
+        __margo_monitor_time_series_append(monitor,
+                                           &(monitor->pool_size_time_series[i]),
+                                           timestamp, pool_size);
+        __margo_monitor_time_series_append(
+            monitor, &(monitor->pool_total_size_time_series[i]), timestamp,
+            pool_total_size);
     }
     ABT_mutex_unlock(
         ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->pool_time_series_mtx));
 }
+
+/* ========================================================================
+ * Span function definitions
+ * ======================================================================== */
+
+/* Writes the spans as an object. The spans are copied (and reset if
+ * requested) with the mutex held, then written. Ids are written in
+ * hexadecimal, as in W3C Trace Context. */
+static void monitor_spans_write(margo_json_writer_t*           w,
+                                const default_monitor_state_t* monitor,
+                                bool                           reset)
+{
+    default_monitor_state_t* state = (default_monitor_state_t*)monitor;
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->spans_mtx));
+    size_t   num_spans = state->num_spans;
+    uint64_t dropped   = state->dropped_spans;
+    span_t*  spans
+        = num_spans ? (span_t*)malloc(num_spans * sizeof(*spans)) : NULL;
+    if (spans)
+        memcpy(spans, state->spans, num_spans * sizeof(*spans));
+    else
+        num_spans = 0;
+    if (reset) {
+        state->num_spans     = 0;
+        state->dropped_spans = 0;
+    }
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->spans_mtx));
+
+    __margo_json_writer_begin_object(w);
+    __margo_json_writer_key_string(w, "address", monitor->self_addr_str);
+    __margo_json_writer_key(w, "pid");
+    __margo_json_writer_int64(w, (int64_t)getpid());
+    __margo_json_writer_key_uint64(w, "dropped", dropped);
+    __margo_json_writer_key(w, "spans");
+    __margo_json_writer_begin_array(w);
+    for (size_t i = 0; i < num_spans; i++) {
+        const span_t* span = &spans[i];
+        char          trace_id[33], span_id[17], parent_span_id[17];
+        snprintf(trace_id, sizeof(trace_id), "%016" PRIx64 "%016" PRIx64,
+                 span->context.trace_id[0], span->context.trace_id[1]);
+        snprintf(span_id, sizeof(span_id), "%016" PRIx64,
+                 span->context.span_id);
+        snprintf(parent_span_id, sizeof(parent_span_id), "%016" PRIx64,
+                 span->context.parent_span_id);
+        uint16_t provider_id;
+        hg_id_t  base_id;
+        demux_id(span->callpath.rpc_id, &base_id, &provider_id);
+        rpc_info_t* rpc_info
+            = rpc_info_find(monitor->rpc_info, span->callpath.rpc_id);
+        // addr_info entries are only freed on finalize
+        ABT_mutex_spinlock(
+            ABT_MUTEX_MEMORY_GET_HANDLE(&state->addr_info_mtx));
+        addr_info_t* addr_info
+            = addr_info_find_by_id(monitor, span->callpath.addr_id);
+        ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&state->addr_info_mtx));
+
+        __margo_json_writer_begin_object(w);
+        __margo_json_writer_key_string(w, "trace_id", trace_id);
+        __margo_json_writer_key_string(w, "span_id", span_id);
+        if (span->context.parent_span_id)
+            __margo_json_writer_key_string(w, "parent_span_id",
+                                           parent_span_id);
+        __margo_json_writer_key_string(w, "kind",
+                                       span->is_origin ? "client" : "server");
+        __margo_json_writer_key_string(w, "name",
+                                       rpc_info ? rpc_info->name : "");
+        __margo_json_writer_key_uint64(w, "rpc_id", base_id);
+        __margo_json_writer_key_uint64(w, "provider_id", provider_id);
+        __margo_json_writer_key_string(w, "peer",
+                                       addr_info ? addr_info->name
+                                                 : "<unknown>");
+        __margo_json_writer_key_double(w, "start", span->start_ts);
+        __margo_json_writer_key_double(w, "end", span->end_ts);
+        __margo_json_writer_end_object(w);
+    }
+    __margo_json_writer_end_array(w);
+    __margo_json_writer_end_object(w);
+    free(spans);
+}
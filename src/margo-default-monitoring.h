@@ -0,0 +1,775 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_DEFAULT_MONITORING_H
+#define __MARGO_DEFAULT_MONITORING_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <abt.h>
+#include "margo-instance.h"
+#include "margo-monitoring.h"
+#include "margo-json-writer.h"
+#include "margo-metrics.h"
+#include "margo-abt-profiling.h"
+#ifdef __clang_analyzer__
+    // Prevent clang-analyzer from getting confused by the actual HASH_JEN
+    // macro. This trivial HASH_FUNCTION is not actually used when the code is
+    // compiled.
+    #define HASH_FUNCTION(keyptr, keylen, hashv) hashv = 0
+#endif
+#include "uthash.h"
+
+/* State of the default monitor
+ * ============================
+ *
+ * The default monitor is implemented in margo-default-monitoring.c. Its
+ * optional exporters are implemented in separate files, each declaring
+ * its entry points in its own header, and access the monitor's state
+ * through the definitions below:
+ * - margo-default-monitoring-abt.c: Argobots profiler time series;
+ * - margo-default-monitoring-outliers.c: outlier RPCs;
+ * - margo-default-monitoring-watchdog.c: progress loop watchdog;
+ * - margo-default-monitoring-metrics.c: shared-memory metrics segment;
+ * - margo-default-monitoring-openmetrics.c: OpenMetrics export.
+ */
+
+/* ========================================================================
+ * Statistics structure definitions
+ * ======================================================================== */
+
+struct default_monitor_state;
+struct monitor_shard;
+
+typedef struct statistics {
+    uint64_t num; /* number of samples  */
+    double   min; /* minimum value      */
+    double   max; /* maximum value      */
+    double   sum; /* sum of all samples */
+    double   avg; /* running average    */
+    double   var; /* running variance   */
+} statistics_t;
+
+typedef struct callpath {
+    hg_id_t  rpc_id;    /* current RPC id */
+    hg_id_t  parent_id; /* id of the RPC it came from, if any */
+    uint64_t addr_id; /* address the current RPC was sent to or received from */
+} callpath_t;
+
+/* Bulk transfer operations are further indexed by
+ * the remote address and the operation, in addition
+ * to their callpath.
+ */
+typedef struct bulk_key {
+    callpath_t callpath;
+    uint64_t
+        remote_addr_id; /* address of the peer with which transfer is done */
+    hg_bulk_op_t operation; /* PULL or PUSH */
+} bulk_key_t;
+
+/* Log-linear histogram of durations, in the style of HdrHistogram.
+ * Durations are recorded in nanoseconds. Values below HISTOGRAM_SUB_COUNT
+ * have their own bucket, and each power of two above is divided into
+ * HISTOGRAM_SUB_COUNT buckets, so a bucket's width is at most 1/16 of
+ * its lower bound. Values above 2^HISTOGRAM_MAX_EXP ns (about 18 minutes)
+ * go in the last bucket.
+ *
+ * The buckets are allocated in blocks of HISTOGRAM_SUB_COUNT (one block
+ * per power of two), when a value first falls in the block. An empty
+ * histogram takes 32 bytes. One that has recorded values takes 296 more
+ * bytes for its array of blocks, plus 128 bytes per power of two its
+ * values span: a histogram of latencies between 10us and 10ms takes
+ * about 1.7 KiB, instead of the 4.7 KiB of all the buckets.
+ */
+#define HISTOGRAM_SUB_BITS    4
+#define HISTOGRAM_SUB_COUNT   (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_EXP     40
+#define HISTOGRAM_NUM_BLOCKS  (HISTOGRAM_MAX_EXP - HISTOGRAM_SUB_BITS + 1)
+#define HISTOGRAM_NUM_BUCKETS (HISTOGRAM_SUB_COUNT * HISTOGRAM_NUM_BLOCKS)
+
+typedef struct histogram {
+    uint64_t** blocks; /* HISTOGRAM_NUM_BLOCKS blocks, or NULL */
+    uint64_t   total;  /* number of samples */
+    uint64_t   min;    /* minimum value (ns) */
+    uint64_t   max;    /* maximum value (ns) */
+} histogram_t;
+
+static inline size_t histogram_bucket_index(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_COUNT) return (size_t)value;
+    unsigned e = 63 - __builtin_clzll(value);
+    if (e >= HISTOGRAM_MAX_EXP) return HISTOGRAM_NUM_BUCKETS - 1;
+    return (e - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT
+         + (size_t)((value >> (e - HISTOGRAM_SUB_BITS)) - HISTOGRAM_SUB_COUNT);
+}
+
+/* Returns the value (in ns) at the middle of the bucket */
+static inline uint64_t histogram_bucket_value(size_t index)
+{
+    if (index < HISTOGRAM_SUB_COUNT) return index;
+    unsigned e     = index / HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub   = index % HISTOGRAM_SUB_COUNT;
+    uint64_t width = 1ULL << (e - HISTOGRAM_SUB_BITS);
+    return (HISTOGRAM_SUB_COUNT + sub) * width + width / 2;
+}
+
+/* Returns the count of a bucket */
+static inline uint64_t histogram_bucket_count(const histogram_t* hist,
+                                              size_t             index)
+{
+    if (!hist->blocks) return 0;
+    const uint64_t* block = hist->blocks[index / HISTOGRAM_SUB_COUNT];
+    return block ? block[index % HISTOGRAM_SUB_COUNT] : 0;
+}
+
+/* Returns the block of counts containing a bucket, allocating it if
+ * needed, or NULL if it cannot be allocated */
+static inline uint64_t* histogram_block(histogram_t* hist, size_t index)
+{
+    if (!hist->blocks) {
+        hist->blocks = calloc(HISTOGRAM_NUM_BLOCKS, sizeof(uint64_t*));
+        if (!hist->blocks) return NULL;
+    }
+    uint64_t** block = &hist->blocks[index / HISTOGRAM_SUB_COUNT];
+    if (!*block) *block = calloc(HISTOGRAM_SUB_COUNT, sizeof(uint64_t));
+    return *block;
+}
+
+/* Records a value that is not a duration, such as a count. Must be
+ * called with the mutex of the shard containing hist held */
+static inline void histogram_record_value(histogram_t* hist, uint64_t value)
+{
+    size_t    index = histogram_bucket_index(value);
+    uint64_t* block = histogram_block(hist, index);
+    if (!block) return;
+    block[index % HISTOGRAM_SUB_COUNT] += 1;
+    hist->min = (hist->min > value || hist->total == 0) ? value : hist->min;
+    hist->max = (hist->max < value) ? value : hist->max;
+    hist->total += 1;
+}
+
+/* Must be called with the mutex of the shard containing hist held */
+static inline void histogram_record(histogram_t* hist, double seconds)
+{
+    histogram_record_value(hist,
+                           seconds > 0.0 ? (uint64_t)(seconds * 1e9) : 0);
+}
+
+/* Statistics related to the Mercury progress loop */
+typedef struct hg_statistics {
+    statistics_t progress_with_timeout;
+    statistics_t progress_without_timeout;
+    statistics_t progress_timeout_value;
+    statistics_t trigger;
+} hg_statistics_t;
+
+/* Histograms of the progress loop */
+enum
+{
+    PROGRESS_ITERATION_HIST = 0, /* between consecutive progress calls */
+    TRIGGER_BATCH_HIST,          /* callbacks triggered in an iteration */
+    NUM_PROGRESS_HIST
+};
+
+/* Some statistics fields in the following structures will be
+ * a pair of "duration" statistics (duration of the operation)
+ * and "timestamp" statistics (timestamp of the operation
+ * relative to another, earlier operation). In the latter case,
+ * the reference operation used for the timestamp is marked with
+ * a comment.
+ */
+enum
+{
+    DURATION  = 0,
+    TIMESTAMP = 1
+};
+
+/* Latency histograms are kept for some of the durations and timestamps
+ * above, in addition to their statistics_t, to provide percentiles.
+ * In the following structures, the histograms must follow the
+ * statistics_t fields and precede the hash key.
+ */
+
+/* Statistics related to bulk creation. */
+typedef struct bulk_create_statistics {
+    statistics_t          duration;
+    statistics_t          size;
+    histogram_t           hist[1];  /* duration */
+    callpath_t            callpath; /* hash key */
+    UT_hash_handle        hh;       /* hash handle */
+    struct monitor_shard* shard;    /* shard containing this entry */
+} bulk_create_statistics_t;
+
+/* Statistics related to bulk transfers */
+enum
+{
+    BULK_TRANSFER_HIST = 0, /* from itransfer start to transfer_cb start */
+    NUM_BULK_TRANSFER_HISTS
+};
+
+typedef struct bulk_transfer_statistics {
+    statistics_t          transfer; /* reference timestamp */
+    statistics_t          transfer_size;
+    statistics_t          transfer_cb[2];
+    statistics_t          wait[2];
+    histogram_t           hist[NUM_BULK_TRANSFER_HISTS];
+    bulk_key_t            bulk_key; /* hash key */
+    UT_hash_handle        hh;       /* hash handle */
+    struct monitor_shard* shard;    /* shard containing this entry */
+} bulk_transfer_statistics_t;
+
+/* Moving estimate of a percentile of the end-to-end time of the RPCs
+ * of a callpath (see "Outliers" above), kept in its statistics entry
+ * of each shard and never merged */
+typedef struct outlier_estimate {
+    double   value;
+    uint64_t num_samples;
+} outlier_estimate_t;
+
+/* Statistics related to RPCs at their origin */
+enum
+{
+    ORIGIN_FORWARD_HIST = 0, /* from iforward start to forward_cb start */
+    NUM_ORIGIN_HISTS
+};
+
+typedef struct origin_rpc_statistics {
+    /* reference timestamp is the create operation,
+     * for which no statistics are collected */
+    statistics_t          forward[2];
+    statistics_t          forward_cb[2];
+    statistics_t          wait[2];
+    statistics_t          set_input[2];
+    statistics_t          get_output[2];
+    histogram_t           hist[NUM_ORIGIN_HISTS];
+    callpath_t            callpath; /* hash key */
+    UT_hash_handle        hh;       /* hash handle */
+    struct monitor_shard* shard;    /* shard containing this entry */
+    outlier_estimate_t    outlier_estimate;
+} origin_rpc_statistics_t;
+
+/* Statistics related to RPCs at their target */
+enum
+{
+    TARGET_ULT_QUEUE_HIST = 0, /* from handler start to ULT start */
+    TARGET_HANDLER_HIST,       /* from ULT start to ULT end */
+    TARGET_RESPOND_HIST,       /* from irespond start to respond_cb start */
+    NUM_TARGET_HISTS
+};
+
+typedef struct target_rpc_statistics {
+    statistics_t          handler; /* handler timestamp isn't used */
+    statistics_t          ult[2];
+    statistics_t          respond[2];
+    statistics_t          respond_cb[2];
+    statistics_t          wait[2];
+    statistics_t          set_output[2];
+    statistics_t          get_input[2];
+    statistics_t          cpu_time; /* CPU time of the ULT */
+    histogram_t           hist[NUM_TARGET_HISTS];
+    callpath_t            callpath; /* hash key */
+    UT_hash_handle        hh;       /* hash handle */
+    struct monitor_shard* shard;    /* shard containing this entry */
+    outlier_estimate_t    outlier_estimate;
+} target_rpc_statistics_t;
+
+/* ========================================================================
+ * Time series structure definitions
+ * ======================================================================== */
+
+/* uint64_t value associated with a timestamp */
+typedef struct timedval {
+    uint64_t value;
+    double   timestamp;
+} timedval_t;
+
+/* Time series are kept at several resolutions ("tiers"), each tier being
+ * a ring buffer holding the most recent values at that resolution. Values
+ * are appended to the first tier every time_interval_sec seconds, and
+ * every `factor` values of a tier are aggregated into one value of the
+ * next tier. The memory used by a time series is therefore bounded by
+ * the sum of the capacities of the tiers, regardless of how long the
+ * process runs and how often the time series are dumped.
+ */
+#define MAX_TIME_SERIES_TIERS 4
+
+/* Configuration of a tier, common to all the time series */
+typedef struct time_series_tier_config {
+    double resolution; /* seconds between two values */
+    size_t factor;     /* number of values of the previous tier per value */
+    size_t capacity;   /* number of values retained */
+} time_series_tier_config_t;
+
+/* Ring buffer of values at a given resolution */
+typedef struct time_series_tier {
+    timedval_t* data; /* capacity entries, allocated on first append */
+    size_t      head; /* index of the oldest value */
+    size_t      size; /* number of values */
+    uint64_t    pending;       /* aggregate of the values of the previous */
+    size_t      pending_count; /* tier not yet added to this one */
+} time_series_tier_t;
+
+/* How values are aggregated into coarser tiers */
+typedef enum time_series_kind
+{
+    TIME_SERIES_SUM, /* counts over an interval: values are summed */
+    TIME_SERIES_MAX  /* sampled values: the maximum is kept */
+} time_series_kind_t;
+
+/* Time series */
+typedef struct time_series {
+    time_series_kind_t kind;
+    time_series_tier_t tiers[MAX_TIME_SERIES_TIERS];
+} time_series_t;
+
+/* RPC-related time series */
+typedef struct rpc_time_series {
+    uint64_t       rpc_count;        /* sum of the shards' rpc_count */
+    time_series_t  rpc_count_series; /* time series of rpc_count */
+    uint64_t       bulk_size;        /* sum of the shards' bulk_size */
+    time_series_t  bulk_size_series; /* time series of bulk-transferred size */
+    hg_id_t        rpc_id;           /* hash key */
+    UT_hash_handle hh;               /* hash handle */
+    /* mutex protecting accesses */
+    ABT_mutex_memory mutex;
+} rpc_time_series_t;
+
+/* ========================================================================
+ * RPC info
+ * ======================================================================== */
+
+/* Structure used to track registered RPCs */
+typedef struct rpc_info {
+    hg_id_t        id;
+    UT_hash_handle hh;
+    char           name[1];
+} rpc_info_t;
+
+static inline rpc_info_t* rpc_info_find(rpc_info_t* hash, hg_id_t id)
+{
+    rpc_info_t* info = NULL;
+    HASH_FIND(hh, hash, &id, sizeof(id), info);
+    return info;
+}
+
+/* Span of a traced RPC, recorded when the RPC's handle is destroyed */
+typedef struct span {
+    margo_trace_context_t context;
+    callpath_t            callpath;
+    double                start_ts;
+    double                end_ts;
+    bool                  is_origin;
+} span_t;
+
+/* Structure used to track addresses, hashed by name */
+typedef struct addr_info {
+    UT_hash_handle hh_by_id;
+    UT_hash_handle hh_by_name;
+    uint64_t       id;
+    char           name[1];
+} addr_info_t;
+
+/* Shard-local cache of the ids of the addr_info_t, hashed by name */
+typedef struct addr_id {
+    UT_hash_handle hh;
+    uint64_t       id;
+    char           name[1];
+} addr_id_t;
+
+/* Shard-local cache of the ids of the addr_info_t, hashed by hg_addr_t,
+ * kept in LRU order (uthash iterates in insertion order, and an entry
+ * that is hit is moved to the end). Each entry holds a duplicate of the
+ * address, which (1) prevents Mercury from freeing and reusing the
+ * hg_addr_t while the entry exists, and (2) lets us check with
+ * margo_addr_cmp that a hg_addr_t that was reused anyway (e.g. when
+ * margo_addr_dup returns a copy rather than a new reference) still
+ * designates the same peer. When the cache is full, the least recently
+ * used entry is evicted and its duplicate freed.
+ */
+typedef struct addr_cache_entry {
+    UT_hash_handle hh;
+    hg_addr_t      addr; /* hash key */
+    hg_addr_t      ref;  /* duplicate of addr */
+    uint64_t       id;
+} addr_cache_entry_t;
+
+#define ADDR_CACHE_CAPACITY 32
+
+/* Shard-local exact counts of the RPCs issued and received, by RPC id
+ * (without provider id), maintained when only a sample of the RPCs is
+ * monitored */
+typedef struct rpc_count {
+    UT_hash_handle hh;
+    hg_id_t        id; /* hash key */
+    uint64_t       origin_total;
+    uint64_t       origin_sampled;
+    uint64_t       target_total;
+    uint64_t       target_sampled;
+} rpc_count_t;
+
+/* Shard-local counts of the RPCs received and of the size
+ * bulk-transferred since the last value added to the RPC time series,
+ * by RPC id (with provider id) */
+typedef struct rpc_ts_count {
+    UT_hash_handle hh;
+    hg_id_t        id; /* hash key */
+    uint64_t       rpc_count;
+    uint64_t       bulk_size;
+} rpc_ts_count_t;
+
+struct session;
+struct bulk_session;
+struct outlier;
+
+/* Statistics updated by the xstreams sharing the same shard index */
+typedef struct monitor_shard {
+    /* mutex protecting all the fields below */
+    ABT_mutex_memory            mutex;
+    hg_statistics_t             hg_stats;
+    histogram_t                 progress_hist[NUM_PROGRESS_HIST];
+    bulk_create_statistics_t*   bulk_create_stats;
+    bulk_transfer_statistics_t* bulk_transfer_stats;
+    origin_rpc_statistics_t*    origin_rpc_stats;
+    target_rpc_statistics_t*    target_rpc_stats;
+    addr_id_t*                  addr_ids;
+    addr_cache_entry_t*         addr_cache;
+    rpc_count_t*                rpc_counts;
+    rpc_ts_count_t*             rpc_ts_counts;
+    /* session and bulk_session pools */
+    struct session*      session_pool;
+    struct bulk_session* bulk_session_pool;
+} monitor_shard_t;
+
+#define MONITOR_NUM_SHARDS 64
+
+#define MAX_PERCENTILES 16
+
+/* RPC handler ULT last started on an xstream, read by the watchdog
+ * thread. rpc_id is 0 if the ULT has completed, and is written last. */
+typedef struct watchdog_slot {
+    hg_id_t  rpc_id;
+    uint64_t ult_id;
+    double   start_ts;
+} watchdog_slot_t;
+
+#define WATCHDOG_MAX_XSTREAMS 64
+
+/* Root of the monitor's state */
+typedef struct default_monitor_state {
+    margo_instance_id mid;
+    bool              enable_statistics;
+    bool              enable_time_series;
+    char*             filename_prefix;
+    int               precision; /* precision used when printing doubles */
+    int stats_pretty_json;       /* use tabs and stuff in JSON printing */
+    int time_series_pretty_json; /* use tabs and stuff in JSON printing */
+    int    sample_progress_every;
+    int    sample_rpcs_every;
+    size_t dump_chunk_size; /* size of the chunks passed to dump_fn */
+    /* percentiles reported from histograms (none disables histograms) */
+    double percentiles[MAX_PERCENTILES];
+    size_t num_percentiles;
+    /* self address */
+    char* self_addr_str;
+    /* sampling counter */
+    uint64_t progress_sampling;
+    /* progress loop iterations (only accessed by the progress loop) */
+    double   progress_last_end_ts;
+    uint64_t trigger_batch; /* callbacks triggered since the last progress */
+    /* RPC information */
+    rpc_info_t*      rpc_info;
+    ABT_mutex_memory rpc_info_mtx;
+    /* Address info */
+    addr_info_t* addr_info_by_name; /* hash of addr_info_t by name field */
+    addr_info_t* addr_info_by_id;   /* hash of addr_info_t by id field */
+    uint64_t     addr_info_last_id; /* last id used for addresses */
+    /* addresses can no longer be cached (set by on_finalize, read with
+     * the shard's mutex held) */
+    _Atomic bool addr_cache_closed;
+    ABT_mutex_memory
+        addr_info_mtx; /* mutex protecting access to the addr_info fields */
+    /* Argobots keys */
+    ABT_key callpath_key; /* may be associated with a callpath */
+    /* Statistics, indexed by xstream rank modulo MONITOR_NUM_SHARDS */
+    monitor_shard_t* shards[MONITOR_NUM_SHARDS];
+    /* Time series and their mutex. RPC handlers and bulk transfers only
+     * update their shard's rpc_ts_counts; rpc_time_series_mtx is taken
+     * by the periodic update (which drains the shards), dumps and
+     * finalization, never on the RPC path. */
+    rpc_time_series_t* rpc_time_series; /* hash */
+    ABT_mutex_memory   rpc_time_series_mtx;
+    time_series_t* pool_size_time_series; /* array of size mid->abt.pools_len */
+    time_series_t*
+        pool_total_size_time_series; /* array of size mid->abt.pools_len */
+    ABT_mutex_memory pool_time_series_mtx;
+    double           rpc_time_series_last_ts;
+    double           time_series_interval;
+    /* Argobots profiler time series and their mutex */
+    bool               enable_abt_time_series;
+    struct abt_time_series* abt_xstream_time_series; /* hash by name */
+    struct abt_time_series* abt_pool_time_series;    /* hash by name */
+    /* last sample of each xstream, indexed by rank, and buffer for the
+     * current samples (only accessed by the progress loop) */
+    margo_abt_prof_sample_t* abt_prof_last_samples;
+    margo_abt_prof_sample_t* abt_prof_samples;
+    double                   abt_time_series_last_ts;
+    ABT_mutex_memory         abt_time_series_mtx;
+    /* whether the monitor started the profiler (and should stop it) */
+    bool                     abt_prof_started_by_monitor;
+    time_series_tier_config_t time_series_tiers[MAX_TIME_SERIES_TIERS];
+    size_t                    num_time_series_tiers;
+    /* Spans of traced RPCs and their mutex */
+    bool             enable_spans;
+    span_t*          spans; /* array growing up to max_spans entries */
+    size_t           num_spans;
+    size_t           spans_capacity;
+    size_t           max_spans;
+    uint64_t         dropped_spans;
+    ABT_mutex_memory spans_mtx;
+    /* Shared-memory metrics segment, NULL if disabled */
+    char*                    metrics_filename_prefix;
+    char*                    metrics_filename;
+    margo_metrics_segment_t* metrics;
+    margo_metrics_segment_t* metrics_snapshot; /* private copy */
+    double                   metrics_interval;
+    double                   metrics_last_ts;
+    ABT_mutex_memory         metrics_mtx;
+    /* Outliers, in a ring buffer of max_outliers entries */
+    bool             enable_outliers;
+    double           outlier_threshold;  /* 0 disables */
+    double           outlier_percentile; /* 0 disables */
+    uint64_t         outlier_min_samples;
+    double           outlier_up;   /* estimate update factors */
+    double           outlier_down;
+    ABT_key          session_key; /* session of the current handler ULT */
+    bool             enable_cpu_time;
+    struct outlier*  outliers;
+    size_t           max_outliers;
+    size_t           outliers_head; /* index of the next record */
+    size_t           num_outliers;
+    uint64_t         total_outliers;
+    ABT_mutex_memory outliers_mtx;
+    /* OpenMetrics export */
+    char*            openmetrics_filename_prefix; /* NULL if no file */
+    double           openmetrics_interval;
+    double           openmetrics_last_ts;
+    bool             openmetrics_dump; /* dump OpenMetrics instead of JSON */
+    ABT_mutex_memory openmetrics_mtx;
+    /* Progress loop watchdog */
+    bool      enable_watchdog;
+    double    watchdog_threshold; /* stall threshold (seconds) */
+    double    watchdog_interval;  /* check interval (seconds) */
+    pthread_t watchdog_thread;
+    bool      watchdog_stop;
+    /* progress pool when the watchdog started, captured since the
+     * watchdog thread cannot access mid->abt.pools without its mutex */
+    unsigned watchdog_pool_idx;
+    ABT_pool watchdog_pool;
+    char*    watchdog_pool_name;
+    /* heartbeat, updated by the progress and trigger callbacks */
+    uint64_t        heartbeat;
+    double          heartbeat_ts;
+    unsigned        heartbeat_timeout_ms; /* of the current HG_Progress */
+    int             progress_xstream; /* rank the progress ULT last ran on */
+    watchdog_slot_t running_rpcs[WATCHDOG_MAX_XSTREAMS];
+    /* stalls detected, and their mutex */
+    uint64_t         num_stalls;
+    double           max_stall;
+    double           total_stall;
+    bool             stalled;
+    ABT_mutex_memory watchdog_mtx;
+} default_monitor_state_t;
+
+/* Locks and returns the shard of the calling xstream */
+static inline monitor_shard_t*
+shard_lock(const default_monitor_state_t* monitor)
+{
+    int rank = 0;
+    if (ABT_self_get_xstream_rank(&rank) != ABT_SUCCESS || rank < 0) rank = 0;
+    monitor_shard_t* shard = monitor->shards[rank % MONITOR_NUM_SHARDS];
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&shard->mutex));
+    return shard;
+}
+
+static inline void shard_unlock(monitor_shard_t* shard)
+{
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&shard->mutex));
+}
+
+/* Rank of the calling xstream, or -1 if not called from an xstream */
+static inline int self_xstream_rank(void)
+{
+    int rank = -1;
+    if (ABT_self_get_xstream_rank(&rank) != ABT_SUCCESS) rank = -1;
+    return rank;
+}
+
+/* Defines the following functions for a hash of statistics in a shard:
+ * - <hash>_find_or_add(shard, key): finds or adds the entry for key;
+ * - <hash>_in_shard(shard, &cached): returns the entry of shard with the
+ *   same key as cached, updating cached if it belongs to another shard.
+ * Both must be called with the shard's mutex held. The key of an entry
+ * never changes and entries are only freed on finalize, so the key of
+ * an entry from another shard can be read without holding its mutex.
+ */
+#define DEFINE_SHARD_HASH_LOOKUP_FUNCTIONS(__hash__, __type__, __key_type__,   \
+                                           __key__)                            \
+    static inline __type__* __hash__##_find_or_add(monitor_shard_t*    shard,  \
+                                                   const __key_type__* key)    \
+    {                                                                          \
+        __type__* entry = NULL;                                                \
+        HASH_FIND(hh, shard->__hash__, key, sizeof(*key), entry);              \
+        if (!entry) {                                                          \
+            entry          = (__type__*)calloc(1, sizeof(*entry));             \
+            entry->__key__ = *key;                                             \
+            entry->shard   = shard;                                            \
+            HASH_ADD(hh, shard->__hash__, __key__, sizeof(*key), entry);       \
+        }                                                                      \
+        return entry;                                                          \
+    }                                                                          \
+    static inline __type__* __hash__##_in_shard(monitor_shard_t* shard,        \
+                                                __type__**       cached)       \
+    {                                                                          \
+        __type__* entry = *cached;                                             \
+        if (entry->shard != shard) {                                           \
+            entry   = __hash__##_find_or_add(shard, &entry->__key__);          \
+            *cached = entry;                                                   \
+        }                                                                      \
+        return entry;                                                          \
+    }
+
+DEFINE_SHARD_HASH_LOOKUP_FUNCTIONS(origin_rpc_stats,
+                                   origin_rpc_statistics_t,
+                                   callpath_t,
+                                   callpath)
+DEFINE_SHARD_HASH_LOOKUP_FUNCTIONS(target_rpc_stats,
+                                   target_rpc_statistics_t,
+                                   callpath_t,
+                                   callpath)
+DEFINE_SHARD_HASH_LOOKUP_FUNCTIONS(bulk_create_stats,
+                                   bulk_create_statistics_t,
+                                   callpath_t,
+                                   callpath)
+DEFINE_SHARD_HASH_LOOKUP_FUNCTIONS(bulk_transfer_stats,
+                                   bulk_transfer_statistics_t,
+                                   bulk_key_t,
+                                   bulk_key)
+
+/* A session is an object that will be associated with an hg_handle_t
+ * when on_forward or on_rpc_handler is invoked, and will be destroyed
+ * when on_destroy is called on the handle.
+ *
+ * Note that when a process sends an RPC to itself, the hg_handle_t
+ * is the same in the sender logic (forward, forward_cb, etc.) and
+ * in the receiver logic (rpc_handler, respond, etc.), so we cannot
+ * factor the origin and target fields into a union.
+ */
+typedef struct origin_session {
+    double                   create_ts;
+    double                   forward_start_ts;
+    double                   forward_end_ts;
+    double                   set_input_start_ts;
+    double                   set_input_end_ts;
+    double                   forward_cb_ts;
+    double                   wait_start_ts;
+    double                   wait_end_ts;
+    double                   get_output_start_ts;
+    double                   get_output_end_ts;
+    int                      xstream_rank; /* of the forwarding ULT */
+    origin_rpc_statistics_t* stats;
+} origin_session_t;
+
+typedef struct target_session {
+    double                   handler_start_ts;
+    double                   ult_start_ts;
+    double                   get_input_start_ts;
+    double                   get_input_end_ts;
+    double                   respond_start_ts;
+    double                   respond_end_ts;
+    double                   ult_end_ts;
+    double                   wait_start_ts;
+    double                   wait_end_ts;
+    int                      xstream_rank; /* of the handler ULT */
+    size_t                   pool_size;    /* when the RPC arrived */
+    /* bulk transfers issued by the handler ULT */
+    uint64_t                 bulk_count;
+    uint64_t                 bulk_size;
+    double                   bulk_time; /* from transfer to end of wait */
+    /* CPU time of the handler ULT, and start of its current segment */
+    double                   cpu_time;
+    double                   cpu_segment_start;
+    int                      cpu_segment_rank;
+    bool                     cpu_segment_running;
+    target_rpc_statistics_t* stats;
+} target_session_t;
+
+typedef struct session {
+    origin_session_t origin;
+    target_session_t target;
+    struct session*  next; /* used to managed the session pool */
+} session_t;
+
+typedef struct bulk_session {
+    double                      transfer_start_ts;
+    double                      transfer_end_ts;
+    bulk_transfer_statistics_t* stats;
+    struct bulk_session* next; /* used to managed the bulk_session pool */
+} bulk_session_t;
+
+static inline addr_info_t*
+addr_info_find_by_id(const default_monitor_state_t* monitor, uint64_t id)
+{
+    addr_info_t* info = NULL;
+    HASH_FIND(hh_by_id, monitor->addr_info_by_id, &id, sizeof(id), info);
+    return info;
+}
+
+/* Size of the chunks of JSON written at once into the files */
+#define MONITOR_FILE_CHUNK_SIZE (64 * 1024)
+
+/* Time series functions used by the monitor and by its exporters */
+void __margo_monitor_time_series_append(const default_monitor_state_t* monitor,
+                                        time_series_t*                 series,
+                                        double                         ts,
+                                        uint64_t                       val);
+
+/* Forgets the values but keeps the ring buffers allocated */
+void __margo_monitor_time_series_reset(time_series_t* series);
+
+void __margo_monitor_time_series_free(time_series_t* series);
+
+/* Copies the values of a time series, so that it can be written without
+ * holding the mutex protecting it. The values of each tier are stored
+ * in order, starting at index 0. The copy must be freed with
+ * __margo_monitor_time_series_free.
+ */
+void __margo_monitor_time_series_copy(const default_monitor_state_t* monitor,
+                                      time_series_t*                 dst,
+                                      const time_series_t*           src);
+
+/* Writes the content of time series updated at the same time (hence
+ * sharing their timestamps) in the current object, the values of
+ * series[i] being written as an array named names[i]. The finest tier is
+ * written directly in the object, while the coarser ones are written as
+ * objects of a "tiers" array, each with their own "resolution_sec" and
+ * "timestamps" fields.
+ */
+void __margo_monitor_time_series_write(margo_json_writer_t*           w,
+                                       const default_monitor_state_t* monitor,
+                                       const time_series_t* const*    series,
+                                       const char* const*             names,
+                                       size_t                         count);
+
+/* Merges the statistics and histograms of src into dst, resetting those
+ * of src if requested. Must be called with the mutex of src held. */
+void __margo_monitor_shard_merge(monitor_shard_t* dst,
+                                 monitor_shard_t* src,
+                                 bool             reset);
+
+/* Frees the statistics of a shard */
+void __margo_monitor_shard_clear(monitor_shard_t* shard);
+
+#endif
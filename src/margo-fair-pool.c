@@ -0,0 +1,322 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <abt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "margo-fair-pool.h"
+#include "uthash.h"
+
+/* FAIR_WAIT */
+
+/* This is a custom Argobots pool, compatible with ABT_POOL_FIFO_WAIT, that
+ * sorts work units into classes (in Margo, one class per RPC origin) and
+ * serves the classes using deficit round robin: the classes that have
+ * pending work units take turns, each turn adding the class' weight to its
+ * deficit and each work unit popped costing 1. A client sending many RPCs
+ * therefore cannot delay the RPCs of other clients by more than one turn.
+ *
+ * Within a class, work units are served in FIFO order. Work units that
+ * yield are pushed back at the end of their class' queue.
+ */
+
+typedef struct unit_t {
+    ABT_thread     thread;
+    ABT_task       task;
+    uint64_t       class_id;
+    struct unit_t* p_next;
+    ABT_bool       is_in_pool;
+} unit_t;
+
+typedef struct class_t {
+    uint64_t        id;
+    double          weight;
+    double          deficit;
+    bool            configured; /* weight set explicitly, keep when empty */
+    bool            is_active;  /* in the active list */
+    unit_t*         p_head;
+    unit_t*         p_tail;
+    size_t          size;
+    struct class_t* p_next_active;
+    UT_hash_handle  hh;
+} class_t;
+
+typedef struct pool_t {
+    class_t*        classes; /* hash of classes by id */
+    class_t*        p_active_head;
+    class_t*        p_active_tail;
+    size_t          num_units;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+} pool_t;
+
+static _Thread_local uint64_t g_next_class_id = 0;
+
+void margo_fair_pool_set_next_class(uint64_t class_id)
+{
+    g_next_class_id = class_id;
+}
+
+uint64_t margo_fair_pool_hash(const char* str)
+{
+    /* FNV-1a */
+    uint64_t h = 14695981039346656037ULL;
+    for (; str && *str; str++) {
+        h ^= (unsigned char)(*str);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static class_t* find_or_create_class(pool_t* p_pool, uint64_t id)
+{
+    class_t* p_class = NULL;
+    HASH_FIND(hh, p_pool->classes, &id, sizeof(id), p_class);
+    if (p_class) return p_class;
+    p_class         = (class_t*)calloc(1, sizeof(*p_class));
+    p_class->id     = id;
+    p_class->weight = 1.0;
+    HASH_ADD(hh, p_pool->classes, id, sizeof(id), p_class);
+    return p_class;
+}
+
+static inline void active_push(pool_t* p_pool, class_t* p_class)
+{
+    p_class->p_next_active = NULL;
+    if (p_pool->p_active_tail)
+        p_pool->p_active_tail->p_next_active = p_class;
+    else
+        p_pool->p_active_head = p_class;
+    p_pool->p_active_tail = p_class;
+    p_class->is_active    = true;
+}
+
+static inline class_t* active_pop(pool_t* p_pool)
+{
+    class_t* p_class      = p_pool->p_active_head;
+    p_pool->p_active_head = p_class->p_next_active;
+    if (!p_pool->p_active_head) p_pool->p_active_tail = NULL;
+    p_class->p_next_active = NULL;
+    p_class->is_active     = false;
+    return p_class;
+}
+
+static inline void queue_push(pool_t* p_pool, unit_t* p_unit)
+{
+    class_t* p_class = find_or_create_class(p_pool, p_unit->class_id);
+    p_unit->p_next   = NULL;
+    if (p_class->p_tail)
+        p_class->p_tail->p_next = p_unit;
+    else
+        p_class->p_head = p_unit;
+    p_class->p_tail = p_unit;
+    p_class->size += 1;
+    p_pool->num_units += 1;
+    p_unit->is_in_pool = ABT_TRUE;
+    if (!p_class->is_active) active_push(p_pool, p_class);
+}
+
+static inline unit_t* queue_pop(pool_t* p_pool)
+{
+    while (p_pool->p_active_head) {
+        class_t* p_class = p_pool->p_active_head;
+        if (p_class->deficit < 1.0) {
+            /* new turn for this class */
+            p_class->deficit += p_class->weight;
+            if (p_class->deficit < 1.0) {
+                active_push(p_pool, active_pop(p_pool));
+                continue;
+            }
+        }
+        unit_t* p_unit  = p_class->p_head;
+        p_class->p_head = p_unit->p_next;
+        if (!p_class->p_head) p_class->p_tail = NULL;
+        p_class->size -= 1;
+        p_class->deficit -= 1.0;
+        p_pool->num_units -= 1;
+        p_unit->p_next     = NULL;
+        p_unit->is_in_pool = ABT_FALSE;
+        if (p_class->size == 0) {
+            /* an idle class does not accumulate credit */
+            p_class->deficit = 0.0;
+            active_pop(p_pool);
+            /* classes are re-created when units of theirs are pushed,
+             * so only the configured ones need to be kept */
+            if (!p_class->configured) {
+                HASH_DEL(p_pool->classes, p_class);
+                free(p_class);
+            }
+        } else if (p_class->deficit < 1.0) {
+            /* end of the turn */
+            active_push(p_pool, active_pop(p_pool));
+        }
+        return p_unit;
+    }
+    return NULL;
+}
+
+static ABT_unit_type pool_unit_get_type(ABT_unit unit)
+{
+    unit_t* p_unit = (unit_t*)unit;
+    if (p_unit->thread != ABT_THREAD_NULL) {
+        return ABT_UNIT_TYPE_THREAD;
+    } else {
+        return ABT_UNIT_TYPE_TASK;
+    }
+}
+
+static ABT_thread pool_unit_get_thread(ABT_unit unit)
+{
+    unit_t* p_unit = (unit_t*)unit;
+    return p_unit->thread;
+}
+
+static ABT_task pool_unit_get_task(ABT_unit unit)
+{
+    unit_t* p_unit = (unit_t*)unit;
+    return p_unit->task;
+}
+
+static ABT_bool pool_unit_is_in_pool(ABT_unit unit)
+{
+    unit_t* p_unit = (unit_t*)unit;
+    return p_unit->is_in_pool;
+}
+
+static ABT_unit pool_unit_create_from_thread(ABT_thread thread)
+{
+    unit_t* p_unit   = (unit_t*)calloc(1, sizeof(unit_t));
+    p_unit->thread   = thread;
+    p_unit->task     = ABT_TASK_NULL;
+    p_unit->class_id = g_next_class_id;
+    return (ABT_unit)p_unit;
+}
+
+static ABT_unit pool_unit_create_from_task(ABT_task task)
+{
+    unit_t* p_unit   = (unit_t*)calloc(1, sizeof(unit_t));
+    p_unit->thread   = ABT_THREAD_NULL;
+    p_unit->task     = task;
+    p_unit->class_id = g_next_class_id;
+    return (ABT_unit)p_unit;
+}
+
+static void pool_unit_free(ABT_unit* p_unit)
+{
+    free(*p_unit);
+    *p_unit = ABT_UNIT_NULL;
+}
+
+static int pool_init(ABT_pool pool, ABT_pool_config config)
+{
+    (void)config;
+    pool_t* p_pool = (pool_t*)calloc(1, sizeof(pool_t));
+    pthread_mutex_init(&p_pool->mutex, NULL);
+    pthread_cond_init(&p_pool->cond, NULL);
+    ABT_pool_set_data(pool, (void*)p_pool);
+    return ABT_SUCCESS;
+}
+
+static size_t pool_get_size(ABT_pool pool)
+{
+    pool_t* p_pool;
+    ABT_pool_get_data(pool, (void**)&p_pool);
+    return p_pool->num_units;
+}
+
+static void pool_push(ABT_pool pool, ABT_unit unit)
+{
+    pool_t* p_pool;
+    ABT_pool_get_data(pool, (void**)&p_pool);
+    unit_t* p_unit = (unit_t*)unit;
+    pthread_mutex_lock(&p_pool->mutex);
+    queue_push(p_pool, p_unit);
+    pthread_cond_signal(&p_pool->cond);
+    pthread_mutex_unlock(&p_pool->mutex);
+}
+
+static ABT_unit pool_pop(ABT_pool pool)
+{
+    pool_t* p_pool;
+    ABT_pool_get_data(pool, (void**)&p_pool);
+    pthread_mutex_lock(&p_pool->mutex);
+    unit_t* p_unit = queue_pop(p_pool);
+    pthread_mutex_unlock(&p_pool->mutex);
+    return p_unit ? (ABT_unit)p_unit : ABT_UNIT_NULL;
+}
+
+static inline void convert_double_sec_to_timespec(struct timespec* ts_out,
+                                                  double           seconds)
+{
+    ts_out->tv_sec  = (time_t)seconds;
+    ts_out->tv_nsec = (long)((seconds - ts_out->tv_sec) * 1000000000.0);
+}
+
+static ABT_unit pool_pop_timedwait(ABT_pool pool, double abstime_secs)
+{
+    pool_t* p_pool;
+    ABT_pool_get_data(pool, (void**)&p_pool);
+    pthread_mutex_lock(&p_pool->mutex);
+    if (p_pool->num_units == 0) {
+        struct timespec ts;
+        convert_double_sec_to_timespec(&ts, abstime_secs);
+        pthread_cond_timedwait(&p_pool->cond, &p_pool->mutex, &ts);
+    }
+    unit_t* p_unit = queue_pop(p_pool);
+    pthread_mutex_unlock(&p_pool->mutex);
+    return p_unit ? (ABT_unit)p_unit : ABT_UNIT_NULL;
+}
+
+static int pool_free(ABT_pool pool)
+{
+    pool_t* p_pool;
+    ABT_pool_get_data(pool, (void**)&p_pool);
+    class_t *p_class, *tmp;
+    HASH_ITER(hh, p_pool->classes, p_class, tmp)
+    {
+        HASH_DEL(p_pool->classes, p_class);
+        free(p_class);
+    }
+    pthread_mutex_destroy(&p_pool->mutex);
+    pthread_cond_destroy(&p_pool->cond);
+    free(p_pool);
+
+    return ABT_SUCCESS;
+}
+
+void margo_fair_pool_set_weight(ABT_pool pool, uint64_t class_id, double w)
+{
+    pool_t* p_pool;
+    ABT_pool_get_data(pool, (void**)&p_pool);
+    pthread_mutex_lock(&p_pool->mutex);
+    class_t* p_class    = find_or_create_class(p_pool, class_id);
+    p_class->weight     = w;
+    p_class->configured = true;
+    pthread_mutex_unlock(&p_pool->mutex);
+}
+
+void margo_create_fair_pool_def(ABT_pool_def* p_def)
+{
+    p_def->access               = ABT_POOL_ACCESS_MPMC;
+    p_def->u_get_type           = pool_unit_get_type;
+    p_def->u_get_thread         = pool_unit_get_thread;
+    p_def->u_get_task           = pool_unit_get_task;
+    p_def->u_is_in_pool         = pool_unit_is_in_pool;
+    p_def->u_create_from_thread = pool_unit_create_from_thread;
+    p_def->u_create_from_task   = pool_unit_create_from_task;
+    p_def->u_free               = pool_unit_free;
+    p_def->p_init               = pool_init;
+    p_def->p_get_size           = pool_get_size;
+    p_def->p_push               = pool_push;
+    p_def->p_pop                = pool_pop;
+    p_def->p_pop_timedwait      = pool_pop_timedwait;
+    p_def->p_remove             = NULL; /* Optional */
+    p_def->p_free               = pool_free;
+    p_def->p_print_all          = NULL; /* Optional */
+}
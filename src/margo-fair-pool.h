@@ -0,0 +1,37 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef __MARGO_FAIR_POOL
+#define __MARGO_FAIR_POOL
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <abt.h>
+#include <stdint.h>
+
+void margo_create_fair_pool_def(ABT_pool_def* p_def);
+
+/* Sets the class of the work units created by the calling thread
+ * until it is called again (0 being the default class). Margo sets it
+ * around the creation of an RPC handler ULT to a hash of the address
+ * of the RPC's origin. */
+void margo_fair_pool_set_next_class(uint64_t class_id);
+
+/* Sets the weight of a class (the default weight is 1). A class of
+ * weight w is given w times more turns than a class of weight 1 when
+ * both have pending work units. */
+void margo_fair_pool_set_weight(ABT_pool pool, uint64_t class_id, double w);
+
+/* Hash function used to compute class identifiers from address strings */
+uint64_t margo_fair_pool_hash(const char* str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MARGO_FAIR_POOL */
@@ -121,3 +121,11 @@ finish:
     ABT_mutex_unlock(mid->handle_cache_mtx);
     return hret;
 }
+
+size_t __margo_handle_cache_num_used(margo_instance_id mid)
+{
+    ABT_mutex_lock(mid->handle_cache_mtx);
+    size_t num_used = HASH_COUNT(mid->used_handle_hash);
+    ABT_mutex_unlock(mid->handle_cache_mtx);
+    return num_used;
+}
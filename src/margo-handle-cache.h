@@ -23,4 +23,7 @@ hg_return_t __margo_handle_cache_get(margo_instance_id mid,
 
 hg_return_t __margo_handle_cache_put(margo_instance_id mid, hg_handle_t handle);
 
+// number of cached handles currently in use
+size_t __margo_handle_cache_num_used(margo_instance_id mid);
+
 #endif
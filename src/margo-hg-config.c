@@ -247,7 +247,7 @@ bool __margo_hg_init_from_json(const struct json_object*   json,
         if (!resolved_addr)
             resolved_addr = (char*)user->protocol;
         else
-            margo_debug(
+            MARGO_DEBUG(
                 0,
                 "mochi-plumber resolved %s to %s for Mercury initialization.",
                 user->protocol, resolved_addr);
@@ -17,6 +17,11 @@ static inline hg_return_t margo_hg_shim_forward_proc(hg_proc_t proc, void* args)
 
     hret = hg_proc_memcpy(proc, (void*)(&sargs->header), sizeof(sargs->header));
     if (hret != HG_SUCCESS) return hret;
+    if (sargs->header.parent_rpc_id & MARGO_HEADER_HAS_TRACE_CONTEXT) {
+        hret = hg_proc_memcpy(proc, (void*)(&sargs->trace_context),
+                              sizeof(sargs->trace_context));
+        if (hret != HG_SUCCESS) return hret;
+    }
     if (!(sargs && sargs->user_cb)) return HG_SUCCESS;
     return sargs->user_cb(proc, sargs->user_args);
 }
@@ -27,9 +27,10 @@ hg_return_t margo_provider_register_identity(margo_instance_id mid,
                                              const char*       identity)
 {
     if (!identity) return HG_INVALID_ARG;
-    hg_id_t id
-        = MARGO_REGISTER_PROVIDER(mid, "__identity__", void, hg_string_t,
-                                  get_identity, provider_id, ABT_POOL_NULL);
+    /* get_identity never blocks, so it can run in the progress loop */
+    hg_id_t id = MARGO_REGISTER_PROVIDER_INLINE(mid, "__identity__", void,
+                                                hg_string_t, get_identity,
+                                                provider_id, ABT_POOL_NULL);
     if (!id) return HG_OTHER_ERROR;
     char* data = strdup(identity);
     margo_register_data(mid, id, data, free);
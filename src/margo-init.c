@@ -80,8 +80,12 @@ margo_instance_id margo_init_ext(const char*                   address,
         = {HG_INIT_INFO_INITIALIZER, NULL, NULL, HG_ADDR_NULL, NULL, 0};
     struct margo_abt abt = {0};
 
-    if (getenv("MARGO_ENABLE_MONITORING") && !args.monitor) {
-        args.monitor = margo_default_monitor;
+    const char* enable_monitoring = getenv("MARGO_ENABLE_MONITORING");
+    if (enable_monitoring && !args.monitor) {
+        if (strcmp(enable_monitoring, "trace") == 0)
+            args.monitor = margo_trace_monitor;
+        else
+            args.monitor = margo_default_monitor;
     }
 
     if (args.json_config && strlen(args.json_config) > 0) {
@@ -104,7 +108,7 @@ margo_instance_id margo_init_ext(const char*                   address,
     }
 
     // validate and complete configuration
-    margo_trace(0, "Validating JSON configuration");
+    MARGO_TRACE(0, "Validating JSON configuration");
     if (!__margo_validate_json(config, address, mode, &args)) goto error;
 
 #ifdef HAVE_MOCHI_PLUMBER
@@ -121,7 +125,7 @@ margo_instance_id margo_init_ext(const char*                   address,
     }
 #endif
 
-    margo_trace(0, "Initializing Mercury");
+    MARGO_TRACE(0, "Initializing Mercury");
     struct json_object* hg_config = json_object_object_get(config, "mercury");
     struct margo_hg_user_args hg_user_args = {.hg_class     = args.hg_class,
                                               .hg_context   = args.hg_context,
@@ -133,7 +137,7 @@ margo_instance_id margo_init_ext(const char*                   address,
                                    &hg))
         goto error;
 
-    margo_trace(0, "Initializing Argobots");
+    MARGO_TRACE(0, "Initializing Argobots");
     struct json_object* abt_config = json_object_object_get(config, "argobots");
     if (!__margo_abt_init_from_json(abt_config, &abt)) goto error;
 
@@ -357,9 +361,42 @@ margo_instance_id margo_init_ext(const char*                   address,
     ret = ABT_key_create(NULL, &(mid->current_rpc_id_key));
     if (ret != ABT_SUCCESS) goto error;
 
+    // create current_trace_context_key ABT_key (values are malloc-ed)
+    ret = ABT_key_create(free, &(mid->current_trace_context_key));
+    if (ret != ABT_SUCCESS) goto error;
+
+    // RPC admission limits
+    struct json_object* rpc_limits
+        = json_object_object_get(config, "rpc_limits");
+    if (!__margo_rpc_limits_init_from_json(rpc_limits, &mid->rpc_limits,
+                                           &mid->num_rpc_limits))
+        goto error;
+
     // set logger
     margo_set_logger(mid, args.logger);
 
+    // asynchronous logger
+    struct json_object* async_logging
+        = json_object_object_get(config, "async_logging");
+    if (async_logging) {
+        mid->async_logger = __margo_async_logger_create(
+            async_logging, mid->abt.xstreams_len);
+        if (!mid->async_logger) goto error;
+        if (args.logger)
+            margo_warning(mid,
+                          "Custom logger provided along with async_logging, "
+                          "messages will be passed to the custom logger "
+                          "synchronously");
+    }
+
+    // RPC capture
+    struct json_object* rpc_capture
+        = json_object_object_get(config, "rpc_capture");
+    if (rpc_capture) {
+        mid->rpc_capture = __margo_rpc_capture_create(rpc_capture);
+        if (!mid->rpc_capture) goto error;
+    }
+
     // set monitor
     if (args.monitor) {
         struct json_object* monitoring
@@ -391,6 +428,8 @@ margo_instance_id margo_init_ext(const char*                   address,
     mid->identity_rpc_id
         = MARGO_REGISTER(mid, "__identity__", void, hg_string_t, NULL);
 
+    __margo_abt_start_rpc_workers(&mid->abt);
+
     MARGO_TRACE(0, "Starting progress loop");
     ret = ABT_thread_create(MARGO_PROGRESS_POOL(mid), __margo_hg_progress_fn,
                             mid, ABT_THREAD_ATTR_NULL, &mid->hg_progress_tid);
@@ -410,6 +449,11 @@ error:
         ABT_cond_free(&mid->finalize_cond);
         ABT_mutex_free(&mid->pending_operations_mtx);
         if (mid->current_rpc_id_key) ABT_key_free(&(mid->current_rpc_id_key));
+        if (mid->current_trace_context_key)
+            ABT_key_free(&(mid->current_trace_context_key));
+        __margo_rpc_limits_destroy(mid->rpc_limits, mid->num_rpc_limits);
+        __margo_rpc_capture_destroy(mid->rpc_capture);
+        __margo_async_logger_destroy(mid->async_logger);
         free(mid->plumber_bucket_policy);
         free(mid->plumber_nic_policy);
         free(mid);
@@ -447,6 +491,9 @@ static bool __margo_validate_json(struct json_object*           _margo,
        - [optional] progress_pool: integer or string
        - [optional] rpc_pool: integer or string
        - [optional] monitoring: object
+       - [optional] rpc_limits: array of objects (see margo-rpc-limits.h)
+       - [optional] async_logging: object (see margo-async-logger.h)
+       - [optional] rpc_capture: object (see margo-rpc-capture.h)
        - [optional] plumber: object
        -            [optional]: bucket_policy: string
        -            [optional]: nic_policy: string
@@ -469,6 +516,21 @@ static bool __margo_validate_json(struct json_object*           _margo,
     struct json_object* _plumber = json_object_object_get(_margo, "plumber");
     if (!__margo_plumber_validate_json(_plumber)) { return false; }
 
+    // check "rpc_limits" configuration field
+    struct json_object* _rpc_limits
+        = json_object_object_get(_margo, "rpc_limits");
+    if (!__margo_rpc_limits_validate_json(_rpc_limits)) { return false; }
+
+    // check "async_logging" configuration field
+    struct json_object* _async_logging
+        = json_object_object_get(_margo, "async_logging");
+    if (!__margo_async_logger_validate_json(_async_logging)) { return false; }
+
+    // check "rpc_capture" configuration field
+    struct json_object* _rpc_capture
+        = json_object_object_get(_margo, "rpc_capture");
+    if (!__margo_rpc_capture_validate_json(_rpc_capture)) { return false; }
+
     // check "progress_spindown_msec" field
     ASSERT_CONFIG_HAS_OPTIONAL(_margo, "progress_spindown_msec", int, "margo");
     if (CONFIG_HAS(_margo, "progress_spindown_msec", ignore)) {
@@ -27,6 +27,9 @@
 #include "margo-monitoring.h"
 #include "margo-bulk-util.h"
 #include "margo-timer-private.h"
+#include "margo-rpc-limits.h"
+#include "margo-async-logger.h"
+#include "margo-rpc-capture.h"
 #include "utlist.h"
 #include "uthash.h"
 
@@ -35,6 +38,17 @@
 
 struct margo_handle_cache_el; /* defined in margo-handle-cache.c */
 
+/* Number of entries of the cache of fair_wait classes by hg_addr_t */
+#define MARGO_ORIGIN_CLASS_CACHE_SIZE 64
+
+/* Class of the RPCs from a given origin in fair_wait pools, cached so that
+ * the origin's address is not converted into a string on every RPC */
+struct margo_origin_class {
+    hg_addr_t addr;     /* hash key, HG_ADDR_NULL if the entry is empty */
+    hg_addr_t ref;      /* duplicate of addr, keeping it allocated */
+    uint64_t  class_id; /* margo_fair_pool_hash of the address string */
+};
+
 struct margo_finalize_cb {
     const void* owner;
     void (*callback)(void*);
@@ -111,6 +125,15 @@ struct margo_instance {
     /* timer data */
     struct margo_timer_list* timer_list;
 
+    /* fair_wait classes of the recent RPC origins (see
+     * dispatch_handler_by_origin in margo-core.c) */
+    struct margo_origin_class origin_classes[MARGO_ORIGIN_CLASS_CACHE_SIZE];
+    ABT_mutex_memory          origin_classes_mtx;
+
+    /* RPC admission limits (see margo-rpc-limits.h) */
+    struct margo_rpc_limit* rpc_limits;
+    unsigned                num_rpc_limits;
+
     /* linked list of free hg handles and a hash of in-use handles */
     size_t                        handle_cache_size;
     struct margo_handle_cache_el* free_handle_list;
@@ -118,8 +141,12 @@ struct margo_instance {
     ABT_mutex handle_cache_mtx; /* mutex protecting access to above caches */
 
     /* logging */
-    struct margo_logger logger;
-    margo_log_level     log_level;
+    struct margo_logger        logger;
+    margo_log_level            log_level;
+    struct margo_async_logger* async_logger; /* see margo-async-logger.h */
+
+    /* RPC capture (see margo-rpc-capture.h) */
+    struct margo_rpc_capture* rpc_capture;
 
     /* monitoring */
     struct margo_monitor* monitor;
@@ -127,10 +154,14 @@ struct margo_instance {
     /* some extra stats on progress/trigger calls */
     _Atomic uint64_t num_progress_calls;
     _Atomic uint64_t num_trigger_calls;
+    _Atomic uint64_t num_pending_forwards; /* waiting for their callback */
 
     /* callpath tracking */
     ABT_key current_rpc_id_key;
 
+    /* distributed tracing (margo_trace_context_t* of the current ULT) */
+    ABT_key current_trace_context_key;
+
     /* optional diagnostics data tracking */
     int abt_profiling_enabled;
 
@@ -156,6 +187,7 @@ struct margo_request_struct {
         hg_op_id_t  bulk_op;
     };
     margo_monitor_data_t monitor_data;
+    bool                 monitoring_skip; // copied from the handle's data
     margo_request_type   type; // forward, respond, or bulk
     margo_request_kind   kind; // callback or eventual
     union {
@@ -179,6 +211,17 @@ struct margo_rpc_data {
     hg_proc_cb_t      out_proc_cb; /* user-provided output proc */
     void*             user_data;
     void (*user_free_callback)(void*);
+    struct margo_rpc_limit* limit; /* admission limit, may be NULL */
+    _Atomic int execution_mode;    /* MARGO_RPC_MODE_* */
+    /* persistent handler ULTs of the pool, may be NULL */
+    _Atomic(struct margo_rpc_workers*) rpc_workers;
+    /* thread attribute of the pool (not owned), may be ABT_THREAD_ATTR_NULL */
+    _Atomic(ABT_thread_attr) pool_thread_attr;
+    /* whether the pool is a fair_wait pool, which classifies ULTs by origin */
+    _Atomic bool classify_by_origin;
+    /* RPC-specific stack size (0 if not set) and corresponding attribute */
+    size_t          stack_size;
+    ABT_thread_attr thread_attr;
 };
 
 // Data associated with a handle with HG_Set_data
@@ -192,6 +235,15 @@ struct margo_handle_data {
     void*        user_data;
     void (*user_free_callback)(void*);
     margo_monitor_data_t monitor_data;
+    int                  execution_mode; /* MARGO_RPC_MODE_* */
+    void (*inline_wrapper)(void*); /* wrapper to run in post_handler_hooks */
+    struct margo_rpc_workers* rpc_workers;   /* copied from margo_rpc_data */
+    bool                      run_by_worker; /* dispatched to rpc_workers */
+    ABT_thread_attr           thread_attr;   /* attribute of handler ULTs */
+    bool                      classify_by_origin; /* from margo_rpc_data */
+    bool                      monitoring_skip;    /* not monitored */
+    margo_trace_context_t     trace_context;      /* sent or received */
+    struct margo_rpc_capture_entry* capture; /* record of a received RPC */
 };
 
 struct lookup_cb_evt {
@@ -255,11 +307,4 @@ typedef struct {
         }                                                                   \
     } while (0)
 
-#define MARGO_TRACE    margo_trace
-#define MARGO_DEBUG    margo_debug
-#define MARGO_INFO     margo_info
-#define MARGO_WARNING  margo_warning
-#define MARGO_ERROR    margo_error
-#define MARGO_CRITICAL margo_critical
-
 #endif
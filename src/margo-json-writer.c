@@ -0,0 +1,295 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include "margo-json-writer.h"
+
+#define JSON_WRITER_DEFAULT_CAPACITY 4096
+
+void __margo_json_writer_init(margo_json_writer_t* w,
+                              margo_json_sink_fn   sink,
+                              void*                sink_args,
+                              size_t               chunk_size,
+                              int                  precision,
+                              bool                 pretty)
+{
+    memset(w, 0, sizeof(*w));
+    w->sink       = sink;
+    w->sink_args  = sink_args;
+    w->chunk_size = chunk_size;
+    w->precision  = precision < 0 ? 0 : precision;
+    w->pretty     = pretty;
+    w->first      = true;
+}
+
+void __margo_json_writer_file_sink(void* file, const char* data, size_t size)
+{
+    fwrite(data, 1, size, (FILE*)file);
+}
+
+static void flush(margo_json_writer_t* w)
+{
+    if (w->size && w->sink) w->sink(w->sink_args, w->buf, w->size);
+    w->size = 0;
+}
+
+static void append(margo_json_writer_t* w, const char* data, size_t len)
+{
+    if (w->failed || !w->sink) return;
+    if (w->chunk_size && w->size + len > w->chunk_size) flush(w);
+    if (w->size + len > w->capacity) {
+        size_t capacity = w->capacity;
+        if (!capacity)
+            capacity = w->chunk_size ? w->chunk_size
+                                     : JSON_WRITER_DEFAULT_CAPACITY;
+        while (capacity < w->size + len) capacity *= 2;
+        char* buf = (char*)realloc(w->buf, capacity);
+        if (!buf) {
+            // LCOV_EXCL_START
+            w->failed = true;
+            return;
+            // LCOV_EXCL_END
+        }
+        w->buf      = buf;
+        w->capacity = capacity;
+    }
+    memcpy(w->buf + w->size, data, len);
+    w->size += len;
+}
+
+static inline void append_char(margo_json_writer_t* w, char c)
+{
+    append(w, &c, 1);
+}
+
+static void newline(margo_json_writer_t* w)
+{
+    static const char spaces[] = "                                ";
+    append_char(w, '\n');
+    size_t indent = 2 * (size_t)w->depth;
+    while (indent) {
+        size_t n = indent < sizeof(spaces) - 1 ? indent : sizeof(spaces) - 1;
+        append(w, spaces, n);
+        indent -= n;
+    }
+}
+
+/* Writes what must precede a key or a value in the current container */
+static void separate(margo_json_writer_t* w)
+{
+    if (w->after_key) {
+        w->after_key = false;
+        return;
+    }
+    if (!w->first) append_char(w, ',');
+    if (w->pretty && w->depth) newline(w);
+    w->first = false;
+}
+
+bool __margo_json_writer_finalize(margo_json_writer_t* w)
+{
+    if (!w->failed) flush(w);
+    free(w->buf);
+    w->buf      = NULL;
+    w->capacity = 0;
+    w->size     = 0;
+    return !w->failed;
+}
+
+static void begin(margo_json_writer_t* w, char c)
+{
+    separate(w);
+    append_char(w, c);
+    w->depth += 1;
+    w->first = true;
+}
+
+static void end(margo_json_writer_t* w, char c)
+{
+    w->depth -= 1;
+    if (!w->first && w->pretty) newline(w);
+    append_char(w, c);
+    w->first = false;
+}
+
+void __margo_json_writer_begin_object(margo_json_writer_t* w)
+{
+    begin(w, '{');
+}
+
+void __margo_json_writer_end_object(margo_json_writer_t* w) { end(w, '}'); }
+
+void __margo_json_writer_begin_array(margo_json_writer_t* w)
+{
+    begin(w, '[');
+}
+
+void __margo_json_writer_end_array(margo_json_writer_t* w) { end(w, ']'); }
+
+/* Writes a quoted and escaped string. Slashes are not escaped. */
+static void write_string(margo_json_writer_t* w, const char* str)
+{
+    append_char(w, '"');
+    const char* start = str;
+    const char* p     = str;
+    for (; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        append(w, start, p - start);
+        start = p + 1;
+        switch (c) {
+        case '"':
+            append(w, "\\\"", 2);
+            break;
+        case '\\':
+            append(w, "\\\\", 2);
+            break;
+        case '\n':
+            append(w, "\\n", 2);
+            break;
+        case '\r':
+            append(w, "\\r", 2);
+            break;
+        case '\t':
+            append(w, "\\t", 2);
+            break;
+        default: {
+            char tmp[8];
+            int  n = snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+            append(w, tmp, n);
+        }
+        }
+    }
+    append(w, start, p - start);
+    append_char(w, '"');
+}
+
+void __margo_json_writer_key(margo_json_writer_t* w, const char* key)
+{
+    separate(w);
+    write_string(w, key);
+    append(w, w->pretty ? ": " : ":", w->pretty ? 2 : 1);
+    w->after_key = true;
+}
+
+void __margo_json_writer_string(margo_json_writer_t* w, const char* str)
+{
+    separate(w);
+    write_string(w, str ? str : "");
+}
+
+void __margo_json_writer_uint64(margo_json_writer_t* w, uint64_t value)
+{
+    char tmp[32];
+    int  n = snprintf(tmp, sizeof(tmp), "%" PRIu64, value);
+    separate(w);
+    append(w, tmp, n);
+}
+
+void __margo_json_writer_int64(margo_json_writer_t* w, int64_t value)
+{
+    char tmp[32];
+    int  n = snprintf(tmp, sizeof(tmp), "%" PRId64, value);
+    separate(w);
+    append(w, tmp, n);
+}
+
+void __margo_json_writer_double(margo_json_writer_t* w, double value)
+{
+    separate(w);
+    if (!isfinite(value)) {
+        /* not representable in JSON */
+        append(w, "null", 4);
+        return;
+    }
+    char tmp[352];
+    int  n = snprintf(tmp, sizeof(tmp), "%.*f", w->precision, value);
+    if (n < 0 || (size_t)n >= sizeof(tmp)) {
+        // LCOV_EXCL_START
+        append(w, "null", 4);
+        return;
+        // LCOV_EXCL_END
+    }
+    append(w, tmp, n);
+    if (w->precision == 0) append(w, ".0", 2);
+}
+
+void __margo_json_writer_bool(margo_json_writer_t* w, bool value)
+{
+    separate(w);
+    append(w, value ? "true" : "false", value ? 4 : 5);
+}
+
+void __margo_json_writer_json(margo_json_writer_t* w, struct json_object* json)
+{
+    switch (json_object_get_type(json)) {
+    case json_type_null:
+        separate(w);
+        append(w, "null", 4);
+        break;
+    case json_type_boolean:
+        __margo_json_writer_bool(w, json_object_get_boolean(json));
+        break;
+    case json_type_double:
+        __margo_json_writer_double(w, json_object_get_double(json));
+        break;
+    case json_type_int:
+        if (json_object_get_int64(json) < 0)
+            __margo_json_writer_int64(w, json_object_get_int64(json));
+        else
+            __margo_json_writer_uint64(w, json_object_get_uint64(json));
+        break;
+    case json_type_string:
+        __margo_json_writer_string(w, json_object_get_string(json));
+        break;
+    case json_type_array: {
+        size_t n = json_object_array_length(json);
+        __margo_json_writer_begin_array(w);
+        for (size_t i = 0; i < n; i++)
+            __margo_json_writer_json(w, json_object_array_get_idx(json, i));
+        __margo_json_writer_end_array(w);
+        break;
+    }
+    case json_type_object:
+        __margo_json_writer_begin_object(w);
+        json_object_object_foreach(json, key, val)
+        {
+            __margo_json_writer_key(w, key);
+            __margo_json_writer_json(w, val);
+        }
+        __margo_json_writer_end_object(w);
+        break;
+    }
+}
+
+void __margo_json_writer_printf(margo_json_writer_t* w, const char* fmt, ...)
+{
+    char    tmp[512];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, args);
+    va_end(args);
+    if (n < 0) return;
+    if ((size_t)n < sizeof(tmp)) {
+        append(w, tmp, n);
+        return;
+    }
+    char* big = (char*)malloc(n + 1);
+    if (!big) {
+        // LCOV_EXCL_START
+        w->failed = true;
+        return;
+        // LCOV_EXCL_END
+    }
+    va_start(args, fmt);
+    vsnprintf(big, n + 1, fmt, args);
+    va_end(args);
+    append(w, big, n);
+    free(big);
+}
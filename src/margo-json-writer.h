@@ -0,0 +1,104 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_JSON_WRITER_H
+#define __MARGO_JSON_WRITER_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <json-c/json.h>
+
+/* Streaming JSON writer
+ * =====================
+ *
+ * Serializes JSON into a buffer that is handed to a sink function every
+ * time it reaches chunk_size bytes, so that large documents (such as the
+ * default monitor's statistics) can be written without building a
+ * json_object tree first. With a chunk_size of 0, the whole document is
+ * accumulated and the sink is called once, by __margo_json_writer_finalize.
+ *
+ * Commas and indentation are handled by the writer: the caller only opens
+ * and closes objects and arrays, and writes keys and values. Doubles are
+ * printed with a fixed number of decimals ("%.<precision>f"), always with
+ * a decimal point so they are read back as doubles.
+ */
+typedef void (*margo_json_sink_fn)(void*, const char*, size_t);
+
+typedef struct margo_json_writer {
+    margo_json_sink_fn sink;
+    void*              sink_args;
+    char*              buf;
+    size_t             size;
+    size_t             capacity;
+    size_t             chunk_size; /* 0 means a single call to sink */
+    int                precision;
+    bool               pretty;
+    bool               failed; /* allocation failed, output truncated */
+    unsigned           depth;
+    bool               first;     /* next value is first in its container */
+    bool               after_key; /* next value follows a key */
+} margo_json_writer_t;
+
+void __margo_json_writer_init(margo_json_writer_t* w,
+                              margo_json_sink_fn   sink,
+                              void*                sink_args,
+                              size_t               chunk_size,
+                              int                  precision,
+                              bool                 pretty);
+
+/* Sink that writes into the FILE* passed as sink_args */
+void __margo_json_writer_file_sink(void* file, const char* data, size_t size);
+
+/* Hands the remaining content to the sink and frees the buffer.
+ * Returns false if the output was truncated. */
+bool __margo_json_writer_finalize(margo_json_writer_t* w);
+
+void __margo_json_writer_begin_object(margo_json_writer_t* w);
+void __margo_json_writer_end_object(margo_json_writer_t* w);
+void __margo_json_writer_begin_array(margo_json_writer_t* w);
+void __margo_json_writer_end_array(margo_json_writer_t* w);
+void __margo_json_writer_key(margo_json_writer_t* w, const char* key);
+
+void __margo_json_writer_string(margo_json_writer_t* w, const char* str);
+void __margo_json_writer_uint64(margo_json_writer_t* w, uint64_t value);
+void __margo_json_writer_int64(margo_json_writer_t* w, int64_t value);
+void __margo_json_writer_double(margo_json_writer_t* w, double value);
+void __margo_json_writer_bool(margo_json_writer_t* w, bool value);
+
+/* Writes the content of a json_object tree (NULL is written as null) */
+void __margo_json_writer_json(margo_json_writer_t* w, struct json_object* json);
+
+/* Appends formatted text as is, outside of the JSON structure. This lets
+ * other text formats (such as OpenMetrics) use the same buffering. */
+void __margo_json_writer_printf(margo_json_writer_t* w, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* Shorthands to write a key followed by a value */
+static inline void __margo_json_writer_key_string(margo_json_writer_t* w,
+                                                  const char*          key,
+                                                  const char*          str)
+{
+    __margo_json_writer_key(w, key);
+    __margo_json_writer_string(w, str);
+}
+
+static inline void __margo_json_writer_key_uint64(margo_json_writer_t* w,
+                                                  const char*          key,
+                                                  uint64_t             value)
+{
+    __margo_json_writer_key(w, key);
+    __margo_json_writer_uint64(w, value);
+}
+
+static inline void __margo_json_writer_key_double(margo_json_writer_t* w,
+                                                  const char*          key,
+                                                  double               value)
+{
+    __margo_json_writer_key(w, key);
+    __margo_json_writer_double(w, value);
+}
+
+#endif
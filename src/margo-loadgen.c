@@ -0,0 +1,887 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+#include <json-c/json.h>
+#include <margo.h>
+#include <mercury_proc_string.h>
+
+#include "margo-macros.h"
+
+/* Open-loop load generator, and the test server it sends RPCs to.
+ *
+ * With -S, runs the test server, which provides three RPCs:
+ * - "echo" sends its payload back;
+ * - "sleep" takes a given time, either yielding (margo_thread_sleep) or
+ *   busy (keeping its xstream busy);
+ * - "bulk" pulls or pushes a given number of bytes.
+ * The server prints its address and runs until a client sends it the
+ * shutdown RPC (see -k).
+ *
+ * Otherwise, sends RPCs to the server at the given address at the rate
+ * and with the arrival process described by the load configuration:
+ * {
+ *   "rate": 1000,              RPCs per second
+ *   "duration_sec": 10,
+ *   "arrival": "poisson",      or "constant", or "bursty"
+ *   "burst_size": 10,          RPCs per burst (bursty arrivals)
+ *   "timeout_ms": 10000,       0 means no timeout
+ *   "max_in_flight": 100000,   RPCs not sent past this number are dropped
+ *   "seed": 0,
+ *   "mix": [ {"rpc": "echo", "weight": 1, "size": 64},
+ *            {"rpc": "sleep", "weight": 1, "sleep_usec": 100,
+ *             "busy": false},
+ *            {"rpc": "bulk", "weight": 1, "size": 65536,
+ *             "operation": "pull"} ]
+ * }
+ * RPCs are sent with margo_cforward_timed, so responses never delay the
+ * following RPCs. The latency of each RPC is measured from the time it
+ * was scheduled to be sent, not from the time it was actually sent, so
+ * that delays of the generator itself (e.g. when the process is
+ * saturated) are not hidden (coordinated omission). The time from the
+ * actual send is reported separately as the service time. For the same
+ * reason, the RPCs dropped because of max_in_flight are counted in the
+ * latency histograms, with the time between their scheduled send and
+ * the end of the run (a lower bound of the latency they would have had).
+ */
+
+#define DEFAULT_RATE          1000.0
+#define DEFAULT_DURATION_SEC  10.0
+#define DEFAULT_TIMEOUT_MS    10000.0
+#define DEFAULT_MAX_IN_FLIGHT 100000
+#define DEFAULT_BULK_BUFFER   (16 * 1024 * 1024)
+/* time given to the RPCs in flight to complete at the end of the run,
+ * when they have no timeout */
+#define DRAIN_TIMEOUT_SEC 60.0
+
+MERCURY_GEN_PROC(loadgen_echo_t, ((hg_string_t)(data)))
+MERCURY_GEN_PROC(loadgen_sleep_in_t, ((uint64_t)(usec))((uint8_t)(busy)))
+MERCURY_GEN_PROC(loadgen_bulk_in_t,
+                 ((hg_bulk_t)(bulk))((uint64_t)(size))((uint8_t)(push)))
+
+struct options {
+    const char* protocol;
+    const char* config_file;
+    const char* load_file;
+    const char* output_file;
+    const char* server_addr;
+    const char* addr_file;
+    size_t      bulk_buffer_size;
+    bool        server;
+    bool        shutdown;
+};
+
+typedef struct loadgen_rpcs {
+    hg_id_t echo_id;
+    hg_id_t sleep_id;
+    hg_id_t bulk_id;
+    hg_id_t shutdown_id;
+} loadgen_rpcs_t;
+
+/* Buffer the server transfers data from or to */
+typedef struct loadgen_server {
+    void*     buffer;
+    hg_size_t size;
+    hg_bulk_t bulk;
+} loadgen_server_t;
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: margo-loadgen -S [-p <protocol>] [-c <margo config>] "
+            "[-f <address file>]\n"
+            "                     [-B <bulk buffer size>]\n"
+            "       margo-loadgen -a <server address> -l <load config> "
+            "[-p <protocol>]\n"
+            "                     [-c <margo config>] [-o <output file>] "
+            "[-k]\n");
+    fprintf(stderr,
+            "   With -S, runs the test server and prints its address (or\n"
+            "   writes it to <address file>). Otherwise, sends RPCs to the\n"
+            "   server as described by <load config> and writes the results\n"
+            "   as JSON to <output file> (default stdout). -k shuts the\n"
+            "   server down at the end of the run.\n");
+}
+
+/* Reads a whole file into a null-terminated string */
+static char* read_file(const char* filename)
+{
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: could not open %s: %s\n", filename,
+                strerror(errno));
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* content = size >= 0 ? calloc((size_t)size + 1, 1) : NULL;
+    if (content && fread(content, 1, (size_t)size, file) != (size_t)size) {
+        free(content);
+        content = NULL;
+    }
+    fclose(file);
+    if (!content) fprintf(stderr, "Error: could not read %s\n", filename);
+    return content;
+}
+
+static double json_object_object_get_double_or(const struct json_object* obj,
+                                               const char*               key,
+                                               double                    x)
+{
+    struct json_object* value = json_object_object_get(obj, key);
+    if (value
+        && (json_object_is_type(value, json_type_double)
+            || json_object_is_type(value, json_type_int)))
+        return json_object_get_double(value);
+    return x;
+}
+
+/* ========================================================================
+ * Test server
+ * ======================================================================== */
+
+static void echo_ult(hg_handle_t handle)
+{
+    loadgen_echo_t in;
+    if (margo_get_input(handle, &in) != HG_SUCCESS) {
+        margo_destroy(handle);
+        return;
+    }
+    margo_respond(handle, &in);
+    margo_free_input(handle, &in);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(echo_ult)
+
+static void sleep_ult(hg_handle_t handle)
+{
+    margo_instance_id  mid = margo_hg_handle_get_instance(handle);
+    loadgen_sleep_in_t in;
+    if (margo_get_input(handle, &in) != HG_SUCCESS) {
+        margo_destroy(handle);
+        return;
+    }
+    if (in.busy) {
+        double end = ABT_get_wtime() + in.usec * 1e-6;
+        while (ABT_get_wtime() < end) {}
+    } else {
+        margo_thread_sleep(mid, in.usec * 1e-3);
+    }
+    margo_free_input(handle, &in);
+    margo_respond(handle, NULL);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(sleep_ult)
+
+static void bulk_ult(hg_handle_t handle)
+{
+    margo_instance_id       mid  = margo_hg_handle_get_instance(handle);
+    const struct hg_info*   info = margo_get_info(handle);
+    const loadgen_server_t* server
+        = (const loadgen_server_t*)margo_registered_data(mid, info->id);
+    loadgen_bulk_in_t in;
+
+    hg_return_t hret = margo_get_input(handle, &in);
+    if (hret != HG_SUCCESS) {
+        margo_destroy(handle);
+        return;
+    }
+    /* concurrent transfers share the buffer, its content is irrelevant */
+    size_t       size = in.size < server->size ? in.size : server->size;
+    hg_bulk_op_t op   = in.push ? HG_BULK_PUSH : HG_BULK_PULL;
+    hret = margo_bulk_transfer(mid, op, info->addr, in.bulk, 0, server->bulk, 0,
+                               size);
+    if (hret != HG_SUCCESS)
+        fprintf(stderr, "Error: margo_bulk_transfer failed (%s)\n",
+                HG_Error_to_string(hret));
+    margo_free_input(handle, &in);
+    margo_respond(handle, NULL);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(bulk_ult)
+
+static void shutdown_ult(hg_handle_t handle)
+{
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+    margo_respond(handle, NULL);
+    margo_destroy(handle);
+    margo_finalize(mid);
+}
+DEFINE_MARGO_RPC_HANDLER(shutdown_ult)
+
+static void register_rpcs(margo_instance_id mid, loadgen_rpcs_t* rpcs)
+{
+    rpcs->echo_id = MARGO_REGISTER(mid, "margo_loadgen_echo", loadgen_echo_t,
+                                   loadgen_echo_t, echo_ult);
+    rpcs->sleep_id = MARGO_REGISTER(mid, "margo_loadgen_sleep",
+                                    loadgen_sleep_in_t, void, sleep_ult);
+    rpcs->bulk_id  = MARGO_REGISTER(mid, "margo_loadgen_bulk",
+                                    loadgen_bulk_in_t, void, bulk_ult);
+    rpcs->shutdown_id = MARGO_REGISTER(mid, "margo_loadgen_shutdown", void,
+                                       void, shutdown_ult);
+}
+
+static void server_finalize_cb(void* uargs)
+{
+    loadgen_server_t* server = (loadgen_server_t*)uargs;
+    margo_bulk_free(server->bulk);
+    free(server->buffer);
+}
+
+static int run_server(const struct options* opts, const char* config)
+{
+    struct margo_init_info info = {.json_config = config};
+    margo_instance_id      mid
+        = margo_init_ext(opts->protocol, MARGO_SERVER_MODE, &info);
+    if (mid == MARGO_INSTANCE_NULL) {
+        fprintf(stderr, "Error: could not initialize the server\n");
+        return -1;
+    }
+    loadgen_rpcs_t rpcs;
+    register_rpcs(mid, &rpcs);
+
+    loadgen_server_t server = {.size = opts->bulk_buffer_size};
+    server.buffer           = calloc(1, server.size);
+    if (!server.buffer
+        || margo_bulk_create(mid, 1, &server.buffer, &server.size,
+                             HG_BULK_READWRITE, &server.bulk)
+               != HG_SUCCESS) {
+        fprintf(stderr, "Error: could not create the server's bulk handle\n");
+        free(server.buffer);
+        margo_finalize(mid);
+        return -1;
+    }
+    margo_register_data(mid, rpcs.bulk_id, &server, NULL);
+    margo_push_finalize_callback(mid, server_finalize_cb, &server);
+
+    char      addr_str[256];
+    hg_size_t addr_str_size = sizeof(addr_str);
+    hg_addr_t self_addr     = HG_ADDR_NULL;
+    margo_addr_self(mid, &self_addr);
+    margo_addr_to_string(mid, addr_str, &addr_str_size, self_addr);
+    margo_addr_free(mid, self_addr);
+    FILE* out = opts->addr_file ? fopen(opts->addr_file, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: could not open %s: %s\n", opts->addr_file,
+                strerror(errno));
+        margo_finalize(mid);
+        return -1;
+    }
+    fprintf(out, "%s\n", addr_str);
+    if (out != stdout)
+        fclose(out);
+    else
+        fflush(stdout);
+
+    margo_wait_for_finalize(mid);
+    return 0;
+}
+
+/* ========================================================================
+ * Latency histograms
+ * ======================================================================== */
+
+/* Log-linear histogram of durations in nanoseconds: values below 16 have
+ * their own bucket, and each power of two above is divided in 16 linear
+ * buckets, so a value is known within 1/16th (6.25%). */
+#define HIST_SUB_BITS    4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_NUM_BUCKETS (HIST_SUB_BUCKETS * (64 - HIST_SUB_BITS + 1))
+
+typedef struct histogram {
+    uint64_t counts[HIST_NUM_BUCKETS];
+    uint64_t num;
+    uint64_t max;
+    double   sum;
+} histogram_t;
+
+static size_t hist_index(uint64_t v)
+{
+    if (v < HIST_SUB_BUCKETS) return (size_t)v;
+    unsigned e   = 63 - __builtin_clzll(v);
+    unsigned sub = (unsigned)(v >> (e - HIST_SUB_BITS)) - HIST_SUB_BUCKETS;
+    return HIST_SUB_BUCKETS + (e - HIST_SUB_BITS) * HIST_SUB_BUCKETS + sub;
+}
+
+/* Upper bound of the values counted in a bucket */
+static uint64_t hist_upper_bound(size_t index)
+{
+    if (index < HIST_SUB_BUCKETS) return index;
+    size_t   e   = (index - HIST_SUB_BUCKETS) / HIST_SUB_BUCKETS;
+    uint64_t sub = (index - HIST_SUB_BUCKETS) % HIST_SUB_BUCKETS;
+    return ((HIST_SUB_BUCKETS + sub + 1) << e) - 1;
+}
+
+static void hist_record(histogram_t* hist, double seconds)
+{
+    uint64_t ns = seconds > 0.0 ? (uint64_t)(seconds * 1e9) : 0;
+    hist->counts[hist_index(ns)] += 1;
+    hist->num += 1;
+    hist->sum += seconds;
+    if (ns > hist->max) hist->max = ns;
+}
+
+static struct json_object* hist_to_json(const histogram_t* hist)
+{
+    static const double      quantiles[] = {0.5, 0.9, 0.99, 0.999, 0.9999};
+    static const char* const names[]
+        = {"p50_usec", "p90_usec", "p99_usec", "p999_usec", "p9999_usec"};
+    struct json_object* result = json_object_new_object();
+    json_object_object_add(result, "num", json_object_new_uint64(hist->num));
+    if (!hist->num) return result;
+    json_object_object_add(
+        result, "avg_usec",
+        json_object_new_double(hist->sum / hist->num * 1e6));
+    json_object_object_add(result, "max_usec",
+                           json_object_new_double(hist->max * 1e-3));
+    size_t   q     = 0;
+    uint64_t count = 0;
+    for (size_t i = 0; i < HIST_NUM_BUCKETS && q < 5; i++) {
+        count += hist->counts[i];
+        while (q < 5 && count >= (uint64_t)ceil(quantiles[q] * hist->num)) {
+            uint64_t bound = hist_upper_bound(i);
+            if (bound > hist->max) bound = hist->max;
+            json_object_object_add(result, names[q],
+                                   json_object_new_double(bound * 1e-3));
+            q++;
+        }
+    }
+    return result;
+}
+
+/* ========================================================================
+ * Load generator
+ * ======================================================================== */
+
+typedef enum
+{
+    ARRIVAL_POISSON,
+    ARRIVAL_CONSTANT,
+    ARRIVAL_BURSTY
+} arrival_t;
+
+/* An entry of the mix of RPCs */
+typedef struct rpc_type {
+    char        name[64];
+    hg_id_t     id;
+    double      weight; /* cumulative, normalized to 1 */
+    void*       input;  /* input of the RPCs of this type */
+    uint64_t    sent;
+    uint64_t    errors;
+    uint64_t    timeouts;
+    uint64_t    dropped;
+    double*     dropped_scheduled; /* scheduled send time of dropped RPCs */
+    uint64_t    dropped_recorded;  /* number of entries in dropped_scheduled */
+    histogram_t latency;      /* from the scheduled send time */
+    histogram_t service_time; /* from the actual send time */
+} rpc_type_t;
+
+typedef struct loadgen {
+    margo_instance_id mid;
+    hg_addr_t         addr;
+    loadgen_rpcs_t    rpcs;
+    double            rate;
+    double            duration;
+    arrival_t         arrival;
+    uint64_t          burst_size;
+    double            timeout_ms;
+    uint64_t          max_in_flight;
+    uint64_t          rng;
+    rpc_type_t*       types;
+    size_t            num_types;
+    hg_bulk_t         bulk;
+    void*             bulk_buffer;
+    uint64_t          in_flight; /* accessed atomically */
+    uint64_t          late; /* RPCs sent more than 1ms after schedule */
+} loadgen_t;
+
+/* RPC in flight */
+typedef struct request {
+    loadgen_t*  lg;
+    rpc_type_t* type;
+    hg_handle_t handle;
+    double      scheduled;
+    double      sent;
+} request_t;
+
+/* xorshift64* */
+static double random_uniform(loadgen_t* lg)
+{
+    lg->rng ^= lg->rng >> 12;
+    lg->rng ^= lg->rng << 25;
+    lg->rng ^= lg->rng >> 27;
+    uint64_t x = lg->rng * 0x2545F4914F6CDD1DULL;
+    return ((x >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+/* Time between the scheduled sends of RPC i and RPC i+1 */
+static double next_interarrival(loadgen_t* lg, uint64_t i)
+{
+    switch (lg->arrival) {
+    case ARRIVAL_POISSON:
+        return -log(random_uniform(lg)) / lg->rate;
+    case ARRIVAL_BURSTY:
+        /* bursts of burst_size RPCs sent at once, at rate/burst_size
+         * bursts per second */
+        return (i + 1) % lg->burst_size ? 0.0 : lg->burst_size / lg->rate;
+    default:
+        return 1.0 / lg->rate;
+    }
+}
+
+/* Called by the progress loop when an RPC completes, so it must be
+ * short: it records the RPC and destroys its handle. */
+static void on_complete(void* uargs, hg_return_t hret)
+{
+    request_t*  req  = (request_t*)uargs;
+    rpc_type_t* type = req->type;
+    double      now  = ABT_get_wtime();
+    if (hret == HG_SUCCESS) {
+        hist_record(&type->latency, now - req->scheduled);
+        hist_record(&type->service_time, now - req->sent);
+    } else if (hret == HG_TIMEOUT) {
+        type->timeouts += 1;
+    } else {
+        type->errors += 1;
+    }
+    margo_destroy(req->handle);
+    __atomic_fetch_sub(&req->lg->in_flight, 1, __ATOMIC_RELEASE);
+    free(req);
+}
+
+/* Waits until the given time, letting the progress loop run */
+static void wait_until(loadgen_t* lg, double deadline)
+{
+    double now;
+    while ((now = ABT_get_wtime()) < deadline) {
+        if (deadline - now > 2e-3)
+            margo_thread_sleep(lg->mid, (deadline - now) * 1e3 - 1.0);
+        else
+            ABT_thread_yield();
+    }
+}
+
+static void send_rpc(loadgen_t* lg, rpc_type_t* type, double scheduled)
+{
+    if (__atomic_load_n(&lg->in_flight, __ATOMIC_ACQUIRE)
+        >= lg->max_in_flight) {
+        /* recorded by record_dropped at the end of the run; the array
+         * grows when its size reaches a power of 2. If it cannot grow,
+         * the following drops are only counted. */
+        type->dropped += 1;
+        uint64_t n = type->dropped_recorded;
+        if (n != type->dropped - 1) return;
+        if ((n & (n - 1)) == 0) {
+            size_t  capacity = n ? 2 * n : 1;
+            double* scheduled_times
+                = (double*)realloc(type->dropped_scheduled,
+                                   capacity * sizeof(double));
+            if (!scheduled_times) return;
+            type->dropped_scheduled = scheduled_times;
+        }
+        type->dropped_scheduled[type->dropped_recorded++] = scheduled;
+        return;
+    }
+    request_t* req = (request_t*)calloc(1, sizeof(*req));
+    req->lg        = lg;
+    req->type      = type;
+    req->scheduled = scheduled;
+    if (margo_create(lg->mid, lg->addr, type->id, &req->handle)
+        != HG_SUCCESS) {
+        type->errors += 1;
+        free(req);
+        return;
+    }
+    __atomic_fetch_add(&lg->in_flight, 1, __ATOMIC_RELEASE);
+    req->sent = ABT_get_wtime();
+    if (req->sent - scheduled > 1e-3) lg->late += 1;
+    type->sent += 1;
+    hg_return_t hret = margo_cforward_timed(req->handle, type->input,
+                                            lg->timeout_ms, on_complete, req);
+    if (hret != HG_SUCCESS) on_complete(req, hret);
+}
+
+/* Records the latency of the dropped RPCs as lasting until end */
+static void record_dropped(loadgen_t* lg, double end)
+{
+    for (size_t i = 0; i < lg->num_types; i++) {
+        rpc_type_t* type = &lg->types[i];
+        for (uint64_t j = 0; j < type->dropped_recorded; j++)
+            hist_record(&type->latency, end - type->dropped_scheduled[j]);
+    }
+}
+
+static rpc_type_t* pick_type(loadgen_t* lg)
+{
+    if (lg->num_types == 1) return &lg->types[0];
+    double x = random_uniform(lg);
+    for (size_t i = 0; i < lg->num_types; i++)
+        if (x < lg->types[i].weight) return &lg->types[i];
+    return &lg->types[lg->num_types - 1];
+}
+
+/* Parses the mix of the load configuration. Returns false on error. */
+static bool parse_mix(loadgen_t* lg, const struct json_object* load)
+{
+    struct json_object* mix = json_object_object_get(load, "mix");
+    if (!mix || !json_object_is_type(mix, json_type_array)
+        || json_object_array_length(mix) == 0) {
+        fprintf(stderr, "Error: the load configuration needs a \"mix\"\n");
+        return false;
+    }
+    lg->num_types = json_object_array_length(mix);
+    lg->types     = (rpc_type_t*)calloc(lg->num_types, sizeof(rpc_type_t));
+    hg_size_t bulk_size   = 0;
+    double    total_weight = 0.0;
+    for (size_t i = 0; i < lg->num_types; i++) {
+        struct json_object* entry = json_object_array_get_idx(mix, i);
+        rpc_type_t*         type  = &lg->types[i];
+        const char*         rpc
+            = json_object_object_get_string_or(entry, "rpc", "echo");
+        uint64_t size
+            = json_object_object_get_uint64_or(entry, "size", 0);
+        double weight
+            = json_object_object_get_double_or(entry, "weight", 1.0);
+        if (weight < 0.0) weight = 0.0;
+        total_weight += weight;
+        type->weight = total_weight;
+        if (strcmp(rpc, "echo") == 0) {
+            loadgen_echo_t* in = (loadgen_echo_t*)calloc(1, sizeof(*in));
+            in->data           = (char*)malloc(size + 1);
+            memset(in->data, 'x', size);
+            in->data[size] = '\0';
+            type->id       = lg->rpcs.echo_id;
+            type->input    = in;
+            snprintf(type->name, sizeof(type->name), "echo:%" PRIu64, size);
+        } else if (strcmp(rpc, "sleep") == 0) {
+            loadgen_sleep_in_t* in
+                = (loadgen_sleep_in_t*)calloc(1, sizeof(*in));
+            in->usec = json_object_object_get_uint64_or(entry, "sleep_usec", 0);
+            in->busy = json_object_object_get_bool_or(entry, "busy", false);
+            type->id    = lg->rpcs.sleep_id;
+            type->input = in;
+            snprintf(type->name, sizeof(type->name), "sleep:%" PRIu64 "%s",
+                     in->usec, in->busy ? ":busy" : "");
+        } else if (strcmp(rpc, "bulk") == 0) {
+            const char* operation = json_object_object_get_string_or(
+                entry, "operation", "pull");
+            loadgen_bulk_in_t* in = (loadgen_bulk_in_t*)calloc(1, sizeof(*in));
+            in->size              = size;
+            in->push              = strcmp(operation, "push") == 0;
+            type->id              = lg->rpcs.bulk_id;
+            type->input           = in;
+            if (size > bulk_size) bulk_size = size;
+            snprintf(type->name, sizeof(type->name), "bulk:%s:%" PRIu64,
+                     in->push ? "push" : "pull", size);
+        } else {
+            fprintf(stderr, "Error: unknown RPC \"%s\" in the mix\n", rpc);
+            return false;
+        }
+    }
+    if (total_weight <= 0.0) {
+        fprintf(stderr, "Error: the weights of the mix are all 0\n");
+        return false;
+    }
+    for (size_t i = 0; i < lg->num_types; i++)
+        lg->types[i].weight /= total_weight;
+
+    /* all the bulk RPCs expose the same buffer, registered once */
+    if (bulk_size) {
+        lg->bulk_buffer = calloc(1, bulk_size);
+        if (!lg->bulk_buffer
+            || margo_bulk_create(lg->mid, 1, &lg->bulk_buffer, &bulk_size,
+                                 HG_BULK_READWRITE, &lg->bulk)
+                   != HG_SUCCESS) {
+            fprintf(stderr,
+                    "Error: could not create the client's bulk handle\n");
+            return false;
+        }
+        for (size_t i = 0; i < lg->num_types; i++)
+            if (lg->types[i].id == lg->rpcs.bulk_id)
+                ((loadgen_bulk_in_t*)lg->types[i].input)->bulk = lg->bulk;
+    }
+    return true;
+}
+
+static void free_types(loadgen_t* lg)
+{
+    for (size_t i = 0; i < lg->num_types; i++) {
+        if (lg->types[i].id == lg->rpcs.echo_id && lg->types[i].input)
+            free(((loadgen_echo_t*)lg->types[i].input)->data);
+        free(lg->types[i].input);
+        free(lg->types[i].dropped_scheduled);
+    }
+    free(lg->types);
+    if (lg->bulk != HG_BULK_NULL) margo_bulk_free(lg->bulk);
+    free(lg->bulk_buffer);
+}
+
+static struct json_object* results_to_json(const loadgen_t* lg,
+                                           double           send_time,
+                                           double           drain_time)
+{
+    static const char* const arrivals[] = {"poisson", "constant", "bursty"};
+    struct json_object*      output     = json_object_new_object();
+    json_object_object_add(output, "rate", json_object_new_double(lg->rate));
+    json_object_object_add(output, "duration_sec",
+                           json_object_new_double(lg->duration));
+    json_object_object_add(output, "arrival",
+                           json_object_new_string(arrivals[lg->arrival]));
+    if (lg->arrival == ARRIVAL_BURSTY)
+        json_object_object_add(output, "burst_size",
+                               json_object_new_uint64(lg->burst_size));
+    json_object_object_add(output, "timeout_ms",
+                           json_object_new_double(lg->timeout_ms));
+
+    histogram_t* total_latency = calloc(1, sizeof(histogram_t));
+    histogram_t* total_service = calloc(1, sizeof(histogram_t));
+    uint64_t     sent = 0, completed = 0, errors = 0, timeouts = 0;
+    uint64_t     dropped = 0;
+    struct json_object* rpcs = json_object_new_object();
+    for (size_t i = 0; i < lg->num_types; i++) {
+        const rpc_type_t*   type   = &lg->types[i];
+        struct json_object* result = json_object_new_object();
+        json_object_object_add(result, "sent",
+                               json_object_new_uint64(type->sent));
+        json_object_object_add(result, "errors",
+                               json_object_new_uint64(type->errors));
+        json_object_object_add(result, "timeouts",
+                               json_object_new_uint64(type->timeouts));
+        json_object_object_add(result, "dropped",
+                               json_object_new_uint64(type->dropped));
+        json_object_object_add(result, "latency",
+                               hist_to_json(&type->latency));
+        json_object_object_add(result, "service_time",
+                               hist_to_json(&type->service_time));
+        json_object_object_add(rpcs, type->name, result);
+        sent += type->sent;
+        completed += type->service_time.num;
+        errors += type->errors;
+        timeouts += type->timeouts;
+        dropped += type->dropped;
+        for (size_t j = 0; j < HIST_NUM_BUCKETS; j++) {
+            total_latency->counts[j] += type->latency.counts[j];
+            total_service->counts[j] += type->service_time.counts[j];
+        }
+        total_latency->num += type->latency.num;
+        total_latency->sum += type->latency.sum;
+        if (type->latency.max > total_latency->max)
+            total_latency->max = type->latency.max;
+        total_service->num += type->service_time.num;
+        total_service->sum += type->service_time.sum;
+        if (type->service_time.max > total_service->max)
+            total_service->max = type->service_time.max;
+    }
+    json_object_object_add(output, "sent", json_object_new_uint64(sent));
+    json_object_object_add(output, "send_rate",
+                           json_object_new_double(sent / send_time));
+    json_object_object_add(output, "completed",
+                           json_object_new_uint64(completed));
+    json_object_object_add(
+        output, "completion_rate",
+        json_object_new_double(completed / (send_time + drain_time)));
+    json_object_object_add(output, "errors", json_object_new_uint64(errors));
+    json_object_object_add(output, "timeouts",
+                           json_object_new_uint64(timeouts));
+    json_object_object_add(output, "dropped",
+                           json_object_new_uint64(dropped));
+    json_object_object_add(output, "late", json_object_new_uint64(lg->late));
+    json_object_object_add(
+        output, "unfinished",
+        json_object_new_uint64(__atomic_load_n(
+            (uint64_t*)&lg->in_flight, __ATOMIC_ACQUIRE)));
+    json_object_object_add(output, "latency", hist_to_json(total_latency));
+    json_object_object_add(output, "service_time",
+                           hist_to_json(total_service));
+    json_object_object_add(output, "rpcs", rpcs);
+    free(total_latency);
+    free(total_service);
+    return output;
+}
+
+static struct json_object* run_client(const struct options* opts,
+                                      const char*           config,
+                                      struct json_object*   load)
+{
+    loadgen_t lg = {0};
+    lg.rate      = json_object_object_get_double_or(load, "rate", DEFAULT_RATE);
+    lg.duration  = json_object_object_get_double_or(load, "duration_sec",
+                                                    DEFAULT_DURATION_SEC);
+    lg.timeout_ms = json_object_object_get_double_or(load, "timeout_ms",
+                                                     DEFAULT_TIMEOUT_MS);
+    lg.burst_size = json_object_object_get_uint64_or(load, "burst_size", 10);
+    lg.max_in_flight = json_object_object_get_uint64_or(
+        load, "max_in_flight", DEFAULT_MAX_IN_FLIGHT);
+    lg.rng = json_object_object_get_uint64_or(load, "seed", 0)
+           ^ 0x9E3779B97F4A7C15ULL;
+    const char* arrival
+        = json_object_object_get_string_or(load, "arrival", "poisson");
+    if (strcmp(arrival, "poisson") == 0)
+        lg.arrival = ARRIVAL_POISSON;
+    else if (strcmp(arrival, "constant") == 0)
+        lg.arrival = ARRIVAL_CONSTANT;
+    else if (strcmp(arrival, "bursty") == 0)
+        lg.arrival = ARRIVAL_BURSTY;
+    else {
+        fprintf(stderr, "Error: unknown arrival process \"%s\"\n", arrival);
+        return NULL;
+    }
+    if (lg.rate <= 0.0 || lg.duration <= 0.0 || lg.burst_size == 0) {
+        fprintf(stderr,
+                "Error: rate, duration_sec and burst_size must be "
+                "positive\n");
+        return NULL;
+    }
+
+    struct margo_init_info info = {.json_config = config};
+    lg.mid = margo_init_ext(opts->protocol, MARGO_CLIENT_MODE, &info);
+    if (lg.mid == MARGO_INSTANCE_NULL) {
+        fprintf(stderr, "Error: could not initialize the client\n");
+        return NULL;
+    }
+    register_rpcs(lg.mid, &lg.rpcs);
+    struct json_object* output = NULL;
+    if (margo_addr_lookup(lg.mid, opts->server_addr, &lg.addr)
+        != HG_SUCCESS) {
+        fprintf(stderr, "Error: could not look up %s\n", opts->server_addr);
+        goto finish;
+    }
+    if (!parse_mix(&lg, load)) goto finish;
+
+    /* open loop: the RPCs are sent at their scheduled time, regardless of
+     * the RPCs still in flight */
+    double   start     = ABT_get_wtime();
+    double   end       = start + lg.duration;
+    double   scheduled = start;
+    uint64_t i         = 0;
+    while (scheduled < end) {
+        wait_until(&lg, scheduled);
+        send_rpc(&lg, pick_type(&lg), scheduled);
+        scheduled += next_interarrival(&lg, i++);
+    }
+    double send_end = ABT_get_wtime();
+
+    /* wait for the RPCs in flight */
+    double drain_timeout = lg.timeout_ms > 0.0 ? lg.timeout_ms * 1e-3 + 1.0
+                                               : DRAIN_TIMEOUT_SEC;
+    while (__atomic_load_n(&lg.in_flight, __ATOMIC_ACQUIRE)
+           && ABT_get_wtime() < send_end + drain_timeout)
+        margo_thread_sleep(lg.mid, 1.0);
+    double drain_end = ABT_get_wtime();
+    record_dropped(&lg, drain_end);
+
+    output = results_to_json(&lg, send_end - start, drain_end - send_end);
+
+    if (opts->shutdown) {
+        hg_handle_t handle = HG_HANDLE_NULL;
+        margo_create(lg.mid, lg.addr, lg.rpcs.shutdown_id, &handle);
+        margo_forward(handle, NULL);
+        margo_destroy(handle);
+    }
+
+finish:
+    /* RPCs still in flight (without timeout) keep their handles */
+    if (!__atomic_load_n(&lg.in_flight, __ATOMIC_ACQUIRE)) free_types(&lg);
+    if (lg.addr != HG_ADDR_NULL) margo_addr_free(lg.mid, lg.addr);
+    margo_finalize(lg.mid);
+    return output;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts
+        = {.protocol = "na+sm", .bulk_buffer_size = DEFAULT_BULK_BUFFER};
+    int opt;
+    while ((opt = getopt(argc, argv, "Sp:c:l:o:a:f:B:kh")) != -1) {
+        switch (opt) {
+        case 'S':
+            opts.server = true;
+            break;
+        case 'p':
+            opts.protocol = optarg;
+            break;
+        case 'c':
+            opts.config_file = optarg;
+            break;
+        case 'l':
+            opts.load_file = optarg;
+            break;
+        case 'o':
+            opts.output_file = optarg;
+            break;
+        case 'a':
+            opts.server_addr = optarg;
+            break;
+        case 'f':
+            opts.addr_file = optarg;
+            break;
+        case 'B':
+            opts.bulk_buffer_size = (size_t)atol(optarg);
+            break;
+        case 'k':
+            opts.shutdown = true;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc || opts.bulk_buffer_size == 0
+        || (!opts.server && (!opts.server_addr || !opts.load_file))) {
+        usage();
+        return -1;
+    }
+
+    char* config = NULL;
+    if (opts.config_file && !(config = read_file(opts.config_file)))
+        return -1;
+    if (opts.server) {
+        int ret = run_server(&opts, config);
+        free(config);
+        return ret;
+    }
+
+    char* load_str = read_file(opts.load_file);
+    if (!load_str) {
+        free(config);
+        return -1;
+    }
+    struct json_object* load = json_tokener_parse(load_str);
+    free(load_str);
+    if (!load || !json_object_is_type(load, json_type_object)) {
+        fprintf(stderr, "Error: could not parse %s\n", opts.load_file);
+        json_object_put(load);
+        free(config);
+        return -1;
+    }
+    struct json_object* output = run_client(&opts, config, load);
+    json_object_put(load);
+    free(config);
+    if (!output) return -1;
+
+    int   ret = 0;
+    FILE* out = opts.output_file ? fopen(opts.output_file, "w") : stdout;
+    if (out) {
+        fprintf(out, "%s\n",
+                json_object_to_json_string_ext(
+                    output,
+                    JSON_C_TO_STRING_PRETTY | JSON_C_TO_STRING_NOSLASHESCAPE));
+        if (out != stdout) fclose(out);
+    } else {
+        fprintf(stderr, "Error: could not open %s: %s\n", opts.output_file,
+                strerror(errno));
+        ret = -1;
+    }
+    json_object_put(output);
+    return ret;
+}
@@ -10,6 +10,19 @@
 static const char*     global_log_level_env = NULL;
 static margo_log_level global_log_level     = -1;
 
+/* accept everything until the global log level is known */
+int __margo_log_min_level = MARGO_LOG_EXTERNAL;
+
+/* lowers __margo_log_min_level to level if it is above */
+static inline void lower_min_log_level(margo_log_level level)
+{
+    int current = __atomic_load_n(&__margo_log_min_level, __ATOMIC_RELAXED);
+    while ((int)level < current
+           && !__atomic_compare_exchange_n(&__margo_log_min_level, &current,
+                                           (int)level, false, __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED)) {}
+}
+
 static void __margo_log_trace(void* uargs, const char* str)
 {
     (void)uargs;
@@ -117,8 +130,11 @@ static inline void set_global_log_level_from_env()
                 global_log_level = MARGO_LOG_WARNING;
             }
         }
-        /* here we know global_log_level is defined. */
+        /* here we know global_log_level is defined. No instance logger
+         * has been set up yet, so it is also the minimum log level. */
         global_log_level_env = log_level_to_string(global_log_level);
+        __atomic_store_n(&__margo_log_min_level, (int)global_log_level,
+                         __ATOMIC_RELAXED);
     }
 }
 
@@ -130,6 +146,16 @@ static inline void set_global_log_level_from_env()
         margo_log_level logger_level                                         \
             = mid ? mid->log_level : global_log_level;                       \
         if (logger_level > function_level) return;                           \
+        /* a custom logger takes precedence over the asynchronous one */   \
+        if (mid && mid->async_logger                                         \
+            && mid->logger.__level__ == __margo_log_##__level__) {           \
+            va_list args;                                                    \
+            va_start(args, fmt);                                             \
+            __margo_async_logger_vlog(mid->async_logger, function_level,     \
+                                      fmt, args);                            \
+            va_end(args);                                                    \
+            return;                                                          \
+        }                                                                    \
         va_list args1;                                                       \
         va_start(args1, fmt);                                                \
         va_list args2;                                                       \
@@ -165,6 +191,11 @@ int margo_set_logger(margo_instance_id mid, const struct margo_logger* logger)
         mid->logger.critical = __margo_log_critical;
     } else {
         mid->logger = *logger;
+        if (mid->async_logger)
+            margo_warning(mid,
+                          "Custom logger set on a margo instance with "
+                          "async_logging, messages will be passed to the "
+                          "custom logger synchronously");
     }
     mid->log_level = global_log_level;
     return 0;
@@ -174,6 +205,7 @@ int margo_set_log_level(margo_instance_id mid, margo_log_level level)
 {
     if (level < 0 || level > MARGO_LOG_CRITICAL) return -1;
     mid->log_level = level;
+    lower_min_log_level(level);
     return 0;
 }
 
@@ -196,7 +228,19 @@ int margo_set_global_logger(const struct margo_logger* logger)
 int margo_set_global_log_level(margo_log_level level)
 {
     if (level < 0 || level > MARGO_LOG_CRITICAL) return -1;
+    if (!global_log_level_env)
+        __atomic_store_n(&__margo_log_min_level, (int)level, __ATOMIC_RELAXED);
+    else
+        lower_min_log_level(level);
     global_log_level     = level;
     global_log_level_env = log_level_to_string(level);
     return 0;
 }
+
+int margo_get_async_log_stats(margo_instance_id             mid,
+                              struct margo_async_log_stats* stats)
+{
+    if (!mid || !mid->async_logger) return -1;
+    __margo_async_logger_get_stats(mid->async_logger, stats);
+    return 0;
+}
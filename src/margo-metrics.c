@@ -0,0 +1,63 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <sched.h>
+#include "margo-metrics.h"
+
+void __margo_metrics_init(margo_metrics_segment_t* segment)
+{
+    segment->version = MARGO_METRICS_VERSION;
+    segment->size    = (uint32_t)sizeof(*segment);
+    /* the magic number is written last, marking the segment as valid */
+    __atomic_store_n(&segment->magic, MARGO_METRICS_MAGIC, __ATOMIC_RELEASE);
+}
+
+/* Offset of the fields updated by __margo_metrics_publish */
+#define METRICS_DATA_OFFSET offsetof(margo_metrics_segment_t, pid)
+
+void __margo_metrics_publish(margo_metrics_segment_t*       segment,
+                             const margo_metrics_segment_t* snapshot)
+{
+    uint64_t seq = __atomic_load_n(&segment->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&segment->seq, seq + 1, __ATOMIC_RELAXED);
+    /* the odd seq must be visible before any of the data */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((char*)segment + METRICS_DATA_OFFSET,
+           (const char*)snapshot + METRICS_DATA_OFFSET,
+           sizeof(*segment) - METRICS_DATA_OFFSET);
+    __atomic_store_n(&segment->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+bool __margo_metrics_read(const margo_metrics_segment_t* segment,
+                          margo_metrics_segment_t*       copy,
+                          unsigned                       attempts)
+{
+    if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE)
+            != MARGO_METRICS_MAGIC
+        || segment->version != MARGO_METRICS_VERSION
+        || segment->size != sizeof(*segment))
+        return false;
+    for (unsigned i = 0; i < attempts; i++) {
+        uint64_t before = __atomic_load_n(&segment->seq, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(copy, segment, sizeof(*copy));
+        /* the copy must be complete before seq is read again */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t after = __atomic_load_n(&segment->seq, __ATOMIC_RELAXED);
+        if (before == after) {
+            copy->seq = before;
+            if (copy->num_pools > MARGO_METRICS_MAX_POOLS)
+                copy->num_pools = MARGO_METRICS_MAX_POOLS;
+            if (copy->num_rpcs > MARGO_METRICS_MAX_RPCS)
+                copy->num_rpcs = MARGO_METRICS_MAX_RPCS;
+            return true;
+        }
+    }
+    return false;
+}
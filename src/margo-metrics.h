@@ -0,0 +1,106 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_METRICS_H
+#define __MARGO_METRICS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Shared-memory metrics segment
+ * ==============================
+ *
+ * When given a "metrics" configuration with a "filename_prefix", the
+ * default monitor publishes a snapshot of its metrics every interval_sec
+ * seconds (from the progress loop) into a memory-mapped file named
+ * <prefix>.<hostname>.<pid>.metrics. Using a prefix in /dev/shm makes it
+ * a POSIX shared-memory segment. The file is removed on finalize.
+ *
+ * The segment is a single margo_metrics_segment_t with a fixed layout,
+ * identified by its magic number and version. It is protected by a
+ * seqlock: the writer increments seq before and after updating the
+ * segment, so readers (such as margo-top) can copy it without taking
+ * any lock, retrying if seq was odd or changed during the copy. The
+ * process publishing the segment never waits on its readers.
+ *
+ * Histograms have one bucket per power of two: bucket i counts the
+ * durations in [2^i, 2^(i+1)) nanoseconds (bucket 0 also counts 0),
+ * and the last bucket counts everything above.
+ */
+#define MARGO_METRICS_MAGIC        0x435254454d4f474dULL /* "MGOMETRC" */
+#define MARGO_METRICS_VERSION      1
+#define MARGO_METRICS_MAX_POOLS    64
+#define MARGO_METRICS_MAX_RPCS     256
+#define MARGO_METRICS_HIST_BUCKETS 40
+
+typedef struct margo_metrics_pool {
+    char     name[48];
+    uint64_t size;       /* runnable ULTs (ABT_pool_get_size) */
+    uint64_t total_size; /* including blocked ULTs */
+} margo_metrics_pool_t;
+
+typedef struct margo_metrics_rpc {
+    uint64_t id; /* RPC id, including the provider id */
+    char     name[56];
+    uint64_t origin_count; /* forwards completed */
+    uint64_t target_count; /* handler ULTs completed */
+    /* from iforward to the forward callback */
+    uint64_t origin_hist[MARGO_METRICS_HIST_BUCKETS];
+    /* duration of the handler ULT */
+    uint64_t target_hist[MARGO_METRICS_HIST_BUCKETS];
+} margo_metrics_rpc_t;
+
+typedef struct margo_metrics_segment {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t size; /* sizeof(margo_metrics_segment_t) */
+    uint64_t seq;  /* odd while the segment is being updated */
+    int64_t  pid;
+    char     address[256];
+    double   update_time; /* wall-clock time of the last update */
+    uint64_t num_updates;
+    uint64_t sample_rpcs_every; /* RPC counts are sampled if > 1 */
+    /* progress loop */
+    uint64_t progress_calls;
+    uint64_t trigger_calls;
+    /* RPCs in flight */
+    uint64_t origin_rpcs_in_flight; /* forwards waiting for a response */
+    uint64_t target_rpcs_in_flight; /* handlers not completed */
+    /* handle cache */
+    uint64_t handle_cache_size;
+    uint64_t handle_cache_used;
+    /* pools and RPCs */
+    uint32_t             num_pools;
+    uint32_t             num_rpcs;
+    margo_metrics_pool_t pools[MARGO_METRICS_MAX_POOLS];
+    margo_metrics_rpc_t  rpcs[MARGO_METRICS_MAX_RPCS];
+} margo_metrics_segment_t;
+
+/* Initializes the identification of a zeroed segment */
+void __margo_metrics_init(margo_metrics_segment_t* segment);
+
+/* Copies the content of snapshot (which must not be shared) into the
+ * segment, taking the seqlock. The identification fields of the segment
+ * are preserved and seq is incremented twice. Only one thread may
+ * publish into a given segment at a time. */
+void __margo_metrics_publish(margo_metrics_segment_t*       segment,
+                             const margo_metrics_segment_t* snapshot);
+
+/* Copies a consistent snapshot of the segment into copy. Returns false
+ * if the segment is not valid or if no consistent copy could be made
+ * within the given number of attempts. */
+bool __margo_metrics_read(const margo_metrics_segment_t* segment,
+                          margo_metrics_segment_t*       copy,
+                          unsigned                       attempts);
+
+/* Index of the histogram bucket of a duration in nanoseconds */
+static inline unsigned __margo_metrics_hist_bucket(uint64_t ns)
+{
+    if (ns < 2) return 0;
+    unsigned e = 63 - __builtin_clzll(ns);
+    return e < MARGO_METRICS_HIST_BUCKETS ? e : MARGO_METRICS_HIST_BUCKETS - 1;
+}
+
+#endif
@@ -19,6 +19,23 @@
             MARGO_MONITOR_##__mevent__, &__args__);             \
     } while (0)
 
+/* Same as __MARGO_MONITOR, for the operations on a handle or on its
+ * request, which are not monitored at all (no timestamp taken) if the
+ * monitor excluded the handle with margo_monitoring_skip_handle.
+ */
+#define __MARGO_MONITOR_UNLESS_SKIPPED(__skip__, __mid__, __mevent__, __fun__, \
+                                       __args__)                              \
+    do {                                                                      \
+        if (__skip__) break;                                                  \
+        __MARGO_MONITOR(__mid__, __mevent__, __fun__, __args__);              \
+    } while (0)
+
+/* Initializes span as a new child span of the calling ULT's trace
+ * context, or zeroes it if the ULT has no trace context */
+void __margo_trace_context_new_span(margo_instance_id      mid,
+                                    margo_trace_context_t* span);
+
 extern struct margo_monitor __margo_default_monitor;
+extern struct margo_monitor __margo_trace_monitor;
 
 #endif
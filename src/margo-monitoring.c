@@ -3,7 +3,9 @@
  *
  * See COPYRIGHT in top-level directory.
  */
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "margo-instance.h"
 #include "margo-monitoring.h"
 
@@ -39,6 +41,15 @@ hg_return_t margo_get_monitoring_data(hg_handle_t           handle,
     return HG_SUCCESS;
 }
 
+hg_return_t margo_monitoring_skip_handle(hg_handle_t handle)
+{
+    if (!handle) return HG_INVALID_ARG;
+    struct margo_handle_data* handle_data = HG_Get_data(handle);
+    if (!handle_data) return HG_OTHER_ERROR;
+    handle_data->monitoring_skip = true;
+    return HG_SUCCESS;
+}
+
 hg_return_t margo_request_set_monitoring_data(margo_request        req,
                                               margo_monitor_data_t data)
 {
@@ -67,3 +78,105 @@ hg_return_t margo_monitor_dump(margo_instance_id     mid,
     mid->monitor->dump(mid->monitor->uargs, dump_fn, uargs, reset);
     return HG_SUCCESS;
 }
+
+/* Random 64-bit identifiers (never 0) for traces and spans, generated
+ * with splitmix64 from a per-thread state seeded with the host, the
+ * process, the thread, and the time. */
+static _Thread_local uint64_t g_trace_id_state = 0;
+
+static uint64_t trace_random_id(void)
+{
+    if (!g_trace_id_state) {
+        g_trace_id_state = ((uint64_t)gethostid() << 32)
+                         ^ ((uint64_t)getpid() << 16)
+                         ^ (uint64_t)(uintptr_t)&g_trace_id_state
+                         ^ (uint64_t)(ABT_get_wtime() * 1e9);
+    }
+    uint64_t z = (g_trace_id_state += 0x9e3779b97f4a7c15ULL);
+    z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z          = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z          = z ^ (z >> 31);
+    return z ? z : 1;
+}
+
+static inline bool trace_context_is_valid(const margo_trace_context_t* ctx)
+{
+    return ctx && (ctx->trace_id[0] || ctx->trace_id[1]);
+}
+
+hg_return_t margo_start_trace_context(margo_instance_id mid, bool sampled)
+{
+    if (!mid) return HG_INVALID_ARG;
+    margo_trace_context_t ctx = {0};
+    ctx.trace_id[0]           = trace_random_id();
+    ctx.trace_id[1]           = trace_random_id();
+    ctx.span_id               = trace_random_id();
+    ctx.flags                 = sampled ? MARGO_TRACE_CONTEXT_SAMPLED : 0;
+    return margo_set_current_trace_context(mid, &ctx);
+}
+
+hg_return_t margo_set_current_trace_context(margo_instance_id            mid,
+                                            const margo_trace_context_t* ctx)
+{
+    if (!mid) return HG_INVALID_ARG;
+    margo_trace_context_t* current = NULL;
+    ABT_key_get(mid->current_trace_context_key, (void**)&current);
+    if (!trace_context_is_valid(ctx)) {
+        /* the allocation is kept for the next context of the ULT */
+        if (current) memset(current, 0, sizeof(*current));
+        return HG_SUCCESS;
+    }
+    if (!current) {
+        current = (margo_trace_context_t*)malloc(sizeof(*current));
+        if (!current) return HG_NOMEM;
+        if (ABT_key_set(mid->current_trace_context_key, current)
+            != ABT_SUCCESS) {
+            // LCOV_EXCL_START
+            free(current);
+            return HG_OTHER_ERROR;
+            // LCOV_EXCL_END
+        }
+    }
+    *current = *ctx;
+    return HG_SUCCESS;
+}
+
+hg_return_t margo_get_current_trace_context(margo_instance_id      mid,
+                                            margo_trace_context_t* ctx)
+{
+    if (!mid || !ctx) return HG_INVALID_ARG;
+    margo_trace_context_t* current = NULL;
+    ABT_key_get(mid->current_trace_context_key, (void**)&current);
+    if (!trace_context_is_valid(current)) {
+        memset(ctx, 0, sizeof(*ctx));
+        return HG_NOENTRY;
+    }
+    *ctx = *current;
+    return HG_SUCCESS;
+}
+
+hg_return_t margo_get_trace_context(hg_handle_t            handle,
+                                    margo_trace_context_t* ctx)
+{
+    if (!handle || !ctx) return HG_INVALID_ARG;
+    struct margo_handle_data* handle_data = HG_Get_data(handle);
+    if (!handle_data || !trace_context_is_valid(&handle_data->trace_context)) {
+        memset(ctx, 0, sizeof(*ctx));
+        return HG_NOENTRY;
+    }
+    *ctx = handle_data->trace_context;
+    return HG_SUCCESS;
+}
+
+void __margo_trace_context_new_span(margo_instance_id      mid,
+                                    margo_trace_context_t* span)
+{
+    margo_trace_context_t parent;
+    if (margo_get_current_trace_context(mid, &parent) != HG_SUCCESS) {
+        memset(span, 0, sizeof(*span));
+        return;
+    }
+    *span                = parent;
+    span->span_id        = trace_random_id();
+    span->parent_span_id = parent.span_id;
+}
@@ -0,0 +1,469 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <json-c/json.h>
+#include <margo.h>
+
+#include "margo-rpc-capture.h"
+
+/* Sends the RPCs recorded in an RPC capture file (see the "rpc_capture"
+ * configuration, margo-rpc-capture.h) to a server, with their serialized
+ * inputs, in the order and at the times they arrived, or with their
+ * inter-arrival times divided by a speedup factor. The server must
+ * provide the recorded RPCs, with the same provider IDs, e.g. a test
+ * deployment of the captured service.
+ *
+ * RPCs are sent with margo_provider_cforward_timed, so that responses
+ * never delay the following RPCs. RPCs whose input was not stored (see
+ * max_input_size) are skipped, RPCs whose handler never decoded its input
+ * are sent with an empty input. The results (per RPC name: counts,
+ * latency, and bytes sent and expected back) are written as JSON.
+ */
+
+#define DEFAULT_TIMEOUT_MS    10000.0
+#define DEFAULT_MAX_IN_FLIGHT 100000
+/* time given to the RPCs in flight to complete at the end of the replay,
+ * when they have no timeout */
+#define DRAIN_TIMEOUT_SEC 60.0
+
+struct options {
+    const char* protocol;
+    const char* config_file;
+    const char* output_file;
+    const char* server_addr;
+    const char* capture_file;
+    double      speedup;
+    double      timeout_ms;
+    uint64_t    max_in_flight;
+};
+
+/* Statistics of the RPCs of a given name */
+typedef struct rpc_stats {
+    char*    name;
+    hg_id_t  id;
+    uint64_t sent;
+    uint64_t completed;
+    uint64_t errors;
+    uint64_t timeouts;
+    uint64_t skipped;
+    uint64_t input_bytes;
+    uint64_t response_bytes; /* as recorded */
+    double   latency_sum;
+    double   latency_max;
+} rpc_stats_t;
+
+typedef struct record {
+    margo_rpc_capture_record_header_t header;
+    size_t                            stats; /* index in replay->stats */
+    void*                             input;
+} record_t;
+
+/* Input of the replayed RPCs: bytes sent as they are */
+typedef struct replay_input {
+    const void* data;
+    uint32_t    size;
+} replay_input_t;
+
+typedef struct replay {
+    margo_instance_id mid;
+    hg_addr_t         addr;
+    record_t*         records;
+    size_t            num_records;
+    rpc_stats_t*      stats;
+    size_t            num_stats;
+    uint64_t          in_flight; /* accessed atomically */
+    uint64_t          dropped;
+} replay_t;
+
+/* RPC in flight */
+typedef struct request {
+    replay_t*    replay;
+    rpc_stats_t* stats;
+    hg_handle_t  handle;
+    double       sent;
+} request_t;
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: margo-replay -a <server address> [-p <protocol>] "
+            "[-c <margo config>]\n"
+            "                    [-s <speedup>] [-t <timeout ms>] "
+            "[-m <max in flight>]\n"
+            "                    [-o <output file>] <capture file>\n");
+    fprintf(stderr,
+            "   Sends the RPCs of <capture file> to the server, preserving\n"
+            "   their inter-arrival times divided by <speedup> (default 1,\n"
+            "   0 sends them as fast as possible). <protocol> defaults to\n"
+            "   the protocol of the server's address.\n");
+}
+
+static hg_return_t hg_proc_replay_input_t(hg_proc_t proc, void* data)
+{
+    replay_input_t* in = (replay_input_t*)data;
+    /* replayed inputs are only encoded */
+    if (hg_proc_get_op(proc) != HG_ENCODE || !in->size) return HG_SUCCESS;
+    return hg_proc_memcpy(proc, (void*)in->data, in->size);
+}
+
+/* Reads the records of the capture file, returns false on error */
+static bool read_capture(replay_t* replay, const char* filename)
+{
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: could not open %s: %s\n", filename,
+                strerror(errno));
+        return false;
+    }
+    margo_rpc_capture_file_header_t file_header;
+    if (fread(&file_header, sizeof(file_header), 1, file) != 1
+        || memcmp(file_header.magic, MARGO_RPC_CAPTURE_MAGIC,
+                  sizeof(file_header.magic))
+               != 0
+        || file_header.version != MARGO_RPC_CAPTURE_VERSION) {
+        fprintf(stderr, "Error: %s is not an RPC capture file\n", filename);
+        fclose(file);
+        return false;
+    }
+
+    size_t                            capacity = 0;
+    margo_rpc_capture_record_header_t header;
+    char                              name[UINT16_MAX + 1];
+    while (fread(&header, sizeof(header), 1, file) == 1) {
+        void* input = header.stored_size ? malloc(header.stored_size) : NULL;
+        if (fread(name, 1, header.name_length, file) != header.name_length
+            || (header.stored_size
+                && fread(input, 1, header.stored_size, file)
+                       != header.stored_size)) {
+            fprintf(stderr, "Warning: %s is truncated\n", filename);
+            free(input);
+            break;
+        }
+        name[header.name_length] = '\0';
+
+        size_t stats = 0;
+        while (stats < replay->num_stats
+               && strcmp(replay->stats[stats].name, name) != 0)
+            stats++;
+        if (stats == replay->num_stats) {
+            replay->stats = realloc(replay->stats, (replay->num_stats + 1)
+                                                       * sizeof(rpc_stats_t));
+            memset(&replay->stats[stats], 0, sizeof(rpc_stats_t));
+            replay->stats[stats].name = strdup(name);
+            replay->num_stats++;
+        }
+
+        if (replay->num_records == capacity) {
+            capacity        = capacity ? 2 * capacity : 1024;
+            replay->records = realloc(replay->records,
+                                      capacity * sizeof(record_t));
+        }
+        record_t* record = &replay->records[replay->num_records++];
+        record->header   = header;
+        record->input    = input;
+        record->stats    = stats;
+    }
+    fclose(file);
+    return true;
+}
+
+static int compare_arrivals(const void* a, const void* b)
+{
+    uint64_t x = ((const record_t*)a)->header.arrival_ns;
+    uint64_t y = ((const record_t*)b)->header.arrival_ns;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Called by the progress loop when an RPC completes, so it must be
+ * short: it records the RPC and destroys its handle. */
+static void on_complete(void* uargs, hg_return_t hret)
+{
+    request_t*   req     = (request_t*)uargs;
+    rpc_stats_t* stats   = req->stats;
+    double       latency = ABT_get_wtime() - req->sent;
+    if (hret == HG_SUCCESS) {
+        stats->completed += 1;
+        stats->latency_sum += latency;
+        if (latency > stats->latency_max) stats->latency_max = latency;
+    } else if (hret == HG_TIMEOUT) {
+        stats->timeouts += 1;
+    } else {
+        stats->errors += 1;
+    }
+    margo_destroy(req->handle);
+    __atomic_fetch_sub(&req->replay->in_flight, 1, __ATOMIC_RELEASE);
+    free(req);
+}
+
+/* Waits until the given time, letting the progress loop run */
+static void wait_until(replay_t* replay, double deadline)
+{
+    double now;
+    while ((now = ABT_get_wtime()) < deadline) {
+        if (deadline - now > 2e-3)
+            margo_thread_sleep(replay->mid, (deadline - now) * 1e3 - 1.0);
+        else
+            ABT_thread_yield();
+    }
+}
+
+static void send_record(replay_t*             replay,
+                        const record_t*       record,
+                        const struct options* opts)
+{
+    rpc_stats_t* stats = &replay->stats[record->stats];
+    if (record->header.flags & MARGO_RPC_CAPTURE_INPUT_TRUNCATED) {
+        stats->skipped += 1;
+        return;
+    }
+    if (__atomic_load_n(&replay->in_flight, __ATOMIC_ACQUIRE)
+        >= opts->max_in_flight) {
+        replay->dropped += 1;
+        return;
+    }
+    request_t* req = (request_t*)calloc(1, sizeof(*req));
+    req->replay    = replay;
+    req->stats     = stats;
+    if (margo_create(replay->mid, replay->addr, stats->id, &req->handle)
+        != HG_SUCCESS) {
+        stats->errors += 1;
+        free(req);
+        return;
+    }
+    replay_input_t in = {.data = record->input,
+                         .size = record->header.stored_size};
+    __atomic_fetch_add(&replay->in_flight, 1, __ATOMIC_RELEASE);
+    stats->sent += 1;
+    stats->input_bytes += record->header.stored_size;
+    stats->response_bytes += record->header.response_size;
+    req->sent        = ABT_get_wtime();
+    hg_return_t hret = margo_provider_cforward_timed(
+        record->header.provider_id, req->handle, &in, opts->timeout_ms,
+        on_complete, req);
+    if (hret != HG_SUCCESS) on_complete(req, hret);
+}
+
+static struct json_object*
+results_to_json(const replay_t* replay, double elapsed, double speedup)
+{
+    struct json_object* output = json_object_new_object();
+    json_object_object_add(output, "records",
+                           json_object_new_uint64(replay->num_records));
+    json_object_object_add(output, "speedup", json_object_new_double(speedup));
+    json_object_object_add(output, "elapsed_sec",
+                           json_object_new_double(elapsed));
+    if (replay->num_records > 1) {
+        double captured
+            = (replay->records[replay->num_records - 1].header.arrival_ns
+               - replay->records[0].header.arrival_ns)
+            * 1e-9;
+        json_object_object_add(output, "captured_sec",
+                               json_object_new_double(captured));
+    }
+    json_object_object_add(output, "dropped",
+                           json_object_new_uint64(replay->dropped));
+    json_object_object_add(
+        output, "unfinished",
+        json_object_new_uint64(__atomic_load_n((uint64_t*)&replay->in_flight,
+                                               __ATOMIC_ACQUIRE)));
+    struct json_object* rpcs = json_object_new_object();
+    for (size_t i = 0; i < replay->num_stats; i++) {
+        const rpc_stats_t*  stats  = &replay->stats[i];
+        struct json_object* result = json_object_new_object();
+        json_object_object_add(result, "sent",
+                               json_object_new_uint64(stats->sent));
+        json_object_object_add(result, "completed",
+                               json_object_new_uint64(stats->completed));
+        json_object_object_add(result, "errors",
+                               json_object_new_uint64(stats->errors));
+        json_object_object_add(result, "timeouts",
+                               json_object_new_uint64(stats->timeouts));
+        json_object_object_add(result, "skipped",
+                               json_object_new_uint64(stats->skipped));
+        json_object_object_add(result, "input_bytes",
+                               json_object_new_uint64(stats->input_bytes));
+        json_object_object_add(result, "recorded_response_bytes",
+                               json_object_new_uint64(stats->response_bytes));
+        if (stats->completed) {
+            json_object_object_add(
+                result, "avg_latency_usec",
+                json_object_new_double(stats->latency_sum / stats->completed
+                                       * 1e6));
+            json_object_object_add(
+                result, "max_latency_usec",
+                json_object_new_double(stats->latency_max * 1e6));
+        }
+        json_object_object_add(rpcs, stats->name, result);
+    }
+    json_object_object_add(output, "rpcs", rpcs);
+    return output;
+}
+
+static struct json_object* run_replay(replay_t*             replay,
+                                      const struct options* opts,
+                                      const char*           config)
+{
+    struct margo_init_info info = {.json_config = config};
+    replay->mid = margo_init_ext(opts->protocol, MARGO_CLIENT_MODE, &info);
+    if (replay->mid == MARGO_INSTANCE_NULL) {
+        fprintf(stderr, "Error: could not initialize margo\n");
+        return NULL;
+    }
+    struct json_object* output = NULL;
+    if (margo_addr_lookup(replay->mid, opts->server_addr, &replay->addr)
+        != HG_SUCCESS) {
+        fprintf(stderr, "Error: could not look up %s\n", opts->server_addr);
+        goto finish;
+    }
+    for (size_t i = 0; i < replay->num_stats; i++)
+        replay->stats[i].id = margo_register_name(
+            replay->mid, replay->stats[i].name, hg_proc_replay_input_t, NULL,
+            NULL);
+
+    double start = ABT_get_wtime();
+    for (size_t i = 0; i < replay->num_records; i++) {
+        const record_t* record = &replay->records[i];
+        if (opts->speedup > 0.0)
+            wait_until(replay,
+                       start
+                           + (record->header.arrival_ns
+                              - replay->records[0].header.arrival_ns)
+                                 * 1e-9 / opts->speedup);
+        send_record(replay, record, opts);
+    }
+    double send_end = ABT_get_wtime();
+
+    /* wait for the RPCs in flight */
+    double drain_timeout = opts->timeout_ms > 0.0
+                             ? opts->timeout_ms * 1e-3 + 1.0
+                             : DRAIN_TIMEOUT_SEC;
+    while (__atomic_load_n(&replay->in_flight, __ATOMIC_ACQUIRE)
+           && ABT_get_wtime() < send_end + drain_timeout)
+        margo_thread_sleep(replay->mid, 1.0);
+
+    output = results_to_json(replay, ABT_get_wtime() - start, opts->speedup);
+
+finish:
+    if (replay->addr != HG_ADDR_NULL)
+        margo_addr_free(replay->mid, replay->addr);
+    margo_finalize(replay->mid);
+    return output;
+}
+
+/* Reads a whole file into a null-terminated string */
+static char* read_file(const char* filename)
+{
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: could not open %s: %s\n", filename,
+                strerror(errno));
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* content = size >= 0 ? calloc((size_t)size + 1, 1) : NULL;
+    if (content && fread(content, 1, (size_t)size, file) != (size_t)size) {
+        free(content);
+        content = NULL;
+    }
+    fclose(file);
+    if (!content) fprintf(stderr, "Error: could not read %s\n", filename);
+    return content;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts = {.speedup       = 1.0,
+                           .timeout_ms    = DEFAULT_TIMEOUT_MS,
+                           .max_in_flight = DEFAULT_MAX_IN_FLIGHT};
+    int            opt;
+    while ((opt = getopt(argc, argv, "a:p:c:s:t:m:o:h")) != -1) {
+        switch (opt) {
+        case 'a':
+            opts.server_addr = optarg;
+            break;
+        case 'p':
+            opts.protocol = optarg;
+            break;
+        case 'c':
+            opts.config_file = optarg;
+            break;
+        case 's':
+            opts.speedup = atof(optarg);
+            break;
+        case 't':
+            opts.timeout_ms = atof(optarg);
+            break;
+        case 'm':
+            opts.max_in_flight = strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            opts.output_file = optarg;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc - 1 || !opts.server_addr || opts.speedup < 0.0) {
+        usage();
+        return -1;
+    }
+    opts.capture_file = argv[optind];
+
+    /* by default, the protocol is the prefix of the address */
+    char protocol[64] = {0};
+    if (!opts.protocol) {
+        const char* sep = strstr(opts.server_addr, "://");
+        size_t      len = sep ? (size_t)(sep - opts.server_addr)
+                              : strlen(opts.server_addr);
+        if (len >= sizeof(protocol)) len = sizeof(protocol) - 1;
+        memcpy(protocol, opts.server_addr, len);
+        opts.protocol = protocol;
+    }
+
+    char* config = NULL;
+    if (opts.config_file && !(config = read_file(opts.config_file)))
+        return -1;
+
+    replay_t replay = {0};
+    int      ret    = -1;
+    if (read_capture(&replay, opts.capture_file)) {
+        qsort(replay.records, replay.num_records, sizeof(record_t),
+              compare_arrivals);
+        struct json_object* output = run_replay(&replay, &opts, config);
+        if (output) {
+            FILE* out
+                = opts.output_file ? fopen(opts.output_file, "w") : stdout;
+            if (out) {
+                fprintf(out, "%s\n",
+                        json_object_to_json_string_ext(
+                            output, JSON_C_TO_STRING_PRETTY
+                                        | JSON_C_TO_STRING_NOSLASHESCAPE));
+                if (out != stdout) fclose(out);
+                ret = 0;
+            } else {
+                fprintf(stderr, "Error: could not open %s: %s\n",
+                        opts.output_file, strerror(errno));
+            }
+            json_object_put(output);
+        }
+    }
+
+    for (size_t i = 0; i < replay.num_records; i++)
+        free(replay.records[i].input);
+    free(replay.records);
+    for (size_t i = 0; i < replay.num_stats; i++) free(replay.stats[i].name);
+    free(replay.stats);
+    free(config);
+    return ret;
+}
@@ -0,0 +1,181 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <abt.h>
+#include <margo.h>
+#include <margo-logging.h>
+#include "margo-rpc-capture.h"
+#include "margo-macros.h"
+#include "margo-id.h"
+
+#define RPC_CAPTURE_DEFAULT_MAX_INPUT (1024 * 1024)
+
+struct margo_rpc_capture {
+    char*            filename;
+    FILE*            file;
+    size_t           max_input_size;
+    double           start; /* ABT_get_wtime() at creation */
+    ABT_mutex_memory mutex; /* protects file */
+};
+
+struct margo_rpc_capture_entry {
+    margo_rpc_capture_t*              capture;
+    const char*                       name; /* owned by the RPC's data */
+    margo_rpc_capture_record_header_t header;
+    void*                             input;
+};
+
+bool __margo_rpc_capture_validate_json(const struct json_object* config)
+{
+    if (!config) return true;
+
+#define HANDLE_CONFIG_ERROR return false
+
+    /* Fields:
+       - [required] filename: string
+       - [optional] max_input_size: integer >= 0 (default 1048576)
+    */
+    if (!json_object_is_type(config, json_type_object)) {
+        margo_error(0,
+                    "\"rpc_capture\" field in configuration "
+                    "should be an object");
+        HANDLE_CONFIG_ERROR;
+    }
+    ASSERT_CONFIG_HAS_REQUIRED(config, "filename", string, "rpc_capture");
+    ASSERT_CONFIG_HAS_OPTIONAL(config, "max_input_size", int, "rpc_capture");
+
+    struct json_object* ignore = NULL;
+    if (CONFIG_HAS(config, "max_input_size", ignore)) {
+        CONFIG_INTEGER_MUST_BE_POSITIVE(config, "max_input_size",
+                                        "rpc_capture.max_input_size");
+    }
+
+    return true;
+#undef HANDLE_CONFIG_ERROR
+}
+
+margo_rpc_capture_t*
+__margo_rpc_capture_create(const struct json_object* config)
+{
+    if (!config) return NULL;
+
+    margo_rpc_capture_t* capture = calloc(1, sizeof(*capture));
+    if (!capture) return NULL;
+
+    const char* filename
+        = json_object_object_get_string_or(config, "filename", "");
+    capture->filename       = strdup(filename);
+    capture->max_input_size = json_object_object_get_uint64_or(
+        config, "max_input_size", RPC_CAPTURE_DEFAULT_MAX_INPUT);
+    capture->start = ABT_get_wtime();
+    capture->file  = fopen(filename, "w");
+    // LCOV_EXCL_START
+    if (!capture->file) {
+        margo_error(0, "in %s: could not open %s", __func__, filename);
+        free(capture->filename);
+        free(capture);
+        return NULL;
+    }
+    // LCOV_EXCL_STOP
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    margo_rpc_capture_file_header_t header = {0};
+    memcpy(header.magic, MARGO_RPC_CAPTURE_MAGIC, sizeof(header.magic));
+    header.version    = MARGO_RPC_CAPTURE_VERSION;
+    header.start_time = now.tv_sec + now.tv_nsec * 1e-9;
+    fwrite(&header, sizeof(header), 1, capture->file);
+    return capture;
+}
+
+struct json_object*
+__margo_rpc_capture_to_json(const margo_rpc_capture_t* capture)
+{
+    int flags = JSON_C_OBJECT_ADD_KEY_IS_NEW | JSON_C_OBJECT_ADD_CONSTANT_KEY;
+    struct json_object* config = json_object_new_object();
+    json_object_object_add_ex(config, "filename",
+                              json_object_new_string(capture->filename), flags);
+    json_object_object_add_ex(config, "max_input_size",
+                              json_object_new_uint64(capture->max_input_size),
+                              flags);
+    return config;
+}
+
+void __margo_rpc_capture_destroy(margo_rpc_capture_t* capture)
+{
+    if (!capture) return;
+    fclose(capture->file);
+    free(capture->filename);
+    free(capture);
+}
+
+margo_rpc_capture_entry_t* __margo_rpc_capture_begin(
+    margo_rpc_capture_t* capture, const char* name, hg_id_t id)
+{
+    margo_rpc_capture_entry_t* entry = calloc(1, sizeof(*entry));
+    if (!entry) return NULL;
+    hg_id_t  base_id;
+    uint16_t provider_id;
+    demux_id(id, &base_id, &provider_id);
+    size_t name_length = name ? strlen(name) : 0;
+    if (name_length > UINT16_MAX) name_length = UINT16_MAX;
+    entry->capture = capture;
+    entry->name    = name;
+    entry->header.arrival_ns
+        = (uint64_t)((ABT_get_wtime() - capture->start) * 1e9);
+    entry->header.flags
+        = MARGO_RPC_CAPTURE_INPUT_UNKNOWN | MARGO_RPC_CAPTURE_NO_RESPONSE;
+    entry->header.provider_id = provider_id;
+    entry->header.name_length = (uint16_t)name_length;
+    return entry;
+}
+
+void __margo_rpc_capture_set_input(margo_rpc_capture_entry_t* entry,
+                                   const void*                input,
+                                   size_t                     size)
+{
+    /* the handler may decode its input more than once */
+    if (!(entry->header.flags & MARGO_RPC_CAPTURE_INPUT_UNKNOWN)) return;
+    entry->header.flags &= ~MARGO_RPC_CAPTURE_INPUT_UNKNOWN;
+    entry->header.input_size = (uint32_t)size;
+    if (size > entry->capture->max_input_size || size > UINT32_MAX) {
+        entry->header.flags |= MARGO_RPC_CAPTURE_INPUT_TRUNCATED;
+        return;
+    }
+    if (!size) return;
+    entry->input = malloc(size);
+    // LCOV_EXCL_START
+    if (!entry->input) {
+        entry->header.flags |= MARGO_RPC_CAPTURE_INPUT_TRUNCATED;
+        return;
+    }
+    // LCOV_EXCL_STOP
+    memcpy(entry->input, input, size);
+    entry->header.stored_size = (uint32_t)size;
+}
+
+void __margo_rpc_capture_set_response(margo_rpc_capture_entry_t* entry,
+                                      size_t                     size)
+{
+    entry->header.flags &= ~MARGO_RPC_CAPTURE_NO_RESPONSE;
+    entry->header.response_size = size;
+}
+
+void __margo_rpc_capture_end(margo_rpc_capture_entry_t* entry)
+{
+    margo_rpc_capture_t* capture = entry->capture;
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&capture->mutex));
+    fwrite(&entry->header, sizeof(entry->header), 1, capture->file);
+    fwrite(entry->name, 1, entry->header.name_length, capture->file);
+    if (entry->header.stored_size)
+        fwrite(entry->input, 1, entry->header.stored_size, capture->file);
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&capture->mutex));
+    free(entry->input);
+    free(entry);
+}
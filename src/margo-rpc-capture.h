@@ -0,0 +1,92 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_RPC_CAPTURE_H
+#define __MARGO_RPC_CAPTURE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <json-c/json.h>
+#include <mercury_types.h>
+
+/* RPC capture
+ * ===========
+ *
+ * When the margo configuration has an "rpc_capture" object, the RPCs
+ * received by the instance are appended to a binary file, so that the
+ * same traffic can later be sent to a test server with margo-replay.
+ * Each record holds the name and provider ID of the RPC, its arrival
+ * time, its serialized input (the bytes decoded by the RPC's input proc
+ * in margo_get_input, without margo's header), and the size of its
+ * serialized response. A record is written when the handle of its RPC
+ * is destroyed, so records are roughly in completion order.
+ *
+ * The "rpc_capture" object may specify:
+ * - filename: file the records are written to (required);
+ * - max_input_size: inputs larger than this number of bytes are recorded
+ *   without their content, and cannot be replayed (default 1 MiB).
+ *
+ * File format (native byte order): a margo_rpc_capture_file_header_t,
+ * then records made of a margo_rpc_capture_record_header_t followed by
+ * the name of the RPC (name_length bytes, not null-terminated) and by
+ * the input (stored_size bytes).
+ */
+#define MARGO_RPC_CAPTURE_MAGIC   "MRGOCAPT"
+#define MARGO_RPC_CAPTURE_VERSION 1
+
+/* the input was not stored (larger than max_input_size) */
+#define MARGO_RPC_CAPTURE_INPUT_TRUNCATED 0x1
+/* margo_get_input was not called by the handler */
+#define MARGO_RPC_CAPTURE_INPUT_UNKNOWN 0x2
+/* no response was sent */
+#define MARGO_RPC_CAPTURE_NO_RESPONSE 0x4
+
+typedef struct margo_rpc_capture_file_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    double   start_time; /* seconds since the Epoch */
+} margo_rpc_capture_file_header_t;
+
+typedef struct margo_rpc_capture_record_header {
+    uint64_t arrival_ns;    /* since start_time */
+    uint64_t response_size; /* serialized response, with margo's header */
+    uint32_t input_size;    /* serialized input */
+    uint32_t flags;         /* MARGO_RPC_CAPTURE_* */
+    uint16_t provider_id;
+    uint16_t name_length;
+    uint32_t stored_size; /* input_size, or 0 if the input was not stored */
+} margo_rpc_capture_record_header_t;
+
+typedef struct margo_rpc_capture       margo_rpc_capture_t;
+typedef struct margo_rpc_capture_entry margo_rpc_capture_entry_t;
+
+bool __margo_rpc_capture_validate_json(const struct json_object* config);
+
+/* Creates the file and writes its header. Returns NULL if config is NULL
+ * or on failure (errors are reported through margo_error). */
+margo_rpc_capture_t*
+__margo_rpc_capture_create(const struct json_object* config);
+
+struct json_object*
+__margo_rpc_capture_to_json(const margo_rpc_capture_t* capture);
+
+void __margo_rpc_capture_destroy(margo_rpc_capture_t* capture);
+
+/* Starts the record of an RPC that just arrived */
+margo_rpc_capture_entry_t* __margo_rpc_capture_begin(
+    margo_rpc_capture_t* capture, const char* name, hg_id_t id);
+
+void __margo_rpc_capture_set_input(margo_rpc_capture_entry_t* entry,
+                                   const void*                input,
+                                   size_t                     size);
+
+void __margo_rpc_capture_set_response(margo_rpc_capture_entry_t* entry,
+                                      size_t                     size);
+
+/* Writes the record and frees the entry */
+void __margo_rpc_capture_end(margo_rpc_capture_entry_t* entry);
+
+#endif
@@ -0,0 +1,351 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include <margo-logging.h>
+#include "margo-rpc-limits.h"
+#include "margo-macros.h"
+#include "margo-instance.h"
+
+bool __margo_rpc_limits_validate_json(const struct json_object* config)
+{
+    if (!config) return true;
+
+#define HANDLE_CONFIG_ERROR return false
+
+    if (!json_object_is_type(config, json_type_array)) {
+        margo_error(0,
+                    "\"rpc_limits\" field in configuration "
+                    "should be an array");
+        HANDLE_CONFIG_ERROR;
+    }
+
+    /* Fields of each entry:
+       - [optional] rpc_name: string
+       - [optional] provider_id: integer in [0, MARGO_MAX_PROVIDER_ID]
+       - [optional] max_concurrent: integer >= 0 (default 0 = unlimited)
+       - [optional] max_queued: integer >= -1 (default -1 = unlimited)
+       - [optional] rate: number >= 0 (default 0 = unlimited)
+       - [optional] burst: number >= 1 (default max(1, rate))
+       At least one of rpc_name and provider_id must be provided.
+    */
+    unsigned            i;
+    struct json_object* entry = NULL;
+    json_array_foreach(config, i, entry)
+    {
+        if (!json_object_is_type(entry, json_type_object)) {
+            margo_error(0, "\"rpc_limits\" entries should be objects");
+            HANDLE_CONFIG_ERROR;
+        }
+        ASSERT_CONFIG_HAS_OPTIONAL(entry, "rpc_name", string, "rpc_limits");
+        ASSERT_CONFIG_HAS_OPTIONAL(entry, "provider_id", int, "rpc_limits");
+        ASSERT_CONFIG_HAS_OPTIONAL(entry, "max_concurrent", int, "rpc_limits");
+        ASSERT_CONFIG_HAS_OPTIONAL(entry, "max_queued", int, "rpc_limits");
+
+        struct json_object* rpc_name
+            = json_object_object_get(entry, "rpc_name");
+        struct json_object* provider_id
+            = json_object_object_get(entry, "provider_id");
+        if (!rpc_name && !provider_id) {
+            margo_error(0,
+                        "\"rpc_limits\" entries should have an \"rpc_name\", "
+                        "a \"provider_id\", or both");
+            HANDLE_CONFIG_ERROR;
+        }
+        if (provider_id) {
+            int64_t id = json_object_get_int64(provider_id);
+            if (id < 0 || id > MARGO_MAX_PROVIDER_ID) {
+                margo_error(0, "Invalid \"provider_id\" (%d) in rpc_limits",
+                            (int)id);
+                HANDLE_CONFIG_ERROR;
+            }
+        }
+        struct json_object* ignore = NULL;
+        if (CONFIG_HAS(entry, "max_concurrent", ignore)) {
+            CONFIG_INTEGER_MUST_BE_POSITIVE(entry, "max_concurrent",
+                                            "rpc_limits[].max_concurrent");
+        }
+        if (CONFIG_HAS(entry, "max_queued", ignore)) {
+            if (json_object_get_int64(ignore) < -1) {
+                margo_error(0, "\"max_queued\" in rpc_limits must be >= -1");
+                HANDLE_CONFIG_ERROR;
+            }
+        }
+        const char* numbers[] = {"rate", "burst"};
+        for (unsigned j = 0; j < 2; j++) {
+            struct json_object* value
+                = json_object_object_get(entry, numbers[j]);
+            if (!value) continue;
+            if (!json_object_is_type(value, json_type_double)
+                && !json_object_is_type(value, json_type_int)) {
+                margo_error(0,
+                            "Invalid type for \"%s\" in rpc_limits "
+                            "configuration (expected number)",
+                            numbers[j]);
+                HANDLE_CONFIG_ERROR;
+            }
+            if (json_object_get_double(value) < 0) {
+                margo_error(0, "\"%s\" in rpc_limits must not be negative",
+                            numbers[j]);
+                HANDLE_CONFIG_ERROR;
+            }
+        }
+    }
+
+    return true;
+#undef HANDLE_CONFIG_ERROR
+}
+
+bool __margo_rpc_limits_init_from_json(const struct json_object* config,
+                                       margo_rpc_limit_t**       limits,
+                                       unsigned*                 num_limits)
+{
+    *limits     = NULL;
+    *num_limits = 0;
+    if (!config || json_object_array_length(config) == 0) return true;
+
+    unsigned count = json_object_array_length(config);
+    *limits        = (margo_rpc_limit_t*)calloc(count, sizeof(**limits));
+    if (!*limits) return false;
+    *num_limits = count;
+
+    unsigned            i;
+    struct json_object* entry = NULL;
+    json_array_foreach(config, i, entry)
+    {
+        margo_rpc_limit_t* limit = &(*limits)[i];
+        const char*        name
+            = json_object_object_get_string_or(entry, "rpc_name", NULL);
+        limit->rpc_name = name ? strdup(name) : NULL;
+        limit->provider_id
+            = json_object_object_get_int_or(entry, "provider_id", -1);
+        limit->max_concurrent
+            = json_object_object_get_int_or(entry, "max_concurrent", 0);
+        limit->max_queued
+            = json_object_object_get_int_or(entry, "max_queued", -1);
+        struct json_object* rate  = json_object_object_get(entry, "rate");
+        struct json_object* burst = json_object_object_get(entry, "burst");
+        limit->rate = rate ? json_object_get_double(rate) : 0.0;
+        if (burst)
+            limit->burst = json_object_get_double(burst);
+        else
+            limit->burst = limit->rate > 1.0 ? limit->rate : 1.0;
+        if (limit->burst < 1.0) limit->burst = 1.0;
+        limit->tokens      = limit->burst;
+        limit->last_refill = ABT_get_wtime();
+    }
+    return true;
+}
+
+struct json_object* __margo_rpc_limits_to_json(const margo_rpc_limit_t* limits,
+                                               unsigned num_limits)
+{
+    int flags = JSON_C_OBJECT_ADD_KEY_IS_NEW | JSON_C_OBJECT_ADD_CONSTANT_KEY;
+    struct json_object* array = json_object_new_array_ext(num_limits);
+    for (unsigned i = 0; i < num_limits; i++) {
+        const margo_rpc_limit_t* limit = &limits[i];
+        struct json_object*      entry = json_object_new_object();
+        if (limit->rpc_name)
+            json_object_object_add_ex(
+                entry, "rpc_name", json_object_new_string(limit->rpc_name),
+                flags);
+        if (limit->provider_id >= 0)
+            json_object_object_add_ex(
+                entry, "provider_id", json_object_new_int(limit->provider_id),
+                flags);
+        json_object_object_add_ex(entry, "max_concurrent",
+                                  json_object_new_int(limit->max_concurrent),
+                                  flags);
+        json_object_object_add_ex(entry, "max_queued",
+                                  json_object_new_int(limit->max_queued),
+                                  flags);
+        json_object_object_add_ex(entry, "rate",
+                                  json_object_new_double(limit->rate), flags);
+        json_object_object_add_ex(entry, "burst",
+                                  json_object_new_double(limit->burst), flags);
+        json_object_array_add(array, entry);
+    }
+    return array;
+}
+
+void __margo_rpc_limits_destroy(margo_rpc_limit_t* limits, unsigned num_limits)
+{
+    if (!limits) return;
+    for (unsigned i = 0; i < num_limits; i++) free(limits[i].rpc_name);
+    free(limits);
+}
+
+margo_rpc_limit_t* __margo_rpc_limits_find(margo_rpc_limit_t* limits,
+                                           unsigned           num_limits,
+                                           const char*        rpc_name,
+                                           uint16_t           provider_id)
+{
+    margo_rpc_limit_t* best       = NULL;
+    int                best_score = 0;
+    for (unsigned i = 0; i < num_limits; i++) {
+        margo_rpc_limit_t* limit = &limits[i];
+        int                score = 0;
+        if (limit->rpc_name) {
+            if (!rpc_name || strcmp(limit->rpc_name, rpc_name) != 0) continue;
+            score += 2;
+        }
+        if (limit->provider_id >= 0) {
+            if (limit->provider_id != provider_id) continue;
+            score += 1;
+        }
+        if (score > best_score) {
+            best       = limit;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+static inline void refill_tokens(margo_rpc_limit_t* limit, double now)
+{
+    if (limit->rate <= 0.0) return;
+    limit->tokens += (now - limit->last_refill) * limit->rate;
+    if (limit->tokens > limit->burst) limit->tokens = limit->burst;
+    limit->last_refill = now;
+}
+
+static inline bool has_capacity(const margo_rpc_limit_t* limit)
+{
+    return (limit->max_concurrent == 0 || limit->active < limit->max_concurrent)
+        && (limit->rate <= 0.0 || limit->tokens >= 1.0);
+}
+
+bool __margo_rpc_limit_acquire(margo_instance_id  mid,
+                               margo_rpc_limit_t* limit,
+                               bool               can_block)
+{
+    ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&limit->mutex);
+
+    ABT_mutex_spinlock(mutex);
+    refill_tokens(limit, ABT_get_wtime());
+
+    /* new arrivals queue behind the handlers already waiting */
+    if (limit->queued || !has_capacity(limit)) {
+        if (!can_block
+            || (limit->max_queued >= 0
+                && limit->queued >= (uint32_t)limit->max_queued)) {
+            limit->num_rejected += 1;
+            ABT_mutex_unlock(mutex);
+            return false;
+        }
+        margo_rpc_limit_waiter_t waiter;
+        memset(&waiter, 0, sizeof(waiter));
+        ABT_cond cond = ABT_COND_MEMORY_GET_HANDLE(&waiter.cond);
+        if (limit->last_waiter)
+            limit->last_waiter->next = &waiter;
+        else
+            limit->first_waiter = &waiter;
+        limit->last_waiter = &waiter;
+        limit->queued += 1;
+        if (limit->queued > limit->max_queued_seen)
+            limit->max_queued_seen = limit->queued;
+
+        /* only the first waiter may be admitted; it sleeps while the
+         * bucket refills, the others wait for their turn or a slot */
+        while (limit->first_waiter != &waiter || !has_capacity(limit)) {
+            if (limit->first_waiter != &waiter
+                || (limit->max_concurrent
+                    && limit->active >= limit->max_concurrent)) {
+                ABT_cond_wait(cond, mutex);
+            } else {
+                double wait_ms = (1.0 - limit->tokens) / limit->rate * 1000.0;
+                ABT_mutex_unlock(mutex);
+                margo_thread_sleep(mid, wait_ms);
+                ABT_mutex_spinlock(mutex);
+            }
+            refill_tokens(limit, ABT_get_wtime());
+        }
+
+        limit->first_waiter = waiter.next;
+        if (!limit->first_waiter) limit->last_waiter = NULL;
+        limit->queued -= 1;
+        limit->num_delayed += 1;
+        /* the next waiter may be admitted as well */
+        if (limit->first_waiter)
+            ABT_cond_signal(
+                ABT_COND_MEMORY_GET_HANDLE(&limit->first_waiter->cond));
+    }
+
+    if (limit->rate > 0.0) limit->tokens -= 1.0;
+    limit->active += 1;
+    if (limit->active > limit->max_active_seen)
+        limit->max_active_seen = limit->active;
+    limit->num_admitted += 1;
+    ABT_mutex_unlock(mutex);
+    return true;
+}
+
+void __margo_rpc_limit_release(margo_rpc_limit_t* limit)
+{
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&limit->mutex));
+    limit->active -= 1;
+    /* only the first waiter may proceed, the others are woken up in
+     * turn as the ones before them are admitted */
+    if (limit->first_waiter)
+        ABT_cond_signal(ABT_COND_MEMORY_GET_HANDLE(&limit->first_waiter->cond));
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&limit->mutex));
+}
+
+struct json_object*
+__margo_rpc_limits_usage_to_json(margo_rpc_limit_t* limits,
+                                 unsigned           num_limits,
+                                 bool               reset)
+{
+    struct json_object* array = json_object_new_array_ext(num_limits);
+    for (unsigned i = 0; i < num_limits; i++) {
+        margo_rpc_limit_t*  limit = &limits[i];
+        struct json_object* entry = json_object_new_object();
+        if (limit->rpc_name)
+            json_object_object_add_ex(entry, "rpc_name",
+                                      json_object_new_string(limit->rpc_name),
+                                      JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        if (limit->provider_id >= 0)
+            json_object_object_add_ex(entry, "provider_id",
+                                      json_object_new_int(limit->provider_id),
+                                      JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&limit->mutex));
+        refill_tokens(limit, ABT_get_wtime());
+        json_object_object_add_ex(entry, "active",
+                                  json_object_new_uint64(limit->active),
+                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(entry, "queued",
+                                  json_object_new_uint64(limit->queued),
+                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        if (limit->rate > 0.0)
+            json_object_object_add_ex(entry, "tokens",
+                                      json_object_new_double(limit->tokens),
+                                      JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(
+            entry, "max_active", json_object_new_uint64(limit->max_active_seen),
+            JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(
+            entry, "max_queued", json_object_new_uint64(limit->max_queued_seen),
+            JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(entry, "num_admitted",
+                                  json_object_new_uint64(limit->num_admitted),
+                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(entry, "num_delayed",
+                                  json_object_new_uint64(limit->num_delayed),
+                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        json_object_object_add_ex(entry, "num_rejected",
+                                  json_object_new_uint64(limit->num_rejected),
+                                  JSON_C_OBJECT_ADD_KEY_IS_NEW);
+        if (reset) {
+            limit->max_active_seen = limit->active;
+            limit->max_queued_seen = limit->queued;
+            limit->num_admitted    = 0;
+            limit->num_delayed     = 0;
+            limit->num_rejected    = 0;
+        }
+        ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&limit->mutex));
+        json_object_array_add(array, entry);
+    }
+    return array;
+}
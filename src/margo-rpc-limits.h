@@ -0,0 +1,108 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_RPC_LIMITS_H
+#define __MARGO_RPC_LIMITS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <abt.h>
+#include <json-c/json.h>
+#include "margo.h"
+
+/* RPC admission limits
+ * ====================
+ *
+ * The "rpc_limits" array of the margo configuration declares limits
+ * that are enforced before an RPC handler's ULT calls the user function.
+ * Each entry matches RPCs by name, by provider id, or by both, and
+ * the most specific matching entry is associated with the RPC when it
+ * is registered (name + provider > name only > provider only).
+ * All the RPCs associated with the same entry share its counters, so
+ * an entry with only a provider_id limits the provider as a whole.
+ *
+ * An entry may specify:
+ * - max_concurrent: maximum number of handlers running concurrently
+ *   (0 means unlimited);
+ * - max_queued: maximum number of handlers waiting for admission
+ *   (-1 means unlimited, 0 means RPCs are rejected right away when
+ *   they cannot be admitted);
+ * - rate: token-bucket refill rate, in RPCs per second (0 means
+ *   unlimited);
+ * - burst: token-bucket capacity (defaults to max(1, rate)).
+ *
+ * Handlers that cannot be admitted are suspended (they do not occupy
+ * their execution stream) until a slot and a token become available.
+ * They are admitted in FIFO order: a handler that arrives while others
+ * are waiting queues behind them, even if a slot and a token happen to
+ * be available, so that waiters cannot be starved by new arrivals.
+ * Handlers that would exceed max_queued are answered with HG_BUSY,
+ * as are handlers registered with an inline or tasklet execution mode
+ * that cannot be admitted right away, since they cannot be suspended.
+ */
+/* Handler waiting for admission, in the FIFO queue of its limit. Each
+ * waiter sleeps on its own condition, so that a release only wakes up
+ * the first one. */
+typedef struct margo_rpc_limit_waiter {
+    ABT_cond_memory                cond;
+    struct margo_rpc_limit_waiter* next;
+} margo_rpc_limit_waiter_t;
+
+typedef struct margo_rpc_limit {
+    char*    rpc_name;       /* NULL if the entry matches any name */
+    int32_t  provider_id;    /* -1 if the entry matches any provider */
+    uint32_t max_concurrent; /* 0 = unlimited */
+    int32_t  max_queued;     /* -1 = unlimited */
+    double   rate;           /* tokens per second, 0 = unlimited */
+    double   burst;          /* capacity of the token bucket */
+    /* runtime state, protected by mutex */
+    ABT_mutex_memory          mutex;
+    double                    tokens;
+    double                    last_refill;
+    uint32_t                  active;
+    uint32_t                  queued;
+    margo_rpc_limit_waiter_t* first_waiter;
+    margo_rpc_limit_waiter_t* last_waiter;
+    uint32_t                  max_active_seen;
+    uint32_t                  max_queued_seen;
+    uint64_t                  num_admitted;
+    uint64_t                  num_delayed;
+    uint64_t                  num_rejected;
+} margo_rpc_limit_t;
+
+bool __margo_rpc_limits_validate_json(const struct json_object* config);
+
+bool __margo_rpc_limits_init_from_json(const struct json_object* config,
+                                       margo_rpc_limit_t**       limits,
+                                       unsigned*                 num_limits);
+
+struct json_object* __margo_rpc_limits_to_json(const margo_rpc_limit_t* limits,
+                                               unsigned num_limits);
+
+void __margo_rpc_limits_destroy(margo_rpc_limit_t* limits, unsigned num_limits);
+
+/* Find the most specific limit applying to the given RPC, or NULL */
+margo_rpc_limit_t* __margo_rpc_limits_find(margo_rpc_limit_t* limits,
+                                           unsigned           num_limits,
+                                           const char*        rpc_name,
+                                           uint16_t           provider_id);
+
+/* Wait until the RPC can be admitted. Returns false if the RPC
+ * should be rejected because too many RPCs are already waiting,
+ * or if it cannot be admitted right away and can_block is false
+ * (handlers that do not run in their own ULT). */
+bool __margo_rpc_limit_acquire(margo_instance_id  mid,
+                               margo_rpc_limit_t* limit,
+                               bool               can_block);
+
+/* Release a slot acquired with __margo_rpc_limit_acquire */
+void __margo_rpc_limit_release(margo_rpc_limit_t* limit);
+
+/* Current usage of the limits, used by the default monitor */
+struct json_object*
+__margo_rpc_limits_usage_to_json(margo_rpc_limit_t* limits,
+                                 unsigned           num_limits,
+                                 bool               reset);
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <margo-logging.h>
+#include "margo-rpc-workers.h"
+
+static void rpc_worker_fn(void* args)
+{
+    margo_rpc_workers_t* w     = (margo_rpc_workers_t*)args;
+    ABT_mutex            mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&w->mutex);
+    ABT_cond             cond  = ABT_COND_MEMORY_GET_HANDLE(&w->cond);
+
+    ABT_mutex_spinlock(mutex);
+    while (true) {
+        while (w->queue_size == 0 && !w->stopped) ABT_cond_wait(cond, mutex);
+        /* pending work is drained before stopping */
+        if (w->queue_size == 0) break;
+        margo_rpc_work_t work = w->queue[w->queue_head];
+        w->queue_head         = (w->queue_head + 1) % w->max_workers;
+        w->queue_size -= 1;
+        w->num_idle -= 1;
+        ABT_mutex_unlock(mutex);
+
+        work.fn(work.arg);
+
+        ABT_mutex_spinlock(mutex);
+        w->num_idle += 1;
+    }
+    ABT_mutex_unlock(mutex);
+}
+
+/* must be called with the mutex held */
+static bool spawn_worker(margo_rpc_workers_t* w)
+{
+    if (w->num_workers == w->max_workers) return false;
+    int ret = ABT_thread_create(w->pool, rpc_worker_fn, w, w->attr,
+                                &w->threads[w->num_workers]);
+    if (ret != ABT_SUCCESS) {
+        // LCOV_EXCL_START
+        margo_error(0, "in %s: ABT_thread_create failed (ret = %d)", __func__,
+                    ret);
+        return false;
+        // LCOV_EXCL_END
+    }
+    w->num_workers += 1;
+    w->num_idle += 1;
+    return true;
+}
+
+/* must be called with the mutex held */
+static void start_workers(margo_rpc_workers_t* w)
+{
+    w->started = true;
+    while (w->num_workers < w->min_workers) {
+        if (!spawn_worker(w)) break;
+    }
+}
+
+margo_rpc_workers_t* __margo_rpc_workers_create(ABT_pool        pool,
+                                                ABT_thread_attr attr,
+                                                uint32_t        min_workers,
+                                                uint32_t        max_workers)
+{
+    if (max_workers < min_workers) max_workers = min_workers;
+    if (max_workers == 0) return NULL;
+    margo_rpc_workers_t* w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->pool        = pool;
+    w->attr        = attr;
+    w->min_workers = min_workers;
+    w->max_workers = max_workers;
+    w->threads     = calloc(max_workers, sizeof(*w->threads));
+    w->queue       = calloc(max_workers, sizeof(*w->queue));
+    if (!w->threads || !w->queue) {
+        // LCOV_EXCL_START
+        __margo_rpc_workers_free(w);
+        return NULL;
+        // LCOV_EXCL_END
+    }
+    return w;
+}
+
+void __margo_rpc_workers_start(margo_rpc_workers_t* w)
+{
+    if (!w) return;
+    ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&w->mutex);
+    ABT_mutex_spinlock(mutex);
+    if (!w->started && !w->stopped) start_workers(w);
+    ABT_mutex_unlock(mutex);
+}
+
+bool __margo_rpc_workers_dispatch(margo_rpc_workers_t* w,
+                                  void (*fn)(void*),
+                                  void* arg)
+{
+    ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&w->mutex);
+    ABT_mutex_spinlock(mutex);
+    if (w->stopped) goto fallback;
+    if (!w->started) start_workers(w);
+    /* every queued entry must be matched by an idle worker */
+    if (w->queue_size >= w->num_idle && !spawn_worker(w)) goto fallback;
+    uint32_t tail  = (w->queue_head + w->queue_size) % w->max_workers;
+    w->queue[tail] = (margo_rpc_work_t){.fn = fn, .arg = arg};
+    w->queue_size += 1;
+    ABT_cond_signal(ABT_COND_MEMORY_GET_HANDLE(&w->cond));
+    ABT_mutex_unlock(mutex);
+    return true;
+
+fallback:
+    ABT_mutex_unlock(mutex);
+    return false;
+}
+
+void __margo_rpc_workers_stop(margo_rpc_workers_t* w)
+{
+    if (!w) return;
+    ABT_mutex mutex = ABT_MUTEX_MEMORY_GET_HANDLE(&w->mutex);
+    ABT_mutex_spinlock(mutex);
+    if (w->stopped) {
+        ABT_mutex_unlock(mutex);
+        return;
+    }
+    w->stopped = true;
+    ABT_cond_broadcast(ABT_COND_MEMORY_GET_HANDLE(&w->cond));
+    ABT_mutex_unlock(mutex);
+    /* no worker can be spawned once stopped is set */
+    for (uint32_t i = 0; i < w->num_workers; i++) {
+        ABT_thread_free(&w->threads[i]);
+    }
+}
+
+void __margo_rpc_workers_free(margo_rpc_workers_t* w)
+{
+    if (!w) return;
+    __margo_rpc_workers_stop(w);
+    free(w->threads);
+    free(w->queue);
+    free(w);
+}
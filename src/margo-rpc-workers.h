@@ -0,0 +1,77 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_RPC_WORKERS_H
+#define __MARGO_RPC_WORKERS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <abt.h>
+
+/* Persistent RPC handler ULTs
+ * ===========================
+ *
+ * A pool configured with "rpc_workers": N gets N long-lived ULTs that
+ * execute the handlers of the RPCs associated with the pool, instead of
+ * a ULT being created (and its stack allocated) for each request.
+ * Handles are passed to the workers through a ring buffer that never
+ * holds more entries than there are idle workers.
+ *
+ * When all the workers are busy (e.g. blocked in nested RPCs), a new
+ * worker is spawned, up to "max_rpc_workers" (which defaults to N).
+ * Beyond that, requests fall back to the usual ULT-per-RPC dispatch,
+ * so a handler never waits for a worker to become available and
+ * nested RPCs cannot deadlock.
+ *
+ * The workers are created with the pool's "thread_stacksize", if any,
+ * so they also act as a cache of stacks of that size.
+ *
+ * The workers are started by margo_init (or on the first dispatch for
+ * pools added later) and stopped when the last xstream executing their
+ * pool is destroyed.
+ */
+typedef struct margo_rpc_work {
+    void (*fn)(void*);
+    void* arg;
+} margo_rpc_work_t;
+
+typedef struct margo_rpc_workers {
+    ABT_pool          pool;
+    ABT_thread_attr   attr; /* attribute of the pool, not owned */
+    uint32_t          min_workers;
+    uint32_t          max_workers;
+    /* runtime state, protected by mutex */
+    ABT_mutex_memory  mutex;
+    ABT_cond_memory   cond;
+    bool              started;
+    bool              stopped;
+    uint32_t          num_workers;
+    uint32_t          num_idle;
+    ABT_thread*       threads;    /* max_workers entries */
+    margo_rpc_work_t* queue;      /* ring buffer of max_workers entries */
+    uint32_t          queue_head;
+    uint32_t          queue_size;
+} margo_rpc_workers_t;
+
+margo_rpc_workers_t* __margo_rpc_workers_create(ABT_pool        pool,
+                                                ABT_thread_attr attr,
+                                                uint32_t        min_workers,
+                                                uint32_t        max_workers);
+
+/* Spawn the initial workers, if not already done */
+void __margo_rpc_workers_start(margo_rpc_workers_t* workers);
+
+/* Hand fn(arg) to a worker. Returns false if no worker can take it,
+ * in which case the caller should create a ULT. */
+bool __margo_rpc_workers_dispatch(margo_rpc_workers_t* workers,
+                                  void (*fn)(void*),
+                                  void* arg);
+
+/* Wait for the workers to complete their current work and terminate.
+ * Must not be called from a worker. */
+void __margo_rpc_workers_stop(margo_rpc_workers_t* workers);
+
+void __margo_rpc_workers_free(margo_rpc_workers_t* workers);
+
+#endif
@@ -29,6 +29,26 @@
 // that prevented the RPC from running. It allows to not care about the
 // semantics of the user-provided data, since any value other than HG_SUCCESS
 // will make serialization stop at the error code.
+//
+// The header of an RPC is followed by the trace context of the RPC if its
+// parent RPC id has the MARGO_HEADER_HAS_TRACE_CONTEXT bit set. This bit is
+// never set in the ids generated by gen_id (see margo-id.h), so the header
+// of RPCs that are not traced is the same as in previous versions of margo
+// and remains compatible with them. A peer running such a version would
+// however read the trace context of a traced RPC as user input, so traced
+// RPCs must only be sent to peers that support trace contexts.
+//
+// When the RPC capture is enabled (see margo-rpc-capture.h), the bytes
+// decoded by the user-provided input callback and the size of the encoded
+// response are added to the record of the received RPC.
+
+/* gen_id uses bits 0-15 and 32-63 with Mercury 2.3.0 and above, and bits
+ * 0-31 with older versions */
+#if (HG_VERSION_MAJOR > 2) || (HG_VERSION_MAJOR == 2 && HG_VERSION_MINOR >= 3)
+    #define MARGO_HEADER_HAS_TRACE_CONTEXT ((hg_id_t)1 << 31)
+#else
+    #define MARGO_HEADER_HAS_TRACE_CONTEXT ((hg_id_t)1 << 63)
+#endif
 
 typedef struct margo_forward_proc_args {
     hg_handle_t   handle;
@@ -38,6 +58,7 @@ typedef struct margo_forward_proc_args {
     struct {
         hg_id_t parent_rpc_id;
     } header;
+    margo_trace_context_t trace_context;
 } * margo_forward_proc_args_t;
 
 typedef struct margo_respond_proc_args {
@@ -61,7 +82,8 @@ static inline hg_return_t margo_forward_proc(hg_proc_t proc, void* args)
      * not in margo_get_input or margo_free_input, so if it set we
      * know we are encoding the input (set_input) and should monitor.
      */
-    if (sargs->request) mid = sargs->request->mid;
+    if (sargs->request && !sargs->request->monitoring_skip)
+        mid = sargs->request->mid;
     struct margo_monitor_set_input_args monitoring_args
         = {.handle  = sargs->handle,
            .request = sargs->request,
@@ -73,8 +95,23 @@ static inline hg_return_t margo_forward_proc(hg_proc_t proc, void* args)
 
     hret = hg_proc_memcpy(proc, (void*)(&sargs->header), sizeof(sargs->header));
     if (hret != HG_SUCCESS) goto finish;
+    if (sargs->header.parent_rpc_id & MARGO_HEADER_HAS_TRACE_CONTEXT) {
+        hret = hg_proc_memcpy(proc, (void*)(&sargs->trace_context),
+                              sizeof(sargs->trace_context));
+        if (hret != HG_SUCCESS) goto finish;
+    }
     if (sargs && sargs->user_cb) {
-        hret = sargs->user_cb(proc, sargs->user_args);
+        margo_rpc_capture_entry_t* capture = NULL;
+        if (hg_proc_get_op(proc) == HG_DECODE) {
+            struct margo_handle_data* handle_data = HG_Get_data(sargs->handle);
+            if (handle_data) capture = handle_data->capture;
+        }
+        /* the input is contiguous when decoding */
+        char* input = capture ? (char*)hg_proc_save_ptr(proc, 0) : NULL;
+        hret        = sargs->user_cb(proc, sargs->user_args);
+        if (capture && hret == HG_SUCCESS)
+            __margo_rpc_capture_set_input(
+                capture, input, (char*)hg_proc_save_ptr(proc, 0) - input);
         goto finish;
     }
 
@@ -100,7 +137,8 @@ static inline hg_return_t margo_respond_proc(hg_proc_t proc, void* args)
      * margo_get_output or margo_free_output, so if it set we know
      * we are encoding the output (set_output) and should monitor.
      */
-    if (sargs->request) mid = sargs->request->mid;
+    if (sargs->request && !sargs->request->monitoring_skip)
+        mid = sargs->request->mid;
     struct margo_monitor_set_output_args monitoring_args
         = {.handle  = sargs->handle,
            .request = sargs->request,
@@ -119,6 +157,15 @@ static inline hg_return_t margo_respond_proc(hg_proc_t proc, void* args)
 
 finish:
 
+    /* RPC capture */
+    if (sargs->request && sargs->request->mid->rpc_capture
+        && hret == HG_SUCCESS) {
+        struct margo_handle_data* handle_data = HG_Get_data(sargs->handle);
+        if (handle_data && handle_data->capture)
+            __margo_rpc_capture_set_response(handle_data->capture,
+                                             hg_proc_get_size_used(proc));
+    }
+
     /* monitoring */
     monitoring_args.ret = hret;
     if (sargs->user_cb) {
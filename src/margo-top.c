@@ -0,0 +1,233 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <margo.h>
+
+#include "margo-metrics.h"
+
+/* Displays the metrics segments published by margo processes (see the
+ * "metrics" configuration of the default monitor), refreshing them
+ * periodically. Reading a segment takes no lock and does not involve
+ * the process publishing it. The latency quantiles are only available
+ * if the monitor keeps histograms ("statistics.percentiles"), and are
+ * shown as 0 otherwise. */
+
+#define READ_ATTEMPTS 100
+
+typedef struct process {
+    const char*              filename;
+    margo_metrics_segment_t* segment;  /* mapping of the file, or NULL */
+    margo_metrics_segment_t* current;  /* last consistent copy */
+    margo_metrics_segment_t* previous; /* copy before it, for rates */
+    bool                     has_previous;
+} process_t;
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: margo-top [-i <seconds>] [-n <iterations>] "
+                    "<metrics file> [<metrics file> ...]\n");
+    fprintf(stderr,
+            "   Displays the metrics published by margo processes every\n"
+            "   <seconds> seconds (default 1), <iterations> times (default\n"
+            "   unlimited).\n");
+}
+
+static bool process_map(process_t* p)
+{
+    int fd = open(p->filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0
+        || (size_t)st.st_size < sizeof(margo_metrics_segment_t)) {
+        close(fd);
+        return false;
+    }
+    void* region = mmap(NULL, sizeof(margo_metrics_segment_t), PROT_READ,
+                        MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) return false;
+    p->segment = (margo_metrics_segment_t*)region;
+    return true;
+}
+
+static void process_unmap(process_t* p)
+{
+    if (p->segment) munmap(p->segment, sizeof(*p->segment));
+    p->segment      = NULL;
+    p->has_previous = false;
+}
+
+/* Value (in microseconds) below which a fraction q of the samples are,
+ * taken in the middle of its power-of-two bucket */
+static double hist_quantile(const uint64_t* hist, double q)
+{
+    uint64_t total = 0;
+    for (unsigned i = 0; i < MARGO_METRICS_HIST_BUCKETS; i++)
+        total += hist[i];
+    if (!total) return 0.0;
+    uint64_t rank = (uint64_t)(q * (double)total);
+    if (rank >= total) rank = total - 1;
+    uint64_t count = 0;
+    unsigned i     = 0;
+    for (; i < MARGO_METRICS_HIST_BUCKETS - 1; i++) {
+        count += hist[i];
+        if (count > rank) break;
+    }
+    return 1.5 * (double)(1ULL << i) * 1e-3;
+}
+
+static const margo_metrics_rpc_t* find_rpc(const margo_metrics_segment_t* s,
+                                           uint64_t                       id)
+{
+    for (uint32_t i = 0; i < s->num_rpcs; i++)
+        if (s->rpcs[i].id == id) return &s->rpcs[i];
+    return NULL;
+}
+
+static double rate(uint64_t current, uint64_t previous, double elapsed)
+{
+    /* counters may have been reset by a dump */
+    if (elapsed <= 0.0 || current < previous) return 0.0;
+    return (double)(current - previous) / elapsed;
+}
+
+static void process_display(process_t* p, double now)
+{
+    if (!p->segment && !process_map(p)) {
+        printf("%s: not available\n\n", p->filename);
+        return;
+    }
+    margo_metrics_segment_t* tmp = p->previous;
+    p->previous                  = p->current;
+    p->current                   = tmp;
+    if (!__margo_metrics_read(p->segment, p->current, READ_ATTEMPTS)) {
+        /* the process may have restarted with a new file */
+        tmp         = p->previous;
+        p->previous = p->current;
+        p->current  = tmp;
+        process_unmap(p);
+        printf("%s: not available\n\n", p->filename);
+        return;
+    }
+    const margo_metrics_segment_t* s    = p->current;
+    const margo_metrics_segment_t* prev = NULL;
+    if (p->has_previous && p->previous->pid == s->pid) prev = p->previous;
+    double elapsed  = prev ? s->update_time - prev->update_time : 0.0;
+    p->has_previous = true;
+
+    printf("pid %" PRId64 "  %s  (updated %.1fs ago)\n", s->pid, s->address,
+           now - s->update_time);
+    printf("progress: %" PRIu64 " (%.1f/s)  trigger: %" PRIu64
+           " (%.1f/s)  in flight: %" PRIu64 " sent, %" PRIu64
+           " received  handle cache: %" PRIu64 "/%" PRIu64 "\n",
+           s->progress_calls,
+           rate(s->progress_calls, prev ? prev->progress_calls : 0, elapsed),
+           s->trigger_calls,
+           rate(s->trigger_calls, prev ? prev->trigger_calls : 0, elapsed),
+           s->origin_rpcs_in_flight, s->target_rpcs_in_flight,
+           s->handle_cache_used, s->handle_cache_size);
+    if (s->sample_rpcs_every > 1)
+        printf("(RPC counts are sampled 1 in %" PRIu64 ")\n",
+               s->sample_rpcs_every);
+
+    printf("\n%-32s %10s %10s\n", "POOL", "SIZE", "TOTAL");
+    for (uint32_t i = 0; i < s->num_pools; i++)
+        printf("%-32s %10" PRIu64 " %10" PRIu64 "\n", s->pools[i].name,
+               s->pools[i].size, s->pools[i].total_size);
+
+    printf("\n%-24s %8s %10s %9s %9s %9s %10s %9s %9s %9s\n", "RPC",
+           "PROVIDER", "SENT", "SENT/s", "p50(us)", "p99(us)", "RECEIVED",
+           "RECV/s", "p50(us)", "p99(us)");
+    for (uint32_t i = 0; i < s->num_rpcs; i++) {
+        const margo_metrics_rpc_t* rpc = &s->rpcs[i];
+        const margo_metrics_rpc_t* old = prev ? find_rpc(prev, rpc->id) : NULL;
+        uint16_t provider_id = (uint16_t)(rpc->id & MARGO_MAX_PROVIDER_ID);
+        char     provider[8] = "-";
+        if (provider_id != MARGO_MAX_PROVIDER_ID)
+            snprintf(provider, sizeof(provider), "%u", provider_id);
+        printf("%-24.24s %8s %10" PRIu64 " %9.1f %9.1f %9.1f %10" PRIu64
+               " %9.1f %9.1f %9.1f\n",
+               rpc->name[0] ? rpc->name : "<unknown>", provider,
+               rpc->origin_count,
+               rate(rpc->origin_count, old ? old->origin_count : 0, elapsed),
+               hist_quantile(rpc->origin_hist, 0.5),
+               hist_quantile(rpc->origin_hist, 0.99), rpc->target_count,
+               rate(rpc->target_count, old ? old->target_count : 0, elapsed),
+               hist_quantile(rpc->target_hist, 0.5),
+               hist_quantile(rpc->target_hist, 0.99));
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    double interval   = 1.0;
+    long   iterations = -1;
+    int    opt;
+    while ((opt = getopt(argc, argv, "i:n:h")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval = atof(optarg);
+            break;
+        case 'n':
+            iterations = atol(optarg);
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (optind >= argc || interval <= 0.0) {
+        usage();
+        return -1;
+    }
+
+    size_t     num_processes = (size_t)(argc - optind);
+    process_t* processes     = calloc(num_processes, sizeof(*processes));
+    for (size_t i = 0; i < num_processes; i++) {
+        processes[i].filename = argv[optind + i];
+        processes[i].current  = malloc(sizeof(margo_metrics_segment_t));
+        processes[i].previous = malloc(sizeof(margo_metrics_segment_t));
+        if (!processes[i].current || !processes[i].previous) {
+            fprintf(stderr, "Error: could not allocate memory\n");
+            return -1;
+        }
+    }
+
+    bool tty = isatty(STDOUT_FILENO);
+    for (long n = 0; iterations < 0 || n < iterations; n++) {
+        if (n > 0) {
+            struct timespec delay;
+            delay.tv_sec  = (time_t)interval;
+            delay.tv_nsec = (long)((interval - (double)delay.tv_sec) * 1e9);
+            nanosleep(&delay, NULL);
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        /* clear the screen */
+        if (tty) printf("\033[H\033[2J");
+        for (size_t i = 0; i < num_processes; i++)
+            process_display(&processes[i], now.tv_sec + now.tv_nsec * 1e-9);
+        fflush(stdout);
+    }
+
+    for (size_t i = 0; i < num_processes; i++) {
+        process_unmap(&processes[i]);
+        free(processes[i].current);
+        free(processes[i].previous);
+    }
+    free(processes);
+    return 0;
+}
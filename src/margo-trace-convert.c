@@ -0,0 +1,91 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "margo-trace.h"
+
+/* Converts a binary trace written by margo_trace_monitor into the
+ * Chrome/Perfetto trace event JSON format, which can be opened with
+ * chrome://tracing or https://ui.perfetto.dev. */
+
+/* Size of the chunks of JSON written at once into the output */
+#define CONVERT_CHUNK_SIZE (64 * 1024)
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: margo-trace-convert <trace file> [output file]\n");
+    fprintf(stderr,
+            "   Writes the trace as Chrome/Perfetto JSON into the output\n"
+            "   file, or on the standard output if none is given.\n");
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 3 || strcmp(argv[1], "-h") == 0) {
+        usage();
+        return argc == 2 ? 0 : -1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: could not open %s: %s\n", argv[1],
+                strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: could not read %s\n", argv[1]);
+        close(fd);
+        return -1;
+    }
+    size_t size   = (size_t)st.st_size;
+    void*  region = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        fprintf(stderr, "Error: could not map %s: %s\n", argv[1],
+                strerror(errno));
+        return -1;
+    }
+    const margo_trace_header_t* trace = (const margo_trace_header_t*)region;
+    if (!__margo_trace_check(trace, size)) {
+        fprintf(stderr, "Error: %s is not a valid margo trace\n", argv[1]);
+        munmap(region, size);
+        return -1;
+    }
+
+    FILE* out = stdout;
+    if (argc == 3) {
+        out = fopen(argv[2], "w");
+        if (!out) {
+            fprintf(stderr, "Error: could not open %s: %s\n", argv[2],
+                    strerror(errno));
+            munmap(region, size);
+            return -1;
+        }
+    }
+
+    margo_json_writer_t writer;
+    __margo_json_writer_init(&writer, __margo_json_writer_file_sink, out,
+                             CONVERT_CHUNK_SIZE, 3, false);
+    bool ok = __margo_trace_write_chrome_json(trace, &writer);
+    ok      = __margo_json_writer_finalize(&writer) && ok;
+    if (out != stdout) fclose(out);
+    munmap(region, size);
+
+    if (!ok) {
+        fprintf(stderr, "Error: could not allocate memory for conversion\n");
+        return -1;
+    }
+    return 0;
+}
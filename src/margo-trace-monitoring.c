@@ -0,0 +1,371 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <abt.h>
+#include <json-c/json.h>
+#include "margo-instance.h"
+#include "margo-monitoring.h"
+#include "margo-trace.h"
+
+/* Trace monitor
+ * =============
+ *
+ * This monitor records every monitoring event into the binary trace
+ * described in margo-trace.h. Recording an event takes no lock: the
+ * callback reserves a slot in the ring of its xstream with a relaxed
+ * atomic increment and fills it. Only the registration of an RPC, which
+ * adds its name to the trace header, takes a mutex.
+ */
+
+#define TRACE_DEFAULT_CAPACITY 16384
+
+typedef struct trace_monitor_state {
+    margo_instance_id     mid;
+    margo_trace_header_t* trace;
+    size_t                size;
+    uint64_t              capacity;
+    char*                 filename_prefix;
+    char*                 filename;
+    int                   fd;
+    ABT_mutex_memory      rpcs_mtx;
+} trace_monitor_state_t;
+
+static uint64_t round_up_power_of_2(uint64_t x)
+{
+    uint64_t p = 1;
+    while (p < x) p <<= 1;
+    return p;
+}
+
+/* Maps the trace, in a file if a filename prefix is configured */
+static bool trace_map(trace_monitor_state_t* monitor)
+{
+    monitor->size = __margo_trace_size(monitor->capacity);
+    monitor->fd   = -1;
+    void* region  = MAP_FAILED;
+
+    if (monitor->filename_prefix && monitor->filename_prefix[0]) {
+        char hostname[1024];
+        hostname[1023] = '\0';
+        gethostname(hostname, 1023);
+        size_t filename_size
+            = snprintf(NULL, 0, "%s.%s.%d.trace", monitor->filename_prefix,
+                       hostname, (int)getpid());
+        monitor->filename = calloc(1, filename_size + 1);
+        sprintf(monitor->filename, "%s.%s.%d.trace", monitor->filename_prefix,
+                hostname, (int)getpid());
+        monitor->fd = open(monitor->filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (monitor->fd < 0) {
+            // LCOV_EXCL_START
+            margo_error(monitor->mid, "in %s: could not open %s: %s", __func__,
+                        monitor->filename, strerror(errno));
+            return false;
+            // LCOV_EXCL_END
+        }
+        if (ftruncate(monitor->fd, (off_t)monitor->size) != 0) {
+            // LCOV_EXCL_START
+            margo_error(monitor->mid, "in %s: could not resize %s: %s",
+                        __func__, monitor->filename, strerror(errno));
+            return false;
+            // LCOV_EXCL_END
+        }
+        region = mmap(NULL, monitor->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      monitor->fd, 0);
+    } else {
+        region = mmap(NULL, monitor->size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (region == MAP_FAILED) {
+        // LCOV_EXCL_START
+        margo_error(monitor->mid, "in %s: could not map trace: %s", __func__,
+                    strerror(errno));
+        return false;
+        // LCOV_EXCL_END
+    }
+    monitor->trace      = (margo_trace_header_t*)region;
+    monitor->trace->pid = (int64_t)getpid();
+    __margo_trace_init_header(monitor->trace, monitor->capacity);
+    return true;
+}
+
+static void trace_unmap(trace_monitor_state_t* monitor)
+{
+    if (monitor->trace) {
+        if (monitor->fd >= 0) msync(monitor->trace, monitor->size, MS_SYNC);
+        munmap(monitor->trace, monitor->size);
+        monitor->trace = NULL;
+    }
+    if (monitor->fd >= 0) close(monitor->fd);
+    monitor->fd = -1;
+}
+
+static void* __margo_trace_monitor_initialize(margo_instance_id   mid,
+                                              void*               uargs,
+                                              struct json_object* config)
+{
+    (void)uargs;
+    trace_monitor_state_t* monitor = calloc(1, sizeof(*monitor));
+    monitor->mid                   = mid;
+    monitor->fd                    = -1;
+
+    /* default configuration */
+    const char* prefix = getenv("MARGO_TRACE_FILENAME_PREFIX");
+    monitor->filename_prefix = prefix ? strdup(prefix) : NULL;
+    monitor->capacity        = TRACE_DEFAULT_CAPACITY;
+
+    /* read configuration */
+    struct json_object* filename_prefix
+        = json_object_object_get(config, "filename_prefix");
+    if (filename_prefix
+        && json_object_is_type(filename_prefix, json_type_string)) {
+        free(monitor->filename_prefix);
+        monitor->filename_prefix
+            = strdup(json_object_get_string(filename_prefix));
+    }
+    struct json_object* capacity = json_object_object_get(config, "capacity");
+    if (capacity && json_object_is_type(capacity, json_type_int)) {
+        int64_t c = json_object_get_int64(capacity);
+        if (c <= 0 || c > ((int64_t)1 << 32)) {
+            margo_warning(mid,
+                          "in %s: invalid trace capacity %" PRId64
+                          ", using %d",
+                          __func__, c, TRACE_DEFAULT_CAPACITY);
+        } else {
+            monitor->capacity = round_up_power_of_2((uint64_t)c);
+        }
+    }
+
+    if (!trace_map(monitor)) {
+        // LCOV_EXCL_START
+        trace_unmap(monitor);
+        free(monitor->filename);
+        free(monitor->filename_prefix);
+        free(monitor);
+        return NULL;
+        // LCOV_EXCL_END
+    }
+    return (void*)monitor;
+}
+
+static void __margo_trace_monitor_finalize(void* uargs)
+{
+    trace_monitor_state_t* monitor = (trace_monitor_state_t*)uargs;
+    if (!monitor) return;
+    trace_unmap(monitor);
+    free(monitor->filename);
+    free(monitor->filename_prefix);
+    free(monitor);
+}
+
+static const char* __margo_trace_monitor_name() { return "trace"; }
+
+static struct json_object* __margo_trace_monitor_config(void* uargs)
+{
+    trace_monitor_state_t* monitor = (trace_monitor_state_t*)uargs;
+    if (!monitor) return NULL;
+
+    struct json_object* config = json_object_new_object();
+    json_object_object_add_ex(
+        config, "filename_prefix",
+        json_object_new_string(monitor->filename_prefix
+                                   ? monitor->filename_prefix
+                                   : ""),
+        JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    json_object_object_add_ex(config, "capacity",
+                              json_object_new_uint64(monitor->capacity),
+                              JSON_C_OBJECT_ADD_KEY_IS_NEW);
+    return config;
+}
+
+static hg_return_t __margo_trace_monitor_dump(void*                 uargs,
+                                              margo_monitor_dump_fn dump_fn,
+                                              void*                 dump_args,
+                                              bool                  reset)
+{
+    const trace_monitor_state_t* monitor
+        = (const trace_monitor_state_t*)uargs;
+    if (!monitor || !monitor->trace) return HG_SUCCESS;
+
+    /* timestamps are written in microseconds, with nanosecond precision */
+    margo_json_writer_t writer;
+    __margo_json_writer_init(&writer, dump_fn, dump_args, 0, 3, false);
+    bool ok = __margo_trace_write_chrome_json(monitor->trace, &writer);
+    ok      = __margo_json_writer_finalize(&writer) && ok;
+
+    if (reset) {
+        for (uint32_t i = 0; i < monitor->trace->num_rings; i++) {
+            margo_trace_ring_t* ring
+                = __margo_trace_get_ring(monitor->trace, i);
+            __atomic_store_n(&ring->head, 0, __ATOMIC_RELEASE);
+        }
+    }
+
+    if (!ok) {
+        // LCOV_EXCL_START
+        margo_error(monitor->mid, "in %s: could not allocate trace buffers",
+                    __func__);
+        return HG_NOMEM;
+        // LCOV_EXCL_END
+    }
+    return HG_SUCCESS;
+}
+
+/* ========================================================================
+ * Event recording
+ * ======================================================================== */
+
+static inline void trace_record(trace_monitor_state_t* monitor,
+                                double                 timestamp,
+                                margo_monitor_event_t  event_type,
+                                uint16_t               op,
+                                uint64_t               object,
+                                uint64_t               rpc_id)
+{
+    int         es  = -1;
+    ABT_unit_id ult = 0;
+    if (ABT_self_get_xstream_rank(&es) != ABT_SUCCESS) es = -1;
+    if (ABT_self_get_thread_id(&ult) != ABT_SUCCESS) ult = 0;
+
+    margo_trace_header_t* trace = monitor->trace;
+    margo_trace_ring_t*   ring  = __margo_trace_get_ring(
+        trace, es < 0 ? 0 : (uint32_t)es % MARGO_TRACE_NUM_RINGS);
+    uint64_t index = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    margo_trace_event_t* event
+        = &__margo_trace_ring_events(ring)[index & (trace->capacity - 1)];
+
+    event->object    = object;
+    event->rpc_id    = rpc_id;
+    event->ult       = (uint64_t)ult;
+    event->op        = op;
+    event->type      = (uint8_t)event_type;
+    event->es        = es;
+    event->timestamp = timestamp;
+}
+
+static inline uint64_t handle_rpc_id(hg_handle_t handle)
+{
+    if (handle == HG_HANDLE_NULL) return 0;
+    const struct hg_info* info = margo_get_info(handle);
+    return info ? (uint64_t)info->id : 0;
+}
+
+/* RPC id of the handle of a forward or response request */
+static inline uint64_t request_rpc_id(margo_request req)
+{
+    if (!req) return 0;
+    if (req->type != MARGO_FORWARD_REQUEST
+        && req->type != MARGO_RESPONSE_REQUEST)
+        return 0;
+    return handle_rpc_id(req->handle);
+}
+
+/* The object and RPC id of an event are taken from inputs only, so that
+ * the FN_START and FN_END events of an operation have the same object.
+ * The RPC id is only needed on FN_START events, which name the operation
+ * in the converted trace. */
+#define __TRACE_FN(__EVENT__, __event__, __object__, __rpc_id__)              \
+    static void __margo_trace_monitor_on_##__event__(                         \
+        void* uargs, double timestamp, margo_monitor_event_t event_type,      \
+        margo_monitor_##__event__##_args_t event_args)                        \
+    {                                                                         \
+        trace_monitor_state_t* monitor = (trace_monitor_state_t*)uargs;       \
+        (void)event_args;                                                     \
+        if (!monitor) return;                                                 \
+        trace_record(monitor, timestamp, event_type,                          \
+                     MARGO_MONITOR_ON_##__EVENT__, (uint64_t)(__object__),    \
+                     event_type == MARGO_MONITOR_FN_START ? (__rpc_id__) : 0); \
+    }
+
+#define __TRACE_HANDLE_FN(__EVENT__, __event__)                    \
+    __TRACE_FN(__EVENT__, __event__, (uintptr_t)event_args->handle, \
+               handle_rpc_id(event_args->handle))
+
+#define __TRACE_REQUEST_FN(__EVENT__, __event__)                    \
+    __TRACE_FN(__EVENT__, __event__, (uintptr_t)event_args->request, \
+               request_rpc_id(event_args->request))
+
+__TRACE_FN(PROGRESS, progress, 0, 0)
+__TRACE_FN(TRIGGER, trigger, 0, 0)
+__TRACE_FN(DEREGISTER, deregister, 0, event_args->id)
+__TRACE_FN(LOOKUP, lookup, 0, 0)
+__TRACE_FN(CREATE, create, 0, event_args->id)
+__TRACE_HANDLE_FN(FORWARD, forward)
+__TRACE_REQUEST_FN(FORWARD_CB, forward_cb)
+__TRACE_HANDLE_FN(RESPOND, respond)
+__TRACE_REQUEST_FN(RESPOND_CB, respond_cb)
+__TRACE_HANDLE_FN(DESTROY, destroy)
+__TRACE_FN(BULK_CREATE, bulk_create, 0, 0)
+__TRACE_REQUEST_FN(BULK_TRANSFER, bulk_transfer)
+__TRACE_REQUEST_FN(BULK_TRANSFER_CB, bulk_transfer_cb)
+__TRACE_FN(BULK_FREE, bulk_free, (uintptr_t)event_args->handle, 0)
+__TRACE_HANDLE_FN(RPC_HANDLER, rpc_handler)
+__TRACE_HANDLE_FN(RPC_ULT, rpc_ult)
+__TRACE_REQUEST_FN(WAIT, wait)
+__TRACE_FN(SLEEP, sleep, 0, 0)
+__TRACE_HANDLE_FN(SET_INPUT, set_input)
+__TRACE_HANDLE_FN(SET_OUTPUT, set_output)
+__TRACE_HANDLE_FN(GET_INPUT, get_input)
+__TRACE_HANDLE_FN(GET_OUTPUT, get_output)
+__TRACE_HANDLE_FN(FREE_INPUT, free_input)
+__TRACE_HANDLE_FN(FREE_OUTPUT, free_output)
+__TRACE_FN(PREFINALIZE, prefinalize, 0, 0)
+__TRACE_FN(FINALIZE, finalize, 0, 0)
+__TRACE_FN(ADD_POOL, add_pool, 0, 0)
+__TRACE_FN(REMOVE_POOL, remove_pool, 0, 0)
+__TRACE_FN(ADD_XSTREAM, add_xstream, 0, 0)
+__TRACE_FN(REMOVE_XSTREAM, remove_xstream, 0, 0)
+__TRACE_FN(USER, user, 0, 0)
+
+/* Registering an RPC also adds its name to the trace header */
+static void
+__margo_trace_monitor_on_register(void*                         uargs,
+                                  double                        timestamp,
+                                  margo_monitor_event_t         event_type,
+                                  margo_monitor_register_args_t event_args)
+{
+    trace_monitor_state_t* monitor = (trace_monitor_state_t*)uargs;
+    if (!monitor) return;
+    trace_record(monitor, timestamp, event_type, MARGO_MONITOR_ON_REGISTER, 0,
+                 event_args->id);
+    if (event_type != MARGO_MONITOR_FN_END || event_args->ret != HG_SUCCESS
+        || !event_args->name)
+        return;
+
+    margo_trace_header_t* trace = monitor->trace;
+    ABT_mutex_spinlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpcs_mtx));
+    uint32_t i = 0;
+    while (i < trace->num_rpcs && trace->rpcs[i].id != event_args->id) i++;
+    if (i < MARGO_TRACE_MAX_RPCS) {
+        margo_trace_rpc_t* rpc = &trace->rpcs[i];
+        rpc->id                = event_args->id;
+        strncpy(rpc->name, event_args->name, sizeof(rpc->name) - 1);
+        rpc->name[sizeof(rpc->name) - 1] = '\0';
+        /* readers of the trace only look at the first num_rpcs entries */
+        if (i == trace->num_rpcs)
+            __atomic_store_n(&trace->num_rpcs, i + 1, __ATOMIC_RELEASE);
+    }
+    ABT_mutex_unlock(ABT_MUTEX_MEMORY_GET_HANDLE(&monitor->rpcs_mtx));
+}
+
+struct margo_monitor __margo_trace_monitor
+    = {.uargs      = NULL,
+       .initialize = __margo_trace_monitor_initialize,
+       .finalize   = __margo_trace_monitor_finalize,
+       .dump       = __margo_trace_monitor_dump,
+       .name       = __margo_trace_monitor_name,
+       .config     = __margo_trace_monitor_config,
+#define X(__x__, __y__) .on_##__y__ = __margo_trace_monitor_on_##__y__,
+       MARGO_EXPAND_MONITOR_MACROS
+#undef X
+};
+
+struct margo_monitor* margo_trace_monitor = &__margo_trace_monitor;
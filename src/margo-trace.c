@@ -0,0 +1,270 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "margo-trace.h"
+#include "uthash.h"
+
+static const char* const op_names[] = {
+#define X(__x__, __y__) #__y__,
+    MARGO_EXPAND_MONITOR_MACROS
+#undef X
+};
+
+const char* __margo_trace_op_name(uint16_t op)
+{
+    return op < MARGO_MONITOR_MAX ? op_names[op] : "unknown";
+}
+
+static size_t ring_offset(void)
+{
+    /* rings start on a page boundary */
+    return (sizeof(margo_trace_header_t) + 4095) & ~(size_t)4095;
+}
+
+static size_t ring_size(uint64_t capacity)
+{
+    return sizeof(margo_trace_ring_t) + capacity * sizeof(margo_trace_event_t);
+}
+
+size_t __margo_trace_size(uint64_t capacity)
+{
+    return ring_offset() + MARGO_TRACE_NUM_RINGS * ring_size(capacity);
+}
+
+void __margo_trace_init_header(margo_trace_header_t* trace, uint64_t capacity)
+{
+    trace->version     = MARGO_TRACE_VERSION;
+    trace->num_rings   = MARGO_TRACE_NUM_RINGS;
+    trace->capacity    = capacity;
+    trace->ring_offset = ring_offset();
+    trace->ring_size   = ring_size(capacity);
+    /* the magic number is written last, marking the header as valid */
+    __atomic_store_n(&trace->magic, MARGO_TRACE_MAGIC, __ATOMIC_RELEASE);
+}
+
+bool __margo_trace_check(const margo_trace_header_t* trace, size_t size)
+{
+    if (size < sizeof(*trace)) return false;
+    if (trace->magic != MARGO_TRACE_MAGIC) return false;
+    if (trace->version != MARGO_TRACE_VERSION) return false;
+    if (trace->capacity == 0 || (trace->capacity & (trace->capacity - 1)))
+        return false;
+    if (trace->num_rpcs > MARGO_TRACE_MAX_RPCS) return false;
+    if (trace->ring_size < ring_size(trace->capacity)) return false;
+    return trace->ring_offset + trace->num_rings * trace->ring_size <= size;
+}
+
+/* Key used to pair the FN_START and FN_END events of an operation */
+typedef struct pending_key {
+    uint64_t object;
+    uint64_t ult;
+    uint64_t op;
+} pending_key_t;
+
+/* FN_START events waiting for their FN_END, innermost last */
+typedef struct pending {
+    pending_key_t               key;
+    const margo_trace_event_t** starts;
+    size_t                      count;
+    size_t                      capacity;
+    UT_hash_handle              hh;
+} pending_t;
+
+static int event_compare(const void* a, const void* b)
+{
+    const margo_trace_event_t* x = *(const margo_trace_event_t* const*)a;
+    const margo_trace_event_t* y = *(const margo_trace_event_t* const*)b;
+    if (x->timestamp != y->timestamp)
+        return x->timestamp < y->timestamp ? -1 : 1;
+    /* deterministic order for events with the same timestamp */
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static const char* rpc_name(const margo_trace_header_t* trace, uint64_t id)
+{
+    for (uint32_t i = 0; i < trace->num_rpcs; i++)
+        if (trace->rpcs[i].id == id) return trace->rpcs[i].name;
+    return NULL;
+}
+
+static void write_event(const margo_trace_header_t* trace,
+                        margo_json_writer_t*        w,
+                        const margo_trace_event_t*  event,
+                        const char*                 ph,
+                        double                      duration)
+{
+    const char* op   = __margo_trace_op_name(event->op);
+    const char* name = event->rpc_id ? rpc_name(trace, event->rpc_id) : NULL;
+    char        full_name[96];
+    if (name)
+        snprintf(full_name, sizeof(full_name), "%s %s", op, name);
+    else
+        snprintf(full_name, sizeof(full_name), "%s", op);
+    char object[32];
+    snprintf(object, sizeof(object), "0x%" PRIx64, event->object);
+
+    __margo_json_writer_begin_object(w);
+    __margo_json_writer_key_string(w, "name", full_name);
+    __margo_json_writer_key_string(w, "cat", "margo");
+    __margo_json_writer_key_string(w, "ph", ph);
+    __margo_json_writer_key_double(w, "ts", event->timestamp * 1e6);
+    if (ph[0] == 'X') __margo_json_writer_key_double(w, "dur", duration * 1e6);
+    if (ph[0] == 'i') __margo_json_writer_key_string(w, "s", "t");
+    __margo_json_writer_key(w, "pid");
+    __margo_json_writer_int64(w, trace->pid);
+    __margo_json_writer_key(w, "tid");
+    __margo_json_writer_int64(w, event->es);
+    __margo_json_writer_key(w, "args");
+    __margo_json_writer_begin_object(w);
+    if (event->rpc_id)
+        __margo_json_writer_key_uint64(w, "rpc_id", event->rpc_id);
+    if (event->object) __margo_json_writer_key_string(w, "object", object);
+    __margo_json_writer_key_uint64(w, "ult", event->ult);
+    __margo_json_writer_end_object(w);
+    __margo_json_writer_end_object(w);
+}
+
+static void write_metadata(const margo_trace_header_t* trace,
+                           margo_json_writer_t*        w,
+                           const char*                 name,
+                           int64_t                     tid,
+                           const char*                 value)
+{
+    __margo_json_writer_begin_object(w);
+    __margo_json_writer_key_string(w, "name", name);
+    __margo_json_writer_key_string(w, "ph", "M");
+    __margo_json_writer_key(w, "pid");
+    __margo_json_writer_int64(w, trace->pid);
+    __margo_json_writer_key(w, "tid");
+    __margo_json_writer_int64(w, tid);
+    __margo_json_writer_key(w, "args");
+    __margo_json_writer_begin_object(w);
+    __margo_json_writer_key_string(w, "name", value);
+    __margo_json_writer_end_object(w);
+    __margo_json_writer_end_object(w);
+}
+
+bool __margo_trace_write_chrome_json(const margo_trace_header_t* trace,
+                                     margo_json_writer_t*        w)
+{
+    bool                        ok     = true;
+    size_t                      count  = 0;
+    const margo_trace_event_t** events = NULL;
+    pending_t *                 pending = NULL, *p, *tmp;
+
+    /* collect the events retained in the rings */
+    for (uint32_t r = 0; r < trace->num_rings; r++) {
+        margo_trace_ring_t* ring = __margo_trace_get_ring(trace, r);
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        count += head < trace->capacity ? head : trace->capacity;
+    }
+    if (count) {
+        events = (const margo_trace_event_t**)malloc(count * sizeof(*events));
+        if (!events) return false;
+    }
+    size_t n = 0;
+    for (uint32_t r = 0; r < trace->num_rings && n < count; r++) {
+        margo_trace_ring_t*  ring  = __margo_trace_get_ring(trace, r);
+        margo_trace_event_t* slots = __margo_trace_ring_events(ring);
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t num  = head < trace->capacity ? head : trace->capacity;
+        if (num > count - n) num = count - n;
+        for (uint64_t i = head - num; i < head; i++) {
+            const margo_trace_event_t* event
+                = &slots[i & (trace->capacity - 1)];
+            /* slot reserved but not written yet */
+            if (event->timestamp == 0.0) continue;
+            events[n++] = event;
+        }
+    }
+    count = n;
+    if (count) qsort(events, count, sizeof(*events), event_compare);
+
+    __margo_json_writer_begin_object(w);
+    __margo_json_writer_key_string(w, "displayTimeUnit", "ns");
+    __margo_json_writer_key(w, "traceEvents");
+    __margo_json_writer_begin_array(w);
+
+    /* name the process and the xstreams */
+    char name[64];
+    snprintf(name, sizeof(name), "margo (pid %" PRId64 ")", trace->pid);
+    write_metadata(trace, w, "process_name", 0, name);
+    int32_t named[256];
+    size_t  num_named = 0;
+    for (size_t i = 0; i < count && num_named < 256; i++) {
+        int32_t es = events[i]->es;
+        size_t  j  = 0;
+        while (j < num_named && named[j] != es) j++;
+        if (j < num_named) continue;
+        named[num_named++] = es;
+        if (es < 0)
+            snprintf(name, sizeof(name), "external threads");
+        else
+            snprintf(name, sizeof(name), "ES %d", es);
+        write_metadata(trace, w, "thread_name", es, name);
+    }
+
+    /* pair the FN_START and FN_END events */
+    for (size_t i = 0; i < count; i++) {
+        const margo_trace_event_t* event = events[i];
+        if (event->type == MARGO_MONITOR_POINT) {
+            write_event(trace, w, event, "i", 0.0);
+            continue;
+        }
+        pending_key_t key;
+        memset(&key, 0, sizeof(key));
+        key.object = event->object;
+        key.ult    = event->ult;
+        key.op     = event->op;
+        HASH_FIND(hh, pending, &key, sizeof(key), p);
+        if (event->type == MARGO_MONITOR_FN_START) {
+            if (!p) {
+                p = (pending_t*)calloc(1, sizeof(*p));
+                if (!p) goto error;
+                p->key = key;
+                HASH_ADD(hh, pending, key, sizeof(key), p);
+            }
+            if (p->count == p->capacity) {
+                size_t capacity = p->capacity ? 2 * p->capacity : 4;
+                const margo_trace_event_t** starts
+                    = realloc(p->starts, capacity * sizeof(*starts));
+                if (!starts) goto error;
+                p->starts   = starts;
+                p->capacity = capacity;
+            }
+            p->starts[p->count++] = event;
+        } else if (p && p->count) {
+            const margo_trace_event_t* start = p->starts[--p->count];
+            write_event(trace, w, start, "X",
+                        event->timestamp - start->timestamp);
+        }
+        /* FN_END events whose FN_START was overwritten are dropped */
+    }
+    /* operations still in progress */
+    HASH_ITER(hh, pending, p, tmp)
+    {
+        for (size_t i = 0; i < p->count; i++)
+            write_event(trace, w, p->starts[i], "i", 0.0);
+    }
+    goto finish;
+
+error:
+    ok = false;
+
+finish:
+    __margo_json_writer_end_array(w);
+    __margo_json_writer_end_object(w);
+    HASH_ITER(hh, pending, p, tmp)
+    {
+        HASH_DEL(pending, p);
+        free(p->starts);
+        free(p);
+    }
+    free(events);
+    return ok;
+}
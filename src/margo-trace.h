@@ -0,0 +1,110 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __MARGO_TRACE_H
+#define __MARGO_TRACE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "margo-monitoring.h"
+#include "margo-json-writer.h"
+
+/* Binary event traces
+ * ===================
+ *
+ * The trace monitor (margo_trace_monitor) records the FN_START, FN_END,
+ * and POINT events of every monitoring callback as fixed-size records
+ * in ring buffers, one per xstream rank (modulo MARGO_TRACE_NUM_RINGS).
+ * A slot is reserved with an atomic increment of the ring's head, so
+ * recording an event takes no lock; when a ring is full, the oldest
+ * events are overwritten.
+ *
+ * The rings live in a single memory region laid out as follows, which
+ * is also the format of the trace files written when the monitor is
+ * given a "filename_prefix" (the region is then a shared mapping of the
+ * file, so the trace survives a crash of the process):
+ *
+ *   margo_trace_header_t (includes the names of the registered RPCs)
+ *   ring 0: margo_trace_ring_t, then capacity margo_trace_event_t
+ *   ring 1: ...
+ *
+ * A trace can be converted into the Chrome/Perfetto trace event JSON
+ * format with __margo_trace_write_chrome_json, which margo-trace-convert
+ * uses on trace files and the monitor's dump function on live traces.
+ * Since events are read while they may be written, the last events of
+ * a live trace may be incomplete.
+ */
+#define MARGO_TRACE_MAGIC     0x45434152544f474dULL /* "MGOTRACE" */
+#define MARGO_TRACE_VERSION   1
+#define MARGO_TRACE_NUM_RINGS 64
+#define MARGO_TRACE_MAX_RPCS  1024
+
+typedef struct margo_trace_event {
+    double   timestamp; /* seconds, as given to the monitor */
+    uint64_t object; /* hg_handle_t, margo_request, or hg_bulk_t, if any */
+    uint64_t rpc_id; /* RPC id (including the provider id), if known */
+    uint64_t ult;    /* id of the ULT that triggered the event */
+    uint16_t op;     /* MARGO_MONITOR_ON_* */
+    uint8_t  type;   /* margo_monitor_event_t */
+    uint8_t  padding;
+    int32_t  es; /* rank of the xstream, -1 outside of xstreams */
+} margo_trace_event_t;
+
+typedef struct margo_trace_ring {
+    uint64_t head;       /* number of events written in this ring */
+    uint64_t padding[7]; /* keeps the heads in separate cache lines */
+} margo_trace_ring_t;
+
+typedef struct margo_trace_rpc {
+    uint64_t id;
+    char     name[56];
+} margo_trace_rpc_t;
+
+typedef struct margo_trace_header {
+    uint64_t          magic;
+    uint32_t          version;
+    uint32_t          num_rings;
+    uint64_t          capacity;    /* events per ring, a power of 2 */
+    uint64_t          ring_offset; /* offset of the first ring */
+    uint64_t          ring_size;   /* bytes between two rings */
+    int64_t           pid;
+    uint32_t          num_rpcs;
+    uint32_t          padding;
+    margo_trace_rpc_t rpcs[MARGO_TRACE_MAX_RPCS];
+} margo_trace_header_t;
+
+/* Total size of a trace with the given capacity per ring */
+size_t __margo_trace_size(uint64_t capacity);
+
+/* Initializes the header of a zeroed trace region */
+void __margo_trace_init_header(margo_trace_header_t* trace, uint64_t capacity);
+
+/* Checks that a region of the given size contains a valid trace */
+bool __margo_trace_check(const margo_trace_header_t* trace, size_t size);
+
+static inline margo_trace_ring_t*
+__margo_trace_get_ring(const margo_trace_header_t* trace, uint32_t index)
+{
+    return (margo_trace_ring_t*)((char*)trace + trace->ring_offset
+                                 + index * trace->ring_size);
+}
+
+static inline margo_trace_event_t*
+__margo_trace_ring_events(margo_trace_ring_t* ring)
+{
+    return (margo_trace_event_t*)(ring + 1);
+}
+
+/* Name of a MARGO_MONITOR_ON_* operation */
+const char* __margo_trace_op_name(uint16_t op);
+
+/* Writes the events of the trace as a Chrome/Perfetto JSON document.
+ * FN_START and FN_END events of the same operation, ULT, and object are
+ * paired into complete ("X") events on the track of their xstream.
+ * Returns false if memory could not be allocated. */
+bool __margo_trace_write_chrome_json(const margo_trace_header_t* trace,
+                                     margo_json_writer_t*        w);
+
+#endif
@@ -0,0 +1,52 @@
+#!/bin/bash -x
+
+# Short run of margo-bench, so that it is built and exercised by
+# "make check".
+
+if [ -z $srcdir ]; then
+    echo srcdir variable not set.
+    exit 1
+fi
+
+if [ -z "$MKTEMP" ] ; then
+    echo expected MKTEMP variable defined to its respective command
+    exit 1
+fi
+
+source $srcdir/tests/test-util.sh
+
+BENCHFILE=$($MKTEMP bench-config-XXXXXX)
+TMPOUT=$($MKTEMP bench-out-XXXXXX)
+
+function cleanup ()
+{
+    rm -f $BENCHFILE $TMPOUT
+}
+
+cat > $BENCHFILE << EOL
+{"benchmarks": [
+  {"type": "latency", "iterations": 100, "warmup": 10},
+  {"type": "latency", "iterations": 100, "warmup": 10, "timeout_ms": 1000},
+  {"type": "throughput", "concurrency": 4, "duration_sec": 0.5},
+  {"type": "bulk", "sizes": [4096, 65536], "iterations": 10, "warmup": 1}
+]}
+EOL
+
+run_to 60 src/margo-bench -b $BENCHFILE -o $TMPOUT
+if [ $? -ne 0 ]; then
+    cat $TMPOUT
+    cleanup
+    exit 1
+fi
+
+cat $TMPOUT
+
+for type in latency throughput bulk; do
+    if ! grep -q "\"$type\"" $TMPOUT; then
+        cleanup
+        exit 1
+    fi
+done
+
+cleanup
+exit 0
@@ -0,0 +1,62 @@
+#!/bin/bash -x
+
+# Short run of margo-loadgen against its own test server, so that it is
+# built and exercised by "make check".
+
+if [ -z $srcdir ]; then
+    echo srcdir variable not set.
+    exit 1
+fi
+
+if [ -z "$MKTEMP" ] ; then
+    echo expected MKTEMP variable defined to its respective command
+    exit 1
+fi
+
+source $srcdir/tests/test-util.sh
+
+ADDRFILE=$($MKTEMP loadgen-addr-XXXXXX)
+LOADFILE=$($MKTEMP loadgen-load-XXXXXX)
+TMPOUT=$($MKTEMP loadgen-out-XXXXXX)
+
+function cleanup ()
+{
+    rm -f $ADDRFILE $LOADFILE $TMPOUT
+}
+
+# the second burst of sleep RPCs exceeds max_in_flight, so some are dropped
+cat > $LOADFILE << EOL
+{"rate": 200, "duration_sec": 1, "arrival": "bursty", "burst_size": 20,
+ "timeout_ms": 5000, "max_in_flight": 10,
+ "mix": [ {"rpc": "echo", "size": 64},
+          {"rpc": "sleep", "sleep_usec": 50000},
+          {"rpc": "bulk", "size": 4096, "operation": "pull"} ]}
+EOL
+
+run_to 30 src/margo-loadgen -S -f $ADDRFILE &
+
+# wait for the server to write its address
+for i in `seq 1 100`; do
+    if [ -s $ADDRFILE ]; then break; fi
+    sleep 0.1
+done
+
+run_to 20 src/margo-loadgen -a `cat $ADDRFILE` -l $LOADFILE -o $TMPOUT -k
+if [ $? -ne 0 ]; then
+    wait
+    cleanup
+    exit 1
+fi
+wait
+
+cat $TMPOUT
+
+for field in completed dropped p99_usec; do
+    if ! grep -q "\"$field\"" $TMPOUT; then
+        cleanup
+        exit 1
+    fi
+done
+
+cleanup
+exit 0
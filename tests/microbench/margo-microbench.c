@@ -0,0 +1,448 @@
+/*
+ * (C) 2024 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <json-c/json.h>
+#include <margo.h>
+#include <margo-timer.h>
+#include <margo-bulk-pool.h>
+/* NOTE: eventuals are internal to margo, not exposed to end-users */
+#include "../../src/margo-abt-macros.h"
+
+/* Microbenchmarks of margo's internal structures. Each benchmark runs an
+ * operation in a loop from one ULT per execution stream, for 1, 2, 4...
+ * up to the given number of execution streams, and reports the time per
+ * operation (wall time of the loop divided by the number of iterations of
+ * each ULT) and the aggregate throughput.
+ *
+ * With a baseline (the JSON output of a previous run), the program fails
+ * if an operation got slower than its baseline by more than the given
+ * tolerance, so regressions can be caught by "make check".
+ */
+
+#define DEFAULT_ITERATIONS  100000
+#define DEFAULT_XSTREAMS    4
+#define DEFAULT_LIVE_TIMERS 1000
+#define DEFAULT_TOLERANCE   1.0
+
+struct options {
+    unsigned long iterations;
+    unsigned      max_xstreams;
+    unsigned      live_timers;
+    double        tolerance;
+    const char*   filter;
+    const char*   baseline_file;
+    const char*   output_file;
+};
+
+typedef struct bench_context {
+    margo_instance_id mid;
+    unsigned long     iterations;
+    hg_addr_t         self_addr;
+    hg_id_t           rpc_id;
+    margo_bulk_pool_t bulk_pool;
+    ABT_barrier       barrier;
+} bench_context_t;
+
+/* Arguments of a ULT running a benchmark loop */
+typedef struct bench_ult {
+    bench_context_t* ctx;
+    void (*fn)(bench_context_t*, unsigned long);
+    double start;
+    double end;
+} bench_ult_t;
+
+typedef struct benchmark {
+    const char* name;
+    const char* pool; /* pool the ULTs run in */
+    void (*fn)(bench_context_t*, unsigned long);
+} benchmark_t;
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: margo-microbench [-n <iterations>] [-x <xstreams>] "
+            "[-t <live timers>]\n"
+            "                        [-f <filter>] [-o <output file>] "
+            "[-b <baseline file>]\n"
+            "                        [-r <tolerance>]\n");
+    fprintf(stderr,
+            "   Runs the benchmarks whose name contains <filter> (default\n"
+            "   all) with 1, 2, 4... up to <xstreams> execution streams\n"
+            "   (default %d), <iterations> times per ULT (default %d), and\n"
+            "   writes the results as JSON to <output file> (default\n"
+            "   stdout). Fails if an operation is slower than in <baseline\n"
+            "   file> by more than <tolerance> (default %.1f, i.e. twice as\n"
+            "   slow).\n",
+            DEFAULT_XSTREAMS, DEFAULT_ITERATIONS, DEFAULT_TOLERANCE);
+}
+
+/* Reads a whole file into a null-terminated string */
+static char* read_file(const char* filename)
+{
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: could not open %s: %s\n", filename,
+                strerror(errno));
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* content = size >= 0 ? calloc((size_t)size + 1, 1) : NULL;
+    if (content && fread(content, 1, (size_t)size, file) != (size_t)size) {
+        free(content);
+        content = NULL;
+    }
+    fclose(file);
+    if (!content) fprintf(stderr, "Error: could not read %s\n", filename);
+    return content;
+}
+
+/* ========================================================================
+ * Benchmarked operations
+ * ======================================================================== */
+
+static void timer_cb(void* uargs) { (void)uargs; }
+
+/* Starts and cancels a timer, among the live timers of the instance */
+static void bench_timer(bench_context_t* ctx, unsigned long iterations)
+{
+    margo_timer_t timer = MARGO_TIMER_NULL;
+    margo_timer_create(ctx->mid, timer_cb, NULL, &timer);
+    for (unsigned long i = 0; i < iterations; i++) {
+        /* spread the deadlines among those of the live timers */
+        margo_timer_start(timer, 3600e3 + (double)(i % 1024));
+        margo_timer_cancel(timer);
+    }
+    margo_timer_destroy(timer);
+}
+
+/* Creates and destroys a handle, going through the handle cache */
+static void bench_handle(bench_context_t* ctx, unsigned long iterations)
+{
+    for (unsigned long i = 0; i < iterations; i++) {
+        hg_handle_t handle = HG_HANDLE_NULL;
+        margo_create(ctx->mid, ctx->self_addr, ctx->rpc_id, &handle);
+        margo_destroy(handle);
+    }
+}
+
+/* Yields, pushing the ULT back into its pool and popping the next one */
+static void bench_yield(bench_context_t* ctx, unsigned long iterations)
+{
+    (void)ctx;
+    for (unsigned long i = 0; i < iterations; i++) ABT_thread_yield();
+}
+
+static void bench_bulk_pool(bench_context_t* ctx, unsigned long iterations)
+{
+    for (unsigned long i = 0; i < iterations; i++) {
+        hg_bulk_t bulk = HG_BULK_NULL;
+        margo_bulk_pool_get(ctx->bulk_pool, &bulk);
+        margo_bulk_pool_release(ctx->bulk_pool, bulk);
+    }
+}
+
+static void bench_eventual(bench_context_t* ctx, unsigned long iterations)
+{
+    (void)ctx;
+    for (unsigned long i = 0; i < iterations; i++) {
+        margo_eventual_t ev;
+        MARGO_EVENTUAL_CREATE(&ev);
+        MARGO_EVENTUAL_SET(ev);
+        MARGO_EVENTUAL_WAIT(ev);
+        MARGO_EVENTUAL_FREE(&ev);
+    }
+}
+
+static const benchmark_t benchmarks[] = {
+    {"timer_start_cancel", "bench_fifo_wait", bench_timer},
+    {"handle_create_destroy", "bench_fifo_wait", bench_handle},
+    {"pool_yield_fifo_wait", "bench_fifo_wait", bench_yield},
+    {"pool_yield_prio_wait", "bench_prio_wait", bench_yield},
+    {"pool_yield_earliest_first", "bench_earliest_first", bench_yield},
+    {"bulk_pool_get_release", "bench_fifo_wait", bench_bulk_pool},
+    {"eventual_create_set_wait", "bench_fifo_wait", bench_eventual},
+};
+
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+/* ========================================================================
+ * Harness
+ * ======================================================================== */
+
+static void bench_ult(void* uargs)
+{
+    bench_ult_t* ult = (bench_ult_t*)uargs;
+    ABT_barrier_wait(ult->ctx->barrier);
+    ult->start = ABT_get_wtime();
+    ult->fn(ult->ctx, ult->ctx->iterations);
+    ult->end = ABT_get_wtime();
+}
+
+/* Runs a benchmark with one ULT per execution stream, returns its result
+ * or NULL on error */
+static struct json_object* run_benchmark(bench_context_t*   ctx,
+                                         const benchmark_t* bench,
+                                         unsigned           num_xstreams)
+{
+    struct margo_pool_info pool_info = {0};
+    if (margo_find_pool_by_name(ctx->mid, bench->pool, &pool_info)
+        != HG_SUCCESS) {
+        fprintf(stderr, "Error: could not find pool %s\n", bench->pool);
+        return NULL;
+    }
+    bench_ult_t* ults    = calloc(num_xstreams, sizeof(*ults));
+    ABT_thread*  threads = calloc(num_xstreams, sizeof(*threads));
+    ABT_barrier_create(num_xstreams, &ctx->barrier);
+    for (unsigned i = 0; i < num_xstreams; i++) {
+        ults[i].ctx = ctx;
+        ults[i].fn  = bench->fn;
+        ABT_thread_create(pool_info.pool, bench_ult, &ults[i],
+                          ABT_THREAD_ATTR_NULL, &threads[i]);
+    }
+    double start = 0.0, end = 0.0;
+    for (unsigned i = 0; i < num_xstreams; i++) {
+        ABT_thread_join(threads[i]);
+        ABT_thread_free(&threads[i]);
+        if (i == 0 || ults[i].start < start) start = ults[i].start;
+        if (i == 0 || ults[i].end > end) end = ults[i].end;
+    }
+    ABT_barrier_free(&ctx->barrier);
+    free(threads);
+    free(ults);
+
+    double              elapsed = end - start;
+    double              ops     = (double)ctx->iterations * num_xstreams;
+    struct json_object* result  = json_object_new_object();
+    json_object_object_add(
+        result, "ns_per_op",
+        json_object_new_double(elapsed * 1e9 / (double)ctx->iterations));
+    json_object_object_add(result, "ops_per_sec",
+                           json_object_new_double(ops / elapsed));
+    return result;
+}
+
+static char* make_config(unsigned num_xstreams)
+{
+    size_t size   = 1024 + num_xstreams * 256;
+    char*  config = malloc(size);
+    int    len    = snprintf(
+        config, size,
+        "{\"argobots\":{\"pools\":["
+        "{\"name\":\"bench_fifo_wait\",\"kind\":\"fifo_wait\","
+        "\"access\":\"mpmc\"},"
+        "{\"name\":\"bench_prio_wait\",\"kind\":\"prio_wait\","
+        "\"access\":\"mpmc\"},"
+        "{\"name\":\"bench_earliest_first\",\"kind\":\"earliest_first\","
+        "\"access\":\"mpmc\"}],\"xstreams\":[");
+    for (unsigned i = 0; i < num_xstreams; i++)
+        len += snprintf(config + len, size - len,
+                        "%s{\"name\":\"bench_es_%u\",\"scheduler\":{"
+                        "\"type\":\"basic_wait\",\"pools\":["
+                        "\"bench_fifo_wait\",\"bench_prio_wait\","
+                        "\"bench_earliest_first\"]}}",
+                        i ? "," : "", i);
+    snprintf(config + len, size - len, "]}}");
+    return config;
+}
+
+/* Runs all the selected benchmarks with the given number of execution
+ * streams, adding their results to the output. Returns false on error. */
+static bool run_all(const struct options* opts,
+                    unsigned              num_xstreams,
+                    struct json_object*   results)
+{
+    char*                  config = make_config(num_xstreams);
+    struct margo_init_info info   = {.json_config = config};
+    bench_context_t        ctx    = {.iterations = opts->iterations};
+    ctx.mid = margo_init_ext("na+sm", MARGO_SERVER_MODE, &info);
+    free(config);
+    if (ctx.mid == MARGO_INSTANCE_NULL) {
+        fprintf(stderr, "Error: could not initialize margo\n");
+        return false;
+    }
+    ctx.rpc_id = MARGO_REGISTER(ctx.mid, "margo_microbench_rpc", void, void,
+                                NULL);
+    margo_addr_self(ctx.mid, &ctx.self_addr);
+    margo_bulk_pool_create(ctx.mid, num_xstreams, 4096, HG_BULK_READWRITE,
+                           &ctx.bulk_pool);
+
+    /* timers that stay armed during the benchmarks */
+    margo_timer_t* timers = calloc(opts->live_timers, sizeof(*timers));
+    for (unsigned i = 0; i < opts->live_timers; i++) {
+        margo_timer_create(ctx.mid, timer_cb, NULL, &timers[i]);
+        margo_timer_start(timers[i], 3600e3 + (double)i);
+    }
+
+    bool ok = true;
+    char key[16];
+    snprintf(key, sizeof(key), "%u", num_xstreams);
+    for (size_t i = 0; i < NUM_BENCHMARKS && ok; i++) {
+        if (opts->filter && !strstr(benchmarks[i].name, opts->filter))
+            continue;
+        struct json_object* result
+            = run_benchmark(&ctx, &benchmarks[i], num_xstreams);
+        if (!result) {
+            ok = false;
+            break;
+        }
+        struct json_object* bench
+            = json_object_object_get(results, benchmarks[i].name);
+        if (!bench) {
+            bench = json_object_new_object();
+            json_object_object_add(results, benchmarks[i].name, bench);
+        }
+        json_object_object_add(bench, key, result);
+    }
+
+    margo_timer_cancel_many(opts->live_timers, timers);
+    for (unsigned i = 0; i < opts->live_timers; i++)
+        margo_timer_destroy(timers[i]);
+    free(timers);
+    margo_bulk_pool_destroy(ctx.bulk_pool);
+    margo_addr_free(ctx.mid, ctx.self_addr);
+    margo_finalize(ctx.mid);
+    return ok;
+}
+
+/* Number of execution streams to run the benchmarks with after n: the next
+ * power of 2, or the maximum */
+static unsigned next_count(unsigned n, const struct options* opts)
+{
+    if (n == opts->max_xstreams) return n + 1;
+    return 2 * n < opts->max_xstreams ? 2 * n : opts->max_xstreams;
+}
+
+/* Compares the results with the baseline, returns the number of
+ * regressions */
+static int compare(const struct json_object* results,
+                   const struct json_object* baseline,
+                   double                    tolerance)
+{
+    int regressions = 0;
+    json_object_object_foreach(results, name, bench)
+    {
+        struct json_object* base = json_object_object_get(baseline, name);
+        if (!base) continue;
+        json_object_object_foreach(bench, num_xstreams, result)
+        {
+            struct json_object* base_result
+                = json_object_object_get(base, num_xstreams);
+            struct json_object* base_ns
+                = json_object_object_get(base_result, "ns_per_op");
+            if (!base_ns) continue;
+            double expected = json_object_get_double(base_ns);
+            double actual   = json_object_get_double(
+                json_object_object_get(result, "ns_per_op"));
+            if (actual > expected * (1.0 + tolerance)) {
+                fprintf(stderr,
+                        "Regression: %s with %s xstreams takes %.1f ns/op "
+                        "(baseline: %.1f ns/op)\n",
+                        name, num_xstreams, actual, expected);
+                regressions += 1;
+            }
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv)
+{
+    struct options opts = {.iterations   = DEFAULT_ITERATIONS,
+                           .max_xstreams = DEFAULT_XSTREAMS,
+                           .live_timers  = DEFAULT_LIVE_TIMERS,
+                           .tolerance    = DEFAULT_TOLERANCE};
+    int            opt;
+    while ((opt = getopt(argc, argv, "n:x:t:f:o:b:r:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            opts.iterations = strtoul(optarg, NULL, 10);
+            break;
+        case 'x':
+            opts.max_xstreams = (unsigned)atoi(optarg);
+            break;
+        case 't':
+            opts.live_timers = (unsigned)atoi(optarg);
+            break;
+        case 'f':
+            opts.filter = optarg;
+            break;
+        case 'o':
+            opts.output_file = optarg;
+            break;
+        case 'b':
+            opts.baseline_file = optarg;
+            break;
+        case 'r':
+            opts.tolerance = atof(optarg);
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc || opts.iterations == 0 || opts.max_xstreams == 0
+        || opts.tolerance < 0.0) {
+        usage();
+        return -1;
+    }
+
+    struct json_object* baseline = NULL;
+    if (opts.baseline_file) {
+        char* content = read_file(opts.baseline_file);
+        if (!content) return -1;
+        baseline = json_tokener_parse(content);
+        free(content);
+        if (!baseline) {
+            fprintf(stderr, "Error: could not parse %s\n", opts.baseline_file);
+            return -1;
+        }
+    }
+
+    struct json_object* output  = json_object_new_object();
+    struct json_object* results = json_object_new_object();
+    json_object_object_add(output, "iterations",
+                           json_object_new_uint64(opts.iterations));
+    json_object_object_add(output, "live_timers",
+                           json_object_new_uint64(opts.live_timers));
+    json_object_object_add(output, "results", results);
+
+    int ret = 0;
+    for (unsigned n = 1; n <= opts.max_xstreams; n = next_count(n, &opts)) {
+        if (!run_all(&opts, n, results)) {
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ret == 0) {
+        FILE* out = opts.output_file ? fopen(opts.output_file, "w") : stdout;
+        if (out) {
+            fprintf(out, "%s\n",
+                    json_object_to_json_string_ext(output,
+                                                   JSON_C_TO_STRING_PRETTY));
+            if (out != stdout) fclose(out);
+        } else {
+            fprintf(stderr, "Error: could not open %s: %s\n",
+                    opts.output_file, strerror(errno));
+            ret = -1;
+        }
+    }
+    if (ret == 0 && baseline
+        && compare(results, json_object_object_get(baseline, "results"),
+                   opts.tolerance))
+        ret = -1;
+
+    json_object_put(output);
+    json_object_put(baseline);
+    return ret;
+}
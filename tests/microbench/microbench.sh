@@ -0,0 +1,28 @@
+#!/bin/bash
+
+set -x
+
+# Short run of the microbenchmarks, so that they are built and exercised by
+# "make check". Setting MARGO_MICROBENCH_BASELINE to the output of a
+# previous run (e.g. on the same machine, before a change) makes the test
+# fail if an operation got slower than in that run by more than
+# MARGO_MICROBENCH_TOLERANCE (default 1.0, i.e. twice as slow).
+
+out=/tmp/microbench-$$.json
+
+args="-n ${MARGO_MICROBENCH_ITERATIONS:-10000} -x 4 -o $out"
+if [ -n "$MARGO_MICROBENCH_BASELINE" ]; then
+    args="$args -b $MARGO_MICROBENCH_BASELINE -r ${MARGO_MICROBENCH_TOLERANCE:-1.0}"
+fi
+
+tests/microbench/margo-microbench $args
+if [ $? -ne 0 ]; then
+    cat $out
+    rm -f $out
+    exit 1
+fi
+
+cat $out
+rm $out
+
+exit 0
@@ -4,6 +4,8 @@
 #include "helper-server.h"
 #include "munit/munit.h"
 #include "munit/munit-goto.h"
+/* NOTE: the classes of the fair_wait pool are internal to margo */
+#include "../../src/margo-fair-pool.h"
 
 /* the intent of these unit tests is to verify the ability to modify various
  * argobots pool settings
@@ -138,9 +140,137 @@ error:
     return MUNIT_FAIL;
 }
 
+/* ULTs of the fair_wait tests, which record the order they ran in */
+struct fair_ult {
+    uint64_t  class_id;
+    unsigned* next_pos;
+    unsigned  pos;
+};
+
+static void fair_ult_func(void* args)
+{
+    struct fair_ult* ult = (struct fair_ult*)args;
+    ult->pos = __atomic_fetch_add(ult->next_pos, 1, __ATOMIC_RELAXED);
+}
+
+struct fair_gate {
+    int started;
+    int released;
+};
+
+/* occupies the xstream of the pool until released, without yielding, so
+ * that the ULTs pushed in the meantime are all queued */
+static void fair_gate_func(void* args)
+{
+    struct fair_gate* gate = (struct fair_gate*)args;
+    __atomic_store_n(&gate->started, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&gate->released, __ATOMIC_ACQUIRE)) {}
+}
+
+/* Pushes num_ults ULTs of classes[0], then num_ults ULTs of classes[1],
+ * while the pool's xstream is busy, and records the order they ran in */
+static void run_fair_ults(ABT_pool pool, const uint64_t classes[2],
+                          unsigned num_ults, struct fair_ult* ults)
+{
+    struct fair_gate gate = {0};
+    ABT_thread gate_ult = ABT_THREAD_NULL;
+    ABT_thread_create(pool, fair_gate_func, &gate, ABT_THREAD_ATTR_NULL, &gate_ult);
+    while (!__atomic_load_n(&gate.started, __ATOMIC_ACQUIRE)) {}
+
+    unsigned next_pos = 0;
+    ABT_thread* threads = calloc(2 * num_ults, sizeof(*threads));
+    for(unsigned c = 0; c < 2; c++) {
+        for(unsigned i = 0; i < num_ults; i++) {
+            struct fair_ult* ult = &ults[c * num_ults + i];
+            ult->class_id = classes[c];
+            ult->next_pos = &next_pos;
+            margo_fair_pool_set_next_class(classes[c]);
+            ABT_thread_create(pool, fair_ult_func, ult, ABT_THREAD_ATTR_NULL,
+                              &threads[c * num_ults + i]);
+        }
+    }
+    margo_fair_pool_set_next_class(0);
+
+    __atomic_store_n(&gate.released, 1, __ATOMIC_RELEASE);
+    ABT_thread_join(gate_ult);
+    ABT_thread_free(&gate_ult);
+    for(unsigned i = 0; i < 2 * num_ults; i++) {
+        ABT_thread_join(threads[i]);
+        ABT_thread_free(&threads[i]);
+    }
+    free(threads);
+}
+
+/* test that the fair_wait pool serves its classes in deficit round robin,
+ * according to their weights */
+static MunitResult fair_wait_drr(const MunitParameter params[], void* data)
+{
+    (void)params;
+    const char * protocol = "na+sm";
+    struct margo_init_info mii = {0};
+    struct test_context* ctx = (struct test_context*)data;
+
+    const char* config = "{"
+        "\"argobots\": {"
+            "\"pools\": ["
+                "{ \"name\":\"my_pool\", \"kind\":\"fair_wait\","
+                  "\"weights\":[{\"address\":\"heavy\",\"weight\":3}] }"
+            "],"
+            "\"xstreams\": ["
+                "{ \"name\":\"my_xstream\", "
+                  "\"scheduler\": {"
+                    "\"type\":\"basic_wait\","
+                    "\"pools\":[\"my_pool\"]"
+                  "}"
+                "}"
+            "]"
+        "}"
+    "}";
+    mii.json_config = config;
+
+    ctx->mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &mii);
+    munit_assert_not_null(ctx->mid);
+
+    struct margo_pool_info info = {0};
+    hg_return_t hret = margo_find_pool_by_name(ctx->mid, "my_pool", &info);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    struct fair_ult ults[64];
+
+    /* 32 ULTs of a client queued before those of another client: both
+     * classes have weight 1 and take turns, so the second client's ULTs
+     * do not wait for all of the first one's */
+    uint64_t classes[2] = {margo_fair_pool_hash("client-a"),
+                           margo_fair_pool_hash("client-b")};
+    memset(ults, 0, sizeof(ults));
+    run_fair_ults(info.pool, classes, 32, ults);
+    for(unsigned i = 0; i < 32; i++) {
+        munit_assert_uint(ults[i].pos, ==, 2 * i);
+        munit_assert_uint(ults[32 + i].pos, ==, 2 * i + 1);
+    }
+
+    /* "heavy" has weight 3 in the configuration: it runs 3 ULTs in each
+     * of its turns, the other class 1 */
+    classes[0] = margo_fair_pool_hash("heavy");
+    memset(ults, 0, sizeof(ults));
+    run_fair_ults(info.pool, classes, 16, ults);
+    for(unsigned i = 0; i < 16; i++) {
+        /* turn t (of 4 ULTs) runs heavy ULTs 3t..3t+2, then light ULT t */
+        unsigned turn = i / 3;
+        munit_assert_uint(ults[i].pos, ==, 4 * turn + i % 3);
+    }
+    for(unsigned i = 0; i < 5; i++)
+        munit_assert_uint(ults[16 + i].pos, ==, 4 * i + 3);
+
+    margo_finalize(ctx->mid);
+
+    return MUNIT_OK;
+}
+
 static char* pool_params[] = {
     "prio_wait",
     "earliest_first",
+    "fair_wait",
     NULL
 };
 
@@ -151,6 +281,7 @@ static MunitParameterEnum rpc_pool_kind_params[] = {
 
 static MunitTest tests[] = {
     { "/rpc-pool-kind", rpc_pool_kind, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, rpc_pool_kind_params},
+    { "/fair-wait-drr", fair_wait_drr, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL},
     { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
 
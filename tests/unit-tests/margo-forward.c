@@ -4,6 +4,7 @@
  * See COPYRIGHT in top-level directory.
  */
 #include <stdio.h>
+#include <unistd.h>
 #include <margo.h>
 #include <margo-hg-shim.h>
 #include <mercury_proc_string.h>
@@ -11,6 +12,8 @@
 #include "helper-server.h"
 #include "munit/munit.h"
 #include "munit/munit-goto.h"
+/* NOTE: the format of the RPC capture file is internal to margo */
+#include "../../src/margo-rpc-capture.h"
 
 #define P(__msg__) printf("%s\n", __msg__); fflush(stdout)
 
@@ -50,6 +53,64 @@ static void sum_ult(hg_handle_t handle)
 }
 DEFINE_MARGO_RPC_HANDLER(sum_ult)
 
+DECLARE_MARGO_RPC_HANDLER(sleepy_sum_ult)
+static void sleepy_sum_ult(hg_handle_t handle)
+{
+    margo_thread_sleep(margo_hg_handle_get_instance(handle), 100);
+    sum_ult(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(sleepy_sum_ult)
+
+/* Returns the stack size of the ULT running the handler */
+DECLARE_MARGO_RPC_HANDLER(stack_size_ult)
+static void stack_size_ult(hg_handle_t handle)
+{
+    ABT_thread      self = ABT_THREAD_NULL;
+    ABT_thread_attr attr = ABT_THREAD_ATTR_NULL;
+    size_t          stack_size = 0;
+    ABT_self_get_thread(&self);
+    ABT_thread_get_attr(self, &attr);
+    ABT_thread_attr_get_stacksize(attr, &stack_size);
+    ABT_thread_attr_free(&attr);
+    uint64_t out = stack_size;
+    margo_respond(handle, &out);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(stack_size_ult)
+
+MERCURY_GEN_PROC(ult_ids_t,
+        ((uint64_t)(id0))\
+        ((uint64_t)(id1))\
+        ((uint64_t)(id2)))
+
+/* Returns the id of the ULT running the handler as id<depth>, after
+ * forwarding the RPC to itself with depth-1 to fill the lower ids */
+DECLARE_MARGO_RPC_HANDLER(ult_ids_ult)
+static void ult_ids_ult(hg_handle_t handle)
+{
+    margo_instance_id     mid  = margo_hg_handle_get_instance(handle);
+    const struct hg_info* info = margo_get_info(handle);
+    uint32_t              depth = 0;
+    ult_ids_t             out   = {0, 0, 0};
+    margo_get_input(handle, &depth);
+    if(depth > 0) {
+        hg_handle_t nested = HG_HANDLE_NULL;
+        uint32_t    nested_depth = depth - 1;
+        munit_assert_int(margo_create(mid, info->addr, info->id, &nested), ==, HG_SUCCESS);
+        munit_assert_int(margo_forward(nested, &nested_depth), ==, HG_SUCCESS);
+        munit_assert_int(margo_get_output(nested, &out), ==, HG_SUCCESS);
+        margo_free_output(nested, &out);
+        margo_destroy(nested);
+    }
+    ABT_unit_id self_id = 0;
+    ABT_self_get_thread_id(&self_id);
+    uint64_t* ids[3] = {&out.id0, &out.id1, &out.id2};
+    *ids[depth] = self_id;
+    margo_respond(handle, &out);
+    margo_free_input(handle, &depth);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(ult_ids_ult)
 
 static int svr_init_fn(margo_instance_id mid, void* arg)
 {
@@ -59,6 +120,11 @@ static int svr_init_fn(margo_instance_id mid, void* arg)
     MARGO_REGISTER(mid, "null_rpc", void, void, NULL);
     MARGO_REGISTER_PROVIDER(mid, "provider_rpc", void, void, rpc_ult, 42, ABT_POOL_NULL);
     MARGO_REGISTER(mid, "get_name", void, hg_string_t, get_name_ult);
+    MARGO_REGISTER_INLINE(mid, "sum_inline", sum_in_t, int32_t, sum_ult);
+    hg_id_t id = MARGO_REGISTER(mid, "sum_tasklet", sum_in_t, int32_t, sum_ult);
+    margo_rpc_set_execution_mode(mid, id, MARGO_RPC_MODE_TASKLET);
+    id = MARGO_REGISTER(mid, "small_stack", void, uint64_t, stack_size_ult);
+    margo_rpc_set_stack_size(mid, id, 64*1024);
     return (0);
 }
 
@@ -218,6 +284,192 @@ error:
     return MUNIT_FAIL;
 }
 
+static MunitResult test_forward_no_ult(const MunitParameter params[],
+                                       void*                data)
+{
+    (void)params;
+    (void)data;
+    hg_return_t hret = HG_SUCCESS;
+    hg_handle_t handle = HG_HANDLE_NULL;
+    hg_addr_t   addr = HG_ADDR_NULL;
+    int32_t     out = 0;
+    int         mode = -1;
+
+    struct test_context* ctx = (struct test_context*)data;
+
+    hg_id_t inline_id = MARGO_REGISTER(ctx->mid, "sum_inline", sum_in_t, int32_t, NULL);
+    hg_id_t tasklet_id = MARGO_REGISTER(ctx->mid, "sum_tasklet", sum_in_t, int32_t, NULL);
+
+    hret = margo_rpc_get_execution_mode(ctx->mid, inline_id, &mode);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    munit_assert_int(mode, ==, MARGO_RPC_MODE_ULT);
+    hret = margo_rpc_set_execution_mode(ctx->mid, inline_id, 42);
+    munit_assert_int(hret, ==, HG_INVALID_ARG);
+
+    hret = margo_addr_lookup(ctx->mid, ctx->remote_addr, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hg_id_t ids[2] = {inline_id, tasklet_id};
+    for(int i = 0; i < 2; i++) {
+        hret = margo_create(ctx->mid, addr, ids[i], &handle);
+        munit_assert_int_goto(hret, ==, HG_SUCCESS, error);
+
+        sum_in_t in = {42, 58};
+        hret = margo_forward(handle, &in);
+        munit_assert_int_goto(hret, ==, HG_SUCCESS, error);
+
+        out = 0;
+        hret = margo_get_output(handle, &out);
+        munit_assert_int_goto(hret, ==, HG_SUCCESS, error);
+        munit_assert_int_goto(out, ==, 100, error);
+        margo_free_output(handle, &out);
+
+        margo_destroy(handle);
+        handle = HG_HANDLE_NULL;
+    }
+
+    margo_addr_free(ctx->mid, addr);
+    return MUNIT_OK;
+
+error:
+    margo_destroy(handle);
+    margo_addr_free(ctx->mid, addr);
+    return MUNIT_FAIL;
+}
+
+static MunitResult test_forward_small_stack(const MunitParameter params[],
+                                            void*                data)
+{
+    (void)params;
+    (void)data;
+    hg_return_t hret = HG_SUCCESS;
+    hg_handle_t handle = HG_HANDLE_NULL;
+    hg_addr_t   addr = HG_ADDR_NULL;
+    uint64_t    out = 0;
+    size_t      stack_size = 0;
+
+    struct test_context* ctx = (struct test_context*)data;
+
+    hg_id_t rpc_id = MARGO_REGISTER(ctx->mid, "small_stack", void, uint64_t, NULL);
+
+    hret = margo_rpc_set_stack_size(ctx->mid, rpc_id, 32*1024);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    hret = margo_rpc_get_stack_size(ctx->mid, rpc_id, &stack_size);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    munit_assert_long(stack_size, ==, 32*1024);
+
+    hret = margo_addr_lookup(ctx->mid, ctx->remote_addr, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_create(ctx->mid, addr, rpc_id, &handle);
+    munit_assert_int_goto(hret, ==, HG_SUCCESS, error);
+
+    hret = margo_forward(handle, NULL);
+    munit_assert_int_goto(hret, ==, HG_SUCCESS, error);
+
+    /* the server registered its handler with a 64 KiB stack */
+    hret = margo_get_output(handle, &out);
+    munit_assert_int_goto(hret, ==, HG_SUCCESS, error);
+    munit_assert_uint64_goto(out, ==, 64*1024, error);
+    margo_free_output(handle, &out);
+
+    margo_destroy(handle);
+    margo_addr_free(ctx->mid, addr);
+    return MUNIT_OK;
+
+error:
+    margo_destroy(handle);
+    margo_addr_free(ctx->mid, addr);
+    return MUNIT_FAIL;
+}
+
+/* Initializes an instance whose RPCs are executed by rpc_workers
+ * persistent ULTs (up to max_rpc_workers) and registers "ult_ids" */
+static margo_instance_id rpc_workers_init(unsigned rpc_workers,
+                                          unsigned max_rpc_workers,
+                                          hg_id_t* rpc_id)
+{
+    char config[1024];
+    snprintf(config, sizeof(config),
+             "{\"argobots\":{\"pools\":[{\"name\":\"__primary__\","
+             "\"kind\":\"fifo_wait\",\"rpc_workers\":%u,"
+             "\"max_rpc_workers\":%u}]}}", rpc_workers, max_rpc_workers);
+    struct margo_init_info init_info = {0};
+    init_info.json_config = config;
+    margo_instance_id mid = margo_init_ext("na+sm", MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+    *rpc_id = MARGO_REGISTER(mid, "ult_ids", uint32_t, ult_ids_t, ult_ids_ult);
+    return mid;
+}
+
+/* Sends an "ult_ids" RPC of the given depth to self */
+static ult_ids_t forward_ult_ids(margo_instance_id mid, hg_id_t rpc_id,
+                                 uint32_t depth)
+{
+    hg_addr_t   addr = HG_ADDR_NULL;
+    hg_handle_t handle = HG_HANDLE_NULL;
+    ult_ids_t   out = {0, 0, 0};
+    munit_assert_int(margo_addr_self(mid, &addr), ==, HG_SUCCESS);
+    munit_assert_int(margo_create(mid, addr, rpc_id, &handle), ==, HG_SUCCESS);
+    munit_assert_int(margo_forward(handle, &depth), ==, HG_SUCCESS);
+    munit_assert_int(margo_get_output(handle, &out), ==, HG_SUCCESS);
+    margo_free_output(handle, &out);
+    margo_destroy(handle);
+    margo_addr_free(mid, addr);
+    return out;
+}
+
+static MunitResult test_forward_rpc_workers(const MunitParameter params[],
+                                            void*                data)
+{
+    (void)params;
+    (void)data;
+    hg_id_t           rpc_id;
+    margo_instance_id mid = rpc_workers_init(1, 1, &rpc_id);
+
+    /* successive RPCs are executed by the same worker */
+    uint64_t worker = forward_ult_ids(mid, rpc_id, 0).id0;
+    for(int i = 0; i < 3; i++)
+        munit_assert_uint64(forward_ult_ids(mid, rpc_id, 0).id0, ==, worker);
+
+    /* the worker is blocked in the nested forward,
+     * so the nested RPC gets a ULT of its own */
+    ult_ids_t ids = forward_ult_ids(mid, rpc_id, 1);
+    munit_assert_uint64(ids.id1, ==, worker);
+    munit_assert_uint64(ids.id0, !=, worker);
+
+    margo_finalize(mid);
+    return MUNIT_OK;
+}
+
+static MunitResult test_forward_rpc_workers_growth(const MunitParameter params[],
+                                                   void*                data)
+{
+    (void)params;
+    (void)data;
+    hg_id_t           rpc_id;
+    margo_instance_id mid = rpc_workers_init(1, 2, &rpc_id);
+
+    /* the first nested RPC spawns a second worker, the second one
+     * finds both workers busy and max_rpc_workers reached */
+    ult_ids_t ids = forward_ult_ids(mid, rpc_id, 2);
+    munit_assert_uint64(ids.id2, !=, ids.id1);
+    munit_assert_uint64(ids.id0, !=, ids.id1);
+    munit_assert_uint64(ids.id0, !=, ids.id2);
+
+    /* the second worker stays, the fallback ULT does not */
+    ult_ids_t again = forward_ult_ids(mid, rpc_id, 2);
+    munit_assert(again.id2 == ids.id2 || again.id2 == ids.id1);
+    munit_assert(again.id1 == ids.id2 || again.id1 == ids.id1);
+    munit_assert_uint64(again.id1, !=, again.id2);
+    munit_assert_uint64(again.id0, !=, ids.id0);
+    munit_assert_uint64(again.id0, !=, ids.id1);
+    munit_assert_uint64(again.id0, !=, ids.id2);
+
+    margo_finalize(mid);
+    return MUNIT_OK;
+}
+
 static hg_return_t forward_with_shim_cb(const struct hg_cb_info *callback_info) {
     ABT_eventual ev = (ABT_eventual)callback_info->arg;
     ABT_eventual_set(ev, (void*)&callback_info->ret, sizeof(callback_info->ret));
@@ -672,6 +924,187 @@ error:
     return MUNIT_FAIL;
 }
 
+/* Sends num_rpcs "sum" RPCs to self with RPC capture enabled, and checks
+ * that each of them was recorded with its 8-byte input */
+static MunitResult run_rpc_capture(const char* monitoring_config,
+                                   int         num_rpcs)
+{
+    char filename[] = "/tmp/margo-rpc-capture-XXXXXX";
+    int fd = mkstemp(filename);
+    munit_assert_int(fd, >=, 0);
+    close(fd);
+
+    char config[1024];
+    snprintf(config, sizeof(config),
+             "{\"rpc_capture\":{\"filename\":\"%s\"}%s%s}", filename,
+             monitoring_config ? "," : "",
+             monitoring_config ? monitoring_config : "");
+    struct margo_init_info init_info = {0};
+    init_info.json_config = config;
+    margo_instance_id mid = margo_init_ext("na+sm", MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+    hg_id_t rpc_id = MARGO_REGISTER(mid, "sum", sum_in_t, int32_t, sum_ult);
+
+    hg_addr_t addr = HG_ADDR_NULL;
+    munit_assert_int(margo_addr_self(mid, &addr), ==, HG_SUCCESS);
+    for(int i = 0; i < num_rpcs; i++) {
+        hg_handle_t handle = HG_HANDLE_NULL;
+        munit_assert_int(margo_create(mid, addr, rpc_id, &handle), ==, HG_SUCCESS);
+        sum_in_t in = {42, 58};
+        munit_assert_int(margo_forward(handle, &in), ==, HG_SUCCESS);
+        int32_t out = 0;
+        munit_assert_int(margo_get_output(handle, &out), ==, HG_SUCCESS);
+        munit_assert_int(out, ==, 100);
+        margo_free_output(handle, &out);
+        margo_destroy(handle);
+    }
+    margo_addr_free(mid, addr);
+    margo_finalize(mid);
+
+    /* one record per RPC, with the 8 bytes of the input */
+    FILE* file = fopen(filename, "r");
+    munit_assert_not_null(file);
+    margo_rpc_capture_file_header_t file_header;
+    munit_assert_int(fread(&file_header, sizeof(file_header), 1, file), ==, 1);
+    munit_assert_memory_equal(8, file_header.magic, MARGO_RPC_CAPTURE_MAGIC);
+    munit_assert_int(file_header.version, ==, MARGO_RPC_CAPTURE_VERSION);
+    for(int i = 0; i < num_rpcs; i++) {
+        margo_rpc_capture_record_header_t header;
+        munit_assert_int(fread(&header, sizeof(header), 1, file), ==, 1);
+        munit_assert_int(header.flags, ==, 0);
+        munit_assert_int(header.provider_id, ==, MARGO_DEFAULT_PROVIDER_ID);
+        munit_assert_int(header.name_length, ==, 3);
+        munit_assert_int(header.input_size, ==, 8);
+        munit_assert_int(header.stored_size, ==, 8);
+        munit_assert_int(header.response_size, >, 0);
+        char record[11];
+        munit_assert_int(fread(record, 1, sizeof(record), file), ==, 11);
+        munit_assert_memory_equal(3, record, "sum");
+    }
+    munit_assert_int(fgetc(file), ==, EOF);
+    fclose(file);
+    unlink(filename);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_rpc_capture(const MunitParameter params[],
+                                    void*                data)
+{
+    (void)params;
+    (void)data;
+    return run_rpc_capture(NULL, 1);
+}
+
+static MunitResult test_rpc_capture_sampled(const MunitParameter params[],
+                                            void*                data)
+{
+    (void)params;
+    (void)data;
+    /* RPCs left out by the monitor's sampling are still captured */
+    return run_rpc_capture(
+        "\"monitoring\":{\"config\":{"
+            "\"filename_prefix\":\"test\","
+            "\"statistics\":{\"disable\":false,\"sample_rpcs_every\":3},"
+            "\"time_series\":{\"disable\":true}}}", 6);
+}
+
+/* Initializes an instance with the given "rpc_limits" configuration
+ * and registers "sum" (sleeping 100ms if sleepy is true) */
+static margo_instance_id rpc_limits_init(const char* limits,
+                                         bool        sleepy,
+                                         hg_id_t*    rpc_id)
+{
+    char config[1024];
+    snprintf(config, sizeof(config), "{\"rpc_limits\":%s}", limits);
+    struct margo_init_info init_info = {0};
+    init_info.json_config = config;
+    margo_instance_id mid = margo_init_ext("na+sm", MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+    if(sleepy) {
+        *rpc_id = MARGO_REGISTER(mid, "sum", sum_in_t, int32_t, sleepy_sum_ult);
+    } else {
+        *rpc_id = MARGO_REGISTER(mid, "sum", sum_in_t, int32_t, sum_ult);
+    }
+    return mid;
+}
+
+static MunitResult test_rpc_limits_busy(const MunitParameter params[],
+                                        void*                data)
+{
+    (void)params;
+    (void)data;
+    const char* limits[] = {
+        "[{\"rpc_name\":\"sum\",\"max_concurrent\":1,\"max_queued\":0}]",
+        "[{\"rpc_name\":\"sum\",\"max_concurrent\":1,\"max_queued\":1}]"
+    };
+    /* with max_queued = 0 the second of two concurrent RPCs is rejected,
+     * with max_queued = 1 it is the third of three */
+    for(int k = 0; k < 2; k++) {
+        hg_id_t rpc_id;
+        margo_instance_id mid = rpc_limits_init(limits[k], true, &rpc_id);
+        hg_addr_t addr = HG_ADDR_NULL;
+        munit_assert_int(margo_addr_self(mid, &addr), ==, HG_SUCCESS);
+
+        int num_rpcs = k + 2;
+        hg_handle_t   handles[3];
+        margo_request reqs[3];
+        sum_in_t in = {42, 58};
+        for(int i = 0; i < num_rpcs; i++) {
+            munit_assert_int(margo_create(mid, addr, rpc_id, &handles[i]), ==, HG_SUCCESS);
+            munit_assert_int(margo_iforward(handles[i], &in, &reqs[i]), ==, HG_SUCCESS);
+        }
+        int num_busy = 0;
+        for(int i = 0; i < num_rpcs; i++) {
+            hg_return_t hret = margo_wait(reqs[i]);
+            if(hret == HG_BUSY) {
+                num_busy += 1;
+            } else {
+                munit_assert_int(hret, ==, HG_SUCCESS);
+                int32_t out = 0;
+                munit_assert_int(margo_get_output(handles[i], &out), ==, HG_SUCCESS);
+                munit_assert_int(out, ==, 100);
+                margo_free_output(handles[i], &out);
+            }
+            margo_destroy(handles[i]);
+        }
+        munit_assert_int(num_busy, ==, 1);
+
+        margo_addr_free(mid, addr);
+        margo_finalize(mid);
+    }
+    return MUNIT_OK;
+}
+
+static MunitResult test_rpc_limits_rate(const MunitParameter params[],
+                                        void*                data)
+{
+    (void)params;
+    (void)data;
+    hg_id_t rpc_id;
+    margo_instance_id mid = rpc_limits_init(
+        "[{\"rpc_name\":\"sum\",\"rate\":10,\"burst\":1}]", false, &rpc_id);
+    hg_addr_t addr = HG_ADDR_NULL;
+    munit_assert_int(margo_addr_self(mid, &addr), ==, HG_SUCCESS);
+
+    /* the first RPC uses the token in the bucket,
+     * the next 4 wait 100ms each for a new token */
+    double start = ABT_get_wtime();
+    for(int i = 0; i < 5; i++) {
+        hg_handle_t handle = HG_HANDLE_NULL;
+        munit_assert_int(margo_create(mid, addr, rpc_id, &handle), ==, HG_SUCCESS);
+        sum_in_t in = {42, 58};
+        munit_assert_int(margo_forward(handle, &in), ==, HG_SUCCESS);
+        margo_destroy(handle);
+    }
+    double elapsed = ABT_get_wtime() - start;
+    munit_assert_double(elapsed, >=, 0.35);
+
+    margo_addr_free(mid, addr);
+    margo_finalize(mid);
+    return MUNIT_OK;
+}
+
 static char* protocol_params[] = {"na+sm", NULL};
 static char* progress_pool_params[] = {"fifo_wait", "prio_wait", "earliest_first", NULL};
 static char* progress_when_needed_params[] = {"true", "false", NULL};
@@ -692,6 +1125,14 @@ static MunitTest test_suite_tests[] = {
      test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params},
     {(char*)"/forward_with_args", test_forward_with_args, test_context_setup,
      test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params},
+    {(char*)"/forward_no_ult", test_forward_no_ult, test_context_setup,
+     test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params},
+    {(char*)"/forward_small_stack", test_forward_small_stack, test_context_setup,
+     test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params},
+    {(char*)"/forward_rpc_workers", test_forward_rpc_workers, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char*)"/forward_rpc_workers_growth", test_forward_rpc_workers_growth,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
     {(char*)"/forward_with_shim", test_forward_with_shim, test_context_setup,
      test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params2},
     {(char*)"/forward_to_null", test_forward_to_null, test_context_setup,
@@ -712,6 +1153,14 @@ static MunitTest test_suite_tests[] = {
      test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params},
     {(char*)"/provider_cforward", test_provider_cforward, test_context_setup,
      test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params},
+    {(char*)"/rpc_capture", test_rpc_capture, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char*)"/rpc_capture_sampled", test_rpc_capture_sampled, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char*)"/rpc_limits_busy", test_rpc_limits_busy, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char*)"/rpc_limits_rate", test_rpc_limits_rate, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
     {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
 
 static const MunitSuite test_suite
@@ -1,4 +1,5 @@
 
+#include <unistd.h>
 #include <margo.h>
 #include "helper-server.h"
 #include "munit/munit.h"
@@ -203,6 +204,120 @@ static MunitResult vary_log_level(const MunitParameter params[], void* data)
     return MUNIT_OK;
 }
 
+static MunitResult macro_log_level(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* ctx = (struct test_context*)data;
+    int evaluated = 0;
+    int ret;
+
+    /* Expected result: at the default log level, trace messages are not
+     * emitted and, unless another instance lowered the minimum level,
+     * their arguments are not evaluated.
+     */
+    MARGO_TRACE(ctx->mid, "MACRO_TRACE %d ", ++evaluated);
+    munit_assert_null(strstr(ctx->log_buffer, "MACRO_TRACE"));
+    if(__margo_log_min_level > MARGO_LOG_TRACE)
+        munit_assert_int(evaluated, ==, 0);
+
+    MARGO_WARNING(ctx->mid, "MACRO_WARNING ");
+    munit_assert_not_null(strstr(ctx->log_buffer, "MACRO_WARNING"));
+
+    /* lowering the level of the instance enables the macro */
+    ret = margo_set_log_level(ctx->mid, MARGO_LOG_TRACE);
+    munit_assert_int(ret, ==, 0);
+    munit_assert_int(__margo_log_min_level, <=, MARGO_LOG_TRACE);
+
+    evaluated = 0;
+    MARGO_TRACE(ctx->mid, "MACRO_TRACE %d ", ++evaluated);
+#if MARGO_MIN_LOG_LEVEL <= 1
+    munit_assert_int(evaluated, ==, 1);
+    munit_assert_not_null(strstr(ctx->log_buffer, "MACRO_TRACE 1"));
+#else
+    munit_assert_int(evaluated, ==, 0);
+    munit_assert_null(strstr(ctx->log_buffer, "MACRO_TRACE"));
+#endif
+
+    return MUNIT_OK;
+}
+
+static MunitResult async_logging(const MunitParameter params[], void* data)
+{
+    (void)params;
+    (void)data;
+    char filename[] = "/tmp/margo-async-log-XXXXXX";
+    int fd = mkstemp(filename);
+    munit_assert_int(fd, >=, 0);
+    close(fd);
+
+    char config[256];
+    snprintf(config, sizeof(config),
+             "{\"async_logging\":{\"filename\":\"%s\",\"rate_limit\":5}}",
+             filename);
+    struct margo_init_info init_info = {0};
+    init_info.json_config = config;
+    margo_instance_id mid = margo_init_ext("na+sm", MARGO_CLIENT_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    struct margo_async_log_stats stats = {0};
+    munit_assert_int(margo_get_async_log_stats(mid, &stats), ==, 0);
+
+    /* messages from the same call site are rate limited, at most two
+     * windows of 5 messages can be used by the loop */
+    for(int i = 0; i < 20; i++)
+        margo_warning(mid, "ASYNC_WARNING %d", i);
+    margo_error(mid, "ASYNC_ERROR");
+    margo_trace(mid, "ASYNC_TRACE");
+
+    munit_assert_int(margo_get_async_log_stats(mid, &stats), ==, 0);
+    munit_assert_int(stats.logged + stats.rate_limited, ==, 21);
+    munit_assert_int(stats.rate_limited, >=, 10);
+    munit_assert_int(stats.dropped, ==, 0);
+
+    margo_finalize(mid);
+
+    /* the drain thread wrote everything on finalize */
+    char content[4096] = {0};
+    FILE* file = fopen(filename, "r");
+    munit_assert_not_null(file);
+    size_t size = fread(content, 1, sizeof(content) - 1, file);
+    fclose(file);
+    unlink(filename);
+    munit_assert_int(size, >, 0);
+    munit_assert_not_null(strstr(content, "[warning] ASYNC_WARNING 0\n"));
+    munit_assert_not_null(strstr(content, "[error] ASYNC_ERROR\n"));
+    munit_assert_null(strstr(content, "ASYNC_TRACE"));
+    munit_assert_not_null(strstr(content, "rate limited"));
+
+    return MUNIT_OK;
+}
+
+static MunitResult async_logging_custom_logger(const MunitParameter params[],
+                                                void*                data)
+{
+    (void)params;
+    struct test_context* ctx = (struct test_context*)data;
+
+    /* the custom logger keeps receiving the messages synchronously */
+    struct margo_init_info init_info = {0};
+    init_info.json_config = "{\"async_logging\":{}}";
+    init_info.logger      = &test_logger;
+    margo_instance_id mid = margo_init_ext("na+sm", MARGO_CLIENT_MODE, &init_info);
+    munit_assert_not_null(mid);
+    munit_assert_not_null(strstr(ctx->log_buffer, "async_logging"));
+
+    margo_error(mid, "CUSTOM_ERROR");
+    munit_assert_not_null(strstr(ctx->log_buffer, "CUSTOM_ERROR"));
+
+    struct margo_async_log_stats stats = {0};
+    munit_assert_int(margo_get_async_log_stats(mid, &stats), ==, 0);
+    munit_assert_int(stats.logged, ==, 0);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
 static MunitTest tests[]
     = {{"/default_log_level", default_log_level, test_context_setup,
         test_context_tear_down, MUNIT_TEST_OPTION_NONE, get_mid},
@@ -210,6 +325,13 @@ static MunitTest tests[]
         test_context_tear_down, MUNIT_TEST_OPTION_NONE, get_log_level},
        {"/init_quiet_log", init_quiet_log, test_context_setup,
         test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL},
+       {"/macro_log_level", macro_log_level, test_context_setup,
+        test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL},
+       {"/async_logging", async_logging, test_context_setup,
+        test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL},
+       {"/async_logging_custom_logger", async_logging_custom_logger,
+        test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE,
+        NULL},
        {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
 
 static const MunitSuite test_suite
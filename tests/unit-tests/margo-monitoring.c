@@ -4,12 +4,15 @@
  * See COPYRIGHT in top-level directory.
  */
 #include <stdio.h>
+#include <inttypes.h>
 #include <margo.h>
 #include <unistd.h>
+#include <time.h>
 #include <json-c/json.h>
 #include <mercury_proc_string.h>
 #include "munit/munit.h"
 #include "munit/munit-goto.h"
+#include "helper-server.h"
 
 struct call_info {
     uint64_t fn_start;
@@ -197,6 +200,108 @@ static void custom_echo_ult(hg_handle_t handle)
 }
 DEFINE_MARGO_RPC_HANDLER(custom_echo_ult)
 
+DECLARE_MARGO_RPC_HANDLER(blocking_ult)
+static void blocking_ult(hg_handle_t handle)
+{
+    /* blocks the xstream, and therefore the progress loop */
+    usleep(300000);
+    hg_return_t hret = margo_respond(handle, NULL);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    hret = margo_destroy(handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+}
+DEFINE_MARGO_RPC_HANDLER(blocking_ult)
+
+DECLARE_MARGO_RPC_HANDLER(spinning_ult)
+static void spinning_ult(hg_handle_t handle)
+{
+    /* uses 50ms of CPU without yielding */
+    struct timespec start, now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    do {
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1e3
+             + (now.tv_nsec - start.tv_nsec) * 1e-6 < 50.0);
+    hg_return_t hret = margo_respond(handle, NULL);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    hret = margo_destroy(handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+}
+DEFINE_MARGO_RPC_HANDLER(spinning_ult)
+
+/* bitmask of the xstreams on which busy_ult ran */
+static uint64_t busy_ult_xstreams = 0;
+
+DECLARE_MARGO_RPC_HANDLER(busy_ult)
+static void busy_ult(hg_handle_t handle)
+{
+    /* blocks its xstream for 20ms, so that concurrent RPCs have to be
+     * handled by the other xstreams sharing the pool */
+    int rank = 0;
+    ABT_self_get_xstream_rank(&rank);
+    __atomic_fetch_or(&busy_ult_xstreams, UINT64_C(1) << (rank % 64),
+                      __ATOMIC_RELAXED);
+    usleep(20000);
+    hg_return_t hret = margo_respond(handle, NULL);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    hret = margo_destroy(handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+}
+DEFINE_MARGO_RPC_HANDLER(busy_ult)
+
+DECLARE_MARGO_RPC_HANDLER(ping_ult)
+static void ping_ult(hg_handle_t handle)
+{
+    margo_respond(handle, NULL);
+    margo_destroy(handle);
+}
+DEFINE_MARGO_RPC_HANDLER(ping_ult)
+
+static int ping_server_init(margo_instance_id mid, void* arg)
+{
+    (void)arg;
+    MARGO_REGISTER(mid, "ping", void, void, ping_ult);
+    return 0;
+}
+
+DECLARE_MARGO_RPC_HANDLER(sleeping_ult)
+static void sleeping_ult(hg_handle_t handle)
+{
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+    margo_thread_sleep(mid, 100);
+    hg_return_t hret = margo_respond(handle, NULL);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    hret = margo_destroy(handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+}
+DEFINE_MARGO_RPC_HANDLER(sleeping_ult)
+
+DECLARE_MARGO_RPC_HANDLER(nesting_ult)
+static void nesting_ult(hg_handle_t handle)
+{
+    /* sends two "spinning" RPCs to itself, with sample_rpcs_every = 2
+     * one of them is not monitored */
+    margo_instance_id mid = margo_hg_handle_get_instance(handle);
+    hg_id_t spinning_id = 0;
+    hg_bool_t flag = HG_FALSE;
+    margo_registered_name(mid, "spinning", &spinning_id, &flag);
+    munit_assert_true(flag);
+    const struct hg_info* info = margo_get_info(handle);
+    for(int i = 0; i < 2; i++) {
+        hg_handle_t nested = HG_HANDLE_NULL;
+        hg_return_t hret = margo_create(mid, info->addr, spinning_id, &nested);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+        hret = margo_forward(nested, NULL);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+        margo_destroy(nested);
+    }
+    hg_return_t hret = margo_respond(handle, NULL);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    hret = margo_destroy(handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+}
+DEFINE_MARGO_RPC_HANDLER(nesting_ult)
+
 static void* test_context_setup(const MunitParameter params[], void* user_data)
 {
     (void)params;
@@ -342,6 +447,102 @@ static MunitResult test_custom_monitoring(const MunitParameter params[],
     return MUNIT_OK;
 }
 
+struct skipping_monitor_data {
+    unsigned num_forwards;
+    unsigned num_waits[2];         /* FN_START, FN_END */
+    unsigned num_skipped_waits[2]; /* FN_START, FN_END */
+};
+
+static void skipping_monitor_on_create(void*                       uargs,
+                                       double                      timestamp,
+                                       margo_monitor_event_t       event_type,
+                                       margo_monitor_create_args_t event_args)
+{
+    (void)uargs;
+    (void)timestamp;
+    /* exclude all the handles created with margo_create */
+    if (event_type == MARGO_MONITOR_FN_END)
+        margo_monitoring_skip_handle(event_args->handle);
+}
+
+static void skipping_monitor_on_forward(void*                        uargs,
+                                        double                       timestamp,
+                                        margo_monitor_event_t        event_type,
+                                        margo_monitor_forward_args_t event_args)
+{
+    (void)timestamp;
+    (void)event_args;
+    struct skipping_monitor_data* data = (struct skipping_monitor_data*)uargs;
+    if (event_type == MARGO_MONITOR_FN_START) data->num_forwards += 1;
+}
+
+static void skipping_monitor_on_wait(void*                     uargs,
+                                     double                    timestamp,
+                                     margo_monitor_event_t     event_type,
+                                     margo_monitor_wait_args_t event_args)
+{
+    (void)timestamp;
+    struct skipping_monitor_data* data = (struct skipping_monitor_data*)uargs;
+    int i = event_type == MARGO_MONITOR_FN_START ? 0 : 1;
+    if (event_args->skipped)
+        data->num_skipped_waits[i] += 1;
+    else
+        data->num_waits[i] += 1;
+}
+
+static MunitResult test_custom_monitoring_skipped_wait(
+        const MunitParameter params[], void* data)
+{
+    (void)data;
+    hg_return_t hret                          = HG_SUCCESS;
+    struct skipping_monitor_data monitor_data = {0};
+
+    struct margo_monitor custom_monitor = {
+        .uargs      = (void*)&monitor_data,
+        .initialize = test_monitor_initialize,
+        .finalize   = test_monitor_finalize,
+        .on_create  = skipping_monitor_on_create,
+        .on_forward = skipping_monitor_on_forward,
+        .on_wait    = skipping_monitor_on_wait
+    };
+
+    const char* protocol = munit_parameters_get(params, "protocol");
+    struct margo_init_info init_info = {
+        .json_config   = NULL,
+        .monitor       = &custom_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    hg_id_t ping_id = MARGO_REGISTER(mid, "ping", void, void, ping_ult);
+
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hg_handle_t handle = HG_HANDLE_NULL;
+    hret = margo_create(mid, addr, ping_id, &handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    hret = margo_forward(handle, NULL);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    margo_destroy(handle);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    /* the forward is not reported, but its wait is, as skipped */
+    munit_assert_int(monitor_data.num_forwards, ==, 0);
+    munit_assert_int(monitor_data.num_skipped_waits[0], >=, 1);
+    munit_assert_int(monitor_data.num_skipped_waits[0], ==,
+                     monitor_data.num_skipped_waits[1]);
+    munit_assert_int(monitor_data.num_waits[0], ==,
+                     monitor_data.num_waits[1]);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
 static void check_json_statistics_content(
         struct json_object* content,
         uint16_t provider_id_param,
@@ -388,7 +589,8 @@ static MunitResult test_default_monitoring_statistics(const MunitParameter param
         "{\"monitoring\":{"
             "\"config\":{"
                 "\"filename_prefix\":\"test\","
-                "\"statistics\":{\"precision\":9, \"disable\":false,\"pretty_json\":true},"
+                "\"statistics\":{\"precision\":9, \"disable\":false,\"pretty_json\":true,"
+                                "\"percentiles\":[50, 90, 99, 99.9]},"
                 "\"time_series\":{\"disable\":true}"
             "}"
         "}}";
@@ -555,6 +757,20 @@ static void check_json_statistics_content(
         } \
     } while(0)
 
+#define ASSERT_JSON_HAS_HISTOGRAM(parent, key, zero) \
+    do { \
+        ASSERT_JSON_HAS(parent, key, object); \
+        ASSERT_JSON_HAS(key, num, int); \
+        ASSERT_JSON_HAS_KEY(key, "p50", p50, double); \
+        ASSERT_JSON_HAS_KEY(key, "p99.9", p999, double); \
+        if(zero) { \
+            munit_assert_int(0, ==, json_object_get_int64(num)); \
+        } else { \
+            munit_assert_int(0, <, json_object_get_int64(num)); \
+            munit_assert_double(json_object_get_double(p50), <=, json_object_get_double(p999)); \
+        } \
+    } while(0)
+
 #define ASSERT_JSON_HAS_DOUBLE_STATS(parent, key, secondary, zero) \
     do { \
         ASSERT_JSON_HAS(parent, key, object); \
@@ -611,6 +827,8 @@ static void check_json_statistics_content(
                 ASSERT_JSON_HAS_DOUBLE_STATS(sent_to, iforward_wait, relative_timestamp_from_iforward_end, expected_zeros);
                 ASSERT_JSON_HAS_DOUBLE_STATS(sent_to, set_input, relative_timestamp_from_iforward_start, expected_zeros);
                 ASSERT_JSON_HAS_DOUBLE_STATS(sent_to, get_output, relative_timestamp_from_wait_end, expected_zeros);
+                ASSERT_JSON_HAS(sent_to, histograms, object);
+                ASSERT_JSON_HAS_HISTOGRAM(histograms, forward, expected_zeros);
             }
             // RPC must have an "target" section
             ASSERT_JSON_HAS(echo, target, object);
@@ -626,6 +844,10 @@ static void check_json_statistics_content(
                 ASSERT_JSON_HAS_DOUBLE_STATS(received_from, irespond_wait, relative_timestamp_from_irespond_end, expected_zeros);
                 ASSERT_JSON_HAS_DOUBLE_STATS(received_from, set_output, relative_timestamp_from_irespond_start, expected_zeros);
                 ASSERT_JSON_HAS_DOUBLE_STATS(received_from, get_input, relative_timestamp_from_ult_start, expected_zeros);
+                ASSERT_JSON_HAS(received_from, histograms, object);
+                ASSERT_JSON_HAS_HISTOGRAM(histograms, ult_queue, expected_zeros);
+                ASSERT_JSON_HAS_HISTOGRAM(histograms, handler, expected_zeros);
+                ASSERT_JSON_HAS_HISTOGRAM(histograms, respond, expected_zeros);
                 // "received from ..." section must have a "bulk" section
                 ASSERT_JSON_HAS(received_from, bulk, object);
                 // "bulk" section must have a "create" section
@@ -642,6 +864,10 @@ static void check_json_statistics_content(
                 ASSERT_JSON_HAS_STATS(itransfer, size, expected_zeros);
                 ASSERT_JSON_HAS_DOUBLE_STATS(pull_from, transfer_cb, relative_timestamp_from_itransfer_start, expected_zeros);
                 ASSERT_JSON_HAS_DOUBLE_STATS(pull_from, itransfer_wait, relative_timestamp_from_itransfer_end, expected_zeros);
+                {
+                    ASSERT_JSON_HAS(pull_from, histograms, object);
+                    ASSERT_JSON_HAS_HISTOGRAM(histograms, transfer, expected_zeros);
+                }
             }
         }
         // must have an "65535:65535:65535:65535" secion with a bulk create
@@ -930,6 +1156,17 @@ static void check_json_time_series_content(
             ASSERT_JSON_HAS(echo, count, array);
             // check for the "bulk_size" array
             ASSERT_JSON_HAS(echo, bulk_size, array);
+            // check for the resolution tiers (1 sec and 1 min by default)
+            ASSERT_JSON_HAS(echo, resolution_sec, double);
+            munit_assert_double(1.0, ==, json_object_get_double(resolution_sec));
+            ASSERT_JSON_HAS(echo, tiers, array);
+            munit_assert_int(1, ==, json_object_array_length(tiers));
+            struct json_object* minutes = json_object_array_get_idx(tiers, 0);
+            ASSERT_JSON_HAS_KEY(minutes, "resolution_sec", minutes_res, double);
+            munit_assert_double(60.0, ==, json_object_get_double(minutes_res));
+            ASSERT_JSON_HAS_KEY(minutes, "timestamps", minutes_ts, array);
+            ASSERT_JSON_HAS_KEY(minutes, "count", minutes_count, array);
+            ASSERT_JSON_HAS_KEY(minutes, "bulk_size", minutes_bulk_size, array);
         }
         // check for the pool section
         ASSERT_JSON_HAS(json_content, pools, object);
@@ -946,29 +1183,1660 @@ static void check_json_time_series_content(
     }
 }
 
-static char* protocol_params[] = {"na+sm", NULL};
-static char* provider_id_params[] = {"65535", "42", "0", NULL};
-static char* relay_params[] = {"true", "false", NULL};
-static char* reset_params[] = {"true", "false", NULL};
+static void dump_sampled_statistics(void* uargs, const char* content, size_t size) {
+    (void)uargs;
+    struct json_object* json_content = NULL;
+    struct json_tokener* tokener     = json_tokener_new();
+    json_content = json_tokener_parse_ex(tokener, content, size);
+    json_tokener_free(tokener);
+    munit_assert_not_null(json_content);
 
-static MunitParameterEnum test_params_custom[]
-    = {{"protocol", protocol_params},
-       {NULL, NULL}};
+    struct json_object* stats = json_object_object_get(json_content, "stats");
+    munit_assert_not_null(stats);
+    struct json_object* sampling = json_object_object_get(stats, "sampling");
+    munit_assert_not_null(sampling);
+    munit_assert_int(2, ==, json_object_get_int(
+        json_object_object_get(sampling, "sample_rpcs_every")));
+    struct json_object* rpcs = json_object_object_get(sampling, "rpcs");
+    munit_assert(json_object_is_type(rpcs, json_type_array));
+    munit_assert_int(1, ==, json_object_array_length(rpcs));
+    struct json_object* echo = json_object_array_get_idx(rpcs, 0);
+    munit_assert_string_equal("echo", json_object_get_string(
+        json_object_object_get(echo, "name")));
+    /* all the RPCs are counted, one in two is monitored */
+    const char* sides[] = {"origin", "target"};
+    for(int i = 0; i < 2; i++) {
+        struct json_object* side = json_object_object_get(echo, sides[i]);
+        munit_assert_not_null(side);
+        munit_assert_int(4, ==, json_object_get_int64(
+            json_object_object_get(side, "num")));
+        munit_assert_int(2, ==, json_object_get_int64(
+            json_object_object_get(side, "sampled")));
+    }
 
-static MunitParameterEnum test_params[]
-    = {{"protocol", protocol_params},
-       {"provider_id", provider_id_params},
-       {"relay", relay_params},
-       {"reset", reset_params},
-       {NULL, NULL}};
+    json_object_put(json_content);
+}
 
-static MunitTest test_suite_tests[] = {
-    {(char*)"/monitoring/statistics", test_default_monitoring_statistics, test_context_setup,
-     test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params},
-    {(char*)"/monitoring/time_series", test_default_monitoring_time_series, test_context_setup,
-     test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params},
-    {(char*)"/monitoring/custom", test_custom_monitoring, test_context_setup,
+static MunitResult test_default_monitoring_sampling(const MunitParameter params[],
+                                                    void*                data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"test\","
+                "\"statistics\":{\"disable\":false,\"sample_rpcs_every\":2},"
+                "\"time_series\":{\"disable\":true}"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    hg_id_t echo_id = MARGO_REGISTER(
+        mid, "echo", echo_in_t, hg_string_t, echo_ult);
+    munit_assert_uint64(echo_id, !=, 0);
+
+    char      buffer[256];
+    void*     ptrs[1]  = { (void*)buffer };
+    hg_size_t sizes[1] = { 256 };
+    hg_bulk_t bulk     = HG_BULK_NULL;
+    hret = margo_bulk_create(mid, 1, ptrs, sizes, HG_BULK_READ_ONLY, &bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    echo_in_t in = {
+        .relay = HG_FALSE,
+        .str = (char*)"hello world",
+        .blk = bulk
+    };
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    for(int i = 0; i < 4; i++) {
+        hg_handle_t handle = HG_HANDLE_NULL;
+        hret = margo_create(mid, addr, echo_id, &handle);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_forward(handle, &in);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        char* output = NULL;
+        hret = margo_get_output(handle, &output);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_free_output(handle, &output);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_destroy(handle);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+    }
+
+    hret = margo_bulk_free(bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_monitor_dump(mid, dump_sampled_statistics, NULL, false);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+struct dump_chunks_args {
+    char*  content;
+    size_t size;
+    size_t num_chunks;
+};
+
+static void dump_chunks(void* uargs, const char* content, size_t size) {
+    struct dump_chunks_args* args = (struct dump_chunks_args*)uargs;
+    munit_assert_size(size, <=, 64);
+    args->content = realloc(args->content, args->size + size);
+    memcpy(args->content + args->size, content, size);
+    args->size       += size;
+    args->num_chunks += 1;
+}
+
+static MunitResult test_default_monitoring_dump_chunks(const MunitParameter params[],
+                                                       void*                data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"test\","
+                "\"dump_chunk_size\":64,"
+                "\"statistics\":{\"disable\":false},"
+                "\"time_series\":{\"disable\":false}"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    hg_id_t echo_id = MARGO_REGISTER(
+        mid, "echo", echo_in_t, hg_string_t, echo_ult);
+    munit_assert_uint64(echo_id, !=, 0);
+
+    char      buffer[256];
+    void*     ptrs[1]  = { (void*)buffer };
+    hg_size_t sizes[1] = { 256 };
+    hg_bulk_t bulk     = HG_BULK_NULL;
+    hret = margo_bulk_create(mid, 1, ptrs, sizes, HG_BULK_READ_ONLY, &bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    echo_in_t in = {
+        .relay = HG_FALSE,
+        .str = (char*)"hello world",
+        .blk = bulk
+    };
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hg_handle_t handle = HG_HANDLE_NULL;
+    hret = margo_create(mid, addr, echo_id, &handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_forward(handle, &in);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    char* output = NULL;
+    hret = margo_get_output(handle, &output);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_free_output(handle, &output);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_destroy(handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_bulk_free(bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    struct dump_chunks_args dump_args = {0};
+    hret = margo_monitor_dump(mid, dump_chunks, &dump_args, false);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    munit_assert_size(dump_args.num_chunks, >, 1);
+
+    /* the concatenation of the chunks is a single JSON document */
+    struct json_tokener* tokener = json_tokener_new();
+    struct json_object*  json_content
+        = json_tokener_parse_ex(tokener, dump_args.content, dump_args.size);
+    json_tokener_free(tokener);
+    munit_assert_not_null(json_content);
+    free(dump_args.content);
+
+    struct json_object* stats = json_object_object_get(json_content, "stats");
+    munit_assert_not_null(stats);
+    munit_assert_not_null(json_object_object_get(json_content, "series"));
+
+    /* the origin, target, and bulk statistics of the RPC are grouped */
+    struct json_object* rpcs = json_object_object_get(stats, "rpcs");
+    munit_assert_not_null(rpcs);
+    struct json_object* echo = NULL;
+    json_object_object_foreach(rpcs, rpc_key, rpc) {
+        (void)rpc_key;
+        const char* name = json_object_get_string(json_object_object_get(rpc, "name"));
+        if(name && strcmp(name, "echo") == 0) echo = rpc;
+    }
+    munit_assert_not_null(echo);
+    munit_assert_not_null(json_object_object_get(echo, "origin"));
+    struct json_object* target = json_object_object_get(echo, "target");
+    munit_assert_not_null(target);
+    munit_assert_int(json_object_object_length(target), ==, 1);
+    json_object_object_foreach(target, received_from, received_from_stats) {
+        munit_assert(strncmp(received_from, "received from ", 14) == 0);
+        munit_assert_not_null(json_object_object_get(received_from_stats, "handler"));
+        struct json_object* bulk = json_object_object_get(received_from_stats, "bulk");
+        munit_assert_not_null(bulk);
+        munit_assert_not_null(json_object_object_get(bulk, "create"));
+        munit_assert_int(json_object_object_length(bulk), ==, 2);
+    }
+
+    json_object_put(json_content);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+static void dump_trace(void* uargs, const char* content, size_t size) {
+    struct dump_chunks_args* args = (struct dump_chunks_args*)uargs;
+    args->content = realloc(args->content, args->size + size);
+    memcpy(args->content + args->size, content, size);
+    args->size       += size;
+    args->num_chunks += 1;
+}
+
+static MunitResult test_trace_monitoring(const MunitParameter params[],
+                                         void*                data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"monitoring\":{"
+            "\"config\":{"
+                "\"capacity\":1000"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_trace_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    /* the capacity is rounded up to a power of 2 */
+    char* config = margo_get_config(mid);
+    struct json_object* json_config_out = json_tokener_parse(config);
+    free(config);
+    struct json_object* capacity = json_object_object_get(
+        json_object_object_get(
+            json_object_object_get(json_config_out, "monitoring"), "config"),
+        "capacity");
+    munit_assert_not_null(capacity);
+    munit_assert_int(json_object_get_int(capacity), ==, 1024);
+    json_object_put(json_config_out);
+
+    hg_id_t echo_id = MARGO_REGISTER(
+        mid, "echo", echo_in_t, hg_string_t, echo_ult);
+    munit_assert_uint64(echo_id, !=, 0);
+
+    char      buffer[256];
+    void*     ptrs[1]  = { (void*)buffer };
+    hg_size_t sizes[1] = { 256 };
+    hg_bulk_t bulk     = HG_BULK_NULL;
+    hret = margo_bulk_create(mid, 1, ptrs, sizes, HG_BULK_READ_ONLY, &bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    echo_in_t in = {
+        .relay = HG_FALSE,
+        .str = (char*)"hello world",
+        .blk = bulk
+    };
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    for(unsigned i = 0; i < 4; i++) {
+        hg_handle_t handle = HG_HANDLE_NULL;
+        hret = margo_create(mid, addr, echo_id, &handle);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_forward(handle, &in);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        char* output = NULL;
+        hret = margo_get_output(handle, &output);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_free_output(handle, &output);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_destroy(handle);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+    }
+
+    hret = margo_bulk_free(bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    struct dump_chunks_args dump_args = {0};
+    hret = margo_monitor_dump(mid, dump_trace, &dump_args, true);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    struct json_tokener* tokener = json_tokener_new();
+    struct json_object*  json_content
+        = json_tokener_parse_ex(tokener, dump_args.content, dump_args.size);
+    json_tokener_free(tokener);
+    munit_assert_not_null(json_content);
+    free(dump_args.content);
+
+    /* the events of each forward are paired into a complete event */
+    struct json_object* events = json_object_object_get(json_content, "traceEvents");
+    munit_assert_not_null(events);
+    munit_assert(json_object_is_type(events, json_type_array));
+    size_t num_forwards = 0, num_handlers = 0;
+    for(size_t i = 0; i < json_object_array_length(events); i++) {
+        struct json_object* event = json_object_array_get_idx(events, i);
+        const char* ph   = json_object_get_string(json_object_object_get(event, "ph"));
+        const char* name = json_object_get_string(json_object_object_get(event, "name"));
+        munit_assert_not_null(ph);
+        munit_assert_not_null(name);
+        if(strcmp(ph, "X") != 0) continue;
+        munit_assert_not_null(json_object_object_get(event, "dur"));
+        if(strcmp(name, "forward echo") == 0) num_forwards += 1;
+        if(strcmp(name, "rpc_handler echo") == 0) num_handlers += 1;
+    }
+    munit_assert_size(num_forwards, ==, 4);
+    munit_assert_size(num_handlers, ==, 4);
+    json_object_put(json_content);
+
+    /* the dump reset the trace */
+    dump_args.content = NULL;
+    dump_args.size    = 0;
+    hret = margo_monitor_dump(mid, dump_trace, &dump_args, false);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    munit_assert_null(strstr(dump_args.content, "forward echo"));
+    free(dump_args.content);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_default_monitoring_spans(const MunitParameter params[],
+                                                 void*                data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"\","
+                "\"statistics\":{\"sample_rpcs_every\":1000},"
+                "\"time_series\":{\"disable\":true},"
+                "\"spans\":{\"max_spans\":16}"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    hg_id_t echo_id = MARGO_REGISTER(
+        mid, "echo", echo_in_t, hg_string_t, echo_ult);
+    munit_assert_uint64(echo_id, !=, 0);
+
+    char      buffer[256];
+    void*     ptrs[1]  = { (void*)buffer };
+    hg_size_t sizes[1] = { 256 };
+    hg_bulk_t bulk     = HG_BULK_NULL;
+    hret = margo_bulk_create(mid, 1, ptrs, sizes, HG_BULK_READ_ONLY, &bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    /* the first RPC is not traced, and is the one sampled */
+    margo_trace_context_t root;
+    hret = margo_get_current_trace_context(mid, &root);
+    munit_assert_int(hret, ==, HG_NOENTRY);
+
+    for(unsigned i = 0; i < 2; i++) {
+        if(i == 1) {
+            hret = margo_start_trace_context(mid, true);
+            munit_assert_int(hret, ==, HG_SUCCESS);
+            hret = margo_get_current_trace_context(mid, &root);
+            munit_assert_int(hret, ==, HG_SUCCESS);
+            munit_assert_int(root.flags, ==, MARGO_TRACE_CONTEXT_SAMPLED);
+            munit_assert_uint64(root.parent_span_id, ==, 0);
+        }
+        echo_in_t in = {
+            .relay = i == 1 ? HG_TRUE : HG_FALSE,
+            .str = (char*)"hello world",
+            .blk = bulk
+        };
+        hg_handle_t handle = HG_HANDLE_NULL;
+        hret = margo_create(mid, addr, echo_id, &handle);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_forward(handle, &in);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        /* the RPC is a child span of the ULT's context */
+        margo_trace_context_t ctx;
+        hret = margo_get_trace_context(handle, &ctx);
+        if(i == 0) {
+            munit_assert_int(hret, ==, HG_NOENTRY);
+        } else {
+            munit_assert_int(hret, ==, HG_SUCCESS);
+            munit_assert_uint64(ctx.trace_id[0], ==, root.trace_id[0]);
+            munit_assert_uint64(ctx.trace_id[1], ==, root.trace_id[1]);
+            munit_assert_uint64(ctx.parent_span_id, ==, root.span_id);
+            munit_assert_uint64(ctx.span_id, !=, root.span_id);
+        }
+
+        char* output = NULL;
+        hret = margo_get_output(handle, &output);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_free_output(handle, &output);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_destroy(handle);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+    }
+
+    hret = margo_set_current_trace_context(mid, NULL);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    margo_trace_context_t none;
+    hret = margo_get_current_trace_context(mid, &none);
+    munit_assert_int(hret, ==, HG_NOENTRY);
+
+    hret = margo_bulk_free(bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    struct dump_chunks_args dump_args = {0};
+    hret = margo_monitor_dump(mid, dump_trace, &dump_args, true);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    struct json_tokener* tokener = json_tokener_new();
+    struct json_object*  json_content
+        = json_tokener_parse_ex(tokener, dump_args.content, dump_args.size);
+    json_tokener_free(tokener);
+    munit_assert_not_null(json_content);
+    free(dump_args.content);
+
+    /* the traced RPC and the RPC relayed by its handler were both
+     * recorded as a client and a server span */
+    struct json_object* spans = json_object_object_get(
+        json_object_object_get(json_content, "spans"), "spans");
+    munit_assert_not_null(spans);
+    munit_assert_size(json_object_array_length(spans), ==, 4);
+    char root_span_id[17];
+    snprintf(root_span_id, sizeof(root_span_id), "%016" PRIx64, root.span_id);
+    char trace_id[33];
+    snprintf(trace_id, sizeof(trace_id), "%016" PRIx64 "%016" PRIx64,
+             root.trace_id[0], root.trace_id[1]);
+    const char* outer_span_id = NULL;
+    for(size_t i = 0; i < 4; i++) {
+        struct json_object* span = json_object_array_get_idx(spans, i);
+        const char* parent = json_object_get_string(
+            json_object_object_get(span, "parent_span_id"));
+        munit_assert_not_null(parent);
+        munit_assert_string_equal(json_object_get_string(
+            json_object_object_get(span, "trace_id")), trace_id);
+        munit_assert_string_equal(json_object_get_string(
+            json_object_object_get(span, "name")), "echo");
+        if(strcmp(parent, root_span_id) == 0)
+            outer_span_id = json_object_get_string(
+                json_object_object_get(span, "span_id"));
+    }
+    munit_assert_not_null(outer_span_id);
+    size_t num_outer = 0, num_inner = 0;
+    for(size_t i = 0; i < 4; i++) {
+        struct json_object* span = json_object_array_get_idx(spans, i);
+        const char* span_id = json_object_get_string(
+            json_object_object_get(span, "span_id"));
+        const char* parent = json_object_get_string(
+            json_object_object_get(span, "parent_span_id"));
+        if(strcmp(span_id, outer_span_id) == 0) num_outer += 1;
+        if(strcmp(parent, outer_span_id) == 0) num_inner += 1;
+    }
+    munit_assert_size(num_outer, ==, 2);
+    munit_assert_size(num_inner, ==, 2);
+    json_object_put(json_content);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_default_monitoring_metrics(const MunitParameter params[],
+                                                   void*                data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"\","
+                "\"metrics\":{\"filename_prefix\":\"test\",\"interval_sec\":0}"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    char* config = margo_get_config(mid);
+    struct json_object* json_config_out = json_tokener_parse(config);
+    free(config);
+    struct json_object* metrics = json_object_object_get(
+        json_object_object_get(
+            json_object_object_get(json_config_out, "monitoring"), "config"),
+        "metrics");
+    munit_assert_not_null(metrics);
+    munit_assert_string_equal(json_object_get_string(
+        json_object_object_get(metrics, "filename_prefix")), "test");
+    json_object_put(json_config_out);
+
+    char* filename = NULL;
+    {
+        char hostname[1024];
+        hostname[1023] = '\0';
+        gethostname(hostname, 1023);
+        pid_t pid = getpid();
+        size_t fullname_size = snprintf(NULL, 0, "test.%s.%d.metrics", hostname, pid);
+        filename = calloc(1, fullname_size+1);
+        sprintf(filename, "test.%s.%d.metrics", hostname, pid);
+    }
+    munit_assert_int(access(filename, F_OK), ==, 0);
+
+    hg_id_t echo_id = MARGO_REGISTER(
+        mid, "echo", echo_in_t, hg_string_t, echo_ult);
+    munit_assert_uint64(echo_id, !=, 0);
+
+    char      buffer[256];
+    void*     ptrs[1]  = { (void*)buffer };
+    hg_size_t sizes[1] = { 256 };
+    hg_bulk_t bulk     = HG_BULK_NULL;
+    hret = margo_bulk_create(mid, 1, ptrs, sizes, HG_BULK_READ_ONLY, &bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    echo_in_t in = {
+        .relay = HG_FALSE,
+        .str = (char*)"hello world",
+        .blk = bulk
+    };
+    for(unsigned i = 0; i < 4; i++) {
+        hg_handle_t handle = HG_HANDLE_NULL;
+        hret = margo_create(mid, addr, echo_id, &handle);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_forward(handle, &in);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        char* output = NULL;
+        hret = margo_get_output(handle, &output);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_free_output(handle, &output);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_destroy(handle);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+    }
+
+    hret = margo_bulk_free(bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    /* the segment starts with its magic number and version, and has
+     * been updated by the progress loop since its creation */
+    struct {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t size;
+        uint64_t seq;
+    } header;
+    FILE* file = fopen(filename, "r");
+    munit_assert_not_null(file);
+    munit_assert_size(fread(&header, sizeof(header), 1, file), ==, 1);
+    fseek(file, 0L, SEEK_END);
+    munit_assert_long(ftell(file), ==, header.size);
+    fclose(file);
+    munit_assert_uint64(header.magic, ==, 0x435254454d4f474dULL);
+    munit_assert_uint32(header.version, ==, 1);
+    munit_assert_uint64(header.seq, >, 2);
+    munit_assert_uint64(header.seq % 2, ==, 0);
+
+    margo_finalize(mid);
+
+    /* the segment is removed on finalize */
+    munit_assert_int(access(filename, F_OK), !=, 0);
+    free(filename);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_default_monitoring_openmetrics(const MunitParameter params[],
+                                                       void*                data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"\","
+                "\"openmetrics\":{\"filename_prefix\":\"test\",\"dump\":true}"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    hg_id_t echo_id = MARGO_REGISTER(
+        mid, "echo", echo_in_t, hg_string_t, echo_ult);
+    munit_assert_uint64(echo_id, !=, 0);
+
+    char      buffer[256];
+    void*     ptrs[1]  = { (void*)buffer };
+    hg_size_t sizes[1] = { 256 };
+    hg_bulk_t bulk     = HG_BULK_NULL;
+    hret = margo_bulk_create(mid, 1, ptrs, sizes, HG_BULK_READ_ONLY, &bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    echo_in_t in = {
+        .relay = HG_FALSE,
+        .str = (char*)"hello world",
+        .blk = bulk
+    };
+    for(unsigned i = 0; i < 4; i++) {
+        hg_handle_t handle = HG_HANDLE_NULL;
+        hret = margo_create(mid, addr, echo_id, &handle);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_forward(handle, &in);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        char* output = NULL;
+        hret = margo_get_output(handle, &output);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_free_output(handle, &output);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_destroy(handle);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+    }
+
+    hret = margo_bulk_free(bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    /* the dump produces OpenMetrics text instead of JSON */
+    struct dump_chunks_args dump_args = {0};
+    hret = margo_monitor_dump(mid, dump_trace, &dump_args, false);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    dump_args.content = realloc(dump_args.content, dump_args.size + 1);
+    dump_args.content[dump_args.size] = '\0';
+    const char* text = dump_args.content;
+
+    munit_assert_not_null(
+        strstr(text, "# TYPE margo_rpc_forward_seconds histogram\n"));
+    munit_assert_not_null(
+        strstr(text, "# TYPE margo_rpc_handler_seconds histogram\n"));
+    munit_assert_not_null(
+        strstr(text, "# TYPE margo_pool_size gauge\n"));
+    munit_assert_size(dump_args.size, >=, 6);
+    munit_assert_string_equal(text + dump_args.size - 6, "# EOF\n");
+
+    /* the 4 RPCs are counted at their origin and at their target */
+    for(unsigned i = 0; i < 2; i++) {
+        const char* name = i == 0 ? "margo_rpc_forward_seconds_count{"
+                                  : "margo_rpc_handler_seconds_count{";
+        const char* line = strstr(text, name);
+        munit_assert_not_null(line);
+        const char* end = strchr(line, '\n');
+        munit_assert_not_null(end);
+        munit_assert_not_null(strstr(line, "rpc=\"echo\""));
+        munit_assert_true(strstr(line, "rpc=\"echo\"") < end);
+        munit_assert_memory_equal(2, end - 2, " 4");
+    }
+    free(dump_args.content);
+
+    margo_finalize(mid);
+
+    /* the last export was written in a file on finalize */
+    char* filename = NULL;
+    {
+        char hostname[1024];
+        hostname[1023] = '\0';
+        gethostname(hostname, 1023);
+        pid_t pid = getpid();
+        size_t fullname_size = snprintf(NULL, 0, "test.%s.%d.prom", hostname, pid);
+        filename = calloc(1, fullname_size+1);
+        sprintf(filename, "test.%s.%d.prom", hostname, pid);
+    }
+    FILE* file = fopen(filename, "r");
+    munit_assert_not_null(file);
+    fseek(file, -6L, SEEK_END);
+    char eof[7] = {0};
+    munit_assert_size(fread(eof, 1, 6, file), ==, 6);
+    munit_assert_string_equal(eof, "# EOF\n");
+    fclose(file);
+    remove(filename);
+    free(filename);
+
+    return MUNIT_OK;
+}
+
+static void dump_outliers(void* uargs, const char* content, size_t size) {
+    (void)uargs;
+    struct json_object* json_content = NULL;
+    struct json_tokener* tokener     = json_tokener_new();
+    json_content = json_tokener_parse_ex(tokener, content, size);
+    json_tokener_free(tokener);
+    munit_assert_not_null(json_content);
+
+    struct json_object* stats = json_object_object_get(json_content, "stats");
+    munit_assert_not_null(stats);
+    struct json_object* outliers = json_object_object_get(stats, "outliers");
+    munit_assert_not_null(outliers);
+    /* with a threshold of 1ns, all the RPCs are outliers at their origin
+     * and at their target */
+    munit_assert_int(8, ==, json_object_get_int64(
+        json_object_object_get(outliers, "total")));
+    struct json_object* records = json_object_object_get(outliers, "records");
+    munit_assert(json_object_is_type(records, json_type_array));
+    munit_assert_int(8, ==, json_object_array_length(records));
+    unsigned num_targets = 0;
+    for(size_t i = 0; i < 8; i++) {
+        struct json_object* record = json_object_array_get_idx(records, i);
+        munit_assert_string_equal("echo", json_object_get_string(
+            json_object_object_get(record, "name")));
+        munit_assert_string_equal("threshold", json_object_get_string(
+            json_object_object_get(record, "exceeded")));
+        munit_assert_double(json_object_get_double(
+            json_object_object_get(record, "duration")), >, 0.0);
+        struct json_object* phases = json_object_object_get(record, "phases");
+        munit_assert(json_object_is_type(phases, json_type_object));
+        const char* side = json_object_get_string(
+            json_object_object_get(record, "side"));
+        if(strcmp(side, "target") == 0) {
+            num_targets += 1;
+            munit_assert_not_null(json_object_object_get(phases, "ult_start"));
+            /* the echo RPC pulls the 256 bytes of its input bulk */
+            struct json_object* bulk = json_object_object_get(record, "bulk");
+            munit_assert_int(1, ==, json_object_get_int64(
+                json_object_object_get(bulk, "count")));
+            munit_assert_int(256, ==, json_object_get_int64(
+                json_object_object_get(bulk, "size")));
+        } else {
+            munit_assert_string_equal("origin", side);
+            munit_assert_not_null(json_object_object_get(phases, "forward_start"));
+        }
+    }
+    munit_assert_int(4, ==, num_targets);
+    json_object_put(json_content);
+}
+
+static MunitResult test_default_monitoring_outliers(const MunitParameter params[],
+                                                    void*                data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"\","
+                "\"time_series\":{\"disable\":true},"
+                "\"outliers\":{\"threshold_sec\":1e-9,\"percentile\":0}"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    hg_id_t echo_id = MARGO_REGISTER(
+        mid, "echo", echo_in_t, hg_string_t, echo_ult);
+    munit_assert_uint64(echo_id, !=, 0);
+
+    char      buffer[256];
+    void*     ptrs[1]  = { (void*)buffer };
+    hg_size_t sizes[1] = { 256 };
+    hg_bulk_t bulk     = HG_BULK_NULL;
+    hret = margo_bulk_create(mid, 1, ptrs, sizes, HG_BULK_READ_ONLY, &bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    echo_in_t in = {
+        .relay = HG_FALSE,
+        .str = (char*)"hello world",
+        .blk = bulk
+    };
+    for(unsigned i = 0; i < 4; i++) {
+        hg_handle_t handle = HG_HANDLE_NULL;
+        hret = margo_create(mid, addr, echo_id, &handle);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_forward(handle, &in);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        char* output = NULL;
+        hret = margo_get_output(handle, &output);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_free_output(handle, &output);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+
+        hret = margo_destroy(handle);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+    }
+
+    hret = margo_bulk_free(bulk);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    /* the target handles may be destroyed after the origin's wait
+     * completes, so let them finish */
+    margo_thread_sleep(mid, 100);
+
+    hret = margo_monitor_dump(mid, dump_outliers, NULL, false);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+static void dump_watchdog(void* uargs, const char* content, size_t size) {
+    (void)uargs;
+    struct json_object* json_content = NULL;
+    struct json_tokener* tokener     = json_tokener_new();
+    json_content = json_tokener_parse_ex(tokener, content, size);
+    json_tokener_free(tokener);
+    munit_assert_not_null(json_content);
+
+    struct json_object* stats = json_object_object_get(json_content, "stats");
+    munit_assert_not_null(stats);
+    struct json_object* progress_loop =
+        json_object_object_get(stats, "progress_loop");
+    munit_assert_not_null(progress_loop);
+    struct json_object* histograms =
+        json_object_object_get(progress_loop, "histograms");
+    munit_assert_not_null(histograms);
+    const char* names[] = {"iteration", "trigger_batch"};
+    for(int i = 0; i < 2; i++) {
+        struct json_object* hist = json_object_object_get(histograms, names[i]);
+        munit_assert_not_null(hist);
+        munit_assert_int64(json_object_get_int64(
+            json_object_object_get(hist, "num")), >, 0);
+    }
+    /* the blocking handler stalled the progress loop once */
+    struct json_object* stalls = json_object_object_get(progress_loop, "stalls");
+    munit_assert_not_null(stalls);
+    munit_assert_int(1, ==, json_object_get_int64(
+        json_object_object_get(stalls, "num")));
+    munit_assert_double(json_object_get_double(
+        json_object_object_get(stalls, "max_sec")), >, 0.1);
+    munit_assert_false(json_object_get_boolean(
+        json_object_object_get(stalls, "ongoing")));
+    json_object_put(json_content);
+}
+
+static MunitResult test_default_monitoring_watchdog(const MunitParameter params[],
+                                                    void*                data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"\","
+                "\"statistics\":{\"percentiles\":[50, 99]},"
+                "\"time_series\":{\"disable\":true},"
+                "\"watchdog\":{\"stall_threshold_sec\":0.15,"
+                              "\"check_interval_sec\":0.01}"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    char* config = margo_get_config(mid);
+    struct json_object* json_config_out = json_tokener_parse(config);
+    free(config);
+    struct json_object* watchdog = json_object_object_get(
+        json_object_object_get(
+            json_object_object_get(json_config_out, "monitoring"), "config"),
+        "watchdog");
+    munit_assert_not_null(watchdog);
+    munit_assert_double_equal(json_object_get_double(
+        json_object_object_get(watchdog, "stall_threshold_sec")), 0.15, 6);
+    json_object_put(json_config_out);
+
+    hg_id_t blocking_id = MARGO_REGISTER(
+        mid, "blocking", void, void, blocking_ult);
+    munit_assert_uint64(blocking_id, !=, 0);
+
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hg_handle_t handle = HG_HANDLE_NULL;
+    hret = margo_create(mid, addr, blocking_id, &handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_forward(handle, NULL);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_destroy(handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    /* let the watchdog notice that the progress loop resumed */
+    margo_thread_sleep(mid, 100);
+
+    hret = margo_monitor_dump(mid, dump_watchdog, NULL, false);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+static void dump_abt_time_series(void* uargs, const char* content, size_t size)
+{
+    (void)uargs;
+    struct json_object* json_content = NULL;
+    struct json_tokener* tokener     = json_tokener_new();
+    json_content = json_tokener_parse_ex(tokener, content, size);
+    json_tokener_free(tokener);
+    munit_assert_not_null(json_content);
+
+    struct json_object* series = json_object_object_get(json_content, "series");
+    munit_assert_not_null(series);
+    struct json_object* abt = json_object_object_get(series, "abt");
+    munit_assert_not_null(abt);
+    const char* kinds[] = {"xstreams", "pools"};
+    const char* names[] = {"busy_usec", "idle_usec", "switches", "finished"};
+    for (size_t k = 0; k < 2; k++) {
+        struct json_object* primary = json_object_object_get(
+            json_object_object_get(abt, kinds[k]), "__primary__");
+        munit_assert_not_null(primary);
+        struct json_object* timestamps
+            = json_object_object_get(primary, "timestamps");
+        munit_assert_not_null(timestamps);
+        size_t len = json_object_array_length(timestamps);
+        munit_assert_size(len, >, 0);
+        for (size_t i = 0; i < 4; i++) {
+            struct json_object* values = json_object_object_get(primary, names[i]);
+            munit_assert_not_null(values);
+            munit_assert_size(len, ==, json_object_array_length(values));
+        }
+        /* the primary xstream ran the progress loop at least once */
+        uint64_t switches = 0;
+        struct json_object* values = json_object_object_get(primary, "switches");
+        for (size_t i = 0; i < len; i++)
+            switches += json_object_get_int64(json_object_array_get_idx(values, i));
+        munit_assert_uint64(switches, >, 0);
+    }
+    json_object_put(json_content);
+}
+
+static MunitResult test_default_monitoring_abt_time_series(
+        const MunitParameter params[], void* data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"\","
+                "\"time_series\":{\"time_interval_sec\":0.05,"
+                                  "\"abt_profiling\":true}"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    /* the option is disabled if Argobots has no tool interface */
+    char* config = margo_get_config(mid);
+    struct json_object* json_config_out = json_tokener_parse(config);
+    free(config);
+    struct json_object* time_series = json_object_object_get(
+        json_object_object_get(
+            json_object_object_get(json_config_out, "monitoring"), "config"),
+        "time_series");
+    munit_assert_not_null(time_series);
+    bool enabled = json_object_get_boolean(
+        json_object_object_get(time_series, "abt_profiling"));
+    json_object_put(json_config_out);
+    if (!enabled) {
+        margo_finalize(mid);
+        return MUNIT_SKIP;
+    }
+
+    /* let the progress loop update the time series a few times */
+    margo_thread_sleep(mid, 300);
+
+    hret = margo_monitor_dump(mid, dump_abt_time_series, NULL, false);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+static void dump_cpu_time(void* uargs, const char* content, size_t size)
+{
+    (void)uargs;
+    struct json_object* json_content = NULL;
+    struct json_tokener* tokener     = json_tokener_new();
+    json_content = json_tokener_parse_ex(tokener, content, size);
+    json_tokener_free(tokener);
+    munit_assert_not_null(json_content);
+
+    struct json_object* rpcs = json_object_object_get(
+        json_object_object_get(json_content, "stats"), "rpcs");
+    munit_assert_not_null(rpcs);
+    unsigned num_found = 0;
+    json_object_object_foreach(rpcs, key, rpc) {
+        (void)key;
+        const char* name = json_object_get_string(
+            json_object_object_get(rpc, "name"));
+        if (!name || strcmp(name, "spinning") != 0) continue;
+        struct json_object* target = json_object_object_get(rpc, "target");
+        munit_assert_not_null(target);
+        json_object_object_foreach(target, addr_key, received_from) {
+            (void)addr_key;
+            struct json_object* cpu_time = json_object_object_get(
+                json_object_object_get(received_from, "cpu_time"), "duration");
+            munit_assert_not_null(cpu_time);
+            munit_assert_int(1, ==, json_object_get_int64(
+                json_object_object_get(cpu_time, "num")));
+            double cpu = json_object_get_double(
+                json_object_object_get(cpu_time, "max"));
+            double ult = json_object_get_double(json_object_object_get(
+                json_object_object_get(
+                    json_object_object_get(received_from, "ult"), "duration"),
+                "max"));
+            /* the handler used 50ms of CPU, within its ULT */
+            munit_assert_double(cpu, >=, 0.045);
+            munit_assert_double(cpu, <=, ult + 1e-3);
+            num_found += 1;
+        }
+    }
+    munit_assert_int(1, ==, num_found);
+    json_object_put(json_content);
+}
+
+static MunitResult test_default_monitoring_cpu_time(const MunitParameter params[],
+                                                    void*                data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"\","
+                "\"time_series\":{\"disable\":true},"
+                "\"cpu_time\":{}"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    hg_id_t spinning_id = MARGO_REGISTER(
+        mid, "spinning", void, void, spinning_ult);
+    munit_assert_uint64(spinning_id, !=, 0);
+
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hg_handle_t handle = HG_HANDLE_NULL;
+    hret = margo_create(mid, addr, spinning_id, &handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_forward(handle, NULL);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_destroy(handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_monitor_dump(mid, dump_cpu_time, NULL, false);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+static void dump_cpu_time_blocked(void* uargs, const char* content, size_t size)
+{
+    (void)uargs;
+    struct json_object* json_content = NULL;
+    struct json_tokener* tokener     = json_tokener_new();
+    json_content = json_tokener_parse_ex(tokener, content, size);
+    json_tokener_free(tokener);
+    munit_assert_not_null(json_content);
+
+    struct json_object* rpcs = json_object_object_get(
+        json_object_object_get(json_content, "stats"), "rpcs");
+    munit_assert_not_null(rpcs);
+    unsigned num_found = 0;
+    json_object_object_foreach(rpcs, key, rpc) {
+        (void)key;
+        const char* name = json_object_get_string(
+            json_object_object_get(rpc, "name"));
+        if (!name || (strcmp(name, "sleeping") != 0
+                      && strcmp(name, "nesting") != 0)) continue;
+        struct json_object* target = json_object_object_get(rpc, "target");
+        munit_assert_not_null(target);
+        json_object_object_foreach(target, addr_key, received_from) {
+            (void)addr_key;
+            struct json_object* cpu_time = json_object_object_get(
+                json_object_object_get(received_from, "cpu_time"), "duration");
+            munit_assert_not_null(cpu_time);
+            double cpu = json_object_get_double(
+                json_object_object_get(cpu_time, "max"));
+            double ult = json_object_get_double(json_object_object_get(
+                json_object_object_get(
+                    json_object_object_get(received_from, "ult"), "duration"),
+                "max"));
+            /* the handlers were blocked for at least 100ms while 50ms
+             * "spinning" handlers ran on their xstream, but used almost
+             * no CPU themselves */
+            munit_assert_double(ult, >=, 0.095);
+            munit_assert_double(cpu, <, 0.02);
+            num_found += 1;
+        }
+    }
+    munit_assert_int(2, ==, num_found);
+    json_object_put(json_content);
+}
+
+static MunitResult test_default_monitoring_cpu_time_blocked(
+        const MunitParameter params[], void* data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"\","
+                "\"statistics\":{\"sample_rpcs_every\":2},"
+                "\"time_series\":{\"disable\":true},"
+                "\"cpu_time\":{}"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    hg_id_t spinning_id = MARGO_REGISTER(
+        mid, "spinning", void, void, spinning_ult);
+    hg_id_t sleeping_id = MARGO_REGISTER(
+        mid, "sleeping", void, void, sleeping_ult);
+    hg_id_t nesting_id = MARGO_REGISTER(
+        mid, "nesting", void, void, nesting_ult);
+
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    /* "spinning" runs while "sleeping" is in margo_thread_sleep */
+    hg_handle_t handles[2] = {HG_HANDLE_NULL, HG_HANDLE_NULL};
+    margo_request reqs[2] = {MARGO_REQUEST_NULL, MARGO_REQUEST_NULL};
+    hg_id_t ids[2] = {sleeping_id, spinning_id};
+    for(int i = 0; i < 2; i++) {
+        hret = margo_create(mid, addr, ids[i], &handles[i]);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+        hret = margo_iforward(handles[i], NULL, &reqs[i]);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+    }
+    for(int i = 0; i < 2; i++) {
+        hret = margo_wait(reqs[i]);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+        margo_destroy(handles[i]);
+    }
+
+    /* the first RPC "nesting" sends is sampled out */
+    hg_handle_t handle = HG_HANDLE_NULL;
+    hret = margo_create(mid, addr, nesting_id, &handle);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    hret = margo_forward(handle, NULL);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    margo_destroy(handle);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_monitor_dump(mid, dump_cpu_time_blocked, NULL, false);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+static void dump_rpc_limits(void* uargs, const char* content, size_t size)
+{
+    (void)uargs;
+    struct json_object* json_content = NULL;
+    struct json_tokener* tokener     = json_tokener_new();
+    json_content = json_tokener_parse_ex(tokener, content, size);
+    json_tokener_free(tokener);
+    munit_assert_not_null(json_content);
+
+    struct json_object* stats = json_object_object_get(json_content, "stats");
+    munit_assert_not_null(stats);
+    struct json_object* limits = json_object_object_get(stats, "rpc_limits");
+    munit_assert(json_object_is_type(limits, json_type_array));
+    munit_assert_int(1, ==, json_object_array_length(limits));
+    struct json_object* limit = json_object_array_get_idx(limits, 0);
+    munit_assert_string_equal("sleeping", json_object_get_string(
+        json_object_object_get(limit, "rpc_name")));
+    /* one RPC ran, the other one was rejected since max_queued = 0 */
+    struct {
+        const char* key;
+        int64_t     value;
+    } expected[] = {{"active", 0},       {"queued", 0},
+                    {"max_active", 1},   {"max_queued", 0},
+                    {"num_admitted", 1}, {"num_delayed", 0},
+                    {"num_rejected", 1}};
+    for(unsigned i = 0; i < sizeof(expected)/sizeof(expected[0]); i++) {
+        struct json_object* value = json_object_object_get(limit, expected[i].key);
+        munit_assert_not_null(value);
+        munit_assert_int64(expected[i].value, ==, json_object_get_int64(value));
+    }
+
+    json_object_put(json_content);
+}
+
+static MunitResult test_default_monitoring_rpc_limits(
+        const MunitParameter params[], void* data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"rpc_limits\":[{\"rpc_name\":\"sleeping\","
+                            "\"max_concurrent\":1,\"max_queued\":0}],"
+         "\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"\","
+                "\"time_series\":{\"disable\":true}"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    hg_id_t sleeping_id = MARGO_REGISTER(
+        mid, "sleeping", void, void, sleeping_ult);
+
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hg_handle_t handles[2] = {HG_HANDLE_NULL, HG_HANDLE_NULL};
+    margo_request reqs[2] = {MARGO_REQUEST_NULL, MARGO_REQUEST_NULL};
+    for(int i = 0; i < 2; i++) {
+        hret = margo_create(mid, addr, sleeping_id, &handles[i]);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+        hret = margo_iforward(handles[i], NULL, &reqs[i]);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+    }
+    hg_return_t rets[2];
+    for(int i = 0; i < 2; i++) {
+        rets[i] = margo_wait(reqs[i]);
+        margo_destroy(handles[i]);
+    }
+    munit_assert_int(rets[0], ==, HG_SUCCESS);
+    munit_assert_int(rets[1], ==, HG_BUSY);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    hret = margo_monitor_dump(mid, dump_rpc_limits, NULL, false);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+struct addr_reuse_expected {
+    char     addr[2][256];
+    unsigned num_found;
+};
+
+static void dump_addr_reuse(void* uargs, const char* content, size_t size)
+{
+    struct addr_reuse_expected* expected = (struct addr_reuse_expected*)uargs;
+    struct json_object* json_content = NULL;
+    struct json_tokener* tokener     = json_tokener_new();
+    json_content = json_tokener_parse_ex(tokener, content, size);
+    json_tokener_free(tokener);
+    munit_assert_not_null(json_content);
+
+    struct json_object* rpcs = json_object_object_get(
+        json_object_object_get(json_content, "stats"), "rpcs");
+    munit_assert_not_null(rpcs);
+    json_object_object_foreach(rpcs, key, rpc) {
+        (void)key;
+        const char* name = json_object_get_string(
+            json_object_object_get(rpc, "name"));
+        if (!name || strcmp(name, "ping") != 0) continue;
+        struct json_object* origin = json_object_object_get(rpc, "origin");
+        munit_assert_not_null(origin);
+        /* each server got its own 3 RPCs, although their addresses
+         * were freed (and their hg_addr_t possibly reused) in between */
+        munit_assert_int(2, ==, json_object_object_length(origin));
+        for(int i = 0; i < 2; i++) {
+            char addr_key[512];
+            snprintf(addr_key, sizeof(addr_key), "sent to %s",
+                     expected->addr[i]);
+            struct json_object* sent_to = json_object_object_get(
+                origin, addr_key);
+            munit_assert_not_null(sent_to);
+            struct json_object* iforward = json_object_object_get(
+                json_object_object_get(sent_to, "iforward"), "duration");
+            munit_assert_not_null(iforward);
+            munit_assert_int(3, ==, json_object_get_int64(
+                json_object_object_get(iforward, "num")));
+            expected->num_found += 1;
+        }
+    }
+    json_object_put(json_content);
+}
+
+static MunitResult test_default_monitoring_addr_reuse(
+        const MunitParameter params[], void* data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"\","
+                "\"time_series\":{\"disable\":true}"
+            "}"
+        "}}";
+
+    struct addr_reuse_expected expected = {0};
+    int pids[2];
+    for(int i = 0; i < 2; i++) {
+        hg_size_t addr_size = sizeof(expected.addr[i]);
+        pids[i] = HS_start(protocol, NULL, ping_server_init, NULL, NULL,
+                           expected.addr[i], &addr_size);
+        munit_assert_int(pids[i], >, 0);
+    }
+
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+    hg_id_t ping_id = MARGO_REGISTER(mid, "ping", void, void, NULL);
+
+    /* look up, use and free the address of each server in turn */
+    for(int round = 0; round < 3; round++) {
+        for(int i = 0; i < 2; i++) {
+            hg_addr_t addr = HG_ADDR_NULL;
+            hret = margo_addr_lookup(mid, expected.addr[i], &addr);
+            munit_assert_int(hret, ==, HG_SUCCESS);
+            hg_handle_t handle = HG_HANDLE_NULL;
+            hret = margo_create(mid, addr, ping_id, &handle);
+            munit_assert_int(hret, ==, HG_SUCCESS);
+            hret = margo_forward(handle, NULL);
+            munit_assert_int(hret, ==, HG_SUCCESS);
+            margo_destroy(handle);
+            hret = margo_addr_free(mid, addr);
+            munit_assert_int(hret, ==, HG_SUCCESS);
+        }
+    }
+
+    hret = margo_monitor_dump(mid, dump_addr_reuse, &expected, false);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    munit_assert_int(expected.num_found, ==, 2);
+
+    for(int i = 0; i < 2; i++) {
+        hg_addr_t addr = HG_ADDR_NULL;
+        margo_addr_lookup(mid, expected.addr[i], &addr);
+        margo_shutdown_remote_instance(mid, addr);
+        margo_addr_free(mid, addr);
+        HS_stop(pids[i], 0);
+    }
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+#define MULTI_XSTREAM_NUM_RPCS 16
+
+static void dump_multi_xstream(void* uargs, const char* content, size_t size)
+{
+    unsigned* num_found = (unsigned*)uargs;
+    struct json_object* json_content = NULL;
+    struct json_tokener* tokener     = json_tokener_new();
+    json_content = json_tokener_parse_ex(tokener, content, size);
+    json_tokener_free(tokener);
+    munit_assert_not_null(json_content);
+
+    struct json_object* rpcs = json_object_object_get(
+        json_object_object_get(json_content, "stats"), "rpcs");
+    munit_assert_not_null(rpcs);
+    json_object_object_foreach(rpcs, key, rpc) {
+        (void)key;
+        const char* name = json_object_get_string(
+            json_object_object_get(rpc, "name"));
+        if (!name || strcmp(name, "busy") != 0) continue;
+        /* the statistics recorded by each xstream are merged into a
+         * single entry per callpath, at the origin and at the target */
+        struct json_object* origin = json_object_object_get(rpc, "origin");
+        munit_assert_not_null(origin);
+        munit_assert_int(1, ==, json_object_object_length(origin));
+        json_object_object_foreach(origin, origin_key, sent_to) {
+            (void)origin_key;
+            struct json_object* iforward = json_object_object_get(
+                json_object_object_get(sent_to, "iforward"), "duration");
+            munit_assert_not_null(iforward);
+            munit_assert_int(MULTI_XSTREAM_NUM_RPCS, ==,
+                json_object_get_int64(json_object_object_get(iforward, "num")));
+        }
+        struct json_object* target = json_object_object_get(rpc, "target");
+        munit_assert_not_null(target);
+        munit_assert_int(1, ==, json_object_object_length(target));
+        json_object_object_foreach(target, target_key, received_from) {
+            (void)target_key;
+            const char* ops[] = {"handler", "ult", "irespond"};
+            for(unsigned i = 0; i < sizeof(ops)/sizeof(ops[0]); i++) {
+                struct json_object* duration = json_object_object_get(
+                    json_object_object_get(received_from, ops[i]), "duration");
+                munit_assert_not_null(duration);
+                munit_assert_int(MULTI_XSTREAM_NUM_RPCS, ==,
+                    json_object_get_int64(json_object_object_get(duration, "num")));
+            }
+        }
+        *num_found += 1;
+    }
+    json_object_put(json_content);
+}
+
+static MunitResult test_default_monitoring_multi_xstream(
+        const MunitParameter params[], void* data)
+{
+    (void)data;
+    hg_return_t hret     = HG_SUCCESS;
+    const char* protocol = munit_parameters_get(params, "protocol");
+    const char* json_config =
+        "{\"use_progress_thread\":true,"
+         "\"rpc_thread_count\":4,"
+         "\"monitoring\":{"
+            "\"config\":{"
+                "\"filename_prefix\":\"\","
+                "\"time_series\":{\"disable\":true}"
+            "}"
+        "}}";
+    struct margo_init_info init_info = {
+        .json_config   = json_config,
+        .monitor       = margo_default_monitor
+    };
+    margo_instance_id mid = margo_init_ext(protocol, MARGO_SERVER_MODE, &init_info);
+    munit_assert_not_null(mid);
+
+    hg_id_t busy_id = MARGO_REGISTER(mid, "busy", void, void, busy_ult);
+
+    hg_addr_t addr = HG_ADDR_NULL;
+    hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    __atomic_store_n(&busy_ult_xstreams, 0, __ATOMIC_RELAXED);
+    hg_handle_t handles[MULTI_XSTREAM_NUM_RPCS];
+    margo_request reqs[MULTI_XSTREAM_NUM_RPCS];
+    for(int i = 0; i < MULTI_XSTREAM_NUM_RPCS; i++) {
+        hret = margo_create(mid, addr, busy_id, &handles[i]);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+        hret = margo_iforward(handles[i], NULL, &reqs[i]);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+    }
+    for(int i = 0; i < MULTI_XSTREAM_NUM_RPCS; i++) {
+        hret = margo_wait(reqs[i]);
+        munit_assert_int(hret, ==, HG_SUCCESS);
+        margo_destroy(handles[i]);
+    }
+    /* the handlers ran on several xstreams, hence recorded their
+     * statistics in several shards */
+    uint64_t xstreams = __atomic_load_n(&busy_ult_xstreams, __ATOMIC_RELAXED);
+    munit_assert_int(__builtin_popcountll(xstreams), >, 1);
+
+    hret = margo_addr_free(mid, addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+
+    unsigned num_found = 0;
+    hret = margo_monitor_dump(mid, dump_multi_xstream, &num_found, false);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    munit_assert_int(num_found, ==, 1);
+
+    margo_finalize(mid);
+
+    return MUNIT_OK;
+}
+
+static char* protocol_params[] = {"na+sm", NULL};
+static char* provider_id_params[] = {"65535", "42", "0", NULL};
+static char* relay_params[] = {"true", "false", NULL};
+static char* reset_params[] = {"true", "false", NULL};
+
+static MunitParameterEnum test_params_custom[]
+    = {{"protocol", protocol_params},
+       {NULL, NULL}};
+
+static MunitParameterEnum test_params[]
+    = {{"protocol", protocol_params},
+       {"provider_id", provider_id_params},
+       {"relay", relay_params},
+       {"reset", reset_params},
+       {NULL, NULL}};
+
+static MunitTest test_suite_tests[] = {
+    {(char*)"/monitoring/statistics", test_default_monitoring_statistics, test_context_setup,
+     test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params},
+    {(char*)"/monitoring/time_series", test_default_monitoring_time_series, test_context_setup,
+     test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params},
+    {(char*)"/monitoring/custom", test_custom_monitoring, test_context_setup,
+     test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params_custom},
+    {(char*)"/monitoring/skipped_wait", test_custom_monitoring_skipped_wait,
+     test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE,
+     test_params_custom},
+    {(char*)"/monitoring/sampling", test_default_monitoring_sampling, test_context_setup,
+     test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params_custom},
+    {(char*)"/monitoring/dump_chunks", test_default_monitoring_dump_chunks, test_context_setup,
+     test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params_custom},
+    {(char*)"/monitoring/trace", test_trace_monitoring, test_context_setup,
+     test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params_custom},
+    {(char*)"/monitoring/spans", test_default_monitoring_spans, test_context_setup,
+     test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params_custom},
+    {(char*)"/monitoring/metrics", test_default_monitoring_metrics,
+     test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE,
+     test_params_custom},
+    {(char*)"/monitoring/openmetrics", test_default_monitoring_openmetrics,
+     test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE,
+     test_params_custom},
+    {(char*)"/monitoring/outliers", test_default_monitoring_outliers,
+     test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE,
+     test_params_custom},
+    {(char*)"/monitoring/watchdog", test_default_monitoring_watchdog,
+     test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE,
+     test_params_custom},
+    {(char*)"/monitoring/abt_time_series",
+     test_default_monitoring_abt_time_series, test_context_setup,
+     test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params_custom},
+    {(char*)"/monitoring/cpu_time", test_default_monitoring_cpu_time,
+     test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE,
+     test_params_custom},
+    {(char*)"/monitoring/addr_reuse", test_default_monitoring_addr_reuse,
+     test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE,
+     test_params_custom},
+    {(char*)"/monitoring/cpu_time_blocked",
+     test_default_monitoring_cpu_time_blocked, test_context_setup,
      test_context_tear_down, MUNIT_TEST_OPTION_NONE, test_params_custom},
+    {(char*)"/monitoring/rpc_limits", test_default_monitoring_rpc_limits,
+     test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE,
+     test_params_custom},
+    {(char*)"/monitoring/multi_xstream", test_default_monitoring_multi_xstream,
+     test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE,
+     test_params_custom},
     {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
 
 static const MunitSuite test_suite